@@ -0,0 +1,119 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include "backpressure.h"
+
+namespace Driveshaft {
+
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+// Weight of the newest sample in the latency average
+static const double LATENCY_EWMA_ALPHA = 0.2;
+
+Backpressure::Backpressure(const std::string& pool_name, const BackpressureOptions& options,
+                           MetricProxyPtr metrics) noexcept
+                           : m_pool_name(pool_name)
+                           , m_metrics(metrics)
+                           , m_paused_until(0)
+                           , m_mutex()
+                           , m_options(options)
+                           , m_next_pause_ms(options.pause_ms)
+                           , m_latency_ewma_ms(0) {
+}
+
+void Backpressure::reportOverload(int64_t retry_after_ms) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    milliseconds duration(retry_after_ms >= 0 ? retry_after_ms : m_next_pause_ms);
+    duration = std::min(duration, milliseconds(m_options.max_pause_ms));
+    m_next_pause_ms = std::min<uint64_t>(uint64_t(m_next_pause_ms) * 2, m_options.max_pause_ms);
+    pause(duration, "overload");
+}
+
+void Backpressure::reportResponse(milliseconds latency) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_next_pause_ms = m_options.pause_ms;
+    if (m_options.latency_threshold_ms == 0) {
+        return;
+    }
+
+    m_latency_ewma_ms = (m_latency_ewma_ms == 0)
+        ? latency.count()
+        : LATENCY_EWMA_ALPHA * latency.count() + (1 - LATENCY_EWMA_ALPHA) * m_latency_ewma_ms;
+
+    // Pause in proportion to how far over the threshold the endpoint is, but
+    // only once per episode: threads already paused should not extend it.
+    if (m_latency_ewma_ms > m_options.latency_threshold_ms && pausedFor().count() == 0) {
+        double overshoot = m_latency_ewma_ms / m_options.latency_threshold_ms;
+        milliseconds duration(static_cast<int64_t>(m_options.pause_ms * overshoot));
+        pause(std::min(duration, milliseconds(m_options.max_pause_ms)), "latency");
+    }
+}
+
+void Backpressure::setOptions(const BackpressureOptions& options) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_options = options;
+    m_next_pause_ms = std::min(std::max(m_next_pause_ms, options.pause_ms), options.max_pause_ms);
+}
+
+void Backpressure::reset() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_paused_until.store(0, std::memory_order_relaxed);
+    m_next_pause_ms = m_options.pause_ms;
+    m_latency_ewma_ms = 0;
+}
+
+milliseconds Backpressure::pausedFor() const noexcept {
+    int64_t now = steady_clock::now().time_since_epoch().count();
+    int64_t until = m_paused_until.load(std::memory_order_relaxed);
+    if (until <= now) {
+        return milliseconds(0);
+    }
+
+    return std::max(milliseconds(1), duration_cast<milliseconds>(steady_clock::duration(until - now)));
+}
+
+// Must be called with m_mutex held
+void Backpressure::pause(milliseconds duration, const char *reason) noexcept {
+    int64_t until = (steady_clock::now() + duration).time_since_epoch().count();
+    if (until <= m_paused_until.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    LOG4CXX_INFO(ThreadLogger, "Pausing job grabbing for pool " << m_pool_name << " for " <<
+                               duration.count() << "ms due to endpoint " << reason);
+    m_paused_until.store(until, std::memory_order_relaxed);
+    if (m_metrics) {
+        m_metrics->reportBackpressurePause(m_pool_name, reason, duration.count() / 1000.0);
+    }
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,83 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_BACKPRESSURE_H_
+#define incl_DRIVESHAFT_BACKPRESSURE_H_
+
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include "common-defs.h"
+#include "pool-options.h"
+#include "metric-proxy.h"
+
+namespace Driveshaft {
+
+/* Pool-wide pause on job grabbing while the endpoint is overloaded. Every
+ * response feeds it; workers check pausedFor() before asking gearmand for
+ * work, so the backlog stays in gearmand instead of piling up in the endpoint.
+ */
+class Backpressure {
+public:
+    Backpressure(const std::string& pool_name, const BackpressureOptions& options,
+                 MetricProxyPtr metrics) noexcept;
+
+    // retry_after_ms is negative when the endpoint did not send one
+    void reportOverload(int64_t retry_after_ms) noexcept;
+    void reportResponse(std::chrono::milliseconds latency) noexcept;
+
+    // Zero when job grabbing may go ahead
+    std::chrono::milliseconds pausedFor() const noexcept;
+
+    // Takes new tunables. A pause already under way runs its course
+    void setOptions(const BackpressureOptions& options) noexcept;
+    // Ends any pause and forgets the latency seen so far
+    void reset() noexcept;
+
+private:
+    Backpressure() = delete;
+    Backpressure(const Backpressure&) = delete;
+    Backpressure(Backpressure&&) = delete;
+    Backpressure& operator=(const Backpressure&) = delete;
+    Backpressure& operator=(const Backpressure&&) = delete;
+
+    void pause(std::chrono::milliseconds duration, const char *reason) noexcept;
+
+    const std::string m_pool_name;
+    MetricProxyPtr m_metrics;
+
+    // steady_clock ticks, read on every grab without taking the lock
+    std::atomic<int64_t> m_paused_until;
+
+    std::mutex m_mutex;
+    BackpressureOptions m_options;
+    uint32_t m_next_pause_ms;
+    double m_latency_ewma_ms;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_BACKPRESSURE_H_
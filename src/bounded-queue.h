@@ -0,0 +1,129 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_BOUNDED_QUEUE_H_
+#define incl_DRIVESHAFT_BOUNDED_QUEUE_H_
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace Driveshaft {
+
+/* Fixed-capacity lock-free multi-producer multi-consumer queue (Vyukov's
+ * bounded queue). Each cell carries a sequence number telling producers and
+ * consumers whose turn it is, so push and pop are one CAS on their cursor.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : m_capacity(capacity ? capacity : 1)
+        , m_cells(new Cell[m_capacity])
+        , m_push_pos(0)
+        , m_padding()
+        , m_pop_pos(0) {
+        for (size_t i = 0; i < m_capacity; i++) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // false when the queue is full
+    bool tryPush(const T& value) noexcept {
+        size_t pos = m_push_pos.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &m_cells[pos % m_capacity];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (m_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_push_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // false when the queue is empty
+    bool tryPop(T& value) noexcept {
+        size_t pos = m_pop_pos.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &m_cells[pos % m_capacity];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (m_pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_pop_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = cell->value;
+        cell->sequence.store(pos + m_capacity, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const noexcept {
+        return m_capacity;
+    }
+
+private:
+    BoundedQueue() = delete;
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue(BoundedQueue&&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&&) = delete;
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t m_capacity;
+    std::unique_ptr<Cell[]> m_cells;
+    // Padded apart so producers and consumers do not contend on a cache line.
+    // Padding rather than alignas, since new ignores extended alignment before C++17
+    std::atomic<size_t> m_push_pos;
+    char m_padding[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_pop_pos;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_BOUNDED_QUEUE_H_
@@ -0,0 +1,189 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include "circuit-breaker.h"
+
+namespace Driveshaft {
+
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+// Once every probe slot is taken, other threads re-check this often
+static const milliseconds HALF_OPEN_RETRY_INTERVAL(100);
+
+CircuitBreaker::CircuitBreaker(const std::string& pool_name, const CircuitBreakerOptions& options,
+                               MetricProxyPtr metrics) noexcept
+                               : m_pool_name(pool_name)
+                               , m_options(options)
+                               , m_metrics(metrics)
+                               , m_mutex()
+                               , m_state(State::CLOSED)
+                               , m_consecutive_failures(0)
+                               , m_probes_in_flight(0)
+                               , m_probe_successes(0)
+                               , m_open_until() {
+}
+
+bool CircuitBreaker::tryAcquire(bool& probe) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    probe = false;
+    switch (m_state) {
+    case State::CLOSED:
+        return true;
+
+    case State::OPEN:
+        if (steady_clock::now() < m_open_until) {
+            return false;
+        }
+        transition(State::HALF_OPEN);
+        /* fall through */
+    case State::HALF_OPEN:
+        if (m_probes_in_flight >= m_options.half_open_probes) {
+            return false;
+        }
+        ++m_probes_in_flight;
+        probe = true;
+        return true;
+    }
+
+    return false; // Unnecessary
+}
+
+void CircuitBreaker::release(bool probe) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (probe && m_state == State::HALF_OPEN && m_probes_in_flight > 0) {
+        --m_probes_in_flight;
+    }
+}
+
+void CircuitBreaker::recordSuccess(bool probe) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_consecutive_failures = 0;
+    if (m_state != State::HALF_OPEN || !probe) {
+        return;
+    }
+
+    if (m_probes_in_flight > 0) {
+        --m_probes_in_flight;
+    }
+
+    if (++m_probe_successes >= m_options.half_open_probes) {
+        LOG4CXX_INFO(ThreadLogger, "Circuit breaker for pool " << m_pool_name << " closing after " << m_probe_successes << " successful probes");
+        transition(State::CLOSED);
+    }
+}
+
+void CircuitBreaker::recordFailure(bool probe) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    switch (m_state) {
+    case State::CLOSED:
+        if (++m_consecutive_failures >= m_options.failure_threshold) {
+            LOG4CXX_ERROR(ThreadLogger, "Circuit breaker for pool " << m_pool_name << " opening after " << m_consecutive_failures << " consecutive failures");
+            transition(State::OPEN);
+        }
+        break;
+
+    case State::HALF_OPEN:
+        if (!probe) {
+            break; // A straggler from before the breaker tripped says nothing of the endpoint now
+        }
+        LOG4CXX_ERROR(ThreadLogger, "Circuit breaker for pool " << m_pool_name << " re-opening after a failed probe");
+        transition(State::OPEN);
+        break;
+
+    case State::OPEN:
+        break; // Stragglers from before the breaker tripped
+    }
+}
+
+void CircuitBreaker::reset() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_consecutive_failures = 0;
+    if (m_state != State::CLOSED) {
+        LOG4CXX_INFO(MainLogger, "Circuit breaker for pool " << m_pool_name << " closing for a new endpoint");
+        transition(State::CLOSED);
+    }
+}
+
+CircuitBreaker::State CircuitBreaker::state() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_state;
+}
+
+milliseconds CircuitBreaker::retryDelay() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    switch (m_state) {
+    case State::CLOSED:
+        return milliseconds(0);
+
+    case State::OPEN:
+        return std::max(milliseconds(1), duration_cast<milliseconds>(m_open_until - steady_clock::now()));
+
+    case State::HALF_OPEN:
+        return HALF_OPEN_RETRY_INTERVAL;
+    }
+
+    return milliseconds(0); // Unnecessary
+}
+
+const char* CircuitBreaker::stateName(State state) noexcept {
+    switch (state) {
+    case State::CLOSED:
+        return "closed";
+    case State::OPEN:
+        return "open";
+    case State::HALF_OPEN:
+        return "half_open";
+    }
+
+    return "unknown"; // Unnecessary
+}
+
+// Must be called with m_mutex held
+void CircuitBreaker::transition(State to) noexcept {
+    State from = m_state;
+    m_state = to;
+    m_consecutive_failures = 0;
+    m_probes_in_flight = 0;
+    m_probe_successes = 0;
+    if (to == State::OPEN) {
+        m_open_until = steady_clock::now() + milliseconds(m_options.open_duration_ms);
+    }
+
+    if (m_metrics) {
+        m_metrics->reportCircuitBreakerTransition(m_pool_name, stateName(from), stateName(to));
+    }
+}
+
+} // namespace Driveshaft
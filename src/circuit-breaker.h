@@ -0,0 +1,93 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_CIRCUIT_BREAKER_H_
+#define incl_DRIVESHAFT_CIRCUIT_BREAKER_H_
+
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include "common-defs.h"
+#include "pool-options.h"
+#include "metric-proxy.h"
+
+namespace Driveshaft {
+
+/* Shared by all the GearmanClients of a pool. Workers ask for a permit before
+ * grabbing a job so that a dead endpoint leaves jobs queued in gearmand instead
+ * of having every thread grab and fail them.
+ *
+ * A permit handed out while half-open is a probe. The caller must hand it back
+ * through recordSuccess/recordFailure, or release() if no job was run.
+ */
+class CircuitBreaker {
+public:
+    enum class State {
+        CLOSED,
+        OPEN,
+        HALF_OPEN
+    };
+
+    CircuitBreaker(const std::string& pool_name, const CircuitBreakerOptions& options,
+                   MetricProxyPtr metrics) noexcept;
+
+    bool tryAcquire(bool& probe) noexcept;
+    void release(bool probe) noexcept;
+    void recordSuccess(bool probe) noexcept;
+    void recordFailure(bool probe) noexcept;
+    // Closes the breaker, as for an endpoint nothing is known about yet
+    void reset() noexcept;
+
+    State state() noexcept;
+    // How long a caller refused a permit should wait before asking again
+    std::chrono::milliseconds retryDelay() noexcept;
+
+    static const char* stateName(State state) noexcept;
+
+private:
+    CircuitBreaker() = delete;
+    CircuitBreaker(const CircuitBreaker&) = delete;
+    CircuitBreaker(CircuitBreaker&&) = delete;
+    CircuitBreaker& operator=(const CircuitBreaker&) = delete;
+    CircuitBreaker& operator=(const CircuitBreaker&&) = delete;
+
+    void transition(State to) noexcept;
+
+    const std::string m_pool_name;
+    const CircuitBreakerOptions m_options;
+    MetricProxyPtr m_metrics;
+
+    std::mutex m_mutex;
+    State m_state;
+    uint32_t m_consecutive_failures;
+    uint32_t m_probes_in_flight;
+    uint32_t m_probe_successes;
+    std::chrono::steady_clock::time_point m_open_until;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_CIRCUIT_BREAKER_H_
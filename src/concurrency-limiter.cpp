@@ -0,0 +1,143 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "concurrency-limiter.h"
+
+namespace Driveshaft {
+
+// Weights of the newest sample in the recent and long-run latency averages
+static const double SHORT_LATENCY_ALPHA = 0.1;
+static const double LONG_LATENCY_ALPHA = 0.01;
+// How much of each newly computed limit is blended into the current one
+static const double LIMIT_SMOOTHING = 0.2;
+static const double DROP_BACKOFF = 0.9;
+static const double MIN_GRADIENT = 0.5;
+
+ConcurrencyLimiter::ConcurrencyLimiter(const std::string& pool_name, const ConcurrencyLimitOptions& options,
+                                       MetricProxyPtr metrics) noexcept
+                                       : m_pool_name(pool_name)
+                                       , m_options(options)
+                                       , m_metrics(metrics)
+                                       , m_mutex()
+                                       , m_limit(std::max(options.min_limit, options.max_limit))
+                                       , m_active(0)
+                                       , m_short_latency_ms(0)
+                                       , m_long_latency_ms(0) {
+    if (m_metrics) {
+        m_metrics->reportConcurrencyLimit(m_pool_name, static_cast<uint32_t>(m_limit));
+    }
+}
+
+bool ConcurrencyLimiter::tryAcquire() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_active >= static_cast<uint32_t>(m_limit)) {
+        return false;
+    }
+
+    m_active++;
+    return true;
+}
+
+void ConcurrencyLimiter::release() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_active > 0) {
+        m_active--;
+    }
+}
+
+bool ConcurrencyLimiter::tryShed() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_active <= static_cast<uint32_t>(m_limit)) {
+        return false;
+    }
+
+    m_active--;
+    return true;
+}
+
+void ConcurrencyLimiter::recordSuccess(std::chrono::milliseconds latency) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    double sample = std::max<double>(1, latency.count());
+    if (m_long_latency_ms == 0) {
+        m_short_latency_ms = m_long_latency_ms = sample;
+    } else {
+        m_short_latency_ms += SHORT_LATENCY_ALPHA * (sample - m_short_latency_ms);
+        m_long_latency_ms += LONG_LATENCY_ALPHA * (sample - m_long_latency_ms);
+    }
+
+    // Once the endpoint recovers from a long overload, let the baseline catch
+    // up instead of waiting for the slow average to decay.
+    if (m_long_latency_ms > 2 * m_short_latency_ms) {
+        m_long_latency_ms *= 0.95;
+    }
+
+    // Without demand the latency says nothing about a higher limit
+    if (m_active * 2 < m_limit) {
+        return;
+    }
+
+    double tolerance = m_options.latency_tolerance_percent / 100.0;
+    double gradient = std::max(MIN_GRADIENT,
+                               std::min(1.0, tolerance * m_long_latency_ms / m_short_latency_ms));
+    double target = m_limit * gradient + std::sqrt(m_limit);
+    setLimit(m_limit * (1 - LIMIT_SMOOTHING) + target * LIMIT_SMOOTHING);
+}
+
+void ConcurrencyLimiter::recordDrop() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    setLimit(m_limit * DROP_BACKOFF);
+}
+
+uint32_t ConcurrencyLimiter::limit() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return static_cast<uint32_t>(m_limit);
+}
+
+void ConcurrencyLimiter::reset() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    setLimit(m_options.max_limit);
+    m_short_latency_ms = 0;
+    m_long_latency_ms = 0;
+}
+
+// Must be called with m_mutex held
+void ConcurrencyLimiter::setLimit(double limit) noexcept {
+    uint32_t before = static_cast<uint32_t>(m_limit);
+    m_limit = std::min<double>(std::max<double>(limit, m_options.min_limit),
+                               std::max(m_options.min_limit, m_options.max_limit));
+
+    uint32_t after = static_cast<uint32_t>(m_limit);
+    if (after != before) {
+        LOG4CXX_DEBUG(ThreadLogger, "Concurrency limit for pool " << m_pool_name << " is now " << after);
+        if (m_metrics) {
+            m_metrics->reportConcurrencyLimit(m_pool_name, after);
+        }
+    }
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,85 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_CONCURRENCY_LIMITER_H_
+#define incl_DRIVESHAFT_CONCURRENCY_LIMITER_H_
+
+#include <string>
+#include <chrono>
+#include <mutex>
+#include "common-defs.h"
+#include "pool-options.h"
+#include "metric-proxy.h"
+
+namespace Driveshaft {
+
+/* Adaptive cap on how many of a pool's workers grab jobs at once, so that a
+ * pool sized for peak does not push the endpoint past the point where latency
+ * collapses. Modelled on a gradient limiter: the ratio of long-run to recent
+ * latency scales the limit down as queueing builds up in the endpoint, while
+ * a sqrt(limit) allowance lets it probe upwards. Errors cut it by 10%.
+ *
+ * A worker holds a slot from tryAcquire() until release() or tryShed().
+ */
+class ConcurrencyLimiter {
+public:
+    ConcurrencyLimiter(const std::string& pool_name, const ConcurrencyLimitOptions& options,
+                       MetricProxyPtr metrics) noexcept;
+
+    bool tryAcquire() noexcept;
+    void release() noexcept;
+    // Gives up the caller's slot and returns true if the pool is over its limit
+    bool tryShed() noexcept;
+
+    void recordSuccess(std::chrono::milliseconds latency) noexcept;
+    void recordDrop() noexcept;
+
+    uint32_t limit() noexcept;
+    // Starts learning again from the widest limit. Held slots stay held
+    void reset() noexcept;
+
+private:
+    ConcurrencyLimiter() = delete;
+    ConcurrencyLimiter(const ConcurrencyLimiter&) = delete;
+    ConcurrencyLimiter(ConcurrencyLimiter&&) = delete;
+    ConcurrencyLimiter& operator=(const ConcurrencyLimiter&) = delete;
+    ConcurrencyLimiter& operator=(const ConcurrencyLimiter&&) = delete;
+
+    void setLimit(double limit) noexcept;
+
+    const std::string m_pool_name;
+    const ConcurrencyLimitOptions m_options;
+    MetricProxyPtr m_metrics;
+
+    std::mutex m_mutex;
+    double m_limit;
+    uint32_t m_active;
+    double m_short_latency_ms;
+    double m_long_latency_ms;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_CONCURRENCY_LIMITER_H_
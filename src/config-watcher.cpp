@@ -0,0 +1,150 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <thread>
+#include <boost/filesystem.hpp>
+#include "config-watcher.h"
+
+namespace Driveshaft {
+
+// Everything that leaves a complete new file behind. Plain writes are only
+// seen once the writer closes the file, so a half written config is never read
+static const uint32_t CONFIG_WATCHER_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB;
+
+// A config directory is watched itself, a config file through its directory
+static std::string watched_directory(const std::string& config_filename) noexcept {
+    boost::system::error_code ec;
+    if (boost::filesystem::is_directory(config_filename, ec)) {
+        return config_filename;
+    }
+
+    std::string directory(boost::filesystem::path(config_filename).parent_path().string());
+    return directory.empty() ? std::string(".") : directory;
+}
+
+ConfigWatcher::ConfigWatcher(const std::string& config_filename) noexcept
+    : m_directory(watched_directory(config_filename))
+    , m_inotify_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    , m_watch(-1) {
+
+    if (m_inotify_fd == -1) {
+        LOG4CXX_ERROR(MainLogger, "Unable to create inotify instance. Polling for config changes. errno: " << errno);
+        return;
+    }
+
+    addWatch();
+}
+
+ConfigWatcher::~ConfigWatcher() noexcept {
+    if (m_inotify_fd != -1) {
+        close(m_inotify_fd);
+    }
+}
+
+bool ConfigWatcher::addWatch() noexcept {
+    m_watch = inotify_add_watch(m_inotify_fd, m_directory.c_str(), CONFIG_WATCHER_EVENTS);
+    if (m_watch == -1) {
+        LOG4CXX_ERROR(MainLogger, "Unable to watch " << m_directory << " for config changes. errno: " << errno);
+        return false;
+    }
+
+    LOG4CXX_DEBUG(MainLogger, "Watching " << m_directory << " for config changes");
+    return true;
+}
+
+bool ConfigWatcher::wait(std::chrono::milliseconds timeout) noexcept {
+    // The directory itself was replaced. Look at the config again once it is back
+    if (m_inotify_fd != -1 && m_watch == -1 && addWatch()) {
+        return true;
+    }
+
+    if (m_inotify_fd == -1 || m_watch == -1) {
+        std::this_thread::sleep_for(timeout);
+        return true;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = m_inotify_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int rc = poll(&pfd, 1, timeout.count());
+    if (rc <= 0) {
+        if (rc == -1 && errno != EINTR) {
+            LOG4CXX_ERROR(MainLogger, "Unable to poll for config changes. errno: " << errno);
+        }
+        return false;
+    }
+
+    return drainEvents();
+}
+
+int ConfigWatcher::fd() const noexcept {
+    return m_inotify_fd;
+}
+
+bool ConfigWatcher::watching() const noexcept {
+    return m_inotify_fd != -1 && m_watch != -1;
+}
+
+bool ConfigWatcher::changed() noexcept {
+    if (!watching()) {
+        // The directory itself was replaced. Watch it again once it is back
+        if (m_inotify_fd != -1) {
+            addWatch();
+        }
+        return true;
+    }
+
+    return drainEvents();
+}
+
+// Reads every queued event, so one rename does not wake the loop several times
+bool ConfigWatcher::drainEvents() noexcept {
+    alignas(struct inotify_event) char buffer[4096];
+    bool changed = false;
+    while (true) {
+        ssize_t len = read(m_inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            return changed;
+        }
+
+        for (char *ptr = buffer; ptr < buffer + len; ) {
+            auto event = reinterpret_cast<const struct inotify_event*>(ptr);
+            if (event->mask & IN_IGNORED) {
+                LOG4CXX_INFO(MainLogger, m_directory << " went away. Watching it again once it is back");
+                m_watch = -1;
+            }
+            changed = true;
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,80 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_CONFIG_WATCHER_H_
+#define incl_DRIVESHAFT_CONFIG_WATCHER_H_
+
+#include <string>
+#include <chrono>
+#include "common-defs.h"
+
+namespace Driveshaft {
+
+/* Wakes the main loop as soon as the jobs config may have changed, rather
+ * than leaving it to find out on its next tick. The directory is watched
+ * with inotify instead of the file, so a config replaced by renaming a new
+ * one over it, or by swapping a symlink, is seen as well. A config directory
+ * is watched itself. Any event in the directory counts; DriveshaftConfig::load
+ * skips contents it already has.
+ * Without inotify every wait simply sleeps and reports a possible change.
+ */
+class ConfigWatcher {
+public:
+    explicit ConfigWatcher(const std::string& config_filename) noexcept;
+    ~ConfigWatcher() noexcept;
+
+    /* true when the config may have changed. false when the timeout passed
+     * without a change, or a signal cut the wait short.
+     */
+    bool wait(std::chrono::milliseconds timeout) noexcept;
+
+    /* For callers that wait on several descriptors at once: fd() turns
+     * readable once there are events, and changed() consumes them without
+     * blocking. While watching() is false nothing will arrive on fd(), so
+     * changed() has to be called periodically instead, and reports a
+     * possible change every time.
+     */
+    int fd() const noexcept;
+    bool watching() const noexcept;
+    bool changed() noexcept;
+
+private:
+    ConfigWatcher() = delete;
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher(ConfigWatcher&&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&&) = delete;
+
+    bool addWatch() noexcept;
+    bool drainEvents() noexcept;
+
+    std::string m_directory;
+    int m_inotify_fd;
+    int m_watch; // -1 until the directory is watched again after it went away
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_CONFIG_WATCHER_H_
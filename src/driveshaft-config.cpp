@@ -1,63 +1,254 @@
+#include <algorithm>
 #include <fstream>
-#include <boost/range/algorithm/copy.hpp>
-#include <boost/range/adaptors.hpp>
+#include <functional>
+#include <sched.h>
 #include <boost/filesystem.hpp>
 #include "driveshaft-config.h"
+#include "worker-processes.h"
 
 namespace Driveshaft {
 
 namespace cfgkeys {
 static std::string GEARMAN_SERVERS_LIST = "gearman_servers_list";
+static std::string DIRECTORY_SERVERS_FILE = "servers.json";
+static std::string DIRECTORY_POOL_FILE_EXTENSION = ".json";
 static std::string POOLS_LIST = "pools_list";
 static std::string POOL_WORKER_COUNT = "worker_count";
 static std::string POOL_JOB_LIST = "jobs_list";
 static std::string POOL_JOB_PROCESSING_URI = "job_processing_uri";
+static std::string POOL_CIRCUIT_BREAKER = "circuit_breaker";
+static std::string CIRCUIT_BREAKER_FAILURE_THRESHOLD = "failure_threshold";
+static std::string CIRCUIT_BREAKER_OPEN_DURATION_MS = "open_duration_ms";
+static std::string CIRCUIT_BREAKER_HALF_OPEN_PROBES = "half_open_probes";
+static std::string POOL_RETRY = "retry";
+static std::string RETRY_MAX_ATTEMPTS = "max_attempts";
+static std::string RETRY_INITIAL_BACKOFF_MS = "initial_backoff_ms";
+static std::string RETRY_MAX_BACKOFF_MS = "max_backoff_ms";
+static std::string RETRY_BUDGET_PERCENT = "budget_percent";
+static std::string RETRY_FUNCTIONS = "functions";
+static std::string POOL_BACKPRESSURE = "backpressure";
+static std::string BACKPRESSURE_PAUSE_MS = "pause_ms";
+static std::string BACKPRESSURE_MAX_PAUSE_MS = "max_pause_ms";
+static std::string BACKPRESSURE_LATENCY_THRESHOLD_MS = "latency_threshold_ms";
+static std::string POOL_CONCURRENCY_LIMIT = "concurrency_limit";
+static std::string CONCURRENCY_MIN_LIMIT = "min_limit";
+static std::string CONCURRENCY_MAX_LIMIT = "max_limit";
+static std::string CONCURRENCY_LATENCY_TOLERANCE_PERCENT = "latency_tolerance_percent";
+static std::string POOL_AUTOSCALE = "autoscale";
+static std::string AUTOSCALE_MIN_WORKERS = "min_workers";
+static std::string AUTOSCALE_MAX_WORKERS = "max_workers";
+static std::string AUTOSCALE_JOBS_PER_WORKER = "jobs_per_worker";
+static std::string AUTOSCALE_HOSTS = "hosts";
+static std::string POOL_RATE_LIMIT = "rate_limit";
+static std::string RATE_LIMIT_JOBS_PER_SECOND = "jobs_per_second";
+static std::string RATE_LIMIT_BURST = "burst";
+static std::string RATE_LIMIT_FUNCTIONS = "functions";
+static std::string POOL_FETCH_QUEUE = "fetch_queue";
+static std::string FETCH_QUEUE_FETCHERS = "fetchers";
+static std::string FETCH_QUEUE_CAPACITY = "capacity";
+static std::string FETCH_QUEUE_REACTOR = "reactor";
+static std::string POOL_WORKER_PROTOCOL = "worker_protocol";
+static std::string WORKER_PROTOCOL_LIBGEARMAN = "libgearman";
+static std::string WORKER_PROTOCOL_NATIVE = "native";
+static std::string POOL_GEARMAND_PROBE = "gearmand_probe";
+static std::string GEARMAND_PROBE_INTERVAL_MS = "interval_ms";
+static std::string GEARMAND_PROBE_TIMEOUT_MS = "timeout_ms";
+static std::string POOL_SERVERS_PER_THREAD = "servers_per_thread";
+static std::string POOL_PROCESS = "process";
+static std::string POOL_SCHEDULING = "scheduling";
+static std::string SCHEDULING_CPUS = "cpus";
+static std::string SCHEDULING_NUMA_NODE = "numa_node";
+static std::string SCHEDULING_NICE = "nice";
+static std::string SCHEDULING_POLICY = "policy";
+static std::string SCHEDULING_POLICY_OTHER = "other";
+static std::string SCHEDULING_POLICY_BATCH = "batch";
+static std::string SCHEDULING_POLICY_IDLE = "idle";
+}
+
+// Reads an optional unsigned member of node, leaving value untouched if absent
+static void readOptionalUInt(const std::string& pool_name, const Json::Value& node,
+                             const std::string& key, uint32_t& value) {
+    if (!node.isMember(key)) {
+        return;
+    }
+
+    if (!node[key].isUInt()) {
+        LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has invalid " << key << ". Expecting an unsigned integer");
+        throw std::runtime_error("config pool options parse failure");
+    }
+
+    value = node[key].asUInt();
+}
+
+static void readRetryOptions(const std::string& pool_name, const Json::Value& node, RetryOptions& retry) {
+    using namespace cfgkeys;
+    readOptionalUInt(pool_name, node, RETRY_MAX_ATTEMPTS, retry.max_attempts);
+    readOptionalUInt(pool_name, node, RETRY_INITIAL_BACKOFF_MS, retry.initial_backoff_ms);
+    readOptionalUInt(pool_name, node, RETRY_MAX_BACKOFF_MS, retry.max_backoff_ms);
+    if (retry.max_attempts == 0) {
+        LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " needs " << RETRY_MAX_ATTEMPTS << " of at least 1");
+        throw std::runtime_error("config pool options parse failure");
+    }
+}
+
+static void readRateLimitOptions(const std::string& pool_name, const Json::Value& node, RateLimitOptions& rate_limit) {
+    using namespace cfgkeys;
+    if (node.isMember(RATE_LIMIT_JOBS_PER_SECOND)) {
+        const auto& rate_node = node[RATE_LIMIT_JOBS_PER_SECOND];
+        if (!rate_node.isNumeric() || rate_node.asDouble() < 0) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has invalid " << RATE_LIMIT_JOBS_PER_SECOND <<
+                                      ". Expecting a non-negative number");
+            throw std::runtime_error("config pool options parse failure");
+        }
+        rate_limit.jobs_per_second = rate_node.asDouble();
+    }
+
+    readOptionalUInt(pool_name, node, RATE_LIMIT_BURST, rate_limit.burst);
 }
 
 DriveshaftConfig::DriveshaftConfig() noexcept :
     m_config_filename(),
     m_server_list(),
     m_pool_map(),
-    m_load_time(0) {
+    m_content_hash(0),
+    m_file_hashes() {
 }
 
-bool DriveshaftConfig::load(const std::string& config_filename, std::shared_ptr<Json::CharReader> json_parser) {
-    if (!this->needsConfigUpdate(config_filename)) {
+/* Hashing the contents rather than looking at the mtime catches every edit,
+ * however close together, and skips rewrites that changed nothing.
+ */
+bool DriveshaftConfig::load(const std::string& config_filename, std::shared_ptr<Json::CharReader> json_parser,
+                            const DriveshaftConfig& running) {
+    if (boost::filesystem::is_directory(config_filename)) {
+        return this->loadDirectory(config_filename, json_parser, running);
+    }
+
+    std::string config_file_contents(this->fetchFileContents(config_filename));
+    if (running.m_config_filename == config_filename &&
+        running.m_content_hash == std::hash<std::string>()(config_file_contents)) {
+        LOG4CXX_DEBUG(MainLogger, "Config contents are unchanged");
         return false;
     }
 
     LOG4CXX_INFO(MainLogger, "Reloading config");
     this->m_config_filename = config_filename;
-
-    std::string config_file_contents(this->fetchFileContents(config_filename));
     return this->parseConfig(config_file_contents, json_parser);
 }
 
-bool DriveshaftConfig::parseConfig(const std::string& config_data, std::shared_ptr<Json::CharReader> json_parser) {
-    Json::Value tree;
+/* A config directory holds servers.json with the gearman_servers_list, and
+ * one <pool name>.json per pool with what would be that pool's entry in
+ * pools_list. Files whose contents hash the same as when running was loaded
+ * from them are not parsed again; their pools are copied over instead.
+ */
+bool DriveshaftConfig::loadDirectory(const std::string& directory, std::shared_ptr<Json::CharReader> json_parser,
+                                     const DriveshaftConfig& running) {
+    using namespace cfgkeys;
+    bool same_directory = running.m_config_filename == directory;
+    bool changed = !same_directory;
+    this->m_config_filename = directory;
+
+    std::string servers_filename((boost::filesystem::path(directory) / DIRECTORY_SERVERS_FILE).string());
+    std::string servers_contents(this->fetchFileContents(servers_filename));
+    std::size_t servers_hash = std::hash<std::string>()(servers_contents);
+    m_file_hashes[servers_filename] = servers_hash;
+
+    auto running_hash = running.m_file_hashes.find(servers_filename);
+    if (!same_directory || running_hash == running.m_file_hashes.end() || running_hash->second != servers_hash) {
+        // Pools without their own servers inherit these, so every pool is parsed again
+        same_directory = false;
+        changed = true;
+        Json::Value tree;
+        this->parseJson(servers_filename, servers_contents, json_parser, tree);
+        if (!tree.isObject() || !tree[GEARMAN_SERVERS_LIST].isArray()) {
+            LOG4CXX_ERROR(MainLogger, servers_filename << " has no " << GEARMAN_SERVERS_LIST << " array");
+            throw std::runtime_error("config parse failure");
+        }
+        this->parseServerList(tree[GEARMAN_SERVERS_LIST], this->m_server_list);
+    } else {
+        this->m_server_list = running.m_server_list;
+    }
+
+    boost::system::error_code ec;
+    for (boost::filesystem::directory_iterator i(directory, ec), end; !ec && i != end; i.increment(ec)) {
+        const auto& path = i->path();
+        std::string name(path.filename().string());
+        if (name[0] == '.' || path.extension().string() != DIRECTORY_POOL_FILE_EXTENSION ||
+            name == DIRECTORY_SERVERS_FILE || !boost::filesystem::is_regular_file(path)) {
+            continue;
+        }
+
+        std::string pool_name(path.stem().string());
+        std::string pool_filename(path.string());
+        std::string pool_contents(this->fetchFileContents(pool_filename));
+        std::size_t pool_hash = std::hash<std::string>()(pool_contents);
+        m_file_hashes[pool_filename] = pool_hash;
+
+        running_hash = running.m_file_hashes.find(pool_filename);
+        if (same_directory && running_hash != running.m_file_hashes.end() && running_hash->second == pool_hash) {
+            // A pool missing from running was left to another worker process by keepProcessPools, and still is
+            auto running_pool = running.m_pool_map.find(pool_name);
+            if (running_pool != running.m_pool_map.end()) {
+                this->m_pool_map.insert(*running_pool);
+            }
+            continue;
+        }
+
+        changed = true;
+        Json::Value pool_node;
+        this->parseJson(pool_filename, pool_contents, json_parser, pool_node);
+        this->parsePool(pool_name, pool_node);
+    }
+
+    if (ec) {
+        LOG4CXX_ERROR(MainLogger, "Unable to list config directory " << directory << ". Error: " << ec.message());
+        throw std::runtime_error("config read failure");
+    }
+
+    // Added and changed files were seen above. This catches removed ones
+    if (m_file_hashes.size() != running.m_file_hashes.size()) {
+        changed = true;
+    }
+
+    if (!changed) {
+        LOG4CXX_DEBUG(MainLogger, "Config directory contents are unchanged");
+        return false;
+    }
+
+    LOG4CXX_INFO(MainLogger, "Reloaded config directory " << directory);
+    return true;
+}
+
+void DriveshaftConfig::parseJson(const std::string& source, const std::string& data,
+                                 std::shared_ptr<Json::CharReader> json_parser, Json::Value& tree) const {
     std::string parse_errors;
-    if (!json_parser->parse(config_data.data(),
-                            config_data.data() + config_data.length(),
-                            &tree, &parse_errors)) {
-        LOG4CXX_ERROR(MainLogger, "Failed to parse " << this->m_config_filename <<
-                                  ". Errors: " << parse_errors);
+    if (!json_parser->parse(data.data(), data.data() + data.length(), &tree, &parse_errors)) {
+        LOG4CXX_ERROR(MainLogger, "Failed to parse " << source << ". Errors: " << parse_errors);
         throw std::runtime_error("config parse failure");
     }
+}
+
+bool DriveshaftConfig::parseConfig(const std::string& config_data, std::shared_ptr<Json::CharReader> json_parser) {
+    Json::Value tree;
+    this->parseJson(this->m_config_filename, config_data, json_parser, tree);
 
     if (!this->validateConfigNode(tree)) {
         throw std::runtime_error("config parse failure");
     }
 
-    this->m_load_time = std::time(nullptr);
+    this->m_content_hash = std::hash<std::string>()(config_data);
     this->m_server_list.clear();
     this->m_pool_map.clear();
 
-    this->parseServerList(tree);
+    this->parseServerList(tree[cfgkeys::GEARMAN_SERVERS_LIST], this->m_server_list);
     this->parsePoolList(tree);
 
     return true;
 }
 
+/* Only pools that were added or changed are passed to the watcher, so a
+ * reload that touches a handful of pools does a handful of resizes however
+ * many pools the config has.
+ */
 void DriveshaftConfig::supersede(DriveshaftConfig& old, PoolWatcher& watcher) const {
     StringSet pools_to_shut;
     std::tie(pools_to_shut, std::ignore) = old.compare(*this);
@@ -65,11 +256,41 @@ void DriveshaftConfig::supersede(DriveshaftConfig& old, PoolWatcher& watcher) co
         old.clearWorkerCount(pool, watcher);
     }
 
+    auto old_pool = old.m_pool_map.begin();
     for (auto const& i : this->m_pool_map) {
         const auto &pool_name = i.first;
         const auto &pool_data = i.second;
-        watcher.inform(pool_data.worker_count, pool_name, this->m_server_list,
-                       pool_data.job_list, pool_data.job_processing_uri);
+        while (old_pool != old.m_pool_map.end() && old_pool->first < pool_name) {
+            ++old_pool;
+        }
+
+        // A restarted pool was cleared above, so it differs here too
+        if (old_pool != old.m_pool_map.end() && old_pool->first == pool_name &&
+            old_pool->second == pool_data) {
+            continue;
+        }
+
+        watcher.inform(pool_data.worker_count, pool_name, pool_data.server_list,
+                       pool_data.job_list, pool_data.job_processing_uri,
+                       pool_data.options);
+    }
+}
+
+/* m_file_hashes keeps the files of dropped pools, so that the next load of
+ * the directory knows them as unchanged instead of parsing them again.
+ */
+void DriveshaftConfig::keepProcessPools(uint32_t process, uint32_t count) noexcept {
+    for (auto i = m_pool_map.begin(); i != m_pool_map.end(); ) {
+        if (i->second.process >= (int32_t) count) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << i->first << " asks for " << cfgkeys::POOL_PROCESS << " " <<
+                                      i->second.process << " of only " << count << ". Using " << i->second.process % count);
+        }
+
+        if (pool_process(i->first, i->second.process, count) == process) {
+            ++i;
+        } else {
+            i = m_pool_map.erase(i);
+        }
     }
 }
 
@@ -82,8 +303,9 @@ void DriveshaftConfig::clearWorkerCount(const std::string& pool_name, PoolWatche
 
     auto& pool_data = pool_iter->second;
     pool_data.worker_count = 0;
-    watcher.inform(0, pool_name, this->m_server_list,
-                   pool_data.job_list, pool_data.job_processing_uri);
+    watcher.inform(0, pool_name, pool_data.server_list,
+                   pool_data.job_list, pool_data.job_processing_uri,
+                   pool_data.options);
 }
 
 void DriveshaftConfig::clearAllWorkerCounts(PoolWatcher& watcher) {
@@ -92,64 +314,48 @@ void DriveshaftConfig::clearAllWorkerCounts(PoolWatcher& watcher) {
     }
 }
 
+/* Running workers take a new jobs list or processing URI in place, except
+ * that the connections of a fetch queue keep the functions they were started
+ * with. Options PoolOptions::needsRestart leaves out are retuned in place too.
+ * Anything else about the pool needs new threads.
+ */
+static bool needs_restart(const PoolData& current, const PoolData& latest) noexcept {
+    return current.server_list != latest.server_list ||
+           current.options.needsRestart(latest.options) ||
+           (current.options.fetch_queue.enabled() && current.job_list != latest.job_list);
+}
+
+// Walks both pool maps in step, as they are sorted by name
 std::pair<StringSet, StringSet> DriveshaftConfig::compare(const DriveshaftConfig& that) const noexcept {
     LOG4CXX_DEBUG(MainLogger, "Beginning config compare");
 
-    StringSet current_pool_names, latest_pool_names;
-    boost::copy(m_pool_map | boost::adaptors::map_keys,
-                std::inserter(current_pool_names, current_pool_names.begin()));
-    boost::copy(that.m_pool_map | boost::adaptors::map_keys,
-                std::inserter(latest_pool_names, latest_pool_names.begin()));
-
-    if (this->m_server_list != that.m_server_list) {
-        // Everything needs restarting
-        return std::pair<StringSet, StringSet>(std::move(current_pool_names),
-                                               std::move(latest_pool_names));
-    } else {
-        StringSet pools_turn_off, pools_turn_on;
-
-        // See what's present in current and missing in new. This is to be turned off.
-        std::set_difference(current_pool_names.begin(), current_pool_names.end(),
-                            latest_pool_names.begin(), latest_pool_names.end(),
-                            std::inserter(pools_turn_off, pools_turn_off.begin()));
-
-        // Reverse of above. See what's to be turned on.
-        std::set_difference(latest_pool_names.begin(), latest_pool_names.end(),
-                            current_pool_names.begin(), current_pool_names.end(),
-                            std::inserter(pools_turn_on, pools_turn_on.begin()));
-
-        // Check for changed jobs or processing URI
-        for (const auto& i : m_pool_map) {
-            auto found = that.m_pool_map.find(i.first);
-            if (found != that.m_pool_map.end()) {
-                bool should_restart = false;
-                if (found->second.job_processing_uri != i.second.job_processing_uri) {
-                    should_restart = true;
-                } else {
-                    const auto& lhs_jobs_set = i.second.job_list;
-                    const auto& rhs_jobs_set = found->second.job_list;
-                    StringSet diff;
-                    std::set_symmetric_difference(lhs_jobs_set.begin(), lhs_jobs_set.end(),
-                                                  rhs_jobs_set.begin(), rhs_jobs_set.end(),
-                                                  std::inserter(diff, diff.begin()));
-                    if (diff.size()) {
-                        should_restart = true;
-                    }
-                }
-
-                if (should_restart) {
-                    pools_turn_off.insert(i.first);
-                    pools_turn_on.insert(i.first);
-                }
+    StringSet pools_turn_off, pools_turn_on;
+    auto current = m_pool_map.begin();
+    auto latest = that.m_pool_map.begin();
+    while (current != m_pool_map.end() || latest != that.m_pool_map.end()) {
+        if (latest == that.m_pool_map.end() ||
+            (current != m_pool_map.end() && current->first < latest->first)) {
+            // Present in current and missing in new. This is to be turned off.
+            pools_turn_off.emplace_hint(pools_turn_off.end(), current->first);
+            ++current;
+        } else if (current == m_pool_map.end() || latest->first < current->first) {
+            // Reverse of above. This is to be turned on.
+            pools_turn_on.emplace_hint(pools_turn_on.end(), latest->first);
+            ++latest;
+        } else {
+            if (needs_restart(current->second, latest->second)) {
+                pools_turn_off.emplace_hint(pools_turn_off.end(), current->first);
+                pools_turn_on.emplace_hint(pools_turn_on.end(), latest->first);
             }
+            ++current;
+            ++latest;
         }
-
-        return std::pair<StringSet, StringSet>(std::move(pools_turn_off), std::move(pools_turn_on));
     }
+
+    return std::pair<StringSet, StringSet>(std::move(pools_turn_off), std::move(pools_turn_on));
 }
 
-void DriveshaftConfig::parseServerList(const Json::Value& node) {
-    const auto& servers_list = node[cfgkeys::GEARMAN_SERVERS_LIST];
+void DriveshaftConfig::parseServerList(const Json::Value& servers_list, StringSet& servers) const {
     for (auto i = servers_list.begin(); i != servers_list.end(); ++i) {
         if (!i->isString()) {
             LOG4CXX_ERROR(MainLogger, cfgkeys::GEARMAN_SERVERS_LIST << " does not contain strings");
@@ -157,7 +363,7 @@ void DriveshaftConfig::parseServerList(const Json::Value& node) {
         }
 
         const auto& name = i->asString();
-        this->m_server_list.insert(name);
+        servers.insert(name);
         LOG4CXX_DEBUG(MainLogger, "Read server: " << name);
     }
 }
@@ -165,63 +371,335 @@ void DriveshaftConfig::parseServerList(const Json::Value& node) {
 void DriveshaftConfig::parsePoolList(const Json::Value& node) {
     const auto& pools_list = node[cfgkeys::POOLS_LIST];
     for (auto i = pools_list.begin(); i != pools_list.end(); ++i) {
-        const auto& pool_name = i.name();
-        const auto& pool_node = *i;
-
-        if (!pool_node.isMember(cfgkeys::POOL_WORKER_COUNT) ||
-            !pool_node.isMember(cfgkeys::POOL_JOB_LIST) ||
-            !pool_node.isMember(cfgkeys::POOL_JOB_PROCESSING_URI) ||
-            !pool_node[cfgkeys::POOL_WORKER_COUNT].isUInt() ||
-            !pool_node[cfgkeys::POOL_JOB_LIST].isArray() ||
-            !pool_node[cfgkeys::POOL_JOB_PROCESSING_URI].isString()) {
-            LOG4CXX_ERROR(
-                MainLogger,
-                "Config (" << m_config_filename << ") has invalid " <<
-                cfgkeys::POOLS_LIST << " elements: (" <<
-                cfgkeys::POOL_WORKER_COUNT << ", " <<
-                cfgkeys::POOL_JOB_PROCESSING_URI << ", " <<
-                cfgkeys::POOL_JOB_LIST << ")"
-            );
-
-            throw std::runtime_error("config jobs list parse failure");
-        }
-
-        auto& pool_data = this->m_pool_map[pool_name];
-        pool_data.worker_count = pool_node[cfgkeys::POOL_WORKER_COUNT].asUInt();
-        pool_data.job_processing_uri = pool_node[cfgkeys::POOL_JOB_PROCESSING_URI].asString();
-        LOG4CXX_DEBUG(
+        this->parsePool(i.name(), *i);
+    }
+}
+
+void DriveshaftConfig::parsePool(const std::string& pool_name, const Json::Value& pool_node) {
+    if (!pool_node.isObject() ||
+        !pool_node.isMember(cfgkeys::POOL_WORKER_COUNT) ||
+        !pool_node.isMember(cfgkeys::POOL_JOB_LIST) ||
+        !pool_node.isMember(cfgkeys::POOL_JOB_PROCESSING_URI) ||
+        !pool_node[cfgkeys::POOL_WORKER_COUNT].isUInt() ||
+        !pool_node[cfgkeys::POOL_JOB_LIST].isArray() ||
+        !pool_node[cfgkeys::POOL_JOB_PROCESSING_URI].isString()) {
+        LOG4CXX_ERROR(
             MainLogger,
-            "Read pool: " << pool_name << " with count " <<
-            pool_data.worker_count << " and URI " << pool_data.job_processing_uri
+            "Config (" << m_config_filename << ") has invalid " <<
+            cfgkeys::POOLS_LIST << " elements: (" <<
+            cfgkeys::POOL_WORKER_COUNT << ", " <<
+            cfgkeys::POOL_JOB_PROCESSING_URI << ", " <<
+            cfgkeys::POOL_JOB_LIST << ")"
         );
 
-        const auto& job_list = pool_node[cfgkeys::POOL_JOB_LIST];
-        for (auto j = job_list.begin(); j != job_list.end(); ++j) {
-            if (!j->isString()) {
-                LOG4CXX_ERROR(MainLogger, cfgkeys::POOL_JOB_LIST << " does not contain strings");
+        throw std::runtime_error("config jobs list parse failure");
+    }
+
+    auto& pool_data = this->m_pool_map[pool_name];
+    pool_data.worker_count = pool_node[cfgkeys::POOL_WORKER_COUNT].asUInt();
+    pool_data.job_processing_uri = pool_node[cfgkeys::POOL_JOB_PROCESSING_URI].asString();
+    LOG4CXX_DEBUG(
+        MainLogger,
+        "Read pool: " << pool_name << " with count " <<
+        pool_data.worker_count << " and URI " << pool_data.job_processing_uri
+    );
+
+    const auto& job_list = pool_node[cfgkeys::POOL_JOB_LIST];
+    for (auto j = job_list.begin(); j != job_list.end(); ++j) {
+        if (!j->isString()) {
+            LOG4CXX_ERROR(MainLogger, cfgkeys::POOL_JOB_LIST << " does not contain strings");
+        }
+
+        const auto& name = j->asString();
+        pool_data.job_list.insert(name);
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " adding job " << name);
+    }
+
+    // A pool may name its own gearmand servers instead of sharing the global ones
+    if (pool_node.isMember(cfgkeys::GEARMAN_SERVERS_LIST)) {
+        const auto& servers_list = pool_node[cfgkeys::GEARMAN_SERVERS_LIST];
+        if (!servers_list.isArray() || servers_list.empty()) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " <<
+                                      cfgkeys::GEARMAN_SERVERS_LIST);
+            throw std::runtime_error("config server list type failure");
+        }
+
+        this->parseServerList(servers_list, pool_data.server_list);
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " uses its own " <<
+                                  pool_data.server_list.size() << " servers");
+    } else {
+        pool_data.server_list = this->m_server_list;
+    }
+
+    this->parsePoolOptions(pool_name, pool_node, pool_data.options);
+
+    if (pool_node.isMember(cfgkeys::POOL_PROCESS)) {
+        uint32_t process = 0;
+        readOptionalUInt(pool_name, pool_node, cfgkeys::POOL_PROCESS, process);
+        pool_data.process = std::min<uint32_t>(process, INT32_MAX);
+    }
+}
+
+void DriveshaftConfig::parsePoolOptions(const std::string& pool_name, const Json::Value& pool_node,
+                                        PoolOptions& options) const {
+    using namespace cfgkeys;
+    if (pool_node.isMember(POOL_CIRCUIT_BREAKER)) {
+        const auto& breaker_node = pool_node[POOL_CIRCUIT_BREAKER];
+        if (!breaker_node.isObject()) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_CIRCUIT_BREAKER);
+            throw std::runtime_error("config pool options parse failure");
+        }
+
+        auto& breaker = options.circuit_breaker;
+        readOptionalUInt(pool_name, breaker_node, CIRCUIT_BREAKER_FAILURE_THRESHOLD, breaker.failure_threshold);
+        readOptionalUInt(pool_name, breaker_node, CIRCUIT_BREAKER_OPEN_DURATION_MS, breaker.open_duration_ms);
+        readOptionalUInt(pool_name, breaker_node, CIRCUIT_BREAKER_HALF_OPEN_PROBES, breaker.half_open_probes);
+        if (breaker.half_open_probes == 0) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " needs at least one " << CIRCUIT_BREAKER_HALF_OPEN_PROBES);
+            throw std::runtime_error("config pool options parse failure");
+        }
+
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " circuit breaker threshold " << breaker.failure_threshold <<
+                                  " open for " << breaker.open_duration_ms << "ms with " <<
+                                  breaker.half_open_probes << " probes");
+    }
+
+    if (pool_node.isMember(POOL_RETRY)) {
+        const auto& retry_node = pool_node[POOL_RETRY];
+        if (!retry_node.isObject() ||
+            (retry_node.isMember(RETRY_FUNCTIONS) && !retry_node[RETRY_FUNCTIONS].isObject())) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_RETRY);
+            throw std::runtime_error("config pool options parse failure");
+        }
+
+        readRetryOptions(pool_name, retry_node, options.retry);
+        readOptionalUInt(pool_name, retry_node, RETRY_BUDGET_PERCENT, options.retry_budget_percent);
+
+        // Per-function settings start from the pool's and override what they name
+        const auto& functions_node = retry_node[RETRY_FUNCTIONS];
+        for (auto i = functions_node.begin(); i != functions_node.end(); ++i) {
+            if (!i->isObject()) {
+                LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_RETRY <<
+                                          " entry for function " << i.name());
+                throw std::runtime_error("config pool options parse failure");
             }
 
-            const auto& name = j->asString();
-            pool_data.job_list.insert(name);
-            LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " adding job " << name);
+            auto& function_retry = options.function_retry[i.name()];
+            function_retry = options.retry;
+            readRetryOptions(pool_name, *i, function_retry);
+        }
+
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " retries up to " << options.retry.max_attempts <<
+                                  " attempts with a " << options.retry_budget_percent << "% budget and " <<
+                                  options.function_retry.size() << " function overrides");
+    }
+
+    if (pool_node.isMember(POOL_BACKPRESSURE)) {
+        const auto& backpressure_node = pool_node[POOL_BACKPRESSURE];
+        if (!backpressure_node.isObject()) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_BACKPRESSURE);
+            throw std::runtime_error("config pool options parse failure");
+        }
+
+        auto& backpressure = options.backpressure;
+        readOptionalUInt(pool_name, backpressure_node, BACKPRESSURE_PAUSE_MS, backpressure.pause_ms);
+        readOptionalUInt(pool_name, backpressure_node, BACKPRESSURE_MAX_PAUSE_MS, backpressure.max_pause_ms);
+        readOptionalUInt(pool_name, backpressure_node, BACKPRESSURE_LATENCY_THRESHOLD_MS, backpressure.latency_threshold_ms);
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " backpressure pause " << backpressure.pause_ms <<
+                                  "ms up to " << backpressure.max_pause_ms << "ms, latency threshold " <<
+                                  backpressure.latency_threshold_ms << "ms");
+    }
+
+    if (pool_node.isMember(POOL_CONCURRENCY_LIMIT)) {
+        const auto& limit_node = pool_node[POOL_CONCURRENCY_LIMIT];
+        if (!limit_node.isObject()) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_CONCURRENCY_LIMIT);
+            throw std::runtime_error("config pool options parse failure");
+        }
+
+        auto& limit = options.concurrency_limit;
+        readOptionalUInt(pool_name, limit_node, CONCURRENCY_MIN_LIMIT, limit.min_limit);
+        readOptionalUInt(pool_name, limit_node, CONCURRENCY_MAX_LIMIT, limit.max_limit);
+        readOptionalUInt(pool_name, limit_node, CONCURRENCY_LATENCY_TOLERANCE_PERCENT, limit.latency_tolerance_percent);
+        if (limit.min_limit == 0 || (limit.max_limit > 0 && limit.min_limit > limit.max_limit) ||
+            limit.latency_tolerance_percent < 100) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " needs 1 <= " << CONCURRENCY_MIN_LIMIT << " <= " <<
+                                      CONCURRENCY_MAX_LIMIT << " and " << CONCURRENCY_LATENCY_TOLERANCE_PERCENT <<
+                                      " of at least 100");
+            throw std::runtime_error("config pool options parse failure");
+        }
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " concurrency limited to between " << limit.min_limit <<
+                                  " and " << limit.max_limit << " workers");
+    }
+
+    if (pool_node.isMember(POOL_AUTOSCALE)) {
+        const auto& autoscale_node = pool_node[POOL_AUTOSCALE];
+        if (!autoscale_node.isObject()) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_AUTOSCALE);
+            throw std::runtime_error("config pool options parse failure");
+        }
+
+        auto& autoscale = options.autoscale;
+        readOptionalUInt(pool_name, autoscale_node, AUTOSCALE_MIN_WORKERS, autoscale.min_workers);
+        readOptionalUInt(pool_name, autoscale_node, AUTOSCALE_MAX_WORKERS, autoscale.max_workers);
+        readOptionalUInt(pool_name, autoscale_node, AUTOSCALE_JOBS_PER_WORKER, autoscale.jobs_per_worker);
+        readOptionalUInt(pool_name, autoscale_node, AUTOSCALE_HOSTS, autoscale.hosts);
+        if ((autoscale.max_workers > 0 && autoscale.min_workers > autoscale.max_workers) ||
+            autoscale.jobs_per_worker == 0 || autoscale.hosts == 0) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " needs " << AUTOSCALE_MIN_WORKERS << " <= " <<
+                                      AUTOSCALE_MAX_WORKERS << ", and " << AUTOSCALE_JOBS_PER_WORKER << " and " <<
+                                      AUTOSCALE_HOSTS << " of at least 1");
+            throw std::runtime_error("config pool options parse failure");
         }
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " autoscales between " << autoscale.min_workers <<
+                                  " and " << autoscale.max_workers << " workers");
+    }
+
+    if (pool_node.isMember(POOL_RATE_LIMIT)) {
+        const auto& rate_node = pool_node[POOL_RATE_LIMIT];
+        if (!rate_node.isObject() ||
+            (rate_node.isMember(RATE_LIMIT_FUNCTIONS) && !rate_node[RATE_LIMIT_FUNCTIONS].isObject())) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_RATE_LIMIT);
+            throw std::runtime_error("config pool options parse failure");
+        }
+
+        readRateLimitOptions(pool_name, rate_node, options.rate_limit);
+
+        // Function limits are separate buckets. A job takes from both
+        const auto& functions_node = rate_node[RATE_LIMIT_FUNCTIONS];
+        for (auto i = functions_node.begin(); i != functions_node.end(); ++i) {
+            if (!i->isObject()) {
+                LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_RATE_LIMIT <<
+                                          " entry for function " << i.name());
+                throw std::runtime_error("config pool options parse failure");
+            }
+
+            readRateLimitOptions(pool_name, *i, options.function_rate_limit[i.name()]);
+        }
+
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " rate limited to " << options.rate_limit.jobs_per_second <<
+                                  " jobs/s with " << options.function_rate_limit.size() << " function limits");
+    }
+
+    if (pool_node.isMember(POOL_FETCH_QUEUE)) {
+        const auto& fetch_node = pool_node[POOL_FETCH_QUEUE];
+        if (!fetch_node.isObject()) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_FETCH_QUEUE);
+            throw std::runtime_error("config pool options parse failure");
+        }
+
+        auto& fetch_queue = options.fetch_queue;
+        readOptionalUInt(pool_name, fetch_node, FETCH_QUEUE_FETCHERS, fetch_queue.fetchers);
+        readOptionalUInt(pool_name, fetch_node, FETCH_QUEUE_CAPACITY, fetch_queue.capacity);
+        if (fetch_node.isMember(FETCH_QUEUE_REACTOR)) {
+            if (!fetch_node[FETCH_QUEUE_REACTOR].isBool()) {
+                LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has invalid " << FETCH_QUEUE_REACTOR << ". Expecting a boolean");
+                throw std::runtime_error("config pool options parse failure");
+            }
+            fetch_queue.reactor = fetch_node[FETCH_QUEUE_REACTOR].asBool();
+        }
+        if (fetch_queue.capacity == 0) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " needs a " << FETCH_QUEUE_CAPACITY << " of at least 1");
+            throw std::runtime_error("config pool options parse failure");
+        }
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " fetches with " <<
+                                  (fetch_queue.reactor ? std::string("a reactor") : std::to_string(fetch_queue.fetchers) + " connections") <<
+                                  " into a queue of " << fetch_queue.capacity);
+    }
+
+    if (pool_node.isMember(POOL_WORKER_PROTOCOL)) {
+        const auto& protocol_node = pool_node[POOL_WORKER_PROTOCOL];
+        if (protocol_node == WORKER_PROTOCOL_LIBGEARMAN) {
+            options.worker_protocol = WorkerProtocol::LIBGEARMAN;
+        } else if (protocol_node == WORKER_PROTOCOL_NATIVE) {
+            options.worker_protocol = WorkerProtocol::NATIVE;
+        } else {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has invalid " << POOL_WORKER_PROTOCOL <<
+                                      ". Expecting " << WORKER_PROTOCOL_LIBGEARMAN << " or " << WORKER_PROTOCOL_NATIVE);
+            throw std::runtime_error("config pool options parse failure");
+        }
+    }
+
+    if (pool_node.isMember(POOL_GEARMAND_PROBE)) {
+        const auto& probe_node = pool_node[POOL_GEARMAND_PROBE];
+        if (!probe_node.isObject()) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_GEARMAND_PROBE);
+            throw std::runtime_error("config pool options parse failure");
+        }
+
+        auto& probe = options.gearmand_probe;
+        readOptionalUInt(pool_name, probe_node, GEARMAND_PROBE_INTERVAL_MS, probe.interval_ms);
+        readOptionalUInt(pool_name, probe_node, GEARMAND_PROBE_TIMEOUT_MS, probe.timeout_ms);
+        if (probe.interval_ms > 0 && probe.timeout_ms == 0) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " needs a " << GEARMAND_PROBE_TIMEOUT_MS << " of at least 1");
+            throw std::runtime_error("config pool options parse failure");
+        }
+        LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " probes gearmand after " << probe.interval_ms <<
+                                  "ms and waits " << probe.timeout_ms << "ms for an answer");
+    }
+
+    readOptionalUInt(pool_name, pool_node, POOL_SERVERS_PER_THREAD, options.servers_per_thread);
+
+    if (pool_node.isMember(POOL_SCHEDULING)) {
+        parseSchedulingOptions(pool_name, pool_node[POOL_SCHEDULING], options.scheduling);
     }
 }
 
-bool DriveshaftConfig::needsConfigUpdate(const std::string& new_config_filename) const {
-    boost::filesystem::path config_path(new_config_filename);
-    boost::system::error_code ec;
-    std::time_t modified_time = boost::filesystem::last_write_time(config_path, ec);
-    if (ec) {
-        LOG4CXX_ERROR(
-            MainLogger,
-            "Unable to ascertain config mtime " << new_config_filename <<
-            ". Error: " << ec.message()
-        );
-        throw std::runtime_error("config stat failure");
+void DriveshaftConfig::parseSchedulingOptions(const std::string& pool_name, const Json::Value& scheduling_node,
+                                              SchedulingOptions& scheduling) const {
+    using namespace cfgkeys;
+    if (!scheduling_node.isObject()) {
+        LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << POOL_SCHEDULING);
+        throw std::runtime_error("config pool options parse failure");
+    }
+
+    if (scheduling_node.isMember(SCHEDULING_CPUS)) {
+        const auto& cpus_node = scheduling_node[SCHEDULING_CPUS];
+        if (!cpus_node.isArray() || cpus_node.empty()) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has a malformed " << SCHEDULING_CPUS << ". Expecting an array of cpu numbers");
+            throw std::runtime_error("config pool options parse failure");
+        }
+        for (auto i = cpus_node.begin(); i != cpus_node.end(); ++i) {
+            if (!i->isUInt() || i->asUInt() >= CPU_SETSIZE) {
+                LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has an invalid cpu in " << SCHEDULING_CPUS);
+                throw std::runtime_error("config pool options parse failure");
+            }
+            scheduling.cpus.insert(i->asUInt());
+        }
+    }
+
+    if (scheduling_node.isMember(SCHEDULING_NUMA_NODE)) {
+        uint32_t numa_node = 0;
+        readOptionalUInt(pool_name, scheduling_node, SCHEDULING_NUMA_NODE, numa_node);
+        scheduling.numa_node = std::min<uint32_t>(numa_node, INT32_MAX);
+    }
+
+    if (scheduling_node.isMember(SCHEDULING_NICE)) {
+        const auto& nice_node = scheduling_node[SCHEDULING_NICE];
+        if (!nice_node.isInt() || nice_node.asInt() < -20 || nice_node.asInt() > 19) {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has invalid " << SCHEDULING_NICE << ". Expecting -20 to 19");
+            throw std::runtime_error("config pool options parse failure");
+        }
+        scheduling.nice = nice_node.asInt();
+    }
+
+    if (scheduling_node.isMember(SCHEDULING_POLICY)) {
+        const auto& policy_node = scheduling_node[SCHEDULING_POLICY];
+        if (policy_node == SCHEDULING_POLICY_OTHER) {
+            scheduling.policy = SchedulingPolicy::OTHER;
+        } else if (policy_node == SCHEDULING_POLICY_BATCH) {
+            scheduling.policy = SchedulingPolicy::BATCH;
+        } else if (policy_node == SCHEDULING_POLICY_IDLE) {
+            scheduling.policy = SchedulingPolicy::IDLE;
+        } else {
+            LOG4CXX_ERROR(MainLogger, "Pool " << pool_name << " has invalid " << SCHEDULING_POLICY << ". Expecting " <<
+                                      SCHEDULING_POLICY_OTHER << ", " << SCHEDULING_POLICY_BATCH << " or " << SCHEDULING_POLICY_IDLE);
+            throw std::runtime_error("config pool options parse failure");
+        }
     }
 
-    return modified_time > this->m_load_time;
+    LOG4CXX_DEBUG(MainLogger, "Pool " << pool_name << " runs on " << scheduling.cpus.size() << " cpus, NUMA node " <<
+                              scheduling.numa_node << " with nice " << scheduling.nice);
 }
 
 std::string DriveshaftConfig::fetchFileContents(const std::string& filename) const {
@@ -3,8 +3,9 @@
 
 #include <map>
 #include <string>
-#include <ctime>
+#include <cstddef>
 #include "common-defs.h"
+#include "pool-options.h"
 #include "dist/json/json.h"
 
 namespace Driveshaft {
@@ -14,17 +15,43 @@ public:
     virtual ~PoolWatcher() = default;
     virtual void inform(uint32_t config_worker_count, const std::string& pool_name,
                         const StringSet& server_list, const StringSet& jobs_list,
-                        const std::string& procesing_uri) = 0;
+                        const std::string& procesing_uri, const PoolOptions& options) = 0;
 };
 
+struct PoolData {
+    uint32_t worker_count;
+    std::string job_processing_uri;
+    StringSet job_list;
+    StringSet server_list; // the pool's own, or the global list
+    PoolOptions options;
+    int32_t process = -1; // the worker process that runs the pool, or -1 to place it by name
+
+    bool operator==(const PoolData& that) const noexcept {
+        return worker_count == that.worker_count &&
+               job_processing_uri == that.job_processing_uri &&
+               job_list == that.job_list &&
+               server_list == that.server_list &&
+               options == that.options &&
+               process == that.process;
+    }
+};
+
+typedef std::map<std::string, PoolData> PoolMap;
+
 class DriveshaftConfig {
 public:
     DriveshaftConfig() noexcept;
 
-    bool load(const std::string& config_filename, std::shared_ptr<Json::CharReader> json_parser);
+    /* config_filename may also be a directory of per-pool files. false when
+     * it holds what running was loaded from.
+     */
+    bool load(const std::string& config_filename, std::shared_ptr<Json::CharReader> json_parser,
+              const DriveshaftConfig& running);
     bool parseConfig(const std::string& config_data, std::shared_ptr<Json::CharReader> json_parser);
 
     void supersede(DriveshaftConfig& old, PoolWatcher& watcher) const;
+    // Drops the pools that another of count worker processes runs
+    void keepProcessPools(uint32_t process, uint32_t count) noexcept;
 
     void clearWorkerCount(const std::string& pool_name, PoolWatcher& watcher);
     void clearAllWorkerCounts(PoolWatcher& watcher);
@@ -32,24 +59,25 @@ public:
     std::pair<StringSet, StringSet> compare(const DriveshaftConfig& that) const noexcept;
 
 private:
-    void parseServerList(const Json::Value& node);
+    bool loadDirectory(const std::string& directory, std::shared_ptr<Json::CharReader> json_parser,
+                       const DriveshaftConfig& running);
+    void parseJson(const std::string& source, const std::string& data,
+                   std::shared_ptr<Json::CharReader> json_parser, Json::Value& tree) const;
+    void parseServerList(const Json::Value& servers_list, StringSet& servers) const;
     void parsePoolList(const Json::Value& node);
+    void parsePool(const std::string& pool_name, const Json::Value& pool_node);
+    void parsePoolOptions(const std::string& pool_name, const Json::Value& pool_node, PoolOptions& options) const;
+    void parseSchedulingOptions(const std::string& pool_name, const Json::Value& scheduling_node,
+                                SchedulingOptions& scheduling) const;
 
-    bool needsConfigUpdate(const std::string& new_config_filename) const;
     std::string fetchFileContents(const std::string& filename) const;
     bool validateConfigNode(const Json::Value& node) const;
 
-    typedef struct {
-        uint32_t worker_count;
-        std::string job_processing_uri;
-        StringSet job_list;
-    } PoolData;
-    typedef std::map<std::string, PoolData> PoolMap;
-
     std::string m_config_filename;
-    StringSet m_server_list;
+    StringSet m_server_list; // for pools without their own
     PoolMap m_pool_map;
-    std::time_t m_load_time;
+    std::size_t m_content_hash;
+    std::map<std::string, std::size_t> m_file_hashes; // of each file in a config directory
 };
 
 } // namespace Driveshaft
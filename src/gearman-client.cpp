@@ -26,12 +26,22 @@
 #include <curl/curl.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
 #include <thread>
+#include <algorithm>
 #include "gearman-client.h"
+#include "native-gearman-worker.h"
 #include "dist/json/json.h"
 
 namespace Driveshaft {
 
+// How long a worker over its pool's concurrency limit idles before checking again
+static const uint32_t CONCURRENCY_IDLE_WAIT_MS = 100;
+// How often a worker backing off before retrying a job checks for shutdown
+static const std::chrono::milliseconds RETRY_SHUTDOWN_CHECK_INTERVAL(100);
+// How often an executor looks whether its pool's fetchers have reached gearmand yet
+static const uint32_t EXECUTOR_READY_CHECK_MS = 100;
+
 class StringstreamWriter : public Writer {
 public:
     StringstreamWriter() {
@@ -47,6 +57,11 @@ public:
     std::string str() {
         return this->stream.str();
     }
+
+    void clear() {
+        this->stream.str(std::string());
+        this->stream.clear();
+    }
 private:
     std::stringstream stream;
 };
@@ -95,6 +110,27 @@ int curl_set_sockopt(void *dummy1, curl_socket_t curlfd, curlsocktype dummy2) no
     return CURL_SOCKOPT_OK;
 }
 
+/* Captures a Retry-After header given in seconds into the long pointed to by
+ * userdata. HTTP-date values are ignored. Returning anything other than the
+ * header length makes curl abort the transfer.
+ */
+size_t curl_header_func(char *buffer, size_t size, size_t nitems, void *userdata) noexcept {
+    static const char retry_after_header[] = "Retry-After:";
+    static const size_t retry_after_len = sizeof(retry_after_header) - 1;
+    size_t len = size*nitems;
+
+    if (len > retry_after_len && strncasecmp(buffer, retry_after_header, retry_after_len) == 0) {
+        std::string value(buffer + retry_after_len, len - retry_after_len);
+        char *end = nullptr;
+        long seconds = strtol(value.c_str(), &end, 10);
+        if (end != value.c_str() && seconds >= 0) {
+            *static_cast<long*>(userdata) = seconds;
+        }
+    }
+
+    return len;
+}
+
 /* return of 1 means failure and curl will abort the transfer */
 int curl_progress_func(void *p, double dltotal, double dlnow,
                                   double ultotal, double ulnow) noexcept {
@@ -120,31 +156,48 @@ void gearman_client_deleter(gearman_worker_st *ptr) noexcept {
 }
 
 GearmanClient::GearmanClient(ThreadRegistryPtr registry, MetricProxyPoolWrapperPtr metrics, const StringSet &server_list,
-                             const StringSet &jobs_list, const std::string &uri)
+                             const StringSet &jobs_list, const std::string &uri,
+                             PoolContextPtr pool_context)
                              : m_registry(registry)
                              , m_metrics(metrics)
                              , m_http_uri(uri)
-                             , m_worker_ptr(gearman_worker_create(nullptr), gearman_client_deleter)
+                             , m_worker()
                              , m_json_parser(nullptr)
+                             , m_pool_context(pool_context)
+                             , m_job_queue(pool_context ? pool_context->jobQueue() : nullptr)
+                             , m_breaker_probe(false)
+                             , m_concurrency_slot(false)
+                             , m_rate_limit_token(false)
+                             , m_server_list(server_list)
+                             , m_jobs_list(jobs_list)
+                             , m_config_generation(0)
+                             , m_throttled_functions()
+                             , m_function_tokens()
+                             , m_shard_slot(0)
+                             , m_shard_rotation(0)
+                             , m_sharded(false)
+                             , m_ready(false)
                              , m_state(State::INIT) {
     LOG4CXX_DEBUG(ThreadLogger, "Starting GearmanClient");
-    if (m_worker_ptr.get() == nullptr) {
-        throw std::bad_alloc();
+    // A pool's jobs and URI come from one snapshot with its generation, so a
+    // reconfigure landing while the thread starts is neither half applied nor missed
+    if (m_pool_context) {
+        PoolConfigSnapshotPtr config = m_pool_context->config();
+        m_jobs_list = config->jobs_list;
+        m_http_uri = config->uri;
+        m_config_generation = config->generation;
     }
 
-    gearman_worker_add_options(m_worker_ptr.get(), GEARMAN_WORKER_NON_BLOCKING);
-    gearman_worker_set_timeout(m_worker_ptr.get(), GEARMAND_RESPONSE_TIMEOUT * 1000);
-
-    for (auto& server : server_list) {
-        if (gearman_worker_add_servers(m_worker_ptr.get(), server.c_str()) != GEARMAN_SUCCESS) {
-            throw GearmanClientException("Unable to add server: " + server, true);
-        }
+    if (m_job_queue == nullptr && m_pool_context && m_pool_context->options()->servers_per_thread > 0) {
+        m_shard_slot = m_pool_context->acquireShardSlot();
+        m_sharded = true;
     }
 
-    for (auto& job : jobs_list) {
-        if (gearman_worker_add_function(m_worker_ptr.get(), job.c_str(), 0, &worker_callback, this) != GEARMAN_SUCCESS) {
-            throw GearmanClientException("Unable to add job: " + job, true);
-        }
+    try {
+        connect();
+    } catch (...) {
+        releaseShardSlot();
+        throw;
     }
 
     Json::CharReaderBuilder jsonfactory;
@@ -157,14 +210,448 @@ GearmanClient::GearmanClient(ThreadRegistryPtr registry, MetricProxyPoolWrapperP
 }
 
 GearmanClient::~GearmanClient() {
+    releasePermits();
+    releaseShardSlot();
     m_metrics->reportThreadEnded();
 }
 
+// Throws a retriable GearmanClientException if the servers or functions cannot be added
+void GearmanClient::connect() {
+    // With a fetch queue this worker only runs jobs and never talks to gearmand
+    if (m_job_queue) {
+        return;
+    }
+
+    if (m_pool_context && m_pool_context->options()->worker_protocol == WorkerProtocol::NATIVE) {
+        m_worker.reset(new NativeGearmanWorker(
+            [this](const FetchedJob& job, std::string& result) { return processJob(job, result); },
+            GEARMAND_RESPONSE_TIMEOUT * 1000, "driveshaft-" + m_pool_context->poolName(),
+            m_pool_context->options()->gearmand_probe));
+    } else {
+        m_worker.reset(new LibgearmanWorker(this, GEARMAND_RESPONSE_TIMEOUT * 1000));
+    }
+
+    for (auto& server : serverShard()) {
+        if (m_worker->addServers(server) != GEARMAN_SUCCESS) {
+            throw GearmanClientException("Unable to add server: " + server, true);
+        }
+    }
+
+    for (auto& job : m_jobs_list) {
+        if (m_worker->addFunction(job) != GEARMAN_SUCCESS) {
+            throw GearmanClientException("Unable to add job: " + job, true);
+        }
+    }
+}
+
+/* Tells the registry the thread is ready once gearmand has answered it, or
+ * for an executor once the pool's fetchers have heard from gearmand. Both
+ * libgearman and the native worker only connect when work() first runs, so
+ * having added the servers proves nothing.
+ */
+void GearmanClient::checkReady() noexcept {
+    if (m_ready) {
+        return;
+    }
+
+    if (answered()) {
+        m_registry->setThreadReady();
+        m_ready = true;
+    }
+}
+
+// An executor goes by the pool's fetchers, which are the ones talking to gearmand
+bool GearmanClient::answered() const noexcept {
+    return m_job_queue ? m_job_queue->connected() : m_worker && m_worker->answered();
+}
+
+/* Switches to a jobs list or URI pushed to the pool since the last job.
+ * Functions are registered and unregistered on the live connection, so the
+ * thread carries on without reconnecting. If gearmand refuses, the retriable
+ * error makes the reconnect register the new list from scratch.
+ */
+void GearmanClient::applyPoolConfig() {
+    if (!m_pool_context || m_pool_context->configGeneration() == m_config_generation) {
+        return;
+    }
+
+    PoolConfigSnapshotPtr config = m_pool_context->config();
+    LOG4CXX_INFO(ThreadLogger, "Applying pool config generation " << config->generation);
+    StringSet old_jobs_list;
+    old_jobs_list.swap(m_jobs_list);
+    m_jobs_list = config->jobs_list;
+    m_http_uri = config->uri;
+    m_config_generation = config->generation;
+
+    // Executors have no functions registered
+    if (!m_worker) {
+        return;
+    }
+
+    for (const auto& job : old_jobs_list) {
+        // A throttled function is already unregistered
+        if (m_jobs_list.count(job) == 0 && m_throttled_functions.erase(job) == 0 &&
+            m_worker->removeFunction(job) != GEARMAN_SUCCESS) {
+            throw GearmanClientException("Unable to remove job: " + job, true);
+        }
+    }
+
+    for (const auto& job : m_jobs_list) {
+        if (old_jobs_list.count(job) == 0 && m_worker->addFunction(job) != GEARMAN_SUCCESS) {
+            throw GearmanClientException("Unable to add job: " + job, true);
+        }
+    }
+}
+
+/* Drops this thread's gearmand connections after run() threw a retriable
+ * error, and hands back what it held of the pool's limits so other threads
+ * can use them while this one backs off.
+ */
+void GearmanClient::disconnect() noexcept {
+    releasePermits();
+    m_worker.reset();
+    m_throttled_functions.clear();
+    m_state = State::INIT;
+}
+
+void GearmanClient::reconnect() {
+    LOG4CXX_INFO(ThreadLogger, "Reconnecting to gearmand");
+    m_metrics->reportReconnect();
+    disconnect();
+    m_shard_rotation++; // Its servers may be the ones that failed
+    connect();
+    m_state = State::GRAB_JOB;
+}
+
+/* The servers this thread connects to. A sharded pool spreads its threads
+ * over servers_per_thread servers each, rather than connecting every thread to
+ * every server.
+ */
+std::vector<std::string> GearmanClient::serverShard() const {
+    if (!m_sharded) {
+        return std::vector<std::string>(m_server_list.begin(), m_server_list.end());
+    }
+
+    auto shard = shard_gearman_servers(expand_gearman_servers(m_server_list),
+                                       m_pool_context->options()->servers_per_thread,
+                                       m_shard_slot, m_shard_rotation);
+    LOG4CXX_DEBUG(ThreadLogger, "Shard slot " << m_shard_slot << " connects to " << shard.size() << " servers");
+    return shard;
+}
+
+void GearmanClient::releaseShardSlot() noexcept {
+    if (m_sharded) {
+        m_pool_context->releaseShardSlot(m_shard_slot);
+        m_sharded = false;
+    }
+}
+
+void GearmanClient::releasePermits() noexcept {
+    if (m_breaker_probe) {
+        m_pool_context->circuitBreaker()->release(true);
+        m_breaker_probe = false;
+    }
+    if (m_concurrency_slot) {
+        m_pool_context->concurrencyLimiter()->release();
+        m_concurrency_slot = false;
+    }
+    giveBackRateLimitTokens();
+}
+
+/* false means the breaker is open. The caller should not grab a job; this has
+ * already waited out part of the open period so the thread does not spin.
+ */
+bool GearmanClient::acquireCircuitPermit() noexcept {
+    CircuitBreaker *breaker = m_pool_context ? m_pool_context->circuitBreaker() : nullptr;
+    if (breaker == nullptr || m_breaker_probe) {
+        return true;
+    }
+
+    if (breaker->tryAcquire(m_breaker_probe)) {
+        return true;
+    }
+
+    // Wake up at least every loop timeout so ThreadLoop can check for shutdown
+    auto delay = std::min(breaker->retryDelay(),
+                          std::chrono::milliseconds(GEARMAND_RESPONSE_TIMEOUT * 1000));
+    LOG4CXX_DEBUG(ThreadLogger, "Circuit breaker is " << CircuitBreaker::stateName(breaker->state())
+                                << ". Not grabbing jobs for " << delay.count() << "ms");
+    std::this_thread::sleep_for(delay);
+    return false;
+}
+
+/* false means the pool is paused for backpressure. Like acquireCircuitPermit,
+ * this has already slept through part of the pause.
+ */
+bool GearmanClient::waitForBackpressure() noexcept {
+    Backpressure *backpressure = m_pool_context ? m_pool_context->backpressure() : nullptr;
+    if (backpressure == nullptr) {
+        return true;
+    }
+
+    auto remaining = backpressure->pausedFor();
+    if (remaining.count() <= 0) {
+        return true;
+    }
+
+    auto delay = std::min(remaining, std::chrono::milliseconds(GEARMAND_RESPONSE_TIMEOUT * 1000));
+    LOG4CXX_DEBUG(ThreadLogger, "Endpoint is overloaded. Not grabbing jobs for " << delay.count() << "ms");
+    std::this_thread::sleep_for(delay);
+    return false;
+}
+
+/* false means the pool is at its concurrency limit and this worker should
+ * idle. A worker keeps its slot between jobs and only gives it up when the
+ * limit drops below the number of workers holding one.
+ */
+bool GearmanClient::acquireConcurrencySlot() noexcept {
+    ConcurrencyLimiter *limiter = m_pool_context ? m_pool_context->concurrencyLimiter() : nullptr;
+    if (limiter == nullptr) {
+        return true;
+    }
+
+    if (m_concurrency_slot) {
+        if (!limiter->tryShed()) {
+            return true;
+        }
+        m_concurrency_slot = false;
+        LOG4CXX_DEBUG(ThreadLogger, "Pool is over its concurrency limit of " << limiter->limit() << ". Idling");
+    } else if (limiter->tryAcquire()) {
+        m_concurrency_slot = true;
+        return true;
+    }
+
+    std::this_thread::sleep_for(std::min(std::chrono::milliseconds(CONCURRENCY_IDLE_WAIT_MS),
+                                         std::chrono::milliseconds(GEARMAND_RESPONSE_TIMEOUT * 1000)));
+    return false;
+}
+
+/* false means the pool is out of rate limit tokens. A grab may return a job
+ * of any registered function, so each registered function with a bucket
+ * gives a token up front, the way the pool's does, and no burst outruns a
+ * bucket however many threads grab at once. Functions whose bucket is empty
+ * are unregistered from gearmand instead, so the worker keeps grabbing jobs
+ * for the rest. They are registered again once their bucket is half full,
+ * not after every token. run() gives back the tokens no job came of.
+ */
+bool GearmanClient::acquireRateLimitToken() noexcept {
+    if (!m_pool_context) {
+        return true;
+    }
+
+    auto shortest_wait = std::chrono::nanoseconds::max();
+    std::string shortest_wait_function;
+    for (const auto& i : m_pool_context->functionRateLimiters()) {
+        const std::string& function_name = i.first;
+        TokenBucket *function_bucket = i.second.get();
+        // Executors have no functions registered. runQueuedJob waits on the bucket instead
+        if (m_job_queue || m_jobs_list.count(function_name) == 0) {
+            continue;
+        }
+
+        std::chrono::nanoseconds wait;
+        if (m_throttled_functions.count(function_name) > 0) {
+            wait = function_bucket->waitTime((function_bucket->burst() + 1) / 2);
+            if (wait.count() > 0 || m_worker->addFunction(function_name) != GEARMAN_SUCCESS) {
+                if (wait < shortest_wait) {
+                    shortest_wait = wait;
+                    shortest_wait_function = function_name;
+                }
+                continue;
+            }
+            m_throttled_functions.erase(function_name);
+        }
+
+        if (function_bucket->tryTake()) {
+            m_function_tokens.insert(function_name);
+            continue;
+        }
+
+        if (m_worker->removeFunction(function_name) == GEARMAN_SUCCESS) {
+            m_throttled_functions.insert(function_name);
+        }
+        wait = function_bucket->waitTime();
+        if (wait < shortest_wait) {
+            shortest_wait = wait;
+            shortest_wait_function = function_name;
+        }
+    }
+
+    if (!m_throttled_functions.empty() && m_throttled_functions.size() == m_jobs_list.size()) {
+        throttle(shortest_wait, shortest_wait_function);
+        return false;
+    }
+
+    TokenBucket *bucket = m_pool_context->rateLimiter();
+    if (bucket == nullptr) {
+        return true;
+    }
+
+    if (!bucket->tryTake()) {
+        giveBackRateLimitTokens();
+        throttle(bucket->waitTime(), "pool");
+        return false;
+    }
+
+    m_rate_limit_token = true;
+    return true;
+}
+
+void GearmanClient::giveBackRateLimitTokens() noexcept {
+    if (m_rate_limit_token) {
+        m_pool_context->rateLimiter()->giveBack();
+        m_rate_limit_token = false;
+    }
+    for (const auto& function_name : m_function_tokens) {
+        TokenBucket *bucket = m_pool_context->functionRateLimiter(function_name);
+        if (bucket) {
+            bucket->giveBack();
+        }
+    }
+    m_function_tokens.clear();
+}
+
+// Fetchers and reactors stop grabbing for the queue while its executors cannot run jobs
+void GearmanClient::holdJobQueue(bool held) noexcept {
+    if (m_job_queue && m_job_queue->held() != held) {
+        LOG4CXX_DEBUG(ThreadLogger, (held ? "Holding" : "Releasing") << " the fetch queue");
+        m_job_queue->setHeld(held);
+    }
+}
+
+void GearmanClient::throttle(std::chrono::nanoseconds wait, const std::string& limit_name) noexcept {
+    auto delay = std::min(std::chrono::duration_cast<std::chrono::milliseconds>(wait) + std::chrono::milliseconds(1),
+                          std::chrono::milliseconds(GEARMAND_RESPONSE_TIMEOUT * 1000));
+    LOG4CXX_DEBUG(ThreadLogger, "Rate limit " << limit_name << " is exhausted. Not grabbing jobs for "
+                                << delay.count() << "ms");
+    std::this_thread::sleep_for(delay);
+    m_metrics->reportThrottled(limit_name, delay.count() / 1000.0);
+}
+
+// Feeds every attempt, retried or not, to the pool's backpressure state
+void GearmanClient::reportEndpointLoad(CURLcode curlrc, long http_code, long retry_after,
+                                       std::chrono::milliseconds latency) noexcept {
+    Backpressure *backpressure = m_pool_context ? m_pool_context->backpressure() : nullptr;
+    if (backpressure == nullptr || curlrc != CURLE_OK) {
+        return;
+    }
+
+    if (http_code == 429 || http_code == 503) {
+        backpressure->reportOverload(retry_after >= 0 ? retry_after * 1000 : -1);
+    } else if (http_code >= 200 && http_code < 300) {
+        backpressure->reportResponse(latency);
+    }
+}
+
+void GearmanClient::reportEndpointOutcome(EndpointOutcome outcome, std::chrono::milliseconds latency) noexcept {
+    ConcurrencyLimiter *limiter = m_pool_context ? m_pool_context->concurrencyLimiter() : nullptr;
+    if (limiter != nullptr) {
+        if (outcome == EndpointOutcome::HEALTHY) {
+            limiter->recordSuccess(latency);
+        } else if (outcome == EndpointOutcome::UNHEALTHY) {
+            limiter->recordDrop();
+        }
+    }
+
+    CircuitBreaker *breaker = m_pool_context ? m_pool_context->circuitBreaker() : nullptr;
+    if (breaker == nullptr) {
+        return;
+    }
+
+    switch (outcome) {
+    case EndpointOutcome::NOT_CONTACTED:
+        breaker->release(m_breaker_probe);
+        break;
+    case EndpointOutcome::HEALTHY:
+        breaker->recordSuccess(m_breaker_probe);
+        break;
+    case EndpointOutcome::UNHEALTHY:
+        breaker->recordFailure(m_breaker_probe);
+        break;
+    }
+
+    m_breaker_probe = false;
+}
+
 using std::chrono::high_resolution_clock;
 using std::chrono::duration;
 using std::chrono::duration_cast;
 
+/* Connect failures never reached the endpoint, and 502/503/504/429 mean it
+ * could not take the job right now. Both are worth another try.
+ */
+static bool is_transient_failure(CURLcode curlrc, long http_code) noexcept {
+    if (curlrc != CURLE_OK) {
+        return curlrc == CURLE_COULDNT_CONNECT || curlrc == CURLE_COULDNT_RESOLVE_HOST;
+    }
+
+    return http_code == 502 || http_code == 503 || http_code == 504 || http_code == 429;
+}
+
+/* delay is only set when the answer is true */
+bool GearmanClient::shouldRetry(const char *function_name, uint32_t attempt, CURLcode curlrc, long http_code,
+                                long retry_after, high_resolution_clock::time_point start,
+                                std::chrono::milliseconds& delay) noexcept {
+    if (!m_pool_context || g_force_shutdown || !is_transient_failure(curlrc, http_code)) {
+        return false;
+    }
+
+    PoolOptionsPtr options = m_pool_context->options();
+    const RetryOptions& retry = options->retryOptions(function_name);
+    if (attempt >= retry.max_attempts) {
+        return false;
+    }
+
+    // No point hammering an endpoint the pool has given up on
+    CircuitBreaker *breaker = m_pool_context->circuitBreaker();
+    if (breaker && breaker->state() == CircuitBreaker::State::OPEN) {
+        return false;
+    }
+
+    // Retry-After is honoured, but no further than the pool's own backoff would go
+    delay = (retry_after >= 0) ? std::min(std::chrono::milliseconds(retry_after * 1000),
+                                          std::chrono::milliseconds(retry.max_backoff_ms))
+                               : retry_backoff(retry, attempt);
+
+    if (high_resolution_clock::now() + delay >= start + std::chrono::seconds(MAX_JOB_RUNNING_TIME)) {
+        LOG4CXX_INFO(ThreadLogger, "Not retrying: a " << delay.count() << "ms backoff would exceed the job's deadline");
+        m_metrics->reportJobRetryDenied(function_name, "deadline");
+        return false;
+    }
+
+    RetryBudget *budget = m_pool_context->retryBudget();
+    if (budget && !budget->tryRetry()) {
+        LOG4CXX_INFO(ThreadLogger, "Not retrying: retry budget for the pool is exhausted");
+        m_metrics->reportJobRetryDenied(function_name, "budget");
+        return false;
+    }
+
+    return true;
+}
+
+/* Sleeps before the next attempt at a job in slices, like ThreadLoop::run
+ * between reconnects, so a hard shutdown does not wait out the backoff. A
+ * graceful drain or a shrinking pool lets the job have its attempts. false
+ * if it was cut short.
+ */
+bool GearmanClient::waitBeforeRetry(std::chrono::milliseconds delay) noexcept {
+    auto deadline = std::chrono::steady_clock::now() + delay;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (g_force_shutdown) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+            deadline - std::chrono::steady_clock::now(), RETRY_SHUTDOWN_CHECK_INTERVAL));
+    }
+    return true;
+}
+
 gearman_return_t GearmanClient::processJob(gearman_job_st *job_ptr, std::string& return_string) noexcept {
+    LibgearmanJob job(job_ptr, nullptr);
+    return processJob(job, return_string);
+}
+
+gearman_return_t GearmanClient::processJob(const FetchedJob& job, std::string& return_string) noexcept {
     CURL *curl;
     CURLcode curlrc;
     CURLFORMcode formerror;
@@ -172,13 +659,17 @@ gearman_return_t GearmanClient::processJob(gearman_job_st *job_ptr, std::string&
     struct curl_httppost *lastptr = nullptr;
     struct curl_slist *headerlist = nullptr;
     gearman_return_t gearman_ret = GEARMAN_SUCCESS;
+    EndpointOutcome endpoint_outcome = EndpointOutcome::NOT_CONTACTED;
+    long http_code = 0;
+    long retry_after = -1;
     high_resolution_clock::time_point hrc_start = high_resolution_clock::now();
     time_t start_ts = time(nullptr);
     StringstreamWriter raw_resp;
-    const char *job_function_name = static_cast<const char *>(gearman_job_function_name(job_ptr));
-    const char *job_handle = static_cast<const char *>(gearman_job_handle(job_ptr));
-    const char *job_unique = static_cast<const char *>(gearman_job_unique(job_ptr));
-    std::string job_workload(static_cast<const char *>(gearman_job_workload(job_ptr)), gearman_job_workload_size(job_ptr));
+    const char *job_function_name = job.functionName();
+    const char *job_handle = job.handle();
+    const char *job_unique = job.unique();
+    const char *job_workload = job.workload();
+    size_t job_workload_size = job.workloadSize();
     char error_buf[CURL_ERROR_SIZE];
     error_buf[0] = 0;
 
@@ -186,9 +677,16 @@ gearman_return_t GearmanClient::processJob(gearman_job_st *job_ptr, std::string&
     // The cURL documentation also recommends it in their examples: http://curl.haxx.se/libcurl/c/postit2.html
     static const char expect_buf[] = "Expect:";
 
-    m_registry->setThreadState(std::this_thread::get_id(), std::string().append("job_handle=").append(job_handle).append(" job_unique=").append(job_unique));
+    m_registry->setThreadJob(job_handle, job_unique);
     m_metrics->reportThreadStartingWork(job_function_name);
 
+    // The job spends the pool token taken before the grab and one of its function's
+    m_rate_limit_token = false;
+    if (m_function_tokens.erase(job_function_name) == 0 && m_pool_context &&
+        m_pool_context->functionRateLimiter(job_function_name)) {
+        m_pool_context->functionRateLimiter(job_function_name)->take();
+    }
+
     curl = curl_easy_init();
     if (!curl) {
         LOG4CXX_ERROR(ThreadLogger, "Unable to open curl handle.");
@@ -256,11 +754,19 @@ gearman_return_t GearmanClient::processJob(gearman_job_st *job_ptr, std::string&
         LOG4CXX_ERROR(ThreadLogger, "Unable to set errorbuffer");
         goto error;
     }
+    if (curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &curl_header_func) != 0) {
+        LOG4CXX_ERROR(ThreadLogger, "Unable to set header function");
+        goto error;
+    }
+    if (curl_easy_setopt(curl, CURLOPT_HEADERDATA, &retry_after) != 0) {
+        LOG4CXX_ERROR(ThreadLogger, "Unable to set header data");
+        goto error;
+    }
 
 
     /* Post data */
     LOG4CXX_INFO(ThreadLogger, "Starting job: function=" << job_function_name << " handle=" << job_handle << " unique=" << job_unique
-                               << " workload=" << job_workload);
+                               << " workload=" << std::string(job_workload, job_workload_size));
 
     if ((formerror = curl_formadd(&formpost, &lastptr, CURLFORM_PTRNAME, "function_name", CURLFORM_PTRCONTENTS, job_function_name, CURLFORM_END)) != 0) {
         LOG4CXX_ERROR(ThreadLogger, "Unable to add function_name to post: " << formerror);
@@ -275,7 +781,7 @@ gearman_return_t GearmanClient::processJob(gearman_job_st *job_ptr, std::string&
         goto error;
     }
     // The length is pulled separately in case there's a NULL byte in the workload.
-    if ((formerror = curl_formadd(&formpost, &lastptr, CURLFORM_PTRNAME, "workload", CURLFORM_PTRCONTENTS, job_workload.c_str(), CURLFORM_CONTENTSLENGTH, job_workload.size(), CURLFORM_END)) != 0) {
+    if ((formerror = curl_formadd(&formpost, &lastptr, CURLFORM_PTRNAME, "workload", CURLFORM_PTRCONTENTS, job_workload, CURLFORM_CONTENTSLENGTH, job_workload_size, CURLFORM_END)) != 0) {
         LOG4CXX_ERROR(ThreadLogger, "Unable to add workload to post: " << formerror);
         goto error;
     }
@@ -284,18 +790,55 @@ gearman_return_t GearmanClient::processJob(gearman_job_st *job_ptr, std::string&
         LOG4CXX_ERROR(ThreadLogger, "Unable to set form POST data");
         goto error;
     }
-    /* Do it! */
-    curlrc = curl_easy_perform(curl);
+    /* Do it! Transient endpoint failures are retried here rather than
+     * failing the job back through gearmand. */
+    if (m_pool_context && m_pool_context->retryBudget()) {
+        m_pool_context->retryBudget()->recordJob();
+    }
+
+    for (uint32_t attempt = 1; ; attempt++) {
+        retry_after = -1;
+        http_code = 0;
+        auto attempt_start = high_resolution_clock::now();
+        curlrc = curl_easy_perform(curl);
+        if (curlrc == CURLE_OK) {
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        }
+        reportEndpointLoad(curlrc, http_code, retry_after,
+                           duration_cast<std::chrono::milliseconds>(high_resolution_clock::now() - attempt_start));
+
+        std::chrono::milliseconds delay;
+        if (!shouldRetry(job_function_name, attempt, curlrc, http_code, retry_after, hrc_start, delay)) {
+            break;
+        }
+
+        LOG4CXX_INFO(ThreadLogger, "Retrying job: function=" << job_function_name << " handle=" << job_handle
+                                   << " after attempt " << attempt << " failed with curl error " << curlrc
+                                   << " and HTTP code " << http_code << ". Waiting " << delay.count() << "ms");
+        m_metrics->reportJobRetry(job_function_name);
+        if (!waitBeforeRetry(delay)) {
+            LOG4CXX_INFO(ThreadLogger, "Shutting down. Failing job with handle " << job_handle << " instead of retrying it");
+            break;
+        }
+        raw_resp.clear();
+    }
+
     if (curlrc != CURLE_OK) {
         LOG4CXX_ERROR(ThreadLogger, "Failed to perform curl. Error: " << curl_easy_strerror(curlrc) << " Message: " << error_buf);
         if (curlrc == CURLE_ABORTED_BY_CALLBACK) {
             m_metrics->reportJobTimeout(job_function_name);
         }
+        // A shutdown abort says nothing about the endpoint's health
+        if (!g_force_shutdown) {
+            endpoint_outcome = EndpointOutcome::UNHEALTHY;
+        }
         goto error;
     } else {
         /* check HTTP response code */
-        long http_code = 0;
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        // 5xx and 429 mean the endpoint is down or overloaded. Anything else
+        // means it is up, even if this job failed.
+        endpoint_outcome = (http_code >= 500 || http_code == 429) ? EndpointOutcome::UNHEALTHY
+                                                                  : EndpointOutcome::HEALTHY;
         if (http_code != 200) {
             LOG4CXX_ERROR(ThreadLogger, "Invalid HTTP response code. Expecting 200, got " << http_code);
             m_metrics->reportJobHttpError(job_function_name, http_code);
@@ -331,7 +874,7 @@ gearman_return_t GearmanClient::processJob(gearman_job_st *job_ptr, std::string&
         m_metrics->reportJobSuccess(job_function_name, delay.count());
 
         LOG4CXX_INFO(ThreadLogger, "Finished job: function=" << job_function_name << " handle=" << job_handle << " unique=" << job_unique
-                                   << " workload=" << job_workload
+                                   << " workload=" << std::string(job_workload, job_workload_size)
                                    << " return_code=" << gearman_ret << " response_string=" << return_string);
 
         goto cleanup;
@@ -341,12 +884,65 @@ error:
     gearman_ret = GEARMAN_WORK_FAIL;
     m_metrics->reportJobError(job_function_name);
 cleanup:
+    reportEndpointOutcome(endpoint_outcome,
+                          duration_cast<std::chrono::milliseconds>(high_resolution_clock::now() - hrc_start));
     curl_easy_cleanup(curl);
     curl_formfree(formpost);
     curl_slist_free_all(headerlist);
     return gearman_ret;
 }
 
+/* Runs the next job the pool's fetchers grabbed, if one turns up within the
+ * loop timeout, and hands the outcome back to whatever grabbed it.
+ */
+void GearmanClient::runQueuedJob() noexcept {
+    // Until the fetchers have heard from gearmand, wake up now and then to notice when they do
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(GEARMAND_RESPONSE_TIMEOUT);
+    FetchedJob *fetched = nullptr;
+    bool popped = false;
+    do {
+        checkReady();
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (!m_ready) {
+            timeout = std::min(timeout, std::chrono::milliseconds(EXECUTOR_READY_CHECK_MS));
+        }
+        popped = m_job_queue->pop(fetched, timeout);
+    } while (!popped && std::chrono::steady_clock::now() < deadline);
+    checkReady();
+
+    if (!popped) {
+        giveBackRateLimitTokens(); // No job came of it
+        return;
+    }
+
+    if (fetched->stale()) {
+        // Its connection dropped while it was queued, so gearmand already gave it to another worker
+        LOG4CXX_INFO(ThreadLogger, "Skipping job " << fetched->handle() << " requeued by gearmand");
+        fetched->source->abandon(fetched);
+        giveBackRateLimitTokens();
+        return;
+    }
+
+    const char *function_name = fetched->functionName();
+    TokenBucket *bucket = m_pool_context->functionRateLimiter(function_name);
+    while (bucket && !g_force_shutdown) {
+        if (bucket->tryTake()) {
+            m_function_tokens.insert(function_name);
+            break;
+        }
+        throttle(bucket->waitTime(), function_name);
+    }
+
+    fetched->ret = processJob(*fetched, fetched->result);
+    if (fetched->ret != GEARMAN_SUCCESS) {
+        LOG4CXX_INFO(ThreadLogger, "Job failed with error " << fetched->ret);
+    }
+    fetched->source->complete(fetched);
+
+    m_metrics->reportThreadWorkComplete();
+    m_registry->setThreadState(ThreadState::WAITING_FOR_WORK);
+}
+
 void GearmanClient::run() {
     while (true) {
         switch (m_state) {
@@ -355,7 +951,39 @@ void GearmanClient::run() {
 
         case State::GRAB_JOB:
         {
-            auto ret = gearman_worker_work(m_worker_ptr.get());
+            if (m_registry->shouldShutdown()) {
+                return; // The pool is shrinking. Leave the next job to a thread that stays
+            }
+
+            applyPoolConfig();
+
+            if (!waitForBackpressure()) {
+                holdJobQueue(true);
+                return; // The endpoint asked us to slow down
+            }
+
+            if (!acquireConcurrencySlot()) {
+                return; // Enough workers of this pool are already grabbing jobs
+            }
+
+            if (!acquireCircuitPermit()) {
+                holdJobQueue(true);
+                return; // The endpoint is unhealthy. Leave jobs queued in gearmand for now
+            }
+
+            if (!acquireRateLimitToken()) {
+                holdJobQueue(true);
+                return; // Out of tokens. Jobs wait in gearmand until the bucket refills
+            }
+
+            if (m_job_queue) {
+                holdJobQueue(false);
+                return runQueuedJob(); // The pool's fetchers talk to gearmand
+            }
+
+            auto ret = m_worker->work();
+            checkReady();
+            giveBackRateLimitTokens(); // Those no job came of
             switch(ret) {
             case GEARMAN_IO_WAIT:
             case GEARMAN_NO_JOBS:
@@ -372,20 +1000,20 @@ void GearmanClient::run() {
                 /* fall through */
             case GEARMAN_SUCCESS:
                 m_metrics->reportThreadWorkComplete();
-                m_registry->setThreadState(std::this_thread::get_id(), std::string("Waiting for work"));
+                m_registry->setThreadState(ThreadState::WAITING_FOR_WORK);
                 return; // The caller should decide whether to get more jobs or do other things
 
             case GEARMAN_TIMEOUT:
             case GEARMAN_NOT_CONNECTED:
             {
-                const char *gearman_error = gearman_worker_error(m_worker_ptr.get());
+                const char *gearman_error = m_worker->error();
                 throw GearmanClientException(std::string("Timeout/disconnected from work(). Error: ") +
                                                 std::string(gearman_error ?: "No details"),
-                                             false);
+                                             true);
             }
             default:
             {
-                const char *gearman_error = gearman_worker_error(m_worker_ptr.get());
+                const char *gearman_error = m_worker->error();
                 throw GearmanClientException(std::string("Unexpected return code from work(): ") +
                                                 std::to_string(ret) + ". Details: " +
                                                 std::string(gearman_error ?: "No details"),
@@ -398,7 +1026,7 @@ void GearmanClient::run() {
 
         case State::POLL:
         {
-            auto ret = gearman_worker_wait(m_worker_ptr.get());
+            auto ret = m_worker->wait();
             switch (ret) {
             case GEARMAN_SUCCESS:
                 m_state = State::GRAB_JOB;
@@ -408,7 +1036,7 @@ void GearmanClient::run() {
                 return; // The caller should decide whether to wait() or do other things
 
             case GEARMAN_NO_ACTIVE_FDS:
-                throw GearmanClientException(std::string("Looks like all gearmand went away"), false);
+                throw GearmanClientException(std::string("Looks like all gearmand went away"), true);
 
             default:
                 throw GearmanClientException(std::string("Unexpected return code from wait()") + std::to_string(ret), false);
@@ -28,10 +28,13 @@
 
 #include <exception>
 #include <memory>
+#include <chrono>
 #include <libgearman-1.0/gearman.h>
 #include "common-defs.h"
 #include "thread-registry.h"
 #include "metric-proxy.h"
+#include "pool-context.h"
+#include "gearman-worker.h"
 #include "dist/json/json.h"
 #include <curl/curl.h>
 
@@ -44,6 +47,7 @@ size_t curl_write_func(char *ptr, size_t size, size_t nmemb, void *userdata) noe
 int curl_progress_func(void *p, double dltotal, double dlnow,
                        double ultotal, double ulnow) noexcept;
 int curl_set_sockopt(void *unused1, curl_socket_t curlfd, curlsocktype unused2) noexcept;
+size_t curl_header_func(char *buffer, size_t size, size_t nitems, void *userdata) noexcept;
 
 void gearman_client_deleter(gearman_worker_st *ptr) noexcept;
 
@@ -56,12 +60,19 @@ public:
 
 class GearmanClient {
 public:
+    // jobs_list and uri only apply without a pool_context, whose current config wins
     GearmanClient(ThreadRegistryPtr registry, std::shared_ptr<MetricProxyPoolWrapper> metrics, const StringSet &server_list,
-                  const StringSet &jobs_list, const std::string &uri);
+                  const StringSet &jobs_list, const std::string &uri,
+                  PoolContextPtr pool_context = PoolContextPtr());
     virtual ~GearmanClient();
 
     void run();
+    void disconnect() noexcept;
+    void reconnect();
+    // true once gearmand has answered the current connections
+    bool answered() const noexcept;
     gearman_return_t processJob(gearman_job_st *job_ptr, std::string& data) noexcept;
+    gearman_return_t processJob(const FetchedJob& job, std::string& data) noexcept;
 
 private:
     GearmanClient() = delete;
@@ -70,11 +81,54 @@ private:
     GearmanClient& operator=(const GearmanClient&) = delete;
     GearmanClient& operator=(const GearmanClient&&) = delete;
 
+    // How the endpoint behaved for a job, as far as pool-wide health goes
+    enum class EndpointOutcome {
+        NOT_CONTACTED,
+        HEALTHY,
+        UNHEALTHY
+    };
+
+    void connect();
+    void checkReady() noexcept;
+    void applyPoolConfig();
+    std::vector<std::string> serverShard() const;
+    void releaseShardSlot() noexcept;
+    void releasePermits() noexcept;
+    bool acquireCircuitPermit() noexcept;
+    bool waitForBackpressure() noexcept;
+    bool acquireConcurrencySlot() noexcept;
+    bool acquireRateLimitToken() noexcept;
+    void giveBackRateLimitTokens() noexcept;
+    void holdJobQueue(bool held) noexcept;
+    void throttle(std::chrono::nanoseconds wait, const std::string& limit_name) noexcept;
+    void runQueuedJob() noexcept;
+    void reportEndpointLoad(CURLcode curlrc, long http_code, long retry_after,
+                            std::chrono::milliseconds latency) noexcept;
+    bool shouldRetry(const char *function_name, uint32_t attempt, CURLcode curlrc, long http_code,
+                     long retry_after, std::chrono::high_resolution_clock::time_point start,
+                     std::chrono::milliseconds& delay) noexcept;
+    void reportEndpointOutcome(EndpointOutcome outcome, std::chrono::milliseconds latency) noexcept;
+    bool waitBeforeRetry(std::chrono::milliseconds delay) noexcept;
+
     ThreadRegistryPtr m_registry;
     MetricProxyPoolWrapperPtr m_metrics;
-    const std::string& m_http_uri;
-    std::unique_ptr<gearman_worker_st, decltype(&gearman_client_deleter)> m_worker_ptr;
+    std::string m_http_uri;
+    GearmanWorkerPtr m_worker; // unset when the pool's fetchers grab jobs for this worker
     std::unique_ptr<Json::CharReader> m_json_parser;
+    PoolContextPtr m_pool_context;
+    JobQueue *m_job_queue; // set when the pool's fetchers grab jobs for this worker
+    bool m_breaker_probe; // holding one of the breaker's half-open probe slots
+    bool m_concurrency_slot; // counted against the pool's concurrency limit
+    bool m_rate_limit_token; // taken from the pool's bucket for the next job
+    const StringSet m_server_list;
+    StringSet m_jobs_list;
+    uint64_t m_config_generation; // of the pool config snapshot the above came from
+    StringSet m_throttled_functions; // unregistered until their bucket refills
+    StringSet m_function_tokens; // functions whose bucket gave a token for the next job
+    uint32_t m_shard_slot; // which of the pool's server shards this thread connects to
+    uint32_t m_shard_rotation; // moves the shard along after each reconnect
+    bool m_sharded;
+    bool m_ready; // told the registry gearmand has answered this thread
     enum class State {
         INIT,
         GRAB_JOB,
@@ -0,0 +1,430 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sstream>
+#include "gearman-protocol.h"
+#include "retry-policy.h"
+
+namespace Driveshaft {
+
+static const char* GEARMAND_DEFAULT_PORT = "4730";
+static const char GEARMAN_REQUEST_MAGIC[] = {'\0', 'R', 'E', 'Q'};
+static const char GEARMAN_RESPONSE_MAGIC[] = {'\0', 'R', 'E', 'S'};
+
+static const int GEARMAN_KEEPALIVE_IDLE_SECONDS = 1;
+static const int GEARMAN_KEEPALIVE_INTERVAL_SECONDS = 1;
+static const int GEARMAN_KEEPALIVE_COUNT = 3;
+static const unsigned int GEARMAN_USER_TIMEOUT_MS = 3000;
+static const std::chrono::milliseconds GEARMAN_CONNECT_TIMEOUT(5000);
+static const uint32_t GEARMAN_RECONNECT_INITIAL_BACKOFF_MS = 100;
+static const uint32_t GEARMAN_RECONNECT_MAX_BACKOFF_MS = 30000;
+static const size_t GEARMAN_READ_SIZE = 64 * 1024;
+
+static void append_uint32(std::string& out, uint32_t value) {
+    uint32_t network = htonl(value);
+    out.append(reinterpret_cast<const char*>(&network), sizeof(network));
+}
+
+static uint32_t read_uint32(const char *buf) noexcept {
+    uint32_t network;
+    memcpy(&network, buf, sizeof(network));
+    return ntohl(network);
+}
+
+// How many arguments a response carries. The last one takes the rest of the data
+static size_t response_arg_count(GearmanPacketType type, size_t size) noexcept {
+    switch (type) {
+    case GearmanPacketType::JOB_ASSIGN:
+        return 3;
+    case GearmanPacketType::JOB_ASSIGN_UNIQ:
+        return 4;
+    case GearmanPacketType::ERROR:
+        return 2;
+    default:
+        return size > 0 ? 1 : 0;
+    }
+}
+
+void append_gearman_header(std::string& out, GearmanPacketType type, size_t size) {
+    out.append(GEARMAN_REQUEST_MAGIC, sizeof(GEARMAN_REQUEST_MAGIC));
+    append_uint32(out, static_cast<uint32_t>(type));
+    append_uint32(out, static_cast<uint32_t>(size));
+}
+
+void append_gearman_request(std::string& out, GearmanPacketType type,
+                            std::initializer_list<GearmanArg> args) {
+    size_t size = 0;
+    for (const auto& arg : args) {
+        size += arg.size;
+    }
+    size += args.size() == 0 ? 0 : args.size() - 1;
+
+    out.reserve(out.size() + GEARMAN_PACKET_HEADER_SIZE + size);
+    append_gearman_header(out, type, size);
+    bool first = true;
+    for (const auto& arg : args) {
+        if (!first) {
+            out.push_back('\0');
+        }
+        out.append(arg.data, arg.size);
+        first = false;
+    }
+}
+
+ssize_t parse_gearman_response(const char *buf, size_t len, GearmanPacket& packet) noexcept {
+    if (len < GEARMAN_PACKET_HEADER_SIZE) {
+        return 0;
+    }
+
+    if (memcmp(buf, GEARMAN_RESPONSE_MAGIC, sizeof(GEARMAN_RESPONSE_MAGIC)) != 0) {
+        return -1;
+    }
+
+    size_t size = read_uint32(buf + 8);
+    if (size > GEARMAN_MAX_PACKET_SIZE) {
+        return -1;
+    }
+    if (len < GEARMAN_PACKET_HEADER_SIZE + size) {
+        return 0;
+    }
+
+    packet.type = static_cast<GearmanPacketType>(read_uint32(buf + 4));
+    packet.arg_count = response_arg_count(packet.type, size);
+
+    const char *data = buf + GEARMAN_PACKET_HEADER_SIZE;
+    const char *end = data + size;
+    for (size_t i = 0; i < packet.arg_count; i++) {
+        const char *arg_end = end;
+        if (i + 1 < packet.arg_count) {
+            arg_end = static_cast<const char*>(memchr(data, '\0', end - data));
+            if (arg_end == nullptr) {
+                return -1;
+            }
+        }
+        packet.args[i] = GearmanArg(data, arg_end - data);
+        data = (arg_end == end) ? end : arg_end + 1;
+    }
+
+    return GEARMAN_PACKET_HEADER_SIZE + size;
+}
+
+void split_gearman_server(const std::string& server, std::string& host, std::string& port) noexcept {
+    port = GEARMAND_DEFAULT_PORT;
+    if (!server.empty() && server[0] == '[') {
+        // [ipv6]:port
+        auto end = server.find(']');
+        host = server.substr(1, end == std::string::npos ? std::string::npos : end - 1);
+        if (end != std::string::npos && end + 1 < server.size() && server[end + 1] == ':') {
+            port = server.substr(end + 2);
+        }
+        return;
+    }
+
+    auto colon = server.find(':');
+    if (colon != std::string::npos && server.find(':', colon + 1) == std::string::npos) {
+        host = server.substr(0, colon);
+        port = server.substr(colon + 1);
+    } else {
+        host = server;
+    }
+}
+
+std::vector<std::string> expand_gearman_servers(const StringSet& server_list) {
+    std::vector<std::string> servers;
+    for (const auto& entry : server_list) {
+        std::istringstream stream(entry);
+        std::string server;
+        while (std::getline(stream, server, ',')) {
+            if (!server.empty()) {
+                servers.push_back(server);
+            }
+        }
+    }
+    return servers;
+}
+
+std::vector<std::string> shard_gearman_servers(const std::vector<std::string>& servers, uint32_t count,
+                                               uint32_t slot, uint32_t rotation) {
+    if (count == 0 || count >= servers.size()) {
+        return servers;
+    }
+
+    std::vector<std::string> shard;
+    uint64_t start = uint64_t(slot) * count + rotation;
+    for (uint32_t i = 0; i < count; i++) {
+        shard.push_back(servers[(start + i) % servers.size()]);
+    }
+    return shard;
+}
+
+void set_gearman_socket_options(int fd) noexcept {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &GEARMAN_KEEPALIVE_IDLE_SECONDS, sizeof(int));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &GEARMAN_KEEPALIVE_INTERVAL_SECONDS, sizeof(int));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &GEARMAN_KEEPALIVE_COUNT, sizeof(int));
+#ifdef TCP_USER_TIMEOUT
+    setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &GEARMAN_USER_TIMEOUT_MS, sizeof(GEARMAN_USER_TIMEOUT_MS));
+#endif
+}
+
+GearmanLiveness::GearmanLiveness(const GearmanProbeOptions& options) noexcept
+    : m_interval(options.interval_ms)
+    , m_timeout(options.timeout_ms)
+    , m_last_heard(std::chrono::steady_clock::now())
+    , m_probe_sent()
+    , m_probing(false) {
+}
+
+void GearmanLiveness::heard(time_point now) noexcept {
+    m_last_heard = now;
+    m_probing = false;
+}
+
+GearmanLiveness::Action GearmanLiveness::check(time_point now) noexcept {
+    if (m_interval.count() == 0) {
+        return Action::NONE;
+    }
+    if (m_probing) {
+        return now >= m_probe_sent + m_timeout ? Action::DEAD : Action::NONE;
+    }
+
+    if (now >= m_last_heard + m_interval) {
+        m_probing = true;
+        m_probe_sent = now;
+        return Action::PROBE;
+    }
+    return Action::NONE;
+}
+
+// time_point::max() when probing is off
+GearmanLiveness::time_point GearmanLiveness::nextCheck() const noexcept {
+    if (m_interval.count() == 0) {
+        return time_point::max();
+    }
+    return m_probing ? m_probe_sent + m_timeout : m_last_heard + m_interval;
+}
+
+GearmanConnection::GearmanConnection(const std::string& server, const GearmanProbeOptions& probe, int epoll_fd,
+                                     LostCallback on_lost) noexcept
+    : server(server)
+    , fd(-1)
+    , state(State::DISCONNECTED)
+    , generation(0)
+    , failures(0)
+    , in_flight(0)
+    , deadline(std::chrono::steady_clock::now())
+    , in()
+    , out()
+    , out_sent(0)
+    , liveness(probe)
+    , m_epoll_fd(epoll_fd)
+    , m_on_lost(on_lost) {
+}
+
+GearmanConnection::~GearmanConnection() noexcept {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool GearmanConnection::connect() noexcept {
+    std::string host, port;
+    split_gearman_server(server, host, port);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addrs = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0) {
+        disconnect("unable to resolve");
+        return false;
+    }
+
+    for (auto ai = addrs; ai != nullptr && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+
+        // Even a connect that completes right away is finished once the socket is writable
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+
+    if (fd < 0) {
+        disconnect("unable to connect");
+        return false;
+    }
+
+    set_gearman_socket_options(fd);
+
+    if (m_epoll_fd >= 0) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = this;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            disconnect("unable to watch socket");
+            return false;
+        }
+    }
+
+    state = State::CONNECTING;
+    deadline = std::chrono::steady_clock::now() + GEARMAN_CONNECT_TIMEOUT;
+    return true;
+}
+
+bool GearmanConnection::finishConnect() noexcept {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        disconnect(std::string("connect failed: ") + strerror(error));
+        return false;
+    }
+
+    state = State::IDLE;
+    failures = 0;
+    liveness.heard(std::chrono::steady_clock::now());
+    return true;
+}
+
+void GearmanConnection::disconnect(const std::string& reason) noexcept {
+    m_on_lost(*this, reason);
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+
+    // gearmand requeues whatever this connection was running
+    generation++;
+    in_flight = 0;
+    state = State::DISCONNECTED;
+    RetryOptions backoff;
+    backoff.initial_backoff_ms = GEARMAN_RECONNECT_INITIAL_BACKOFF_MS;
+    backoff.max_backoff_ms = GEARMAN_RECONNECT_MAX_BACKOFF_MS;
+    deadline = std::chrono::steady_clock::now() + retry_backoff(backoff, ++failures);
+    in.clear();
+    out.clear();
+    out_sent = 0;
+}
+
+bool GearmanConnection::fill() noexcept {
+    char buffer[GEARMAN_READ_SIZE];
+    while (fd >= 0) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            in.append(buffer, n);
+            liveness.heard(std::chrono::steady_clock::now());
+        } else if (n == 0) {
+            disconnect("closed by server");
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        } else {
+            disconnect(std::string("read failed: ") + strerror(errno));
+        }
+    }
+    return false;
+}
+
+bool GearmanConnection::flush() noexcept {
+    while (fd >= 0 && out_sent < out.size()) {
+        ssize_t n = send(fd, out.data() + out_sent, out.size() - out_sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            out_sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else {
+            disconnect(std::string("write failed: ") + strerror(errno));
+        }
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    out.clear();
+    out_sent = 0;
+    return true;
+}
+
+bool GearmanConnection::check(time_point now) noexcept {
+    if (state == State::DISCONNECTED) {
+        return false;
+    }
+    if (state == State::CONNECTING) {
+        if (deadline <= now) {
+            disconnect("connect timed out");
+        }
+        return false;
+    }
+
+    switch (liveness.check(now)) {
+    case GearmanLiveness::Action::PROBE:
+        append_gearman_request(out, GearmanPacketType::ECHO_REQ);
+        return flush();
+    case GearmanLiveness::Action::DEAD:
+        if (in_flight > 0 || out_sent < out.size()) {
+            /* Dropping it would throw away finished results and have gearmand
+             * run those jobs again. A host that is really gone fails the socket
+             * once the unacknowledged ECHO_REQ hits TCP_USER_TIMEOUT.
+             */
+            liveness.heard(now);
+            break;
+        }
+        disconnect("no answer to echo");
+        return false;
+    case GearmanLiveness::Action::NONE:
+        break;
+    }
+    return true;
+}
+
+GearmanConnection::time_point GearmanConnection::nextCheck() const noexcept {
+    if (state == State::DISCONNECTED || state == State::CONNECTING) {
+        return deadline;
+    }
+    return liveness.nextCheck();
+}
+
+} // namespace Driveshaft
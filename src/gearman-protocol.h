@@ -0,0 +1,229 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_GEARMAN_PROTOCOL_H_
+#define incl_DRIVESHAFT_GEARMAN_PROTOCOL_H_
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <initializer_list>
+#include <string.h>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <functional>
+#include <sys/types.h>
+#include "common-defs.h"
+#include "pool-options.h"
+
+namespace Driveshaft {
+
+// Worker side of the gearman binary protocol
+enum class GearmanPacketType : uint32_t {
+    CAN_DO = 1,
+    CANT_DO = 2,
+    RESET_ABILITIES = 3,
+    PRE_SLEEP = 4,
+    NOOP = 6,
+    GRAB_JOB = 9,
+    NO_JOB = 10,
+    JOB_ASSIGN = 11,
+    WORK_COMPLETE = 13,
+    WORK_FAIL = 14,
+    ECHO_REQ = 16,
+    ECHO_RES = 17,
+    ERROR = 19,
+    SET_CLIENT_ID = 22,
+    GRAB_JOB_UNIQ = 30,
+    JOB_ASSIGN_UNIQ = 31
+};
+
+static const size_t GEARMAN_PACKET_HEADER_SIZE = 12;
+// Larger packets are treated as a corrupt stream
+static const size_t GEARMAN_MAX_PACKET_SIZE = 64 * 1024 * 1024;
+
+// Points into the buffer a packet was parsed from or is built from
+struct GearmanArg {
+    GearmanArg() noexcept : data(nullptr), size(0) {}
+    GearmanArg(const char *data, size_t size) noexcept : data(data), size(size) {}
+    GearmanArg(const std::string& str) noexcept : data(str.data()), size(str.size()) {}
+    GearmanArg(const char *str) noexcept : data(str), size(strlen(str)) {}
+
+    std::string str() const {
+        return std::string(data, size);
+    }
+
+    const char *data;
+    size_t size;
+};
+
+static const size_t GEARMAN_MAX_PACKET_ARGS = 4;
+
+/* A parsed response. Arguments are not copied, so it is only valid while the
+ * buffer it was parsed from is untouched. Every argument but the last is
+ * followed by a NUL in that buffer and can be used as a C string.
+ */
+struct GearmanPacket {
+    GearmanPacketType type;
+    size_t arg_count;
+    GearmanArg args[GEARMAN_MAX_PACKET_ARGS];
+};
+
+// Appends a worker request with its arguments joined by NULs to out
+void append_gearman_request(std::string& out, GearmanPacketType type,
+                            std::initializer_list<GearmanArg> args = {});
+
+// Appends just the header of a request whose data is sent separately
+void append_gearman_header(std::string& out, GearmanPacketType type, size_t size);
+
+/* Parses one server response from the front of buf. Returns the bytes it
+ * took, 0 if buf holds only part of a packet, or -1 for a corrupt stream.
+ * The last argument of a packet keeps any NULs it contains.
+ */
+ssize_t parse_gearman_response(const char *buf, size_t len, GearmanPacket& packet) noexcept;
+
+// Splits host[:port] or [ipv6]:port, defaulting to the gearmand port
+void split_gearman_server(const std::string& server, std::string& host, std::string& port) noexcept;
+
+// Expands comma separated entries, as libgearman accepts them, into servers
+std::vector<std::string> expand_gearman_servers(const StringSet& server_list);
+
+/* The count servers that start slot * count + rotation places in, wrapping
+ * around, or all of them for a count of 0. Threads holding slots 0 to n-1 then
+ * cover every server about n * count / servers.size() times, and bumping the
+ * rotation moves a thread on to other servers.
+ */
+std::vector<std::string> shard_gearman_servers(const std::vector<std::string>& servers, uint32_t count,
+                                               uint32_t slot, uint32_t rotation);
+
+/* Sets TCP_NODELAY, plus TCP_USER_TIMEOUT and tight keepalives so the kernel
+ * gives up on a gearmand host that vanished without a FIN within seconds
+ * instead of minutes.
+ */
+void set_gearman_socket_options(int fd) noexcept;
+
+/* Notices a gearmand connection that stopped answering, as GearmanProbeOptions
+ * describes. Anything read counts as an answer, so a busy connection is never
+ * probed.
+ */
+class GearmanLiveness {
+public:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    enum class Action {
+        NONE,
+        PROBE, // send an ECHO_REQ now
+        DEAD
+    };
+
+    explicit GearmanLiveness(const GearmanProbeOptions& options) noexcept;
+
+    void heard(time_point now) noexcept;
+    Action check(time_point now) noexcept;
+    time_point nextCheck() const noexcept;
+
+private:
+    const std::chrono::milliseconds m_interval;
+    const std::chrono::milliseconds m_timeout;
+    time_point m_last_heard;
+    time_point m_probe_sent;
+    bool m_probing;
+};
+
+/* A non-blocking worker connection to one gearmand server, shared by the pool
+ * reactor and the native worker. It owns the socket, the read and write
+ * buffers, liveness probing and the jittered reconnect backoff. What to ask
+ * gearmand for and what to do with the packets it sends is up to the owner,
+ * which calls finishConnect() once the socket is writable while CONNECTING.
+ */
+struct GearmanConnection {
+    typedef std::chrono::steady_clock::time_point time_point;
+    // Told why the connection was lost, before it is reset
+    typedef std::function<void(GearmanConnection&, const std::string&)> LostCallback;
+
+    enum class State {
+        DISCONNECTED,
+        CONNECTING,
+        IDLE, // connected, not grabbing
+        GRABBING, // GRAB_JOB_UNIQ sent
+        SLEEPING // PRE_SLEEP sent, waiting for a NOOP
+    };
+
+    // With an epoll_fd, the socket is added to that epoll set, edge triggered
+    GearmanConnection(const std::string& server, const GearmanProbeOptions& probe, int epoll_fd,
+                      LostCallback on_lost) noexcept;
+    ~GearmanConnection() noexcept;
+
+    // Starts connecting. false if that failed right away, and the backoff starts over
+    bool connect() noexcept;
+    // Once the socket is writable while CONNECTING. false if the connect failed
+    bool finishConnect() noexcept;
+    // Closes the socket and waits out the reconnect backoff
+    void disconnect(const std::string& reason) noexcept;
+
+    // Reads whatever is available into in. false if the connection was lost
+    bool fill() noexcept;
+    // Sends what the socket takes of out. false if the connection was lost
+    bool flush() noexcept;
+
+    bool reconnectDue(time_point now) const noexcept {
+        return state == State::DISCONNECTED && deadline <= now;
+    }
+
+    /* Gives up on a connect that took too long, and probes a quiet connection
+     * or drops one that did not answer while nothing of its owner's was in
+     * flight. false if the connection is not up.
+     */
+    bool check(time_point now) noexcept;
+    // When check() or a reconnect is due next
+    time_point nextCheck() const noexcept;
+
+    const std::string server;
+    int fd;
+    State state;
+    std::atomic<uint64_t> generation; // bumped on every disconnect, so jobs gearmand requeued are dropped
+    uint32_t failures; // since the last successful connect, for the reconnect backoff
+    uint32_t in_flight; // jobs grabbed on this connection whose results are not sent yet
+    time_point deadline; // when to reconnect, or to give up connecting
+    std::string in;
+    std::string out;
+    size_t out_sent;
+    GearmanLiveness liveness;
+
+private:
+    GearmanConnection() = delete;
+    GearmanConnection(const GearmanConnection&) = delete;
+    GearmanConnection(GearmanConnection&&) = delete;
+    GearmanConnection& operator=(const GearmanConnection&) = delete;
+    GearmanConnection& operator=(const GearmanConnection&&) = delete;
+
+    const int m_epoll_fd;
+    LostCallback m_on_lost;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_GEARMAN_PROTOCOL_H_
@@ -0,0 +1,99 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include "gearman-worker.h"
+#include "gearman-client.h"
+
+namespace Driveshaft {
+
+LibgearmanWorker::LibgearmanWorker(GearmanClient *client, int timeout_ms)
+    : m_client(client)
+    , m_worker_ptr(gearman_worker_create(nullptr), gearman_client_deleter)
+    , m_polled(false)
+    , m_answered(false) {
+    if (m_worker_ptr.get() == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    gearman_worker_add_options(m_worker_ptr.get(), GEARMAN_WORKER_NON_BLOCKING);
+    gearman_worker_set_timeout(m_worker_ptr.get(), timeout_ms);
+}
+
+gearman_return_t LibgearmanWorker::addServers(const std::string& servers) {
+    return gearman_worker_add_servers(m_worker_ptr.get(), servers.c_str());
+}
+
+gearman_return_t LibgearmanWorker::addFunction(const std::string& function_name) {
+    return gearman_worker_add_function(m_worker_ptr.get(), function_name.c_str(), 0, &worker_callback, m_client);
+}
+
+gearman_return_t LibgearmanWorker::removeFunction(const std::string& function_name) {
+    return gearman_worker_unregister(m_worker_ptr.get(), function_name.c_str());
+}
+
+/* libgearman connects lazily and returns GEARMAN_IO_WAIT until a server
+ * replies, so the worker counts as answered once it ran a job, or once work()
+ * read what wait() saw arrive without failing.
+ */
+gearman_return_t LibgearmanWorker::work() {
+    gearman_return_t ret = gearman_worker_work(m_worker_ptr.get());
+    switch (ret) {
+    case GEARMAN_IO_WAIT:
+    case GEARMAN_NO_JOBS:
+        m_answered = m_answered || m_polled;
+        break;
+
+    case GEARMAN_SUCCESS:
+    case GEARMAN_WORK_ERROR:
+    case GEARMAN_WORK_DATA:
+    case GEARMAN_WORK_WARNING:
+    case GEARMAN_WORK_STATUS:
+    case GEARMAN_WORK_EXCEPTION:
+    case GEARMAN_WORK_FAIL:
+        m_answered = true;
+        break;
+
+    default:
+        break;
+    }
+    m_polled = false;
+    return ret;
+}
+
+gearman_return_t LibgearmanWorker::wait() {
+    gearman_return_t ret = gearman_worker_wait(m_worker_ptr.get());
+    m_polled = (ret == GEARMAN_SUCCESS);
+    return ret;
+}
+
+const char* LibgearmanWorker::error() const noexcept {
+    return gearman_worker_error(m_worker_ptr.get());
+}
+
+bool LibgearmanWorker::answered() const noexcept {
+    return m_answered;
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,91 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_GEARMAN_WORKER_H_
+#define incl_DRIVESHAFT_GEARMAN_WORKER_H_
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <libgearman-1.0/gearman.h>
+
+namespace Driveshaft {
+
+class GearmanClient;
+class FetchedJob;
+
+// Runs a job and fills in its result
+typedef std::function<gearman_return_t(const FetchedJob& job, std::string& result)> GearmanJobHandler;
+
+/* The gearmand connections of one GearmanClient. work() and wait() follow
+ * libgearman's non-blocking worker: work() runs at most one job through
+ * GearmanClient::processJob and returns GEARMAN_IO_WAIT or GEARMAN_NO_JOBS
+ * when it has to wait(), which polls for up to the timeout.
+ */
+class GearmanWorkerInterface {
+public:
+    virtual ~GearmanWorkerInterface() noexcept {}
+
+    virtual gearman_return_t addServers(const std::string& servers) = 0;
+    virtual gearman_return_t addFunction(const std::string& function_name) = 0;
+    virtual gearman_return_t removeFunction(const std::string& function_name) = 0;
+    virtual gearman_return_t work() = 0;
+    virtual gearman_return_t wait() = 0;
+    virtual const char* error() const noexcept = 0;
+    // true once a gearmand server has answered, rather than just being added
+    virtual bool answered() const noexcept = 0;
+};
+
+typedef std::unique_ptr<GearmanWorkerInterface> GearmanWorkerPtr;
+
+class LibgearmanWorker : public GearmanWorkerInterface {
+public:
+    // throws std::bad_alloc if libgearman cannot create a worker
+    LibgearmanWorker(GearmanClient *client, int timeout_ms);
+
+    gearman_return_t addServers(const std::string& servers) override;
+    gearman_return_t addFunction(const std::string& function_name) override;
+    gearman_return_t removeFunction(const std::string& function_name) override;
+    gearman_return_t work() override;
+    gearman_return_t wait() override;
+    const char* error() const noexcept override;
+    bool answered() const noexcept override;
+
+private:
+    LibgearmanWorker() = delete;
+    LibgearmanWorker(const LibgearmanWorker&) = delete;
+    LibgearmanWorker(LibgearmanWorker&&) = delete;
+    LibgearmanWorker& operator=(const LibgearmanWorker&) = delete;
+    LibgearmanWorker& operator=(const LibgearmanWorker&&) = delete;
+
+    GearmanClient *m_client;
+    std::unique_ptr<gearman_worker_st, void(*)(gearman_worker_st*)> m_worker_ptr;
+    bool m_polled; // wait() saw a server's reply for the next work() to read
+    bool m_answered;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_GEARMAN_WORKER_H_
@@ -0,0 +1,351 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "job-fetcher.h"
+
+namespace Driveshaft {
+
+// How long a fetcher with no jobs out waits on gearmand, and how often a quiet
+// one grabs again. libgearman cannot be woken from its wait, so this bounds
+// how long stop() takes
+static const int FETCHER_IDLE_TIMEOUT_MS = 1000;
+// How long a fetcher with jobs out waits on gearmand at a time, between
+// reporting the jobs executors hand back. Waiting sends nothing to gearmand
+static const int FETCHER_BUSY_TIMEOUT_MS = 10;
+// How long a fetcher with a job that did not fit waits for room in the queue
+static const std::chrono::milliseconds FETCHER_BUSY_WAIT(10);
+static const std::chrono::seconds FETCHER_ERROR_SLEEP(1);
+// How often a fetcher held back by its executors looks whether they run jobs again
+static const std::chrono::milliseconds FETCHER_HELD_WAIT(100);
+
+JobQueue::JobQueue(size_t capacity) noexcept
+    : m_queue(capacity)
+    , m_waiters(0)
+    , m_connected(false)
+    , m_held(false)
+    , m_mutex()
+    , m_cond() {
+}
+
+bool JobQueue::tryPush(FetchedJob *job) noexcept {
+    if (!m_queue.tryPush(job)) {
+        return false;
+    }
+
+    // Pairs with the waiter count going up before pop() checks the queue again
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+    }
+    return true;
+}
+
+bool JobQueue::tryPop(FetchedJob *&job) noexcept {
+    return m_queue.tryPop(job);
+}
+
+bool JobQueue::pop(FetchedJob *&job, std::chrono::milliseconds timeout) noexcept {
+    if (m_queue.tryPop(job)) {
+        return true;
+    }
+
+    // Waiters are counted before the queue is checked again under the lock,
+    // so a push either finds the waiter or is seen by it
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_waiters++;
+    bool popped = m_cond.wait_for(lock, timeout, [this, &job]{ return m_queue.tryPop(job); });
+    m_waiters--;
+    return popped;
+}
+
+void JobQueue::abandonAll() noexcept {
+    FetchedJob *job;
+    while (m_queue.tryPop(job)) {
+        job->source->abandon(job);
+    }
+}
+
+JobFetcher::JobFetcher(const std::string& pool_name, JobQueue& queue) noexcept
+    : m_pool_name(pool_name)
+    , m_queue(queue)
+    , m_worker_ptr(nullptr, gearman_worker_free)
+    , m_completed_mutex()
+    , m_completed()
+    , m_sending()
+    , m_pending(nullptr)
+    , m_polled(false)
+    , m_outstanding(0)
+    , m_stopping(false)
+    , m_wakeup_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    , m_thread() {
+}
+
+JobFetcher::~JobFetcher() noexcept {
+    stop();
+    sendCompletions();
+    if (m_pending) {
+        abandon(m_pending);
+        m_pending = nullptr;
+    }
+
+    for (auto job : m_sending) {
+        abandon(job);
+    }
+
+    if (m_outstanding.load() > 0) {
+        LOG4CXX_ERROR(MainLogger, "Fetcher for pool " << m_pool_name << " closing with " <<
+                                  m_outstanding.load() << " jobs unreported");
+    }
+
+    if (m_wakeup_fd >= 0) {
+        close(m_wakeup_fd);
+    }
+}
+
+bool JobFetcher::start(const StringSet& server_list, const StringSet& jobs_list) noexcept {
+    m_worker_ptr.reset(gearman_worker_create(nullptr));
+    if (!m_worker_ptr) {
+        LOG4CXX_ERROR(MainLogger, "Unable to create fetcher for pool " << m_pool_name);
+        return false;
+    }
+
+    gearman_worker_add_options(m_worker_ptr.get(), GEARMAN_WORKER_NON_BLOCKING);
+    gearman_worker_set_timeout(m_worker_ptr.get(), FETCHER_IDLE_TIMEOUT_MS);
+    if (m_wakeup_fd < 0) {
+        LOG4CXX_ERROR(MainLogger, "Fetcher for pool " << m_pool_name << " has no wakeup descriptor, errno: " << errno <<
+                                  ". Finished jobs are reported when it next looks");
+    }
+
+    for (auto& server : server_list) {
+        if (gearman_worker_add_servers(m_worker_ptr.get(), server.c_str()) != GEARMAN_SUCCESS) {
+            LOG4CXX_ERROR(MainLogger, "Fetcher for pool " << m_pool_name << " unable to add server: " << server);
+            return false;
+        }
+    }
+
+    // Grabbed jobs are run by executors, so no callback is registered
+    for (auto& job : jobs_list) {
+        if (gearman_worker_register(m_worker_ptr.get(), job.c_str(), 0) != GEARMAN_SUCCESS) {
+            LOG4CXX_ERROR(MainLogger, "Fetcher for pool " << m_pool_name << " unable to add job: " << job);
+            return false;
+        }
+    }
+
+    m_thread = std::thread(&JobFetcher::run, this);
+    return true;
+}
+
+void JobFetcher::stop() noexcept {
+    m_stopping = true;
+    if (m_thread.joinable()) {
+        wakeUp();
+        m_thread.join();
+    }
+}
+
+void JobFetcher::complete(FetchedJob *job) noexcept {
+    {
+        std::lock_guard<std::mutex> lock(m_completed_mutex);
+        m_completed.push_back(static_cast<LibgearmanJob*>(job));
+    }
+    wakeUp();
+}
+
+// A fetcher that is already due to wake up makes the write fail with EAGAIN, which is fine
+void JobFetcher::wakeUp() noexcept {
+    if (m_wakeup_fd >= 0) {
+        uint64_t one = 1;
+        if (write(m_wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            LOG4CXX_ERROR(MainLogger, "Unable to wake the fetcher for pool " << m_pool_name << ". errno: " << errno);
+        }
+    }
+}
+
+// Sleeps until an executor hands back a job, stop() is called, or the timeout passes
+void JobFetcher::waitForWakeUp(std::chrono::milliseconds timeout) noexcept {
+    if (m_wakeup_fd < 0) {
+        std::this_thread::sleep_for(timeout);
+        return;
+    }
+
+    struct pollfd pfd = { m_wakeup_fd, POLLIN, 0 };
+    if (poll(&pfd, 1, static_cast<int>(std::max<int64_t>(timeout.count(), 0))) > 0) {
+        uint64_t count;
+        if (read(m_wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            LOG4CXX_ERROR(MainLogger, "Unable to reset the fetcher wakeup for pool " << m_pool_name << ". errno: " << errno);
+        }
+    }
+}
+
+void JobFetcher::sendCompletions() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(m_completed_mutex);
+        m_sending.insert(m_sending.end(), m_completed.begin(), m_completed.end());
+        m_completed.clear();
+    }
+
+    // A send that would block is resumed by calling it again on the next round
+    auto still_sending = std::remove_if(m_sending.begin(), m_sending.end(), [this](LibgearmanJob *fetched) {
+        gearman_return_t ret = (fetched->ret == GEARMAN_SUCCESS)
+            ? gearman_job_send_complete(fetched->job, fetched->result.data(), fetched->result.size())
+            : gearman_job_send_fail(fetched->job);
+        if (ret == GEARMAN_IO_WAIT) {
+            return false;
+        }
+
+        if (ret != GEARMAN_SUCCESS) {
+            LOG4CXX_ERROR(MainLogger, "Fetcher for pool " << m_pool_name << " unable to report job: " << ret);
+        }
+        gearman_job_free(fetched->job);
+        delete fetched;
+        m_outstanding--;
+        return true;
+    });
+    m_sending.erase(still_sending, m_sending.end());
+}
+
+void JobFetcher::abandon(FetchedJob *job) noexcept {
+    gearman_job_free(static_cast<LibgearmanJob*>(job)->job);
+    delete job;
+    m_outstanding--;
+}
+
+void JobFetcher::run() noexcept {
+    LOG4CXX_DEBUG(MainLogger, "Starting fetcher for pool " << m_pool_name);
+    while (!m_stopping) {
+        sendCompletions();
+        grab();
+    }
+}
+
+void JobFetcher::grab() noexcept {
+    if (m_queue.held()) {
+        waitForWakeUp(FETCHER_HELD_WAIT);
+        return;
+    }
+
+    if (m_pending) {
+        if (!m_queue.tryPush(m_pending)) {
+            // The queue is full. Leave the rest of the jobs in gearmand
+            waitForWakeUp(FETCHER_BUSY_WAIT);
+            return;
+        }
+        m_pending = nullptr;
+    }
+
+    gearman_return_t ret;
+    gearman_job_st *job = gearman_worker_grab_job(m_worker_ptr.get(), nullptr, &ret);
+    // libgearman connects lazily, so only a reply read off the wire shows gearmand is there
+    bool polled = m_polled;
+    m_polled = false;
+    if (job != nullptr || (polled && (ret == GEARMAN_IO_WAIT || ret == GEARMAN_NO_JOBS))) {
+        m_queue.setConnected();
+    }
+
+    if (job != nullptr) {
+        m_outstanding++;
+        LibgearmanJob *fetched = new LibgearmanJob(job, this);
+        if (!m_queue.tryPush(fetched)) {
+            m_pending = fetched;
+        }
+        return;
+    }
+
+    if (ret == GEARMAN_IO_WAIT || ret == GEARMAN_NO_JOBS || ret == GEARMAN_SUCCESS) {
+        /* Every grab sends GRAB_JOB, and PRE_SLEEP once there is nothing, to
+         * every server, so the next one waits for a server to answer or wake
+         * this fetcher with a NOOP. Executors cannot wake libgearman's wait, so
+         * with jobs out it waits in short slices and reports them in between.
+         */
+        auto regrab_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(FETCHER_IDLE_TIMEOUT_MS);
+        while (true) {
+            gearman_worker_set_timeout(m_worker_ptr.get(),
+                                       m_outstanding.load() > 0 ? FETCHER_BUSY_TIMEOUT_MS : FETCHER_IDLE_TIMEOUT_MS);
+            ret = gearman_worker_wait(m_worker_ptr.get());
+            if (ret == GEARMAN_SUCCESS) {
+                m_polled = true;
+                return;
+            }
+            if (ret != GEARMAN_TIMEOUT) {
+                break;
+            }
+            if (m_stopping || std::chrono::steady_clock::now() >= regrab_at) {
+                return;
+            }
+            sendCompletions();
+        }
+    }
+
+    // libgearman reconnects on the next grab
+    const char *gearman_error = gearman_worker_error(m_worker_ptr.get());
+    LOG4CXX_ERROR(MainLogger, "Fetcher for pool " << m_pool_name << " failed to grab a job: " << ret <<
+                              ". Details: " << (gearman_error ?: "No details"));
+    auto until = std::chrono::steady_clock::now() + FETCHER_ERROR_SLEEP;
+    while (!m_stopping && std::chrono::steady_clock::now() < until) {
+        sendCompletions();
+        waitForWakeUp(std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now()));
+    }
+}
+
+JobFetcherGroup::JobFetcherGroup(const std::string& pool_name, const FetchQueueOptions& options) noexcept
+    : m_pool_name(pool_name)
+    , m_options(options)
+    , m_queue(options.capacity)
+    , m_mutex()
+    , m_fetchers() {
+}
+
+JobFetcherGroup::~JobFetcherGroup() noexcept {
+    for (auto& fetcher : m_fetchers) {
+        fetcher->stop();
+    }
+
+    // Nothing will run the jobs still queued
+    m_queue.abandonAll();
+}
+
+void JobFetcherGroup::start(const StringSet& server_list, const StringSet& jobs_list) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_fetchers.empty()) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < m_options.fetchers; i++) {
+        std::unique_ptr<JobFetcher> fetcher(new JobFetcher(m_pool_name, m_queue));
+        if (fetcher->start(server_list, jobs_list)) {
+            m_fetchers.push_back(std::move(fetcher));
+        }
+    }
+
+    LOG4CXX_INFO(MainLogger, "Started " << m_fetchers.size() << " fetchers for pool " << m_pool_name);
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,236 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_JOB_FETCHER_H_
+#define incl_DRIVESHAFT_JOB_FETCHER_H_
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <libgearman-1.0/gearman.h>
+#include "common-defs.h"
+#include "pool-options.h"
+#include "bounded-queue.h"
+
+namespace Driveshaft {
+
+class FetchedJob;
+
+// Whatever grabbed a job and is the only one allowed to report on it
+class JobSource {
+public:
+    virtual ~JobSource() noexcept {}
+
+    // Called by executors once a job has run
+    virtual void complete(FetchedJob *job) noexcept = 0;
+    // Frees a job that was never run. gearmand hands it out again once the
+    // connection it came from goes away
+    virtual void abandon(FetchedJob *job) noexcept = 0;
+};
+
+/* A job grabbed off a gearmand connection and run by an executor. Only its
+ * source may talk to that connection, so the executor fills in the outcome
+ * and hands the job back to the source to report.
+ */
+class FetchedJob {
+public:
+    explicit FetchedJob(JobSource *source) noexcept
+        : source(source), ret(GEARMAN_SUCCESS), result() {}
+    virtual ~FetchedJob() noexcept {}
+
+    virtual const char* functionName() const noexcept = 0;
+    virtual const char* handle() const noexcept = 0;
+    virtual const char* unique() const noexcept = 0;
+    virtual const char* workload() const noexcept = 0;
+    virtual size_t workloadSize() const noexcept = 0;
+    // true once gearmand has handed the job to another worker. Executors skip it
+    virtual bool stale() const noexcept {
+        return false;
+    }
+
+    JobSource *source;
+    gearman_return_t ret;
+    std::string result;
+};
+
+// A job grabbed through libgearman
+class LibgearmanJob : public FetchedJob {
+public:
+    LibgearmanJob(gearman_job_st *job, JobSource *source) noexcept
+        : FetchedJob(source), job(job) {}
+
+    const char* functionName() const noexcept override {
+        return gearman_job_function_name(job);
+    }
+    const char* handle() const noexcept override {
+        return gearman_job_handle(job);
+    }
+    const char* unique() const noexcept override {
+        return gearman_job_unique(job);
+    }
+    const char* workload() const noexcept override {
+        return static_cast<const char*>(gearman_job_workload(job));
+    }
+    size_t workloadSize() const noexcept override {
+        return gearman_job_workload_size(job);
+    }
+
+    gearman_job_st *job;
+};
+
+// Bounded queue of grabbed jobs that executors can block on
+class JobQueue {
+public:
+    explicit JobQueue(size_t capacity) noexcept;
+
+    bool tryPush(FetchedJob *job) noexcept;
+    bool tryPop(FetchedJob *&job) noexcept;
+    // Waits up to timeout for a job
+    bool pop(FetchedJob *&job, std::chrono::milliseconds timeout) noexcept;
+    // Hands every queued job back to its source unrun
+    void abandonAll() noexcept;
+
+    // Set by whatever grabs for the queue once a gearmand server has answered it
+    void setConnected() noexcept {
+        m_connected.store(true);
+    }
+    bool connected() const noexcept {
+        return m_connected.load();
+    }
+
+    /* Set by executors while a pool gate (backpressure, the circuit breaker
+     * or a rate limit) keeps them from running jobs, so whatever grabs for
+     * the queue leaves jobs in gearmand instead of holding them here.
+     */
+    void setHeld(bool held) noexcept {
+        m_held.store(held);
+    }
+    bool held() const noexcept {
+        return m_held.load();
+    }
+
+private:
+    JobQueue() = delete;
+    JobQueue(const JobQueue&) = delete;
+    JobQueue(JobQueue&&) = delete;
+    JobQueue& operator=(const JobQueue&) = delete;
+    JobQueue& operator=(const JobQueue&&) = delete;
+
+    BoundedQueue<FetchedJob*> m_queue;
+    std::atomic<uint32_t> m_waiters;
+    std::atomic<bool> m_connected;
+    std::atomic<bool> m_held;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+/* One gearmand worker connection per server that grabs jobs for a whole pool
+ * into the JobQueue and reports the results executors hand back to it. It
+ * holds at most one grabbed job that did not fit in the queue, so a full
+ * queue stops it from grabbing more. Between grabs it waits on gearmand, and
+ * grabs again when a server wakes it or once a second. With jobs out it
+ * waits in short slices, reporting those executors hand back in between.
+ */
+class JobFetcher : public JobSource {
+public:
+    JobFetcher(const std::string& pool_name, JobQueue& queue) noexcept;
+    ~JobFetcher() noexcept;
+
+    // false if the servers or functions could not be set up
+    bool start(const StringSet& server_list, const StringSet& jobs_list) noexcept;
+    // Stops grabbing. Jobs already handed out must still come back
+    void stop() noexcept;
+
+    void complete(FetchedJob *job) noexcept override;
+    void abandon(FetchedJob *job) noexcept override;
+    // Reports finished jobs to gearmand. Called by the fetcher thread
+    void sendCompletions() noexcept;
+
+    uint32_t outstanding() const noexcept {
+        return m_outstanding.load();
+    }
+
+private:
+    JobFetcher() = delete;
+    JobFetcher(const JobFetcher&) = delete;
+    JobFetcher(JobFetcher&&) = delete;
+    JobFetcher& operator=(const JobFetcher&) = delete;
+    JobFetcher& operator=(const JobFetcher&&) = delete;
+
+    void run() noexcept;
+    void grab() noexcept;
+    void wakeUp() noexcept;
+    void waitForWakeUp(std::chrono::milliseconds timeout) noexcept;
+
+    const std::string m_pool_name;
+    JobQueue& m_queue;
+    std::unique_ptr<gearman_worker_st, void(*)(gearman_worker_st*)> m_worker_ptr;
+    std::mutex m_completed_mutex;
+    std::vector<LibgearmanJob*> m_completed;
+    std::vector<LibgearmanJob*> m_sending; // results still being flushed
+    LibgearmanJob *m_pending; // grabbed but not yet queued
+    bool m_polled; // the last wait saw a server's reply
+    std::atomic<uint32_t> m_outstanding; // grabbed and not yet reported
+    std::atomic<bool> m_stopping;
+    int m_wakeup_fd; // an eventfd executors write to when they hand back a job
+    std::thread m_thread;
+};
+
+/* The fetchers and queue of a pool running with fetch_queue. Destroyed with
+ * the pool's PoolContext, after its last executor has exited.
+ */
+class JobFetcherGroup {
+public:
+    JobFetcherGroup(const std::string& pool_name, const FetchQueueOptions& options) noexcept;
+    ~JobFetcherGroup() noexcept;
+
+    void start(const StringSet& server_list, const StringSet& jobs_list);
+
+    JobQueue& queue() noexcept {
+        return m_queue;
+    }
+
+private:
+    JobFetcherGroup() = delete;
+    JobFetcherGroup(const JobFetcherGroup&) = delete;
+    JobFetcherGroup(JobFetcherGroup&&) = delete;
+    JobFetcherGroup& operator=(const JobFetcherGroup&) = delete;
+    JobFetcherGroup& operator=(const JobFetcherGroup&&) = delete;
+
+    const std::string m_pool_name;
+    const FetchQueueOptions m_options;
+    JobQueue m_queue;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<JobFetcher>> m_fetchers;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_JOB_FETCHER_H_
@@ -26,6 +26,10 @@
 #include <iostream>
 #include <signal.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/stat.h>
 #include <cstring>
 #include <unistd.h>
@@ -34,53 +38,215 @@
 #include <boost/asio.hpp>
 #include <exception>
 #include <utility>
-#include <mutex>
-#include <condition_variable>
+#include <functional>
 #include "common-defs.h"
 #include "thread-registry.h"
 #include "metric-proxy.h"
 #include "main-loop.h"
 #include "thread-loop.h"
 #include "gearman-client.h"
+#include "pool-context.h"
+#include "queue-status.h"
+#include "config-watcher.h"
+#include "spare-threads.h"
+#include "upgrade-channel.h"
+#include "supervisor-channel.h"
+#include "worker-processes.h"
+#include "thread-scheduling.h"
 
 namespace Driveshaft {
 
-static std::mutex s_new_thread_mutex;
-static std::condition_variable s_new_thread_cond;
-static enum class ThreadStartState {
-    INIT,
-    SUCCESS,
-    FAILURE
-} s_new_thread_wakeup = ThreadStartState::INIT;
-
 static void gearman_thread_delegate(ThreadRegistryPtr registry,
                             MetricProxyPtr metrics,
                             std::string pool,
                             StringSet servers_list,
                             StringSet jobs_list,
-                            std::string http_uri) noexcept {
-    std::unique_lock<std::mutex> lock(s_new_thread_mutex);
+                            std::string http_uri,
+                            PoolContextPtr pool_context) noexcept {
+    // Before anything else runs here, so the client is allocated on the pool's NUMA node
+    apply_thread_scheduling(pool, pool_context->options()->scheduling);
+
     const MetricProxyPoolWrapperPtr metricsPoolWrapper = MetricProxyPoolWrapper::wrap(pool, metrics);
-    GearmanClient *client = new GearmanClient(registry, metricsPoolWrapper, servers_list,
-                                              jobs_list, http_uri);
-    ThreadLoop loop(registry, pool, client);
-    s_new_thread_wakeup = ThreadStartState::SUCCESS;
-    lock.unlock();
-    s_new_thread_cond.notify_one();
+    ThreadLoop loop(registry, pool, [&]() {
+        return new GearmanClient(registry, metricsPoolWrapper, servers_list,
+                                 jobs_list, http_uri, pool_context);
+    });
 
-    return loop.run(0);
+    return loop.run();
 }
 
+// An autoscaled pool shrinks at most this often, so a briefly empty queue does
+// not tear down threads that the next burst needs again
+static const std::chrono::seconds AUTOSCALE_SCALE_DOWN_DELAY(60);
+
 class ThreadPoolWatcher : public PoolWatcher {
 public:
-    ThreadPoolWatcher(ThreadRegistryPtr registry, MetricProxyPtr metrics) :
+    ThreadPoolWatcher(ThreadRegistryPtr registry, MetricProxyPtr metrics,
+                      std::shared_ptr<SpareThreads> spare_threads) :
          m_thread_registry(registry)
-        ,m_metrics_proxy(metrics) {
+        ,m_metrics_proxy(metrics)
+        ,m_spare_threads(spare_threads)
+        ,m_pool_contexts()
+        ,m_pools()
+        ,m_autoscaled_pools()
+        ,m_changes(0) {
     }
 
     virtual void inform(uint32_t config_worker_count, const std::string& pool_name,
                         const StringSet& server_list, const StringSet& jobs_list,
-                        const std::string& processing_uri) {
+                        const std::string& processing_uri, const PoolOptions& options) {
+        ++m_changes;
+        if (config_worker_count == 0) {
+            // Running threads keep their own reference until they exit
+            m_pool_contexts.erase(pool_name);
+            m_pools.erase(pool_name);
+            m_autoscaled_pools.erase(pool_name);
+            return resize(0, pool_name, server_list, jobs_list, processing_uri, options);
+        }
+
+        // worker_count is where an autoscaled pool starts out. Once running it
+        // keeps the size it scaled to, within whatever bounds it has now
+        auto running = m_pools.find(pool_name);
+        bool was_autoscaled = running != m_pools.end() && m_autoscaled_pools.count(pool_name) > 0;
+        uint32_t worker_count = was_autoscaled ? running->second.worker_count : config_worker_count;
+        const auto& autoscale = options.autoscale;
+        if (autoscale.max_workers > 0) {
+            worker_count = std::min(std::max(worker_count, autoscale.min_workers), autoscale.max_workers);
+            m_autoscaled_pools.insert(pool_name);
+        } else {
+            worker_count = config_worker_count;
+            m_autoscaled_pools.erase(pool_name);
+        }
+
+        if (running != m_pools.end() &&
+            (running->second.jobs_list != jobs_list || running->second.processing_uri != processing_uri)) {
+            reconfigure(pool_name, jobs_list, processing_uri);
+        }
+        if (running != m_pools.end() && running->second.options != options) {
+            retune(pool_name, options);
+        }
+
+        auto& pool = m_pools[pool_name];
+
+        if (!was_autoscaled || pool.worker_count != worker_count) {
+            pool.last_scaled = std::chrono::steady_clock::now();
+        }
+        pool.worker_count = worker_count;
+        pool.server_list = server_list;
+        pool.jobs_list = jobs_list;
+        pool.processing_uri = processing_uri;
+        pool.options = options;
+        resize(worker_count, pool_name, server_list, jobs_list, processing_uri, options);
+    }
+
+    // Resizes autoscaled pools to follow the queues of their functions
+    void autoscale(const FunctionStatusMap& status) {
+        auto now = std::chrono::steady_clock::now();
+        for (const auto& pool_name : m_autoscaled_pools) {
+            auto& pool = m_pools[pool_name];
+            uint32_t target = autoscale_target(pool.options.autoscale, pool.jobs_list, status);
+            if (target == pool.worker_count ||
+                (target < pool.worker_count && now - pool.last_scaled < AUTOSCALE_SCALE_DOWN_DELAY)) {
+                continue;
+            }
+
+            LOG4CXX_INFO(MainLogger, "autoscaling pool " << pool_name << " from " << pool.worker_count <<
+                                     " to " << target << " threads");
+            pool.worker_count = target;
+            pool.last_scaled = now;
+            resize(target, pool_name, pool.server_list, pool.jobs_list, pool.processing_uri, pool.options);
+        }
+    }
+
+    /* Starts threads for pools that lost some since the last call, whether to
+     * a non-retriable error or because they were restarted with new settings.
+     * Pools that kept all their threads are not looked at.
+     */
+    void replenish() {
+        for (const auto& pool_name : m_thread_registry->takeExitedPools()) {
+            auto found = m_pools.find(pool_name);
+            if (found == m_pools.end()) {
+                continue;
+            }
+
+            const auto& pool = found->second;
+            resize(pool.worker_count, pool_name, pool.server_list, pool.jobs_list, pool.processing_uri, pool.options);
+        }
+    }
+
+    bool autoscaling() const noexcept {
+        return !m_autoscaled_pools.empty();
+    }
+
+    // Threads all pools together are meant to have
+    uint32_t workerCount() const noexcept {
+        uint32_t worker_count = 0;
+        for (const auto& i : m_pools) {
+            worker_count += i.second.worker_count;
+        }
+        return worker_count;
+    }
+
+    // Counts inform calls, so callers can tell the pools changed since they last looked
+    uint64_t changes() const noexcept {
+        return m_changes;
+    }
+
+    StringSet serverList() const noexcept {
+        StringSet server_list;
+        for (const auto& i : m_pools) {
+            server_list.insert(i.second.server_list.begin(), i.second.server_list.end());
+        }
+        return server_list;
+    }
+
+    StringSet functions() const noexcept {
+        StringSet functions;
+        for (const auto& i : m_pools) {
+            functions.insert(i.second.jobs_list.begin(), i.second.jobs_list.end());
+        }
+        return functions;
+    }
+
+private:
+    // What a running pool was last started with
+    struct PoolSpec {
+        uint32_t worker_count;
+        StringSet server_list;
+        StringSet jobs_list;
+        std::string processing_uri;
+        PoolOptions options;
+        std::chrono::steady_clock::time_point last_scaled;
+    };
+
+    /* DriveshaftConfig::compare leaves a pool running when only its jobs or
+     * URI changed. Its workers switch over in place between jobs.
+     */
+    void reconfigure(const std::string& pool_name, const StringSet& jobs_list,
+                     const std::string& processing_uri) {
+        auto found = m_pool_contexts.find(pool_name);
+        if (found == m_pool_contexts.end()) {
+            return;
+        }
+
+        LOG4CXX_INFO(MainLogger, "reconfiguring pool " << pool_name << " in place");
+        found->second->reconfigure(processing_uri, jobs_list);
+    }
+
+    // Likewise for options that differ only in what PoolOptions::needsRestart leaves out
+    void retune(const std::string& pool_name, const PoolOptions& options) {
+        auto found = m_pool_contexts.find(pool_name);
+        if (found == m_pool_contexts.end()) {
+            return;
+        }
+
+        LOG4CXX_INFO(MainLogger, "retuning pool " << pool_name << " in place");
+        found->second->retune(options);
+    }
+
+    void resize(uint32_t config_worker_count, const std::string& pool_name,
+                const StringSet& server_list, const StringSet& jobs_list,
+                const std::string& processing_uri, const PoolOptions& options) {
         uint32_t current_worker_count = m_thread_registry->poolCount(pool_name);
         if (current_worker_count > config_worker_count) {
             uint32_t num_workers_to_stop = current_worker_count - config_worker_count;
@@ -89,61 +255,410 @@ public:
         } else if (current_worker_count < config_worker_count) {
             uint32_t num_workers_to_start = config_worker_count - current_worker_count;
             LOG4CXX_INFO(MainLogger, "starting " << num_workers_to_start << " threads");
-            for (uint32_t i = num_workers_to_start; i > 0; i--) {
-                std::unique_lock<std::mutex> lock(s_new_thread_mutex);
-                s_new_thread_wakeup = ThreadStartState::INIT;
-
-                std::thread t(gearman_thread_delegate,
-                              m_thread_registry,
-                              m_metrics_proxy,
-                              pool_name, server_list,
-                              jobs_list, processing_uri);
+            PoolContextPtr pool_context = poolContext(pool_name, server_list, jobs_list, processing_uri, options);
 
-                s_new_thread_cond.wait(lock, []{return s_new_thread_wakeup != ThreadStartState::INIT;});
-                t.detach();
+            // Counted by poolCount from here on. The threads connect on their
+            // own time and report to the registry when they are ready
+            m_thread_registry->reserveThreads(pool_name, num_workers_to_start);
+            for (uint32_t i = num_workers_to_start; i > 0; i--) {
+                std::function<void()> start = std::bind(gearman_thread_delegate,
+                                                        m_thread_registry,
+                                                        m_metrics_proxy,
+                                                        pool_name, server_list,
+                                                        jobs_list, processing_uri,
+                                                        pool_context);
+                if (!m_spare_threads->assign(start)) {
+                    std::thread(start).detach();
+                }
             }
         }
     }
 
-private:
+    PoolContextPtr poolContext(const std::string& pool_name, const StringSet& server_list,
+                               const StringSet& jobs_list, const std::string& processing_uri,
+                               const PoolOptions& options) {
+        auto& pool_context = m_pool_contexts[pool_name];
+        if (!pool_context || pool_context->options()->needsRestart(options) ||
+            !pool_context->fetchesFor(server_list, jobs_list)) {
+            pool_context.reset(new PoolContext(pool_name, processing_uri, jobs_list, options, m_metrics_proxy));
+            pool_context->startFetchers(server_list, jobs_list);
+        } else if (*pool_context->options() != options) {
+            pool_context->retune(options);
+        }
+
+        return pool_context;
+    }
+
     ThreadRegistryPtr m_thread_registry;
     MetricProxyPtr m_metrics_proxy;
+    std::shared_ptr<SpareThreads> m_spare_threads;
+    std::map<std::string, PoolContextPtr> m_pool_contexts;
+    std::map<std::string, PoolSpec> m_pools;
+    StringSet m_autoscaled_pools;
+    uint64_t m_changes;
 };
 
-MainLoop::MainLoop(const std::string &config_file, const std::string &exporter_addr) :
+// The signals that stop driveshaft. They are read off a signalfd by the main loop
+static const int CONTROL_SIGNALS[] = {SIGTERM, SIGINT, SIGUSR1, SIGHUP, SIGUSR2};
+
+// Descriptors one epoll_wait returns at most. The next call returns any others that are ready
+static const int MAIN_LOOP_MAX_EVENTS = 16;
+
+// How long a supervisor waits past its own deadline for worker processes to finish theirs
+static const uint32_t WORKER_PROCESS_SHUTDOWN_GRACE = 2;
+
+// How often a shutdown looks for exited threads when the registry has no eventfd
+static const std::chrono::milliseconds SHUTDOWN_POLL_INTERVAL(100);
+
+/* Blocks the control signals and returns a signalfd that receives them
+ * instead. Threads inherit the blocked mask, so this has to happen before
+ * the first one starts: otherwise a signal landing on one of them would take
+ * the default action and kill the process on the spot.
+ */
+static int control_signal_fd() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(struct sigaction));
+
+    sa.sa_handler = SIG_IGN;
+    if (sigemptyset(&sa.sa_mask) == -1 ||
+        sigaction(SIGPIPE, &sa, 0) == -1) {
+        LOG4CXX_ERROR(MainLogger, "Could not set SIGPIPE handler");
+        throw std::runtime_error("Unable to setup signals");
+    }
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    for (int signal_number : CONTROL_SIGNALS) {
+        sigaddset(&signals, signal_number);
+    }
+
+    int fd = -1;
+    if (pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0 ||
+        (fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        LOG4CXX_ERROR(MainLogger, "Could not set up a signalfd for SIGTERM|SIGINT|SIGUSR1|SIGHUP|SIGUSR2. errno: " << errno);
+        throw std::runtime_error("Unable to setup signals");
+    }
+
+    return fd;
+}
+
+/* SIGUSR1 asks for a graceful shutdown, the rest for a hard one, which wins.
+ * SIGUSR2 asks for a binary upgrade instead, and only sets upgrade.
+ */
+static ShutdownType read_control_signals(int fd, bool& upgrade) noexcept {
+    ShutdownType shutdown_type = ShutdownType::NO;
+    struct signalfd_siginfo info;
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        LOG4CXX_INFO(MainLogger, "Received signal " << info.ssi_signo);
+        if (info.ssi_signo == SIGUSR2) {
+            upgrade = true;
+        } else if (info.ssi_signo != SIGUSR1) {
+            shutdown_type = ShutdownType::HARD;
+        } else if (shutdown_type == ShutdownType::NO) {
+            shutdown_type = ShutdownType::GRACEFUL;
+        }
+    }
+
+    return shutdown_type;
+}
+
+// Resets a timerfd or eventfd so it stops reporting readable
+static void drain_counter(int fd) noexcept {
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) == sizeof(count)) {
+    }
+}
+
+MainLoop::MainLoop(const std::string &config_file, const std::string &exporter_addr,
+                   uint32_t queue_status_interval, uint32_t spare_threads, uint32_t worker_processes,
+                   std::unique_ptr<UpgradeChannel> old_process, std::unique_ptr<SupervisorChannel> supervisor) :
     m_config_filename(config_file),
+    m_signal_fd(control_signal_fd()),
+    m_epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+    m_timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+    m_timer_armed(false),
     m_config(),
+    m_config_watcher(config_file),
     m_thread_registry(new ThreadRegistry),
-    m_metric_proxy(new MetricProxy(exporter_addr)),
-    m_pool_watcher(new ThreadPoolWatcher(m_thread_registry, m_metric_proxy)) {
-    if (!setupSignals()) {
-        throw std::runtime_error("Unable to setup signals");
+    m_supervisor(std::move(supervisor)),
+    // The old process of an upgrade still has the address, and worker processes leave it to their supervisor
+    m_exporter(m_supervisor ? nullptr : new MetricProxy(exporter_addr, !old_process)),
+    m_metric_proxy(m_supervisor ? MetricProxyPtr(m_supervisor) : MetricProxyPtr(m_exporter)),
+    m_spare_threads(new SpareThreads(spare_threads)),
+    m_pool_watcher(new ThreadPoolWatcher(m_thread_registry, m_metric_proxy, m_spare_threads)),
+    m_start_time(std::chrono::steady_clock::now()),
+    m_at_capacity(false),
+    m_pool_changes_seen(0),
+    m_queue_status_interval(queue_status_interval),
+    m_queue_status(new QueueStatusCollector(m_metric_proxy,
+        std::chrono::seconds(std::max<uint32_t>(queue_status_interval ? queue_status_interval : LOOP_SLEEP_DURATION, 1)))),
+    m_executable(current_executable()),
+    m_new_process(),
+    m_old_process(std::move(old_process)),
+    m_ready_reported(false),
+    m_on_takeover(),
+    m_worker_process_count(worker_processes),
+    m_worker_processes() {
+    if (m_epoll_fd == -1 || m_timer_fd == -1) {
+        LOG4CXX_ERROR(MainLogger, "Could not create the main loop epoll set or timerfd. errno: " << errno);
+        throw std::runtime_error("Unable to setup main loop events");
+    }
+
+    // A supervisor leaves the config to its worker processes
+    if (worker_processes > 0 && !m_supervisor) {
+        m_worker_processes.reset(new WorkerProcesses(worker_processes, m_executable, m_metric_proxy));
+    }
+
+    watchEvents(m_signal_fd);
+    watchEvents(m_timer_fd);
+    if (m_config_watcher.fd() != -1 && !m_worker_processes) {
+        watchEvents(m_config_watcher.fd());
+    }
+    if (m_thread_registry->eventFd() != -1) {
+        watchEvents(m_thread_registry->eventFd());
+    }
+    if (m_old_process) {
+        LOG4CXX_INFO(MainLogger, "Taking over from process " << m_old_process->peer() << " once all threads are ready");
+        watchEvents(m_old_process->fd());
+    }
+    if (m_supervisor) {
+        LOG4CXX_INFO(MainLogger, "Running as worker process " << m_supervisor->process() << " of " << m_worker_process_count);
+        watchEvents(m_supervisor->fd());
     }
 }
 
-enum class ShutdownType {
-    NO,
-    GRACEFUL,
-    HARD
-};
+MainLoop::~MainLoop() noexcept {
+    // The new process takes the pidfile over when this closes, so it must outlive ours
+    if (m_new_process) {
+        m_new_process->release();
+    }
+    close(m_timer_fd);
+    close(m_epoll_fd);
+    close(m_signal_fd);
+}
 
-extern "C" {
+void MainLoop::watchEvents(int fd) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        LOG4CXX_ERROR(MainLogger, "Could not add fd " << fd << " to the main loop epoll set. errno: " << errno);
+        throw std::runtime_error("Unable to setup main loop events");
+    }
+}
 
-static ShutdownType shutdown_type = ShutdownType::NO;
+void MainLoop::unwatchEvents(int fd) noexcept {
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+        LOG4CXX_ERROR(MainLogger, "Could not remove fd " << fd << " from the main loop epoll set. errno: " << errno);
+    }
+}
 
-static void shutdown_handler(int signal_arg) {
-    if (signal_arg == SIGUSR1) {
-        shutdown_type = ShutdownType::GRACEFUL;
-    } else {
-        shutdown_type = ShutdownType::HARD;
+void MainLoop::onTakeover(std::function<void()> callback) {
+    m_on_takeover = callback;
+}
+
+// Starts this binary again alongside, to take over once its pools are at full strength
+void MainLoop::startUpgrade() noexcept {
+    if (m_supervisor) {
+        LOG4CXX_ERROR(MainLogger, "Ignoring an upgrade request. Worker processes are upgraded by signalling their supervisor");
+        return;
+    }
+    if (m_new_process || m_old_process) {
+        LOG4CXX_ERROR(MainLogger, "Ignoring an upgrade request while an upgrade is in progress");
+        return;
+    }
+
+    try {
+        m_new_process = UpgradeChannel::startNewProcess(m_executable);
+        watchEvents(m_new_process->fd());
+    } catch (std::exception& e) {
+        LOG4CXX_ERROR(MainLogger, "Unable to upgrade: " << e.what());
+        m_new_process.reset();
+        return;
     }
+
+    LOG4CXX_INFO(MainLogger, "Draining once process " << m_new_process->peer() << " is ready");
 }
+
+// true once the new process is ready and this one should drain
+bool MainLoop::handleNewProcess() noexcept {
+    switch (m_new_process->receive()) {
+    case UpgradeChannel::Event::READY:
+        LOG4CXX_INFO(MainLogger, "Process " << m_new_process->peer() << " is ready, draining for the upgrade...");
+        return true;
+
+    case UpgradeChannel::Event::CLOSED:
+        LOG4CXX_ERROR(MainLogger, "Upgrade failed: process " << m_new_process->peer() << " exited before it was ready");
+        unwatchEvents(m_new_process->fd());
+        waitpid(m_new_process->peer(), nullptr, 0);
+        m_new_process.reset();
+        return false;
+
+    case UpgradeChannel::Event::NONE:
+        break;
+    }
+
+    return false;
 }
 
-void MainLoop::doShutdown(uint32_t wait) noexcept {
-    g_force_shutdown = true;
+// The old process exits once it has drained, and only then lets go of the exporter address
+void MainLoop::handleOldProcess() noexcept {
+    if (m_old_process->receive() != UpgradeChannel::Event::CLOSED) {
+        return;
+    }
+
+    LOG4CXX_INFO(MainLogger, "Process " << m_old_process->peer() << " exited, taking over");
+    unwatchEvents(m_old_process->fd());
+    m_old_process.reset();
+    if (m_exporter) {
+        m_exporter->startExporter();
+    }
+    if (m_on_takeover) {
+        m_on_takeover();
+    }
+}
+
+// Tells the supervisor or the old process of an upgrade, once every thread or worker process is ready
+void MainLoop::reportReady() noexcept {
+    if (m_ready_reported ||
+        (!m_at_capacity && (m_worker_processes || m_pool_watcher->workerCount() > 0))) {
+        return;
+    }
+
+    m_ready_reported = true;
+    if (m_supervisor) {
+        m_supervisor->sendReady();
+    }
+    if (m_old_process) {
+        LOG4CXX_INFO(MainLogger, "All threads are ready, telling process " << m_old_process->peer() << " to drain");
+        m_old_process->sendReady();
+    }
+}
+
+// Starts worker processes that are not running, when their restart delay allows
+void MainLoop::startWorkerProcesses() {
+    for (int fd : m_worker_processes->start()) {
+        watchEvents(fd);
+    }
+}
+
+/* Everything else wakes the loop through its own descriptor, so the timer
+ * only runs while something has to be looked at periodically: autoscaled
+ * pools, and whatever inotify or the registry eventfd could not be set up
+ * for. An idle driveshaft does not wake up at all.
+ */
+void MainLoop::updateTimer() {
+    bool needed = m_worker_processes ? m_worker_processes->restartPending() :
+                  m_pool_watcher->autoscaling() ||
+                  !m_config_watcher.watching() ||
+                  m_thread_registry->eventFd() == -1 ||
+                  (m_supervisor && m_supervisor->backlogged());
+    if (needed == m_timer_armed) {
+        return;
+    }
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (needed) {
+        spec.it_interval.tv_sec = std::max<uint32_t>(LOOP_SLEEP_DURATION, 1);
+        spec.it_value = spec.it_interval;
+    }
+
+    if (timerfd_settime(m_timer_fd, 0, &spec, nullptr) == -1) {
+        LOG4CXX_ERROR(MainLogger, "Could not set the main loop timer. errno: " << errno);
+        throw std::runtime_error("Unable to set main loop timer");
+    }
+
+    LOG4CXX_DEBUG(MainLogger, (needed ? "Started" : "Stopped") << " the main loop timer");
+    m_timer_armed = needed;
+}
+
+/* Tells every thread to stop and returns as soon as the last one has exited,
+ * or at the deadline. A graceful drain, which an upgrade handover is too,
+ * lets running jobs finish; only a hard shutdown aborts their requests. A
+ * hard shutdown signal during a graceful drain brings the deadline forward.
+ * Jobs still running when it passes are logged, since they die with the
+ * process. A supervisor passes the signal on to its worker processes
+ * instead, and kills those still running at the deadline.
+ */
+void MainLoop::doShutdown(ShutdownType type) noexcept {
+    if (type == ShutdownType::HARD) {
+        g_force_shutdown = true;
+    }
     this->m_config.clearAllWorkerCounts(*m_pool_watcher);
-    std::this_thread::sleep_for(std::chrono::seconds(wait));
+    m_queue_status->stop();
+
+    uint32_t wait = type == ShutdownType::HARD ? HARD_SHUTDOWN_WAIT_DURATION : GRACEFUL_SHUTDOWN_WAIT_DURATION;
+    uint32_t hard_wait = HARD_SHUTDOWN_WAIT_DURATION;
+    if (m_worker_processes) {
+        m_worker_processes->stop(type == ShutdownType::HARD ? SIGTERM : SIGUSR1);
+        wait += WORKER_PROCESS_SHUTDOWN_GRACE;
+        hard_wait += WORKER_PROCESS_SHUTDOWN_GRACE;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(wait);
+    uint32_t remaining;
+    while ((remaining = m_thread_registry->threadCount() + (m_worker_processes ? m_worker_processes->running() : 0)) > 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+
+        // Every exit wakes us through the registry eventfd. Without one, look every so often
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1);
+        if (m_thread_registry->eventFd() == -1) {
+            timeout = std::min(timeout, SHUTDOWN_POLL_INTERVAL);
+        }
+
+        struct epoll_event events[MAIN_LOOP_MAX_EVENTS];
+        int count = epoll_wait(m_epoll_fd, events, MAIN_LOOP_MAX_EVENTS, timeout.count());
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            bool upgrade = false;
+            if (fd == m_signal_fd) {
+                if (read_control_signals(fd, upgrade) == ShutdownType::HARD &&
+                    deadline > now + std::chrono::seconds(hard_wait)) {
+                    LOG4CXX_INFO(MainLogger, "Shutting down hard while draining...");
+                    g_force_shutdown = true;
+                    deadline = now + std::chrono::seconds(hard_wait);
+                    if (m_worker_processes) {
+                        m_worker_processes->stop(SIGTERM);
+                    }
+                }
+            } else if (m_worker_processes && m_worker_processes->owns(fd)) {
+                m_worker_processes->handle(fd);
+            } else if (fd == m_config_watcher.fd()) {
+                m_config_watcher.changed();
+            } else if (fd == m_timer_fd || fd == m_thread_registry->eventFd()) {
+                drain_counter(fd);
+            } else {
+                // An upgrade or supervisor channel. Whatever it says no longer matters
+                unwatchEvents(fd);
+            }
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const char *what = m_worker_processes ? " worker processes" : " threads";
+    if (remaining == 0) {
+        LOG4CXX_INFO(MainLogger, "All" << what << " exited " << elapsed.count() << " seconds into the shutdown");
+        return;
+    }
+
+    LOG4CXX_ERROR(MainLogger, "Abandoning " << remaining << what << " " << elapsed.count() << " seconds into the shutdown");
+    if (m_worker_processes) {
+        m_worker_processes->abandon();
+    }
+    for (const auto& thread : m_thread_registry->snapshot()) {
+        if (thread.state == ThreadState::WORKING) {
+            LOG4CXX_ERROR(MainLogger, "Abandoning job of pool " << thread.pool << ": job_handle=" << thread.job_handle
+                                      << " job_unique=" << thread.job_unique);
+        }
+    }
+    // Past the deadline, whatever still runs is cut short
+    g_force_shutdown = true;
 }
 
 void MainLoop::run() {
@@ -151,51 +666,183 @@ void MainLoop::run() {
     jsonfactory.strictMode(&jsonfactory.settings_);
     std::shared_ptr<Json::CharReader> json_parser(jsonfactory.newCharReader());
 
+    if (m_worker_processes) {
+        startWorkerProcesses();
+    } else {
+        m_spare_threads->fill();
+        reloadConfig(json_parser, true);
+        updateQueueStatus();
+    }
+    // A config without workers is ready right away, and nothing else would wake us to say so
+    checkCapacity();
+    reportReady();
+
+    struct epoll_event events[MAIN_LOOP_MAX_EVENTS];
     while(true) {
+        if (m_supervisor) {
+            // Metrics held while the supervisor was behind go out here, on the timer at the latest
+            m_supervisor->flush();
+        }
+        updateTimer();
+
+        int count = epoll_wait(m_epoll_fd, events, MAIN_LOOP_MAX_EVENTS, -1);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG4CXX_ERROR(MainLogger, "Could not wait for main loop events. errno: " << errno);
+            throw std::runtime_error("Unable to wait for main loop events");
+        }
+
+        ShutdownType shutdown_type = ShutdownType::NO;
+        bool upgrade = false;
+        bool upgraded = false;
+        bool orphaned = false;
+        bool config_event = false;
+        bool tick = false;
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == m_signal_fd) {
+                shutdown_type = read_control_signals(fd, upgrade);
+            } else if (m_new_process && fd == m_new_process->fd()) {
+                upgraded = handleNewProcess();
+            } else if (m_old_process && fd == m_old_process->fd()) {
+                handleOldProcess();
+            } else if (m_supervisor && fd == m_supervisor->fd()) {
+                orphaned = m_supervisor->closed();
+            } else if (m_worker_processes && m_worker_processes->owns(fd)) {
+                m_worker_processes->handle(fd);
+            } else if (fd == m_config_watcher.fd()) {
+                config_event = true;
+            } else if (fd == m_timer_fd) {
+                drain_counter(fd);
+                tick = true;
+            } else if (fd == m_thread_registry->eventFd()) {
+                drain_counter(fd);
+            }
+        }
+
+        if (orphaned) {
+            LOG4CXX_ERROR(MainLogger, "The supervisor exited");
+            shutdown_type = ShutdownType::HARD;
+        }
+
         switch (shutdown_type) {
         case ShutdownType::GRACEFUL:
             LOG4CXX_INFO(MainLogger, "Shutting down gracefully...");
-            return doShutdown(GRACEFUL_SHUTDOWN_WAIT_DURATION);
+            return doShutdown(ShutdownType::GRACEFUL);
 
         case ShutdownType::HARD:
             LOG4CXX_INFO(MainLogger, "Shutting down hard...");
-            return doShutdown(HARD_SHUTDOWN_WAIT_DURATION);
+            return doShutdown(ShutdownType::HARD);
 
         case ShutdownType::NO:
             break;
         }
 
-        DriveshaftConfig new_config;
-        new_config.load(this->m_config_filename, json_parser);
+        if (upgraded) {
+            // Jobs still running here finish before this process exits, so the handover loses none
+            return doShutdown(ShutdownType::GRACEFUL);
+        }
+        if (upgrade) {
+            startUpgrade();
+        }
 
-        new_config.supersede(m_config, *m_pool_watcher);
-        m_config = new_config;
+        // The worker processes run the pools
+        if (m_worker_processes) {
+            startWorkerProcesses();
+            checkCapacity();
+            reportReady();
+            continue;
+        }
+
+        // Without a watch on the config, every tick has to look at it
+        if ((config_event || (tick && !m_config_watcher.watching())) && m_config_watcher.changed()) {
+            reloadConfig(json_parser, false);
+        }
 
-        std::this_thread::sleep_for(std::chrono::seconds(LOOP_SLEEP_DURATION));
+        // All cheap when nothing happened to the pools
+        m_pool_watcher->replenish();
+        for (const auto& i : m_thread_registry->takeScaleDownTimes()) {
+            m_metric_proxy->reportScaleDown(i.first, i.second);
+        }
+        updateQueueStatus();
+        checkCapacity();
+        reportReady();
+        m_spare_threads->fill();
     }
 }
 
-bool MainLoop::setupSignals() const noexcept {
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(struct sigaction));
+// Reports once how long it took after startup until every configured thread was ready
+void MainLoop::checkCapacity() noexcept {
+    if (m_at_capacity) {
+        return;
+    }
 
-    sa.sa_handler = SIG_IGN;
-    if (sigemptyset(&sa.sa_mask) == -1 ||
-        sigaction(SIGPIPE, &sa, 0) == -1) {
-        LOG4CXX_ERROR(MainLogger, "Could not set SIGPIPE handler");
-        return false;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start_time;
+    if (m_worker_processes) {
+        if (!m_worker_processes->allReady()) {
+            return;
+        }
+        LOG4CXX_INFO(MainLogger, "All " << m_worker_process_count << " worker processes ready " << elapsed.count() << " seconds after startup");
+    } else {
+        uint32_t worker_count = m_pool_watcher->workerCount();
+        if (worker_count == 0 || m_thread_registry->readyCount() < worker_count) {
+            return;
+        }
+        LOG4CXX_INFO(MainLogger, "All " << worker_count << " threads ready " << elapsed.count() << " seconds after startup");
     }
 
-    sa.sa_handler = shutdown_handler;
-    if ((sigaction(SIGTERM, &sa, 0) == -1) ||
-        (sigaction(SIGINT, &sa, 0) == -1)  ||
-        (sigaction(SIGUSR1, &sa, 0) == -1) ||
-        (sigaction(SIGHUP, &sa, 0) == -1)) {
-        LOG4CXX_ERROR(MainLogger, "Could not set SIGTERM|SIGINT|SIGUSR1|SIGHUP handler");
-        return false;
+    m_at_capacity = true;
+    m_metric_proxy->reportTimeToCapacity(elapsed.count());
+}
+
+/* Once pools are running, a config that fails to load is logged and the
+ * running one is kept, so a bad push cannot take the workers down. Only the
+ * first load is fatal.
+ */
+void MainLoop::reloadConfig(std::shared_ptr<Json::CharReader> json_parser, bool must_load) {
+    DriveshaftConfig new_config;
+    try {
+        if (!new_config.load(this->m_config_filename, json_parser, m_config)) {
+            return;
+        }
+        if (m_supervisor) {
+            new_config.keepProcessPools(m_supervisor->process(), std::max<uint32_t>(m_worker_process_count, 1));
+        }
+    } catch (std::runtime_error& e) {
+        if (must_load) {
+            throw;
+        }
+
+        LOG4CXX_ERROR(MainLogger, "Keeping the running config. The new one failed to load: " << e.what());
+        return;
+    }
+
+    new_config.supersede(m_config, *m_pool_watcher);
+    m_config = std::move(new_config);
+}
+
+/* The collector runs while any pool autoscales, or all the time when an
+ * interval was given on the command line for the queue depth metrics.
+ */
+void MainLoop::updateQueueStatus() {
+    bool autoscaling = m_pool_watcher->autoscaling();
+    if (!autoscaling && m_queue_status_interval == 0) {
+        m_queue_status->stop();
+        return;
     }
 
-    return true;
+    if (m_pool_watcher->changes() != m_pool_changes_seen) {
+        m_pool_changes_seen = m_pool_watcher->changes();
+        m_queue_status->setTargets(m_pool_watcher->serverList(), m_pool_watcher->functions());
+    }
+    m_queue_status->start();
+
+    FunctionStatusMap status;
+    if (autoscaling && m_queue_status->snapshot(status)) {
+        m_pool_watcher->autoscale(status);
+    }
 }
 
 } // namespace Driveshaft
@@ -29,25 +29,59 @@
 #include <string>
 #include <map>
 #include <utility>
+#include <functional>
 #include <time.h>
 #include "common-defs.h"
 #include "thread-registry.h"
 #include "metric-proxy.h"
 #include "driveshaft-config.h"
+#include "queue-status.h"
+#include "config-watcher.h"
+#include "spare-threads.h"
+#include "upgrade-channel.h"
+#include "supervisor-channel.h"
+#include "worker-processes.h"
 
 namespace Driveshaft {
 
+class ThreadPoolWatcher;
+
+enum class ShutdownType {
+    NO,
+    GRACEFUL,
+    HARD
+};
+
 class MainLoop {
 public:
     // treat this class as a singleton. you really, really don't want more
     // than one in your process.
-    MainLoop(const std::string &config_file, const std::string &exporter_addr);
+    /* With worker_processes the pools run in that many supervised copies of
+     * this process. old_process is set when this one was started by a binary
+     * upgrade, and supervisor when it is one of the worker processes.
+     */
+    MainLoop(const std::string &config_file, const std::string &exporter_addr,
+             uint32_t queue_status_interval, uint32_t spare_threads, uint32_t worker_processes = 0,
+             std::unique_ptr<UpgradeChannel> old_process = std::unique_ptr<UpgradeChannel>(),
+             std::unique_ptr<SupervisorChannel> supervisor = std::unique_ptr<SupervisorChannel>());
+    // Called once the old process of an upgrade has exited
+    void onTakeover(std::function<void()> callback);
     void run();
-    ~MainLoop() = default;
+    ~MainLoop() noexcept;
 
 private:
-    bool setupSignals() const noexcept;
-    void doShutdown(uint32_t wait) noexcept;
+    void watchEvents(int fd);
+    void unwatchEvents(int fd) noexcept;
+    void startUpgrade() noexcept;
+    bool handleNewProcess() noexcept;
+    void handleOldProcess() noexcept;
+    void reportReady() noexcept;
+    void startWorkerProcesses();
+    void updateTimer();
+    void doShutdown(ShutdownType type) noexcept;
+    void updateQueueStatus();
+    void checkCapacity() noexcept;
+    void reloadConfig(std::shared_ptr<Json::CharReader> json_parser, bool must_load);
 
     MainLoop() = delete;
     MainLoop(const MainLoop&) = delete;
@@ -56,10 +90,30 @@ private:
     MainLoop& operator=(const MainLoop&&) = delete;
 
     std::string m_config_filename;
+    int m_signal_fd; // set up before any thread starts, so they all inherit the blocked signals
+    int m_epoll_fd;
+    int m_timer_fd;
+    bool m_timer_armed;
     DriveshaftConfig m_config;
+    ConfigWatcher m_config_watcher;
     ThreadRegistryPtr m_thread_registry;
+    std::shared_ptr<SupervisorChannel> m_supervisor; // in a worker process, where it also takes the metrics
+    std::shared_ptr<MetricProxy> m_exporter; // unless this is a worker process
     MetricProxyPtr m_metric_proxy;
-    std::shared_ptr<PoolWatcher> m_pool_watcher;
+    std::shared_ptr<SpareThreads> m_spare_threads;
+    std::shared_ptr<ThreadPoolWatcher> m_pool_watcher;
+    std::chrono::steady_clock::time_point m_start_time;
+    bool m_at_capacity; // time to capacity was reported
+    uint64_t m_pool_changes_seen; // when the queue status targets were last set
+    uint32_t m_queue_status_interval;
+    std::unique_ptr<QueueStatusCollector> m_queue_status;
+    std::string m_executable; // looked up at startup, before an upgrade replaces the file
+    std::unique_ptr<UpgradeChannel> m_new_process; // started by an upgrade of this one
+    std::unique_ptr<UpgradeChannel> m_old_process; // upgraded to this one, until it exits
+    bool m_ready_reported; // told the supervisor or the old process that all threads are ready
+    std::function<void()> m_on_takeover;
+    uint32_t m_worker_process_count;
+    std::unique_ptr<WorkerProcesses> m_worker_processes; // in the supervisor
 };
 
 } // namespace Driveshaft
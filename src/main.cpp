@@ -47,6 +47,8 @@
 #include "main-loop.h"
 #include <driveshaft-version.h>
 #include "pidfile.h"
+#include "upgrade-channel.h"
+#include "supervisor-channel.h"
 
 namespace Driveshaft {
 
@@ -125,6 +127,9 @@ int main(int argc, char **argv) {
     std::string pid_filename;
     bool daemonize = false;
     std::string exporter_addr;
+    uint32_t queue_status_interval = 0;
+    uint32_t spare_threads = 0;
+    uint32_t worker_processes = 0;
 
     /* Parse command line opts */
     namespace po = boost::program_options;
@@ -135,11 +140,14 @@ int main(int argc, char **argv) {
             ("user", po::value<std::string>(&username), "username to run as")
             ("pid_file", po::value<std::string>(&pid_filename), "file to write process ID out to")
             ("daemonize", po::bool_switch(&daemonize)->default_value(false), "Daemon, detach and run in the background")
-            ("jobsconfig", po::value<std::string>(&jobs_config_file)->required(), "jobs config file path")
+            ("jobsconfig", po::value<std::string>(&jobs_config_file)->required(), "jobs config file or directory path")
             ("logconfig", po::value<std::string>(&log_config_file)->required(), "log config file path")
             ("max_running_time", po::value<uint32_t>(&Driveshaft::MAX_JOB_RUNNING_TIME)->required(), "how long can a job run before it is considered failed (in seconds)")
             ("loop_timeout", po::value<uint32_t>(&Driveshaft::GEARMAND_RESPONSE_TIMEOUT)->required(), "how long to wait for a response from gearmand before restarting event-loop (in seconds)")
             ("exporter_addr", po::value<std::string>(&exporter_addr)->default_value("0.0.0.0:8888"), "the address:port on which to launch a prometheus exporter to publish metrics")
+            ("queue_status_interval", po::value<uint32_t>(&queue_status_interval)->default_value(0), "how often to poll gearmand for queue depths (in seconds). 0 polls only while a pool autoscales")
+            ("spare_threads", po::value<uint32_t>(&spare_threads)->default_value(0), "threads to keep started ahead of time and hand to pools as they grow")
+            ("worker_processes", po::value<uint32_t>(&worker_processes)->default_value(0), "run the pools in this many supervised processes, restarted when they exit. 0 runs them all in this one")
     ;
 
     try {
@@ -166,18 +174,32 @@ int main(int argc, char **argv) {
     Driveshaft::HARD_SHUTDOWN_WAIT_DURATION = Driveshaft::GEARMAND_RESPONSE_TIMEOUT * 2;
     Driveshaft::GRACEFUL_SHUTDOWN_WAIT_DURATION = Driveshaft::HARD_SHUTDOWN_WAIT_DURATION * 2;
 
-    if ((username.length() > 0) && (switch_user(username) == false)) {
+    /* Started by a supervisor or a binary upgrade: already running as the user
+     * and detached. The pidfile is not ours yet, or never.
+     */
+    auto supervisor = Driveshaft::SupervisorChannel::inherited();
+    auto old_process = supervisor ? nullptr : Driveshaft::UpgradeChannel::inherited();
+    bool started_by_driveshaft = supervisor || old_process;
+
+    if (!started_by_driveshaft && (username.length() > 0) && (switch_user(username) == false)) {
         return 1;
     }
 
-    if (daemonize && (do_daemon() == false)) {
+    if (!started_by_driveshaft && daemonize && (do_daemon() == false)) {
         return 1;
     }
 
     // RAII: On going out of scope will clean up the file
-    datadifferential::util::Pidfile pid_file(pid_filename);
-    if ((pid_filename.length() > 0) && (pid_file.create() == false)) {
-        std::cout << "Unable to write pidfile due to errors: " << pid_file.error_message() << std::endl;
+    std::unique_ptr<datadifferential::util::Pidfile> pid_file;
+    auto create_pid_file = [&pid_file, &pid_filename]() {
+        pid_file.reset(new datadifferential::util::Pidfile(pid_filename));
+        if ((pid_filename.length() > 0) && (pid_file->create() == false)) {
+            std::cout << "Unable to write pidfile due to errors: " << pid_file->error_message() << std::endl;
+            return false;
+        }
+        return true;
+    };
+    if (!started_by_driveshaft && !create_pid_file()) {
         return 1;
     }
 
@@ -203,7 +225,11 @@ int main(int argc, char **argv) {
         LOG4CXX_INFO(Driveshaft::MainLogger, "Starting up with gearmand response timeout=" << Driveshaft::GEARMAND_RESPONSE_TIMEOUT
                                              << " and max running time=" << Driveshaft::MAX_JOB_RUNNING_TIME);
 
-        Driveshaft::MainLoop loop(jobs_config_file, exporter_addr);
+        Driveshaft::MainLoop loop(jobs_config_file, exporter_addr, queue_status_interval, spare_threads,
+                                  worker_processes, std::move(old_process), std::move(supervisor));
+        loop.onTakeover([&create_pid_file]() {
+            create_pid_file();
+        });
         loop.run();
     } catch (std::exception& e) {
         std::cout << "MainLoop threw exception: " << e.what() << std::endl;
@@ -27,20 +27,29 @@
 
 namespace Driveshaft {
 
-MetricProxy::MetricProxy(const std::string &metricAddress) noexcept
-    : m_exporter{metricAddress} // ←-- starts the exporter
+MetricProxy::MetricProxy(const std::string &metricAddress, bool start_exporter) noexcept
+    : m_exporter_address(metricAddress)
+    , m_exporter()
     , m_registry(new prometheus::Registry()) {
-    LOG4CXX_DEBUG(MainLogger, "Started metric exporter on " << metricAddress);
-    m_exporter.RegisterCollectable(m_registry);
-
-//    prometheus::Family<prometheus::Counter> &m_errors_family = prometheus::BuildCounter()
-//            .Name("driveshaft_errors")
-//            .Help("error when processing a job, includes driveshaft_http_errors and driveshaft_timeouts")
-//            .Labels({})
-//            .Register(*m_registry);
+    if (start_exporter) {
+        startExporter();
+    }
+}
 
+void MetricProxy::startExporter() noexcept {
+    if (m_exporter) {
+        return;
+    }
 
+    try {
+        m_exporter.reset(new prometheus::Exposer(m_exporter_address));
+    } catch (std::exception& e) {
+        LOG4CXX_ERROR(MainLogger, "Unable to start metric exporter on " << m_exporter_address << ": " << e.what());
+        return;
+    }
 
+    LOG4CXX_DEBUG(MainLogger, "Started metric exporter on " << m_exporter_address);
+    m_exporter->RegisterCollectable(m_registry);
 }
 
 MetricProxy::~MetricProxy() noexcept {
@@ -75,6 +84,19 @@ void MetricProxy::reportJobError(const std::string &pool_name, const std::string
     counter.Increment();
 }
 
+void MetricProxy::reportJobRetry(const std::string &pool_name, const std::string &function_name) noexcept {
+    auto& counter = m_retries_family.Add({{"pool", pool_name},
+                                          {"function", function_name}});
+    counter.Increment();
+}
+
+void MetricProxy::reportJobRetryDenied(const std::string &pool_name, const std::string &function_name, const std::string &reason) noexcept {
+    auto& counter = m_retries_denied_family.Add({{"pool", pool_name},
+                                                 {"function", function_name},
+                                                 {"reason", reason}});
+    counter.Increment();
+}
+
 void MetricProxy::reportThreadStartingWork(const std::string &pool_name, const std::string &function_name) noexcept {
     auto& active = m_threads_family.Add({{"pool", pool_name},
                                          {"function", function_name},
@@ -111,4 +133,60 @@ void MetricProxy::reportThreadEnded(const std::string &pool_name) noexcept {
     idle.Decrement();
 }
 
+void MetricProxy::reportCircuitBreakerTransition(const std::string &pool_name, const std::string &from_state, const std::string &to_state) noexcept {
+    auto& from = m_circuit_breaker_state_family.Add({{"pool", pool_name},
+                                                     {"state", from_state}});
+
+    auto& to = m_circuit_breaker_state_family.Add({{"pool", pool_name},
+                                                   {"state", to_state}});
+
+    from.Set(0);
+    to.Set(1);
+
+    if (to_state == "open") {
+        auto& trips = m_circuit_breaker_trips_family.Add({{"pool", pool_name}});
+        trips.Increment();
+    }
+}
+
+void MetricProxy::reportBackpressurePause(const std::string &pool_name, const std::string &reason, double duration) noexcept {
+    auto& pauses = m_backpressure_pauses_family.Add({{"pool", pool_name},
+                                                     {"reason", reason}});
+
+    auto& seconds = m_backpressure_pause_seconds_family.Add({{"pool", pool_name},
+                                                             {"reason", reason}});
+
+    pauses.Increment();
+    seconds.Increment(duration);
+}
+
+void MetricProxy::reportConcurrencyLimit(const std::string &pool_name, uint32_t limit) noexcept {
+    auto& gauge = m_concurrency_limit_family.Add({{"pool", pool_name}});
+    gauge.Set(limit);
+}
+
+void MetricProxy::reportThrottled(const std::string &pool_name, const std::string &limit_name, double duration) noexcept {
+    auto& counter = m_throttled_seconds_family.Add({{"pool", pool_name},
+                                                    {"limit", limit_name}});
+    counter.Increment(duration);
+}
+
+void MetricProxy::reportReconnect(const std::string &pool_name) noexcept {
+    m_reconnects_family.Add({{"pool", pool_name}}).Increment();
+}
+
+void MetricProxy::reportQueueStatus(const std::string &function_name, uint64_t queued, uint64_t running, uint64_t available_workers) noexcept {
+    m_queued_jobs_family.Add({{"function", function_name}}).Set(queued);
+    m_running_jobs_family.Add({{"function", function_name}}).Set(running);
+    m_available_workers_family.Add({{"function", function_name}}).Set(available_workers);
+}
+
+void MetricProxy::reportTimeToCapacity(double duration) noexcept {
+    m_time_to_capacity_family.Add({}).Set(duration);
+}
+
+void MetricProxy::reportScaleDown(const std::string &pool_name, double duration) noexcept {
+    m_scale_down_seconds_family.Add({{"pool", pool_name}}).Set(duration);
+}
+
 }
@@ -32,6 +32,7 @@
 #include <prometheus/histogram.h>
 #include <prometheus/gauge.h>
 #include <stack>
+#include <memory>
 
 #include "common-defs.h"
 
@@ -45,28 +46,54 @@ public:
     virtual void reportHttpJobError(const std::string &pool_name, const std::string &function_name, uint16_t http_status) noexcept = 0;
     virtual void reportJobTimeout(const std::string &pool_name, const std::string &function_name) noexcept = 0;
     virtual void reportJobError(const std::string &pool_name, const std::string &function_name) noexcept = 0;
+    virtual void reportJobRetry(const std::string &pool_name, const std::string &function_name) noexcept = 0;
+    virtual void reportJobRetryDenied(const std::string &pool_name, const std::string &function_name, const std::string &reason) noexcept = 0;
 
     virtual void reportThreadStarted(const std::string &pool_name) noexcept = 0;
     virtual void reportThreadEnded(const std::string &pool_name) noexcept = 0;
     virtual void reportThreadStartingWork(const std::string &pool_name, const std::string &function_name) noexcept = 0;
     virtual void reportThreadWorkComplete(const std::string &pool_name, const std::string &function_name) noexcept = 0;
+
+    virtual void reportCircuitBreakerTransition(const std::string &pool_name, const std::string &from_state, const std::string &to_state) noexcept = 0;
+    virtual void reportBackpressurePause(const std::string &pool_name, const std::string &reason, double duration) noexcept = 0;
+    virtual void reportConcurrencyLimit(const std::string &pool_name, uint32_t limit) noexcept = 0;
+    virtual void reportThrottled(const std::string &pool_name, const std::string &limit_name, double duration) noexcept = 0;
+    virtual void reportReconnect(const std::string &pool_name) noexcept = 0;
+
+    virtual void reportQueueStatus(const std::string &function_name, uint64_t queued, uint64_t running, uint64_t available_workers) noexcept = 0;
+    virtual void reportTimeToCapacity(double duration) noexcept = 0;
+    virtual void reportScaleDown(const std::string &pool_name, double duration) noexcept = 0;
 };
 
 class MetricProxy : public MetricProxyInterface {
 public:
-    explicit MetricProxy(const std::string &metricAddress) noexcept;
+    // Without start_exporter nothing listens until startExporter is called
+    explicit MetricProxy(const std::string &metricAddress, bool start_exporter = true) noexcept;
     ~MetricProxy() noexcept override;
 
+    void startExporter() noexcept;
+
     void reportJobSuccess(const std::string &pool_name, const std::string &function_name, double duration) noexcept override;
     void reportHttpJobError(const std::string &pool_name, const std::string &function_name, uint16_t http_status) noexcept override;
     void reportJobTimeout(const std::string &pool_name, const std::string &function_name) noexcept override;
     void reportJobError(const std::string &pool_name, const std::string &function_name) noexcept override;
+    void reportJobRetry(const std::string &pool_name, const std::string &function_name) noexcept override;
+    void reportJobRetryDenied(const std::string &pool_name, const std::string &function_name, const std::string &reason) noexcept override;
 
     void reportThreadStarted(const std::string &pool_name) noexcept override;
     void reportThreadEnded(const std::string &pool_name) noexcept override;
     void reportThreadStartingWork(const std::string &pool_name, const std::string &function_name) noexcept override;
     void reportThreadWorkComplete(const std::string &pool_name, const std::string &function_name) noexcept override;
 
+    void reportCircuitBreakerTransition(const std::string &pool_name, const std::string &from_state, const std::string &to_state) noexcept override;
+    void reportBackpressurePause(const std::string &pool_name, const std::string &reason, double duration) noexcept override;
+    void reportConcurrencyLimit(const std::string &pool_name, uint32_t limit) noexcept override;
+    void reportThrottled(const std::string &pool_name, const std::string &limit_name, double duration) noexcept override;
+    void reportReconnect(const std::string &pool_name) noexcept override;
+
+    void reportQueueStatus(const std::string &function_name, uint64_t queued, uint64_t running, uint64_t available_workers) noexcept override;
+    void reportTimeToCapacity(double duration) noexcept override;
+    void reportScaleDown(const std::string &pool_name, double duration) noexcept override;
 
     // Disable copying
     MetricProxy(const MetricProxy&) = delete;
@@ -75,7 +102,8 @@ public:
     MetricProxy& operator=(const MetricProxy&&) = delete;
 
 private:
-    prometheus::Exposer m_exporter;
+    const std::string m_exporter_address;
+    std::unique_ptr<prometheus::Exposer> m_exporter;
     std::shared_ptr<prometheus::Registry> m_registry;
 
     const prometheus::Histogram::BucketBoundaries m_job_duration_bucket_boundaries =
@@ -105,11 +133,95 @@ private:
             .Labels({})
             .Register(*m_registry);
 
+    prometheus::Family<prometheus::Counter> &m_retries_family = prometheus::BuildCounter()
+            .Name("driveshaft_retries")
+            .Help("transient endpoint failures retried locally instead of failing the job")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Counter> &m_retries_denied_family = prometheus::BuildCounter()
+            .Name("driveshaft_retries_denied")
+            .Help("retriable failures that were not retried because of the retry budget or the job deadline")
+            .Labels({})
+            .Register(*m_registry);
+
     prometheus::Family<prometheus::Gauge> &m_threads_family = prometheus::BuildGauge()
             .Name("driveshaft_threads")
             .Help("tracks threads by pool and function including their working/idle status")
             .Labels({})
             .Register(*m_registry);
+
+    prometheus::Family<prometheus::Gauge> &m_circuit_breaker_state_family = prometheus::BuildGauge()
+            .Name("driveshaft_circuit_breaker_state")
+            .Help("1 for the current circuit breaker state of a pool (closed, open or half_open), 0 otherwise")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Counter> &m_circuit_breaker_trips_family = prometheus::BuildCounter()
+            .Name("driveshaft_circuit_breaker_trips")
+            .Help("number of times a pool's circuit breaker has opened")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Counter> &m_backpressure_pauses_family = prometheus::BuildCounter()
+            .Name("driveshaft_backpressure_pauses")
+            .Help("times a pool stopped grabbing jobs because the endpoint was overloaded or slow")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Counter> &m_backpressure_pause_seconds_family = prometheus::BuildCounter()
+            .Name("driveshaft_backpressure_pause_seconds")
+            .Help("total length of the pauses counted in driveshaft_backpressure_pauses")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Gauge> &m_concurrency_limit_family = prometheus::BuildGauge()
+            .Name("driveshaft_concurrency_limit")
+            .Help("how many of a pool's workers may grab jobs at once under adaptive concurrency")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Counter> &m_throttled_seconds_family = prometheus::BuildCounter()
+            .Name("driveshaft_throttled_seconds")
+            .Help("time workers spent waiting on a rate limit instead of grabbing jobs")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Counter> &m_reconnects_family = prometheus::BuildCounter()
+            .Name("driveshaft_gearman_reconnects")
+            .Help("times a worker rebuilt its gearmand connections after losing them")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Gauge> &m_queued_jobs_family = prometheus::BuildGauge()
+            .Name("driveshaft_gearman_queued_jobs")
+            .Help("jobs waiting in gearmand for a worker, summed over all servers")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Gauge> &m_running_jobs_family = prometheus::BuildGauge()
+            .Name("driveshaft_gearman_running_jobs")
+            .Help("jobs gearmand has handed to a worker, summed over all servers")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Gauge> &m_available_workers_family = prometheus::BuildGauge()
+            .Name("driveshaft_gearman_available_workers")
+            .Help("workers registered with gearmand for a function, summed over all servers")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Gauge> &m_time_to_capacity_family = prometheus::BuildGauge()
+            .Name("driveshaft_time_to_capacity_seconds")
+            .Help("seconds from startup until every configured worker thread was connected and ready")
+            .Labels({})
+            .Register(*m_registry);
+
+    prometheus::Family<prometheus::Gauge> &m_scale_down_seconds_family = prometheus::BuildGauge()
+            .Name("driveshaft_scale_down_seconds")
+            .Help("seconds the last shrink of a pool took until every thread told to stop had exited")
+            .Labels({})
+            .Register(*m_registry);
 };
 
 typedef std::shared_ptr<MetricProxyInterface> MetricProxyPtr;
@@ -139,6 +251,22 @@ public:
         m_metric_proxy->reportJobError(m_pool_name, function_name);
     }
 
+    void reportJobRetry(const std::string &function_name) noexcept {
+        m_metric_proxy->reportJobRetry(m_pool_name, function_name);
+    }
+
+    void reportJobRetryDenied(const std::string &function_name, const std::string &reason) noexcept {
+        m_metric_proxy->reportJobRetryDenied(m_pool_name, function_name, reason);
+    }
+
+    void reportThrottled(const std::string &limit_name, double duration) noexcept {
+        m_metric_proxy->reportThrottled(m_pool_name, limit_name, duration);
+    }
+
+    void reportReconnect() noexcept {
+        m_metric_proxy->reportReconnect(m_pool_name);
+    }
+
     void reportThreadStarted() noexcept {
         m_metric_proxy->reportThreadStarted(m_pool_name);
     }
@@ -0,0 +1,344 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "native-gearman-worker.h"
+#include "job-fetcher.h"
+
+namespace Driveshaft {
+
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+// A job assigned on a connection, pointing straight into its read buffer
+class NativeJob : public FetchedJob {
+public:
+    explicit NativeJob(const GearmanPacket& packet) noexcept
+        : FetchedJob(nullptr)
+        , m_packet(packet)
+        , m_uniq(packet.type == GearmanPacketType::JOB_ASSIGN_UNIQ) {}
+
+    const char* functionName() const noexcept override {
+        return m_packet.args[1].data;
+    }
+    const char* handle() const noexcept override {
+        return m_packet.args[0].data;
+    }
+    const char* unique() const noexcept override {
+        return m_uniq ? m_packet.args[2].data : "";
+    }
+    const char* workload() const noexcept override {
+        return m_packet.args[m_packet.arg_count - 1].data;
+    }
+    size_t workloadSize() const noexcept override {
+        return m_packet.args[m_packet.arg_count - 1].size;
+    }
+
+private:
+    const GearmanPacket& m_packet;
+    const bool m_uniq;
+};
+
+NativeGearmanWorker::NativeGearmanWorker(GearmanJobHandler handler, int timeout_ms,
+                                         const std::string& client_id, const GearmanProbeOptions& probe) noexcept
+    : m_handler(handler)
+    , m_timeout_ms(timeout_ms)
+    , m_client_id(client_id)
+    , m_probe(probe)
+    , m_functions()
+    , m_connections()
+    , m_next(0)
+    , m_error()
+    , m_answered(false) {
+}
+
+NativeGearmanWorker::~NativeGearmanWorker() noexcept {
+}
+
+gearman_return_t NativeGearmanWorker::addServers(const std::string& servers) {
+    for (const auto& server : expand_gearman_servers({servers})) {
+        m_connections.emplace_back(new GearmanConnection(server, m_probe, -1,
+            [this](GearmanConnection& conn, const std::string& reason) {
+                LOG4CXX_WARN(ThreadLogger, "Lost gearmand server " << conn.server << ": " << reason);
+                m_error = conn.server + ": " + reason;
+            }));
+    }
+    return GEARMAN_SUCCESS;
+}
+
+gearman_return_t NativeGearmanWorker::addFunction(const std::string& function_name) {
+    if (m_functions.insert(function_name).second) {
+        broadcast(GearmanPacketType::CAN_DO, function_name);
+    }
+    return GEARMAN_SUCCESS;
+}
+
+gearman_return_t NativeGearmanWorker::removeFunction(const std::string& function_name) {
+    if (m_functions.erase(function_name) > 0) {
+        broadcast(GearmanPacketType::CANT_DO, function_name);
+    }
+    return GEARMAN_SUCCESS;
+}
+
+// Tells every connected server, so throttling takes effect right away
+void NativeGearmanWorker::broadcast(GearmanPacketType type, const std::string& function_name) noexcept {
+    for (auto& conn : m_connections) {
+        if (conn->fd >= 0 && conn->state != GearmanConnection::State::CONNECTING) {
+            append_gearman_request(conn->out, type, {function_name});
+            conn->flush();
+        }
+    }
+}
+
+gearman_return_t NativeGearmanWorker::work() {
+    if (m_connections.empty()) {
+        m_error = "No servers added";
+        return GEARMAN_NO_SERVERS;
+    }
+
+    auto now = steady_clock::now();
+    for (size_t n = 0; n < m_connections.size(); n++) {
+        size_t index = (m_next + n) % m_connections.size();
+        GearmanConnection& conn = *m_connections[index];
+        if (conn.state == GearmanConnection::State::DISCONNECTED) {
+            if (!conn.reconnectDue(now) || !conn.connect()) {
+                continue; // Backing off
+            }
+        }
+        if (conn.state == GearmanConnection::State::CONNECTING && !finishConnect(conn)) {
+            continue;
+        }
+        if (!conn.fill()) {
+            continue;
+        }
+
+        size_t offset = 0;
+        bool ran = false;
+        gearman_return_t job_ret = GEARMAN_SUCCESS;
+        GearmanPacket packet;
+        while (conn.fd >= 0 && !ran) {
+            ssize_t used = parse_gearman_response(conn.in.data() + offset, conn.in.size() - offset, packet);
+            if (used < 0) {
+                conn.disconnect("corrupt packet");
+                break;
+            }
+            if (used == 0) {
+                break;
+            }
+            m_answered = m_answered || packet.type != GearmanPacketType::ERROR;
+
+            switch (packet.type) {
+            case GearmanPacketType::NOOP:
+                if (conn.state == GearmanConnection::State::SLEEPING) {
+                    conn.state = GearmanConnection::State::IDLE;
+                }
+                break;
+
+            case GearmanPacketType::NO_JOB:
+                append_gearman_request(conn.out, GearmanPacketType::PRE_SLEEP);
+                conn.state = GearmanConnection::State::SLEEPING;
+                break;
+
+            case GearmanPacketType::JOB_ASSIGN:
+            case GearmanPacketType::JOB_ASSIGN_UNIQ:
+                conn.state = GearmanConnection::State::IDLE;
+                job_ret = runJob(conn, packet);
+                ran = true;
+                break;
+
+            case GearmanPacketType::ERROR:
+                conn.disconnect("gearmand error " + packet.args[0].str() + ": " + packet.args[1].str());
+                break;
+
+            default:
+                break;
+            }
+            offset += used;
+        }
+
+        // The job ran even if sending its result lost the connection
+        if (ran) {
+            m_next = index + 1;
+            if (conn.fd >= 0) {
+                conn.in.erase(0, offset);
+            }
+            return job_ret;
+        }
+
+        if (conn.fd < 0) {
+            continue;
+        }
+
+        conn.in.erase(0, offset);
+
+        if (conn.state == GearmanConnection::State::IDLE) {
+            append_gearman_request(conn.out, GearmanPacketType::GRAB_JOB_UNIQ);
+            conn.state = GearmanConnection::State::GRABBING;
+        }
+        if (conn.check(now)) {
+            conn.flush();
+        }
+    }
+
+    return GEARMAN_IO_WAIT;
+}
+
+gearman_return_t NativeGearmanWorker::wait() {
+    std::vector<struct pollfd> fds;
+    int timeout = m_timeout_ms;
+    auto now = steady_clock::now();
+    for (const auto& conn : m_connections) {
+        if (conn->fd >= 0) {
+            short events = POLLIN;
+            if (conn->state == GearmanConnection::State::CONNECTING || conn->out_sent < conn->out.size()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({conn->fd, events, 0});
+        }
+
+        // Wake up in time to reconnect, to give up connecting, or to probe
+        auto left = duration_cast<milliseconds>(conn->nextCheck() - now).count() + 1;
+        timeout = std::min<int64_t>(timeout, std::max<int64_t>(left, 0));
+    }
+
+    if (fds.empty()) {
+        std::this_thread::sleep_for(milliseconds(timeout));
+        return GEARMAN_TIMEOUT;
+    }
+
+    int rc = poll(fds.data(), fds.size(), timeout);
+    if (rc > 0) {
+        return GEARMAN_SUCCESS;
+    }
+    if (rc == 0 || errno == EINTR) {
+        return GEARMAN_TIMEOUT;
+    }
+
+    m_error = std::string("poll failed: ") + strerror(errno);
+    return GEARMAN_ERRNO;
+}
+
+const char* NativeGearmanWorker::error() const noexcept {
+    return m_error.c_str();
+}
+
+// false while the connection is not usable yet
+bool NativeGearmanWorker::finishConnect(GearmanConnection& conn) noexcept {
+    struct pollfd pfd = {conn.fd, POLLOUT, 0};
+    if (poll(&pfd, 1, 0) <= 0) {
+        conn.check(steady_clock::now());
+        return false;
+    }
+
+    if (!conn.finishConnect()) {
+        return false;
+    }
+
+    onConnected(conn);
+    return conn.fd >= 0;
+}
+
+void NativeGearmanWorker::onConnected(GearmanConnection& conn) noexcept {
+    LOG4CXX_DEBUG(ThreadLogger, "Connected to gearmand server " << conn.server);
+    if (!m_client_id.empty()) {
+        append_gearman_request(conn.out, GearmanPacketType::SET_CLIENT_ID, {m_client_id});
+    }
+    for (const auto& function_name : m_functions) {
+        append_gearman_request(conn.out, GearmanPacketType::CAN_DO, {function_name});
+    }
+    conn.flush();
+}
+
+gearman_return_t NativeGearmanWorker::runJob(GearmanConnection& conn, const GearmanPacket& packet) noexcept {
+    NativeJob job(packet);
+    std::string result;
+    gearman_return_t ret = m_handler(job, result);
+    sendResult(conn, packet.args[0], ret, result);
+
+    // Like libgearman, work() reports any failure the handler returns as a failed job
+    return ret == GEARMAN_SUCCESS ? GEARMAN_SUCCESS : GEARMAN_WORK_FAIL;
+}
+
+/* Gathers the header and handle with the result instead of copying the result
+ * into the write buffer. Only what the socket does not take is copied.
+ */
+bool NativeGearmanWorker::sendResult(GearmanConnection& conn, const GearmanArg& handle, gearman_return_t ret,
+                                     const std::string& result) noexcept {
+    static const std::string empty;
+    bool ok = (ret == GEARMAN_SUCCESS);
+    std::string head;
+    if (ok) {
+        append_gearman_header(head, GearmanPacketType::WORK_COMPLETE, handle.size + 1 + result.size());
+        head.append(handle.data, handle.size);
+        head.push_back('\0');
+    } else {
+        append_gearman_request(head, GearmanPacketType::WORK_FAIL, {handle});
+    }
+    const std::string& body = ok ? result : empty;
+
+    if (conn.out_sent < conn.out.size()) {
+        conn.out.append(head);
+        conn.out.append(body);
+        return conn.flush();
+    }
+
+    struct iovec iov[2] = {
+        {const_cast<char*>(head.data()), head.size()},
+        {const_cast<char*>(body.data()), body.size()}
+    };
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        conn.disconnect(std::string("write failed: ") + strerror(errno));
+        return false;
+    }
+
+    size_t done = sent < 0 ? 0 : sent;
+    if (done < head.size()) {
+        conn.out.assign(head, done, std::string::npos);
+        conn.out.append(body);
+    } else if (done < head.size() + body.size()) {
+        conn.out.assign(body, done - head.size(), std::string::npos);
+    }
+    conn.out_sent = 0;
+    return true;
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,91 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_NATIVE_GEARMAN_WORKER_H_
+#define incl_DRIVESHAFT_NATIVE_GEARMAN_WORKER_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "common-defs.h"
+#include "gearman-worker.h"
+#include "gearman-protocol.h"
+
+namespace Driveshaft {
+
+/* Speaks the gearman worker protocol over non-blocking sockets without
+ * libgearman. A job is run straight out of the read buffer, and its result is
+ * written from the string processJob filled in, so workloads and results are
+ * never copied on their way through. A lost server is reconnected to from
+ * work() after a jittered exponential backoff while the others keep serving.
+ * A server that goes quiet is probed with ECHO_REQ and dropped if it does not
+ * answer, so a host that vanished without a FIN is noticed well before the
+ * loop timeout.
+ */
+class NativeGearmanWorker : public GearmanWorkerInterface {
+public:
+    NativeGearmanWorker(GearmanJobHandler handler, int timeout_ms, const std::string& client_id,
+                        const GearmanProbeOptions& probe = GearmanProbeOptions()) noexcept;
+    ~NativeGearmanWorker() noexcept;
+
+    gearman_return_t addServers(const std::string& servers) override;
+    gearman_return_t addFunction(const std::string& function_name) override;
+    gearman_return_t removeFunction(const std::string& function_name) override;
+    gearman_return_t work() override;
+    gearman_return_t wait() override;
+    const char* error() const noexcept override;
+    bool answered() const noexcept override {
+        return m_answered;
+    }
+
+private:
+    NativeGearmanWorker() = delete;
+    NativeGearmanWorker(const NativeGearmanWorker&) = delete;
+    NativeGearmanWorker(NativeGearmanWorker&&) = delete;
+    NativeGearmanWorker& operator=(const NativeGearmanWorker&) = delete;
+    NativeGearmanWorker& operator=(const NativeGearmanWorker&&) = delete;
+
+    bool finishConnect(GearmanConnection& conn) noexcept;
+    void onConnected(GearmanConnection& conn) noexcept;
+    bool sendResult(GearmanConnection& conn, const GearmanArg& handle, gearman_return_t ret,
+                    const std::string& result) noexcept;
+    gearman_return_t runJob(GearmanConnection& conn, const GearmanPacket& packet) noexcept;
+    void broadcast(GearmanPacketType type, const std::string& function_name) noexcept;
+
+    GearmanJobHandler m_handler;
+    const int m_timeout_ms;
+    const std::string m_client_id;
+    const GearmanProbeOptions m_probe;
+    StringSet m_functions;
+    std::vector<std::unique_ptr<GearmanConnection>> m_connections;
+    size_t m_next; // connection to look at first, so one busy server does not starve the rest
+    std::string m_error;
+    bool m_answered; // a server sent something other than an error
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_NATIVE_GEARMAN_WORKER_H_
@@ -0,0 +1,146 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include "pool-context.h"
+
+namespace Driveshaft {
+
+PoolContext::PoolContext(const std::string& pool_name, const std::string& uri, const StringSet& jobs_list,
+                         const PoolOptions& options, MetricProxyPtr metrics) noexcept
+                         : m_pool_name(pool_name)
+                         , m_config(new PoolConfigSnapshot{uri, jobs_list, 0})
+                         , m_config_generation(0)
+                         , m_options(new PoolOptions(options))
+                         , m_circuit_breaker(nullptr)
+                         , m_retry_budget(nullptr)
+                         , m_backpressure(nullptr)
+                         , m_concurrency_limiter(nullptr)
+                         , m_rate_limiter(nullptr)
+                         , m_function_rate_limiters()
+                         , m_fetchers(nullptr)
+                         , m_reactor(nullptr)
+                         , m_fetch_server_list()
+                         , m_fetch_jobs_list()
+                         , m_shard_mutex()
+                         , m_shard_slots() {
+    if (options.circuit_breaker.failure_threshold > 0) {
+        m_circuit_breaker.reset(new CircuitBreaker(pool_name, options.circuit_breaker, metrics));
+    }
+
+    if (options.retryEnabled()) {
+        m_retry_budget.reset(new RetryBudget(options.retry_budget_percent));
+    }
+
+    if (options.backpressure.pause_ms > 0) {
+        m_backpressure.reset(new Backpressure(pool_name, options.backpressure, metrics));
+    }
+
+    if (options.concurrency_limit.max_limit > 0) {
+        m_concurrency_limiter.reset(new ConcurrencyLimiter(pool_name, options.concurrency_limit, metrics));
+    }
+
+    if (options.rate_limit.jobs_per_second > 0) {
+        m_rate_limiter.reset(new TokenBucket(options.rate_limit));
+    }
+
+    for (const auto& i : options.function_rate_limit) {
+        if (i.second.jobs_per_second > 0) {
+            m_function_rate_limiters[i.first].reset(new TokenBucket(i.second));
+        }
+    }
+
+    if (options.fetch_queue.reactor) {
+        m_reactor.reset(new PoolReactor(pool_name, options.fetch_queue, options.gearmand_probe, metrics));
+    } else if (options.fetch_queue.fetchers > 0) {
+        m_fetchers.reset(new JobFetcherGroup(pool_name, options.fetch_queue));
+    }
+}
+
+void PoolContext::reconfigure(const std::string& uri, const StringSet& jobs_list) noexcept {
+    if (config()->uri != uri) {
+        if (m_circuit_breaker) {
+            m_circuit_breaker->reset();
+        }
+        if (m_backpressure) {
+            m_backpressure->reset();
+        }
+        if (m_concurrency_limiter) {
+            m_concurrency_limiter->reset();
+        }
+    }
+
+    uint64_t generation = m_config_generation.load(std::memory_order_relaxed) + 1;
+    PoolConfigSnapshotPtr config(new PoolConfigSnapshot{uri, jobs_list, generation});
+    std::atomic_store(&m_config, config);
+    m_config_generation.store(generation, std::memory_order_release);
+}
+
+void PoolContext::retune(const PoolOptions& options) noexcept {
+    if (m_retry_budget) {
+        m_retry_budget->setBudgetPercent(options.retry_budget_percent);
+    }
+
+    if (m_backpressure) {
+        m_backpressure->setOptions(options.backpressure);
+    }
+
+    std::atomic_store(&m_options, PoolOptionsPtr(new PoolOptions(options)));
+}
+
+void PoolContext::startFetchers(const StringSet& server_list, const StringSet& jobs_list) {
+    if (!m_options->fetch_queue.enabled() || !m_fetch_server_list.empty()) {
+        return;
+    }
+
+    m_fetch_server_list = server_list;
+    m_fetch_jobs_list = jobs_list;
+    if (m_reactor) {
+        m_reactor->start(server_list, jobs_list);
+    } else {
+        m_fetchers->start(server_list, jobs_list);
+    }
+}
+
+uint32_t PoolContext::acquireShardSlot() noexcept {
+    std::lock_guard<std::mutex> lock(m_shard_mutex);
+    auto free_slot = std::find(m_shard_slots.begin(), m_shard_slots.end(), false);
+    uint32_t slot = free_slot - m_shard_slots.begin();
+    if (free_slot == m_shard_slots.end()) {
+        m_shard_slots.push_back(true);
+    } else {
+        *free_slot = true;
+    }
+    return slot;
+}
+
+void PoolContext::releaseShardSlot(uint32_t slot) noexcept {
+    std::lock_guard<std::mutex> lock(m_shard_mutex);
+    if (slot < m_shard_slots.size()) {
+        m_shard_slots[slot] = false;
+    }
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,185 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_POOL_CONTEXT_H_
+#define incl_DRIVESHAFT_POOL_CONTEXT_H_
+
+#include <string>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include "common-defs.h"
+#include "pool-options.h"
+#include "metric-proxy.h"
+#include "circuit-breaker.h"
+#include "retry-policy.h"
+#include "backpressure.h"
+#include "concurrency-limiter.h"
+#include "token-bucket.h"
+#include "job-fetcher.h"
+#include "pool-reactor.h"
+
+namespace Driveshaft {
+
+/* What the pool's workers serve. A config push that only changes these swaps
+ * in a new snapshot and each worker picks it up before its next job, so the
+ * pool keeps its threads and gearmand connections.
+ */
+struct PoolConfigSnapshot {
+    std::string uri;
+    StringSet jobs_list;
+    uint64_t generation;
+};
+
+typedef std::shared_ptr<const PoolConfigSnapshot> PoolConfigSnapshotPtr;
+typedef std::shared_ptr<const PoolOptions> PoolOptionsPtr;
+
+/* Runtime state shared by every GearmanClient serving a pool. The
+ * ThreadPoolWatcher owns one per running pool and hands it to each thread it
+ * starts, so a context outlives config changes until its last thread exits.
+ */
+class PoolContext {
+public:
+    PoolContext(const std::string& pool_name, const std::string& uri, const StringSet& jobs_list,
+                const PoolOptions& options, MetricProxyPtr metrics) noexcept;
+
+    const std::string& poolName() const noexcept {
+        return m_pool_name;
+    }
+
+    PoolConfigSnapshotPtr config() const noexcept {
+        return std::atomic_load(&m_config);
+    }
+
+    // Bumped by every reconfigure, so workers can cheaply tell they are current
+    uint64_t configGeneration() const noexcept {
+        return m_config_generation.load(std::memory_order_acquire);
+    }
+
+    /* Publishes a new uri and jobs list to the pool's running workers. What
+     * the pool learned about the old endpoint's health is dropped with it
+     */
+    void reconfigure(const std::string& uri, const StringSet& jobs_list) noexcept;
+
+    // Swapped by retune, so hold on to the snapshot rather than read it twice
+    PoolOptionsPtr options() const noexcept {
+        return std::atomic_load(&m_options);
+    }
+
+    /* Takes up options that differ only in what PoolOptions::needsRestart
+     * leaves out. Running workers use them from their next job.
+     */
+    void retune(const PoolOptions& options) noexcept;
+
+    // nullptr when the pool has no circuit breaker configured
+    CircuitBreaker* circuitBreaker() const noexcept {
+        return m_circuit_breaker.get();
+    }
+
+    // nullptr when no function of the pool is retried
+    RetryBudget* retryBudget() const noexcept {
+        return m_retry_budget.get();
+    }
+
+    // nullptr when the pool ignores endpoint overload signals
+    Backpressure* backpressure() const noexcept {
+        return m_backpressure.get();
+    }
+
+    // nullptr when every worker of the pool may grab jobs
+    ConcurrencyLimiter* concurrencyLimiter() const noexcept {
+        return m_concurrency_limiter.get();
+    }
+
+    // nullptr when the pool has no rate limit of its own
+    TokenBucket* rateLimiter() const noexcept {
+        return m_rate_limiter.get();
+    }
+
+    // nullptr when the function is not rate limited
+    TokenBucket* functionRateLimiter(const std::string& function_name) const noexcept {
+        auto found = m_function_rate_limiters.find(function_name);
+        return found == m_function_rate_limiters.end() ? nullptr : found->second.get();
+    }
+
+    const std::map<std::string, std::unique_ptr<TokenBucket>>& functionRateLimiters() const noexcept {
+        return m_function_rate_limiters;
+    }
+
+    // nullptr when each worker grabs its own jobs
+    JobQueue* jobQueue() const noexcept {
+        if (m_reactor) {
+            return &m_reactor->queue();
+        }
+        return m_fetchers ? &m_fetchers->queue() : nullptr;
+    }
+
+    /* The lowest shard slot no running thread holds, so threads started after
+     * others exited fill their gaps and the servers stay evenly covered.
+     */
+    uint32_t acquireShardSlot() noexcept;
+    void releaseShardSlot(uint32_t slot) noexcept;
+
+    // Starts the pool's fetchers or reactor once. Does nothing without fetch_queue
+    void startFetchers(const StringSet& server_list, const StringSet& jobs_list);
+
+    // false when the fetchers grab from other servers or functions
+    bool fetchesFor(const StringSet& server_list, const StringSet& jobs_list) const noexcept {
+        return !m_options->fetch_queue.enabled() ||
+               (m_fetch_server_list == server_list && m_fetch_jobs_list == jobs_list);
+    }
+
+private:
+    PoolContext() = delete;
+    PoolContext(const PoolContext&) = delete;
+    PoolContext(PoolContext&&) = delete;
+    PoolContext& operator=(const PoolContext&) = delete;
+    PoolContext& operator=(const PoolContext&&) = delete;
+
+    const std::string m_pool_name;
+    PoolConfigSnapshotPtr m_config;
+    std::atomic<uint64_t> m_config_generation;
+    PoolOptionsPtr m_options;
+    std::unique_ptr<CircuitBreaker> m_circuit_breaker;
+    std::unique_ptr<RetryBudget> m_retry_budget;
+    std::unique_ptr<Backpressure> m_backpressure;
+    std::unique_ptr<ConcurrencyLimiter> m_concurrency_limiter;
+    std::unique_ptr<TokenBucket> m_rate_limiter;
+    std::map<std::string, std::unique_ptr<TokenBucket>> m_function_rate_limiters;
+    std::unique_ptr<JobFetcherGroup> m_fetchers;
+    std::unique_ptr<PoolReactor> m_reactor;
+    StringSet m_fetch_server_list;
+    StringSet m_fetch_jobs_list;
+    std::mutex m_shard_mutex;
+    std::vector<bool> m_shard_slots; // true while held
+};
+
+typedef std::shared_ptr<PoolContext> PoolContextPtr;
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_POOL_CONTEXT_H_
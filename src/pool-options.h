@@ -0,0 +1,316 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_POOL_OPTIONS_H_
+#define incl_DRIVESHAFT_POOL_OPTIONS_H_
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+namespace Driveshaft {
+
+/* Trips after failure_threshold consecutive endpoint failures. While open no
+ * jobs are grabbed for open_duration_ms, after which up to half_open_probes
+ * jobs are let through to test the endpoint. A failure_threshold of 0 disables
+ * the breaker.
+ */
+struct CircuitBreakerOptions {
+    uint32_t failure_threshold = 0;
+    uint32_t open_duration_ms = 10000;
+    uint32_t half_open_probes = 1;
+
+    bool operator==(const CircuitBreakerOptions& that) const noexcept {
+        return failure_threshold == that.failure_threshold &&
+               open_duration_ms == that.open_duration_ms &&
+               half_open_probes == that.half_open_probes;
+    }
+    bool operator!=(const CircuitBreakerOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+/* How often a job is sent to the endpoint when it fails with a connect error,
+ * 502/503/504 or 429. Backoff doubles from initial_backoff_ms up to
+ * max_backoff_ms with full jitter, and a Retry-After from the endpoint is
+ * capped at max_backoff_ms too. A max_attempts of 1 means no retries.
+ */
+struct RetryOptions {
+    uint32_t max_attempts = 1;
+    uint32_t initial_backoff_ms = 100;
+    uint32_t max_backoff_ms = 5000;
+
+    bool operator==(const RetryOptions& that) const noexcept {
+        return max_attempts == that.max_attempts &&
+               initial_backoff_ms == that.initial_backoff_ms &&
+               max_backoff_ms == that.max_backoff_ms;
+    }
+    bool operator!=(const RetryOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+/* Pauses job grabbing for the whole pool when the endpoint signals overload
+ * with a 429 or 503, honoring Retry-After and doubling the pause up to
+ * max_pause_ms while the signals keep coming. With latency_threshold_ms set,
+ * a smoothed response time above it pauses the pool too. A pause_ms of 0
+ * disables backpressure.
+ */
+struct BackpressureOptions {
+    uint32_t pause_ms = 0;
+    uint32_t max_pause_ms = 30000;
+    uint32_t latency_threshold_ms = 0;
+
+    bool operator==(const BackpressureOptions& that) const noexcept {
+        return pause_ms == that.pause_ms &&
+               max_pause_ms == that.max_pause_ms &&
+               latency_threshold_ms == that.latency_threshold_ms;
+    }
+    bool operator!=(const BackpressureOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+/* Bounds for the adaptive limit on how many of a pool's workers grab jobs at
+ * once. The limit starts at max_limit and follows the endpoint's latency: it
+ * shrinks once recent responses are slower than latency_tolerance_percent of
+ * the long-run average, and on errors. A max_limit of 0 disables the limiter
+ * and every worker grabs jobs.
+ */
+struct ConcurrencyLimitOptions {
+    uint32_t min_limit = 1;
+    uint32_t max_limit = 0;
+    uint32_t latency_tolerance_percent = 150;
+
+    bool operator==(const ConcurrencyLimitOptions& that) const noexcept {
+        return min_limit == that.min_limit &&
+               max_limit == that.max_limit &&
+               latency_tolerance_percent == that.latency_tolerance_percent;
+    }
+    bool operator!=(const ConcurrencyLimitOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+/* Token bucket refilled at jobs_per_second and holding up to burst tokens. A
+ * burst of 0 means one second's worth. A jobs_per_second of 0 means no limit.
+ */
+struct RateLimitOptions {
+    double jobs_per_second = 0;
+    uint32_t burst = 0;
+
+    bool operator==(const RateLimitOptions& that) const noexcept {
+        return jobs_per_second == that.jobs_per_second &&
+               burst == that.burst;
+    }
+    bool operator!=(const RateLimitOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+/* Sizes the pool from the gearmand queues of its functions instead of a fixed
+ * worker_count: one worker per jobs_per_worker queued or running jobs, kept
+ * between min_workers and max_workers. A max_workers of 0 disables it. The
+ * queues are cluster-wide, so with the pool running on several driveshaft
+ * hosts each one takes its 1/hosts share of them.
+ */
+struct AutoscaleOptions {
+    uint32_t min_workers = 1;
+    uint32_t max_workers = 0;
+    uint32_t jobs_per_worker = 1;
+    uint32_t hosts = 1;
+
+    bool operator==(const AutoscaleOptions& that) const noexcept {
+        return min_workers == that.min_workers &&
+               max_workers == that.max_workers &&
+               jobs_per_worker == that.jobs_per_worker &&
+               hosts == that.hosts;
+    }
+    bool operator!=(const AutoscaleOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+/* Splits grabbing jobs from running them. fetchers connections per server
+ * grab jobs into a queue holding up to capacity jobs, and the pool's
+ * worker_count threads only run them. With reactor set a single epoll thread
+ * keeps one connection per server instead. A fetchers of 0 without reactor
+ * keeps one connection per worker thread.
+ */
+struct FetchQueueOptions {
+    uint32_t fetchers = 0;
+    uint32_t capacity = 64;
+    bool reactor = false;
+
+    bool enabled() const noexcept {
+        return fetchers > 0 || reactor;
+    }
+
+    bool operator==(const FetchQueueOptions& that) const noexcept {
+        return fetchers == that.fetchers &&
+               capacity == that.capacity &&
+               reactor == that.reactor;
+    }
+    bool operator!=(const FetchQueueOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+enum class SchedulingPolicy {
+    OTHER, // the default time-sharing policy
+    BATCH, // CPU-bound work that can wait, never preempting interactive threads
+    IDLE // runs only when nothing else wants the CPU
+};
+
+/* Where and how eagerly the pool's worker threads run. They are pinned to
+ * cpus, or to those of numa_node, and allocate from numa_node's memory when
+ * it can. A numa_node of -1 and a nice of 0 leave the thread as it started.
+ */
+struct SchedulingOptions {
+    std::set<uint32_t> cpus;
+    int32_t numa_node = -1;
+    int32_t nice = 0;
+    SchedulingPolicy policy = SchedulingPolicy::OTHER;
+
+    bool enabled() const noexcept {
+        return !cpus.empty() || numa_node >= 0 || nice != 0 || policy != SchedulingPolicy::OTHER;
+    }
+
+    bool operator==(const SchedulingOptions& that) const noexcept {
+        return cpus == that.cpus &&
+               numa_node == that.numa_node &&
+               nice == that.nice &&
+               policy == that.policy;
+    }
+    bool operator!=(const SchedulingOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+/* How the reactor and the native worker check a quiet gearmand connection.
+ * After interval_ms without a word from the server it is sent an ECHO_REQ,
+ * and dropped if nothing arrives within timeout_ms. A connection with jobs
+ * in flight is not dropped for that alone, since gearmand would hand those
+ * jobs out again. Keepalives and TCP_USER_TIMEOUT still catch a host that
+ * went away under it. An interval_ms of 0 leaves dead peers to those alone.
+ */
+struct GearmanProbeOptions {
+    uint32_t interval_ms = 30000;
+    uint32_t timeout_ms = 10000;
+
+    bool operator==(const GearmanProbeOptions& that) const noexcept {
+        return interval_ms == that.interval_ms &&
+               timeout_ms == that.timeout_ms;
+    }
+    bool operator!=(const GearmanProbeOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+// What each worker thread speaks to gearmand with when it grabs its own jobs
+enum class WorkerProtocol {
+    LIBGEARMAN,
+    NATIVE // see NativeGearmanWorker
+};
+
+/* Optional per-pool tuning read from the jobs config. Everything defaults to
+ * the behavior driveshaft had before the option existed.
+ */
+struct PoolOptions {
+    CircuitBreakerOptions circuit_breaker;
+    RetryOptions retry;
+    std::map<std::string, RetryOptions> function_retry; // overrides retry per function
+    uint32_t retry_budget_percent = 20; // retries allowed as a share of jobs
+    BackpressureOptions backpressure;
+    ConcurrencyLimitOptions concurrency_limit;
+    AutoscaleOptions autoscale;
+    RateLimitOptions rate_limit; // shared by every job of the pool
+    std::map<std::string, RateLimitOptions> function_rate_limit; // each on top of the pool's
+    FetchQueueOptions fetch_queue;
+    WorkerProtocol worker_protocol = WorkerProtocol::LIBGEARMAN;
+    GearmanProbeOptions gearmand_probe;
+    uint32_t servers_per_thread = 0; // 0 connects every thread to every server
+    SchedulingOptions scheduling;
+
+    const RetryOptions& retryOptions(const std::string& function_name) const noexcept {
+        auto found = function_retry.find(function_name);
+        return found == function_retry.end() ? retry : found->second;
+    }
+
+    bool retryEnabled() const noexcept {
+        if (retry.max_attempts > 1) {
+            return true;
+        }
+        for (const auto& i : function_retry) {
+            if (i.second.max_attempts > 1) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* Whether running threads have to be replaced to switch to that. Autoscale
+     * bounds, retry settings and backpressure tunables are retuned in place,
+     * but turning retries or backpressure on or off restarts the pool.
+     */
+    bool needsRestart(const PoolOptions& that) const noexcept {
+        return !(circuit_breaker == that.circuit_breaker &&
+                 retryEnabled() == that.retryEnabled() &&
+                 (backpressure.pause_ms > 0) == (that.backpressure.pause_ms > 0) &&
+                 concurrency_limit == that.concurrency_limit &&
+                 rate_limit == that.rate_limit &&
+                 function_rate_limit == that.function_rate_limit &&
+                 fetch_queue == that.fetch_queue &&
+                 worker_protocol == that.worker_protocol &&
+                 gearmand_probe == that.gearmand_probe &&
+                 servers_per_thread == that.servers_per_thread &&
+                 scheduling == that.scheduling);
+    }
+
+    bool operator==(const PoolOptions& that) const noexcept {
+        return circuit_breaker == that.circuit_breaker &&
+               retry == that.retry &&
+               function_retry == that.function_retry &&
+               retry_budget_percent == that.retry_budget_percent &&
+               backpressure == that.backpressure &&
+               concurrency_limit == that.concurrency_limit &&
+               autoscale == that.autoscale &&
+               rate_limit == that.rate_limit &&
+               function_rate_limit == that.function_rate_limit &&
+               fetch_queue == that.fetch_queue &&
+               worker_protocol == that.worker_protocol &&
+               gearmand_probe == that.gearmand_probe &&
+               servers_per_thread == that.servers_per_thread &&
+               scheduling == that.scheduling;
+    }
+    bool operator!=(const PoolOptions& that) const noexcept {
+        return !(*this == that);
+    }
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_POOL_OPTIONS_H_
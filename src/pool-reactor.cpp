@@ -0,0 +1,392 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include "pool-reactor.h"
+
+namespace Driveshaft {
+
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+// How often jobs that did not fit in the full queue are offered again, and a held queue looked at
+static const int REACTOR_PENDING_RETRY_MS = 100;
+static const int REACTOR_MAX_EVENTS = 64;
+
+// Keeps one copy of the packet's data, since the read buffer is reused
+class PoolReactor::Job : public FetchedJob {
+public:
+    Job(PoolReactor *reactor, GearmanConnection *connection, const GearmanPacket& packet) noexcept
+        : FetchedJob(reactor)
+        , connection(connection)
+        , generation(connection->generation) {
+        const GearmanArg& first = packet.args[0];
+        const GearmanArg& last = packet.args[packet.arg_count - 1];
+        m_data.assign(first.data, last.data + last.size - first.data);
+
+        bool uniq = (packet.type == GearmanPacketType::JOB_ASSIGN_UNIQ);
+        m_function = packet.args[1].data - first.data;
+        m_unique = uniq ? packet.args[2].data - first.data : std::string::npos;
+        m_workload = last.data - first.data;
+    }
+
+    const char* functionName() const noexcept override {
+        return m_data.c_str() + m_function;
+    }
+    const char* handle() const noexcept override {
+        return m_data.c_str();
+    }
+    const char* unique() const noexcept override {
+        return m_unique == std::string::npos ? "" : m_data.c_str() + m_unique;
+    }
+    const char* workload() const noexcept override {
+        return m_data.data() + m_workload;
+    }
+    size_t workloadSize() const noexcept override {
+        return m_data.size() - m_workload;
+    }
+    bool stale() const noexcept override {
+        return connection->generation.load() != generation;
+    }
+
+    GearmanConnection *connection;
+    const uint64_t generation;
+
+private:
+    // Arguments are NUL separated, so each but the workload is a C string
+    std::string m_data;
+    size_t m_function;
+    size_t m_unique;
+    size_t m_workload;
+};
+
+PoolReactor::PoolReactor(const std::string& pool_name, const FetchQueueOptions& options,
+                         const GearmanProbeOptions& probe, MetricProxyPtr metrics) noexcept
+    : m_pool_name(pool_name)
+    , m_queue(options.capacity)
+    , m_probe(probe)
+    , m_metrics(metrics)
+    , m_jobs_list()
+    , m_connections()
+    , m_pending()
+    , m_completed_mutex()
+    , m_completed()
+    , m_epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+    , m_wakeup_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    , m_stopping(false)
+    , m_started(false)
+    , m_thread() {
+    if (m_epoll_fd >= 0 && m_wakeup_fd >= 0) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_fd, &event) < 0) {
+            close(m_wakeup_fd);
+            m_wakeup_fd = -1;
+        }
+    }
+}
+
+PoolReactor::~PoolReactor() noexcept {
+    stop();
+
+    m_queue.abandonAll();
+    for (auto job : m_pending) {
+        delete job;
+    }
+    for (auto job : m_completed) {
+        delete job;
+    }
+    if (m_wakeup_fd >= 0) {
+        close(m_wakeup_fd);
+    }
+    if (m_epoll_fd >= 0) {
+        close(m_epoll_fd);
+    }
+}
+
+void PoolReactor::start(const StringSet& server_list, const StringSet& jobs_list) {
+    if (m_started) {
+        return;
+    }
+
+    if (m_epoll_fd < 0 || m_wakeup_fd < 0) {
+        LOG4CXX_ERROR(MainLogger, "Unable to set up the reactor for pool " << m_pool_name << ". errno: " << errno);
+        return;
+    }
+
+    m_jobs_list = jobs_list;
+    for (const auto& server : expand_gearman_servers(server_list)) {
+        m_connections.emplace_back(new GearmanConnection(server, m_probe, m_epoll_fd,
+            [this](GearmanConnection& conn, const std::string& reason) {
+                LOG4CXX_WARN(MainLogger, "Reactor for pool " << m_pool_name << " lost gearmand server " <<
+                                         conn.server << ": " << reason);
+            }));
+    }
+
+    m_started = true;
+    m_thread = std::thread(&PoolReactor::run, this);
+    LOG4CXX_INFO(MainLogger, "Started reactor for pool " << m_pool_name << " with " <<
+                             m_connections.size() << " connections");
+}
+
+void PoolReactor::stop() noexcept {
+    m_stopping = true;
+    if (m_thread.joinable()) {
+        uint64_t one = 1;
+        if (write(m_wakeup_fd, &one, sizeof(one)) < 0) {
+            LOG4CXX_ERROR(MainLogger, "Unable to wake the reactor for pool " << m_pool_name << ". errno: " << errno);
+        }
+        m_thread.join();
+    }
+}
+
+void PoolReactor::complete(FetchedJob *job) noexcept {
+    {
+        std::lock_guard<std::mutex> lock(m_completed_mutex);
+        m_completed.push_back(job);
+    }
+
+    uint64_t one = 1;
+    if (write(m_wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG4CXX_ERROR(MainLogger, "Unable to wake the reactor for pool " << m_pool_name << ". errno: " << errno);
+    }
+}
+
+void PoolReactor::abandon(FetchedJob *job) noexcept {
+    delete job;
+}
+
+void PoolReactor::run() noexcept {
+    for (auto& conn : m_connections) {
+        conn->connect();
+    }
+
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    while (!m_stopping) {
+        int count = epoll_wait(m_epoll_fd, events, REACTOR_MAX_EVENTS, nextTimeoutMs());
+        if (count < 0 && errno != EINTR) {
+            LOG4CXX_ERROR(MainLogger, "Reactor for pool " << m_pool_name << " failed to wait. errno: " << errno);
+            std::this_thread::sleep_for(milliseconds(REACTOR_PENDING_RETRY_MS));
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == nullptr) {
+                uint64_t value;
+                if (read(m_wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                    LOG4CXX_ERROR(MainLogger, "Reactor for pool " << m_pool_name << " failed to read wakeup. errno: " << errno);
+                }
+                sendCompletions();
+                continue;
+            }
+
+            GearmanConnection& conn = *static_cast<GearmanConnection*>(events[i].data.ptr);
+            uint32_t flags = events[i].events;
+            if (conn.fd < 0) {
+                continue; // Closed earlier in this batch
+            }
+
+            if (conn.state == GearmanConnection::State::CONNECTING) {
+                if (!(flags & (EPOLLOUT | EPOLLERR | EPOLLHUP)) || !conn.finishConnect()) {
+                    continue;
+                }
+                onConnected(conn);
+            }
+
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                onReadable(conn);
+            }
+            if (flags & EPOLLOUT) {
+                conn.flush();
+            }
+        }
+
+        auto now = steady_clock::now();
+        for (auto& conn : m_connections) {
+            if (conn->reconnectDue(now)) {
+                m_metrics->reportReconnect(m_pool_name);
+                conn->connect();
+            } else {
+                conn->check(now);
+            }
+        }
+
+        // Also resumes grabbing on connections left idle while the queue was held
+        pushPending();
+    }
+}
+
+void PoolReactor::onConnected(GearmanConnection& conn) noexcept {
+    LOG4CXX_INFO(MainLogger, "Reactor for pool " << m_pool_name << " connected to gearmand server " << conn.server);
+    append_gearman_request(conn.out, GearmanPacketType::SET_CLIENT_ID, {"driveshaft-" + m_pool_name});
+    for (const auto& function : m_jobs_list) {
+        append_gearman_request(conn.out, GearmanPacketType::CAN_DO, {function});
+    }
+    grab(conn);
+}
+
+void PoolReactor::onReadable(GearmanConnection& conn) noexcept {
+    if (!conn.fill()) {
+        return;
+    }
+
+    size_t offset = 0;
+    GearmanPacket packet;
+    while (conn.fd >= 0) {
+        ssize_t used = parse_gearman_response(conn.in.data() + offset, conn.in.size() - offset, packet);
+        if (used < 0) {
+            return conn.disconnect("corrupt packet");
+        }
+        if (used == 0) {
+            break;
+        }
+        offset += used;
+        onPacket(conn, packet);
+    }
+
+    if (conn.fd >= 0) {
+        conn.in.erase(0, offset);
+    }
+}
+
+void PoolReactor::onPacket(GearmanConnection& conn, const GearmanPacket& packet) noexcept {
+    switch (packet.type) {
+    case GearmanPacketType::NOOP:
+        if (conn.state == GearmanConnection::State::SLEEPING) {
+            grab(conn);
+        }
+        break;
+
+    case GearmanPacketType::NO_JOB:
+        m_queue.setConnected();
+        append_gearman_request(conn.out, GearmanPacketType::PRE_SLEEP);
+        conn.state = GearmanConnection::State::SLEEPING;
+        conn.flush();
+        break;
+
+    case GearmanPacketType::JOB_ASSIGN:
+    case GearmanPacketType::JOB_ASSIGN_UNIQ:
+        m_queue.setConnected();
+        conn.in_flight++;
+        queueJob(new Job(this, &conn, packet));
+        grab(conn);
+        break;
+
+    case GearmanPacketType::ERROR:
+        conn.disconnect("gearmand error " + packet.args[0].str() + ": " + packet.args[1].str());
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Leaves the connection IDLE while jobs are waiting for room in the queue or executors hold it
+void PoolReactor::grab(GearmanConnection& conn) noexcept {
+    if (!m_pending.empty() || m_queue.held()) {
+        conn.state = GearmanConnection::State::IDLE;
+        return;
+    }
+
+    append_gearman_request(conn.out, GearmanPacketType::GRAB_JOB_UNIQ);
+    conn.state = GearmanConnection::State::GRABBING;
+    conn.flush();
+}
+
+void PoolReactor::queueJob(Job *job) noexcept {
+    if (!m_pending.empty() || !m_queue.tryPush(job)) {
+        m_pending.push_back(job);
+    }
+}
+
+void PoolReactor::sendCompletions() noexcept {
+    std::vector<FetchedJob*> completed;
+    {
+        std::lock_guard<std::mutex> lock(m_completed_mutex);
+        completed.swap(m_completed);
+    }
+
+    for (auto fetched : completed) {
+        Job *job = static_cast<Job*>(fetched);
+        GearmanConnection& conn = *job->connection;
+        if (conn.fd >= 0 && conn.generation == job->generation) {
+            conn.in_flight--;
+            if (job->ret == GEARMAN_SUCCESS) {
+                append_gearman_request(conn.out, GearmanPacketType::WORK_COMPLETE, {job->handle(), job->result});
+            } else {
+                append_gearman_request(conn.out, GearmanPacketType::WORK_FAIL, {job->handle()});
+            }
+            conn.flush();
+        }
+        delete job;
+    }
+
+    // Executors pop before they complete, so the queue has room again
+    pushPending();
+}
+
+void PoolReactor::pushPending() noexcept {
+    while (!m_pending.empty()) {
+        Job *job = m_pending.front();
+        if (!job->stale() && !m_queue.tryPush(job)) {
+            return;
+        }
+        if (job->stale()) {
+            delete job; // Already handed to another worker by gearmand
+        }
+        m_pending.pop_front();
+    }
+
+    for (auto& conn : m_connections) {
+        if (conn->state == GearmanConnection::State::IDLE) {
+            grab(*conn);
+        }
+    }
+}
+
+// -1 waits for socket activity alone, when there are no connections to watch
+int PoolReactor::nextTimeoutMs() const noexcept {
+    int64_t timeout = (m_pending.empty() && !m_queue.held()) ? -1 : REACTOR_PENDING_RETRY_MS;
+    auto now = steady_clock::now();
+    for (const auto& conn : m_connections) {
+        auto next = conn->nextCheck();
+        if (next == steady_clock::time_point::max()) {
+            continue; // Not probed
+        }
+
+        auto left = duration_cast<milliseconds>(next - now).count() + 1;
+        int64_t ms = std::max<int64_t>(left, 0);
+        timeout = (timeout < 0) ? ms : std::min(timeout, ms);
+    }
+    return static_cast<int>(std::min<int64_t>(timeout, INT32_MAX));
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,108 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_POOL_REACTOR_H_
+#define incl_DRIVESHAFT_POOL_REACTOR_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include "common-defs.h"
+#include "pool-options.h"
+#include "metric-proxy.h"
+#include "job-fetcher.h"
+#include "gearman-protocol.h"
+
+namespace Driveshaft {
+
+/* One epoll thread that keeps a single worker connection to every gearmand
+ * server of a pool and speaks the worker protocol itself, since libgearman
+ * does not hand out its sockets. Grabbed jobs go on the pool's JobQueue, and
+ * results come back through an eventfd. Connections sit in PRE_SLEEP until
+ * gearmand sends a NOOP, so an idle pool only wakes up every probe interval
+ * to check quiet servers with ECHO_REQ. A lost server is
+ * reconnected to after a jittered exponential backoff, so the reactors of
+ * every host do not all come back to a restarted gearmand at once.
+ */
+class PoolReactor : public JobSource {
+public:
+    PoolReactor(const std::string& pool_name, const FetchQueueOptions& options, const GearmanProbeOptions& probe,
+                MetricProxyPtr metrics) noexcept;
+    ~PoolReactor() noexcept;
+
+    // Connects to the servers and starts the reactor thread once
+    void start(const StringSet& server_list, const StringSet& jobs_list);
+
+    JobQueue& queue() noexcept {
+        return m_queue;
+    }
+
+    void complete(FetchedJob *job) noexcept override;
+    void abandon(FetchedJob *job) noexcept override;
+
+private:
+    PoolReactor() = delete;
+    PoolReactor(const PoolReactor&) = delete;
+    PoolReactor(PoolReactor&&) = delete;
+    PoolReactor& operator=(const PoolReactor&) = delete;
+    PoolReactor& operator=(const PoolReactor&&) = delete;
+
+    class Job;
+
+    void run() noexcept;
+    void stop() noexcept;
+    void onConnected(GearmanConnection& conn) noexcept;
+    void onReadable(GearmanConnection& conn) noexcept;
+    void onPacket(GearmanConnection& conn, const GearmanPacket& packet) noexcept;
+    void grab(GearmanConnection& conn) noexcept;
+    void queueJob(Job *job) noexcept;
+    void sendCompletions() noexcept;
+    void pushPending() noexcept;
+    int nextTimeoutMs() const noexcept;
+
+    const std::string m_pool_name;
+    JobQueue m_queue;
+    const GearmanProbeOptions m_probe;
+    MetricProxyPtr m_metrics;
+    StringSet m_jobs_list;
+    std::vector<std::unique_ptr<GearmanConnection>> m_connections;
+    std::deque<Job*> m_pending; // grabbed while the queue was full
+    std::mutex m_completed_mutex;
+    std::vector<FetchedJob*> m_completed;
+    int m_epoll_fd;
+    int m_wakeup_fd;
+    std::atomic<bool> m_stopping;
+    bool m_started;
+    std::thread m_thread;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_POOL_REACTOR_H_
@@ -0,0 +1,394 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <sstream>
+#include <system_error>
+#include <vector>
+#include "queue-status.h"
+#include "gearman-protocol.h"
+
+namespace Driveshaft {
+
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+static const char GEARMAND_STATUS_COMMAND[] = "status\n";
+
+/* One polling round, shared with the threads polling its servers. A thread
+ * stuck resolving a server outlives the round that gave up on it, so it
+ * keeps the round alive rather than the collector.
+ */
+struct StatusPass {
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t pending = 0; // servers yet to answer or fail
+    bool failed = false;
+    bool cancelled = false;
+    FunctionStatusMap status;
+};
+
+static bool parse_count(const std::string& field, uint64_t& value) noexcept {
+    if (field.empty() || field.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+
+    value = strtoull(field.c_str(), nullptr, 10);
+    return true;
+}
+
+static void add_function_status(FunctionStatusMap& into, const FunctionStatusMap& from) noexcept {
+    for (const auto& i : from) {
+        auto& function_status = into[i.first];
+        function_status.total += i.second.total;
+        function_status.running += i.second.running;
+        function_status.available_workers += i.second.available_workers;
+    }
+}
+
+bool parse_gearman_status(const std::string& response, FunctionStatusMap& status) noexcept {
+    FunctionStatusMap parsed_status;
+    std::istringstream lines(response);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        if (line == ".") {
+            add_function_status(status, parsed_status);
+            return true;
+        }
+
+        // FUNCTION\tTOTAL\tRUNNING\tAVAILABLE_WORKERS
+        std::vector<std::string> fields;
+        std::istringstream tokens(line);
+        std::string field;
+        while (std::getline(tokens, field, '\t')) {
+            fields.push_back(field);
+        }
+
+        FunctionStatus parsed;
+        if (fields.size() != 4 || fields[0].empty() ||
+            !parse_count(fields[1], parsed.total) ||
+            !parse_count(fields[2], parsed.running) ||
+            !parse_count(fields[3], parsed.available_workers)) {
+            return false;
+        }
+
+        auto& function_status = parsed_status[fields[0]];
+        function_status.total += parsed.total;
+        function_status.running += parsed.running;
+        function_status.available_workers += parsed.available_workers;
+    }
+
+    return false;
+}
+
+static int remaining_ms(steady_clock::time_point deadline) noexcept {
+    auto left = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+    return left > 0 ? static_cast<int>(left) : 0;
+}
+
+static bool wait_for(int fd, short events, steady_clock::time_point deadline) noexcept {
+    struct pollfd pfd = {fd, events, 0};
+    while (true) {
+        int rc = poll(&pfd, 1, remaining_ms(deadline));
+        if (rc > 0) {
+            return true;
+        }
+        if (rc == 0 || errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+static int connect_with_deadline(const struct addrinfo *ai, steady_clock::time_point deadline) noexcept {
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (errno != EINPROGRESS || !wait_for(fd, POLLOUT, deadline) ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+static bool response_complete(const std::string& response) noexcept {
+    return response == ".\n" || response == ".\r\n" ||
+           (response.size() >= 3 && response.compare(response.size() - 3, 3, "\n.\n") == 0) ||
+           (response.size() >= 4 && response.compare(response.size() - 4, 4, "\n.\r\n") == 0);
+}
+
+bool fetch_gearman_status(const std::string& server, milliseconds timeout, std::string& response) noexcept {
+    auto deadline = steady_clock::now() + timeout;
+    std::string host, port;
+    split_gearman_server(server, host, port);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addrs = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0) {
+        LOG4CXX_WARN(MainLogger, "Unable to resolve gearmand server " << server);
+        return false;
+    }
+
+    int fd = -1;
+    for (auto ai = addrs; ai != nullptr && fd < 0; ai = ai->ai_next) {
+        fd = connect_with_deadline(ai, deadline);
+    }
+    freeaddrinfo(addrs);
+
+    if (fd < 0) {
+        LOG4CXX_WARN(MainLogger, "Unable to connect to gearmand server " << server << " for status");
+        return false;
+    }
+
+    bool ok = true;
+    size_t sent = 0;
+    const size_t command_len = sizeof(GEARMAND_STATUS_COMMAND) - 1;
+    while (ok && sent < command_len) {
+        ssize_t n = send(fd, GEARMAND_STATUS_COMMAND + sent, command_len - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            ok = wait_for(fd, POLLOUT, deadline);
+        } else {
+            ok = false;
+        }
+    }
+
+    response.clear();
+    char buffer[4096];
+    while (ok && !response_complete(response)) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            response.append(buffer, n);
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            ok = wait_for(fd, POLLIN, deadline);
+        } else {
+            ok = false; // closed before the terminator
+        }
+    }
+
+    close(fd);
+    if (!ok) {
+        LOG4CXX_WARN(MainLogger, "Failed to read status from gearmand server " << server);
+    }
+    return ok;
+}
+
+uint32_t autoscale_target(const AutoscaleOptions& options, const StringSet& jobs_list,
+                          const FunctionStatusMap& status) noexcept {
+    uint64_t demand = 0;
+    for (const auto& job : jobs_list) {
+        auto found = status.find(job);
+        if (found != status.end()) {
+            demand += found->second.total;
+        }
+    }
+
+    // Every host serving the pool sees the same cluster-wide queues, and sizes for its share
+    uint64_t per_worker = uint64_t(std::max<uint32_t>(options.jobs_per_worker, 1)) * std::max<uint32_t>(options.hosts, 1);
+    uint64_t target = (demand + per_worker - 1) / per_worker;
+    target = std::max<uint64_t>(target, options.min_workers);
+    target = std::min<uint64_t>(target, options.max_workers);
+    return static_cast<uint32_t>(target);
+}
+
+static void poll_server(std::shared_ptr<StatusPass> pass, const std::string& server,
+                        milliseconds timeout) noexcept {
+    std::string response;
+    FunctionStatusMap status;
+    bool ok = fetch_gearman_status(server, timeout, response);
+    if (ok && !parse_gearman_status(response, status)) {
+        LOG4CXX_WARN(MainLogger, "Malformed status response from gearmand server " << server);
+        ok = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pass->mutex);
+        if (ok) {
+            add_function_status(pass->status, status);
+        } else {
+            pass->failed = true;
+        }
+        pass->pending--;
+    }
+    pass->cond.notify_all();
+}
+
+QueueStatusCollector::QueueStatusCollector(MetricProxyPtr metrics, milliseconds interval) noexcept
+    : m_metrics(metrics)
+    , m_interval(interval)
+    , m_mutex()
+    , m_cond()
+    , m_stopping(false)
+    , m_server_list()
+    , m_functions()
+    , m_status()
+    , m_status_valid(false)
+    , m_pass()
+    , m_thread() {
+}
+
+QueueStatusCollector::~QueueStatusCollector() {
+    stop();
+}
+
+void QueueStatusCollector::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_thread.joinable()) {
+        return;
+    }
+
+    m_stopping = false;
+    m_thread = std::thread(&QueueStatusCollector::run, this);
+}
+
+void QueueStatusCollector::stop() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        if (m_pass) {
+            std::lock_guard<std::mutex> pass_lock(m_pass->mutex);
+            m_pass->cancelled = true;
+            m_pass->cond.notify_all();
+        }
+    }
+    m_cond.notify_all();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void QueueStatusCollector::setTargets(const StringSet& server_list, const StringSet& functions) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_server_list = server_list;
+    m_functions = functions;
+}
+
+bool QueueStatusCollector::snapshot(FunctionStatusMap& status) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    status = m_status;
+    return m_status_valid;
+}
+
+void QueueStatusCollector::collect() noexcept {
+    StringSet server_list, functions;
+    std::shared_ptr<StatusPass> pass(new StatusPass);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping) {
+            return;
+        }
+        server_list = m_server_list;
+        functions = m_functions;
+        m_pass = pass;
+    }
+
+    // getaddrinfo cannot be given a timeout, so each server gets its own thread
+    auto servers = expand_gearman_servers(server_list);
+    auto deadline = steady_clock::now() + m_interval;
+    pass->pending = servers.size();
+    for (const auto& server : servers) {
+        try {
+            std::thread(poll_server, pass, server, m_interval).detach();
+        } catch (const std::system_error& e) {
+            LOG4CXX_ERROR(MainLogger, "Unable to poll gearmand server " << server << " for status: " << e.what());
+            std::lock_guard<std::mutex> lock(pass->mutex);
+            pass->failed = true;
+            pass->pending--;
+        }
+    }
+
+    FunctionStatusMap all;
+    bool complete = false;
+    {
+        std::unique_lock<std::mutex> lock(pass->mutex);
+        pass->cond.wait_until(lock, deadline, [&pass]{ return pass->pending == 0 || pass->cancelled; });
+        if (pass->pending > 0 && !pass->cancelled) {
+            LOG4CXX_WARN(MainLogger, pass->pending << " gearmand servers did not answer status in time");
+        }
+        complete = !servers.empty() && pass->pending == 0 && !pass->failed;
+        if (complete) {
+            all.swap(pass->status);
+        }
+    }
+
+    FunctionStatusMap served;
+    for (const auto& function : functions) {
+        served[function] = all[function];
+    }
+
+    if (complete && m_metrics) {
+        for (const auto& i : served) {
+            m_metrics->reportQueueStatus(i.first, i.second.queued(), i.second.running,
+                                         i.second.available_workers);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pass.reset();
+    m_status_valid = complete;
+    m_status.swap(served);
+}
+
+void QueueStatusCollector::run() noexcept {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+        lock.unlock();
+        collect();
+        lock.lock();
+        m_cond.wait_for(lock, m_interval, [this]{ return m_stopping; });
+    }
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,121 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_QUEUE_STATUS_H_
+#define incl_DRIVESHAFT_QUEUE_STATUS_H_
+
+#include <string>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "common-defs.h"
+#include "pool-options.h"
+#include "metric-proxy.h"
+
+namespace Driveshaft {
+
+// One function's line of the gearmand admin "status" command
+struct FunctionStatus {
+    uint64_t total = 0; // queued and running
+    uint64_t running = 0;
+    uint64_t available_workers = 0;
+
+    uint64_t queued() const noexcept {
+        return total > running ? total - running : 0;
+    }
+};
+
+typedef std::map<std::string, FunctionStatus> FunctionStatusMap;
+
+/* Adds the counts in a "status" response to status, so that responses from
+ * several servers sum up. false, leaving status as it was, if the response is
+ * malformed or unterminated.
+ */
+bool parse_gearman_status(const std::string& response, FunctionStatusMap& status) noexcept;
+
+/* Sends "status" to a gearmand server given as host[:port] and reads the
+ * response up to the terminating ".". false on any network error or timeout.
+ */
+bool fetch_gearman_status(const std::string& server, std::chrono::milliseconds timeout,
+                          std::string& response) noexcept;
+
+// Worker count on this host for an autoscaled pool given the queues of its functions
+uint32_t autoscale_target(const AutoscaleOptions& options, const StringSet& jobs_list,
+                          const FunctionStatusMap& status) noexcept;
+
+struct StatusPass;
+
+/* Polls every gearmand server with the text admin protocol on a background
+ * thread and keeps the sum of their answers for the functions driveshaft
+ * serves. Servers are polled in parallel and a round gives up on those that
+ * have not answered within one interval, or as soon as stop() is called.
+ * Queue depths are published as gauges after every round that every server
+ * answered; a partial sum would understate them.
+ */
+class QueueStatusCollector {
+public:
+    QueueStatusCollector(MetricProxyPtr metrics, std::chrono::milliseconds interval) noexcept;
+    ~QueueStatusCollector();
+
+    void start();
+    void stop() noexcept;
+
+    void setTargets(const StringSet& server_list, const StringSet& functions) noexcept;
+
+    // false unless the last round heard from every server
+    bool snapshot(FunctionStatusMap& status) noexcept;
+
+    // One polling round. Called by the background thread
+    void collect() noexcept;
+
+private:
+    QueueStatusCollector() = delete;
+    QueueStatusCollector(const QueueStatusCollector&) = delete;
+    QueueStatusCollector(QueueStatusCollector&&) = delete;
+    QueueStatusCollector& operator=(const QueueStatusCollector&) = delete;
+    QueueStatusCollector& operator=(const QueueStatusCollector&&) = delete;
+
+    void run() noexcept;
+
+    MetricProxyPtr m_metrics;
+    const std::chrono::milliseconds m_interval;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stopping;
+    StringSet m_server_list;
+    StringSet m_functions;
+    FunctionStatusMap m_status;
+    bool m_status_valid;
+    std::shared_ptr<StatusPass> m_pass; // the round in progress, for stop() to cut short
+    std::thread m_thread;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_QUEUE_STATUS_H_
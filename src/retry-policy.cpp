@@ -0,0 +1,77 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <random>
+#include <thread>
+#include <algorithm>
+#include "retry-policy.h"
+
+namespace Driveshaft {
+
+static const double RETRY_BUDGET_MIN_BALANCE = 10;
+static const double RETRY_BUDGET_MAX_BALANCE = 100;
+
+RetryBudget::RetryBudget(uint32_t budget_percent) noexcept
+    : m_mutex()
+    , m_deposit(budget_percent / 100.0)
+    , m_balance(RETRY_BUDGET_MIN_BALANCE) {
+}
+
+void RetryBudget::recordJob() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_balance = std::min(RETRY_BUDGET_MAX_BALANCE, m_balance + m_deposit);
+}
+
+void RetryBudget::setBudgetPercent(uint32_t budget_percent) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_deposit = budget_percent / 100.0;
+}
+
+bool RetryBudget::tryRetry() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_balance < 1) {
+        return false;
+    }
+
+    m_balance -= 1;
+    return true;
+}
+
+std::chrono::milliseconds retry_backoff(const RetryOptions& options, uint32_t attempt) noexcept {
+    static thread_local std::minstd_rand generator(
+        std::random_device{}() ^ std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+    // Stop doubling well before the shift overflows
+    uint32_t shift = std::min<uint32_t>(attempt > 0 ? attempt - 1 : 0, 20);
+    uint64_t ceiling = std::min<uint64_t>(uint64_t(options.initial_backoff_ms) << shift,
+                                          options.max_backoff_ms);
+    std::uniform_int_distribution<uint64_t> jitter(0, ceiling);
+    return std::chrono::milliseconds(jitter(generator));
+}
+
+} // namespace Driveshaft
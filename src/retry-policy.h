@@ -0,0 +1,67 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_RETRY_POLICY_H_
+#define incl_DRIVESHAFT_RETRY_POLICY_H_
+
+#include <chrono>
+#include <mutex>
+#include "common-defs.h"
+#include "pool-options.h"
+
+namespace Driveshaft {
+
+/* Caps retries at a share of the jobs a pool runs so that a struggling
+ * endpoint does not get hit by every job several times over. Every job
+ * deposits budget_percent/100 of a token and every retry spends a whole one.
+ * A small reserve lets a quiet pool still retry the odd failure.
+ */
+class RetryBudget {
+public:
+    explicit RetryBudget(uint32_t budget_percent) noexcept;
+
+    void recordJob() noexcept;
+    bool tryRetry() noexcept;
+    // Applies to jobs recorded from now on. The balance carries over
+    void setBudgetPercent(uint32_t budget_percent) noexcept;
+
+private:
+    RetryBudget() = delete;
+    RetryBudget(const RetryBudget&) = delete;
+    RetryBudget(RetryBudget&&) = delete;
+    RetryBudget& operator=(const RetryBudget&) = delete;
+    RetryBudget& operator=(const RetryBudget&&) = delete;
+
+    std::mutex m_mutex;
+    double m_deposit;
+    double m_balance;
+};
+
+// Exponential backoff with full jitter for the given (1-based) failed attempt
+std::chrono::milliseconds retry_backoff(const RetryOptions& options, uint32_t attempt) noexcept;
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_RETRY_POLICY_H_
@@ -0,0 +1,94 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <thread>
+#include "spare-threads.h"
+
+namespace Driveshaft {
+
+SpareThreads::SpareThreads(uint32_t count) noexcept
+    : m_count(count)
+    , m_shared(new Shared()) {
+    m_shared->idle = 0;
+    m_shared->stopping = false;
+}
+
+// Idle spares are let go. Work already handed out still runs
+SpareThreads::~SpareThreads() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(m_shared->mutex);
+        m_shared->stopping = true;
+    }
+    m_shared->cond.notify_all();
+}
+
+void SpareThreads::fill() {
+    std::lock_guard<std::mutex> lock(m_shared->mutex);
+    if (m_shared->idle < m_count) {
+        LOG4CXX_DEBUG(MainLogger, "starting " << m_count - m_shared->idle << " spare threads");
+    }
+
+    while (m_shared->idle < m_count) {
+        std::thread(spareMain, m_shared).detach();
+        ++m_shared->idle;
+    }
+}
+
+bool SpareThreads::assign(std::function<void()> work) noexcept {
+    {
+        std::lock_guard<std::mutex> lock(m_shared->mutex);
+        if (m_shared->stopping || m_shared->idle == 0) {
+            return false;
+        }
+
+        --m_shared->idle;
+        m_shared->work.push_back(std::move(work));
+    }
+    m_shared->cond.notify_one();
+    return true;
+}
+
+uint32_t SpareThreads::idle() const noexcept {
+    std::lock_guard<std::mutex> lock(m_shared->mutex);
+    return m_shared->idle;
+}
+
+void SpareThreads::spareMain(std::shared_ptr<Shared> shared) noexcept {
+    std::function<void()> work;
+    {
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        shared->cond.wait(lock, [&shared]{ return shared->stopping || !shared->work.empty(); });
+        if (shared->work.empty()) {
+            return;
+        }
+
+        work = std::move(shared->work.front());
+        shared->work.pop_front();
+    }
+
+    work();
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,77 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_SPARE_THREADS_H_
+#define incl_DRIVESHAFT_SPARE_THREADS_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "common-defs.h"
+
+namespace Driveshaft {
+
+/* Threads started ahead of time that sit idle until a pool scales up, so the
+ * pool does not wait for new threads to be created. A spare runs the work it
+ * is given and ends with it; fill() starts replacements.
+ */
+class SpareThreads {
+public:
+    explicit SpareThreads(uint32_t count) noexcept;
+    ~SpareThreads() noexcept;
+
+    // Starts spares until count of them are idle. Throws std::system_error like std::thread
+    void fill();
+    // Runs work on an idle spare. false when there is none; the caller starts its own thread
+    bool assign(std::function<void()> work) noexcept;
+    uint32_t idle() const noexcept;
+
+private:
+    SpareThreads() = delete;
+    SpareThreads(const SpareThreads&) = delete;
+    SpareThreads(SpareThreads&&) = delete;
+    SpareThreads& operator=(const SpareThreads&) = delete;
+    SpareThreads& operator=(const SpareThreads&&) = delete;
+
+    // Outlives this object for as long as detached spares are still waiting on it
+    struct Shared {
+        mutable std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<std::function<void()>> work;
+        uint32_t idle; // spares that have not been given work yet
+        bool stopping;
+    };
+
+    static void spareMain(std::shared_ptr<Shared> shared) noexcept;
+
+    uint32_t m_count;
+    std::shared_ptr<Shared> m_shared;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_SPARE_THREADS_H_
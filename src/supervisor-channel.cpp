@@ -0,0 +1,378 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "supervisor-channel.h"
+
+namespace Driveshaft {
+
+size_t SupervisorMessage::encode(char *buffer) const noexcept {
+    char *out = buffer;
+    *out++ = static_cast<char>(type);
+    for (const auto& name : names) {
+        uint16_t length = std::min(name.size(), SUPERVISOR_NAME_MAX);
+        memcpy(out, &length, sizeof(length));
+        out += sizeof(length);
+        memcpy(out, name.data(), length);
+        out += length;
+    }
+    memcpy(out, &value, sizeof(value));
+    out += sizeof(value);
+    memcpy(out, counts, sizeof(counts));
+    out += sizeof(counts);
+
+    return out - buffer;
+}
+
+bool SupervisorMessage::decode(const char *data, size_t length) noexcept {
+    const char *end = data + length;
+    if (length < 1 || data[0] < static_cast<char>(Type::JOB_SUCCESS) ||
+        data[0] > static_cast<char>(Type::LAST)) {
+        return false;
+    }
+    type = static_cast<Type>(*data++);
+
+    for (auto& name : names) {
+        uint16_t name_length;
+        if (end - data < (ptrdiff_t) sizeof(name_length)) {
+            return false;
+        }
+        memcpy(&name_length, data, sizeof(name_length));
+        data += sizeof(name_length);
+        if (end - data < name_length) {
+            return false;
+        }
+        name.assign(data, name_length);
+        data += name_length;
+    }
+
+    if (end - data != (ptrdiff_t) (sizeof(value) + sizeof(counts))) {
+        return false;
+    }
+    memcpy(&value, data, sizeof(value));
+    memcpy(counts, data + sizeof(value), sizeof(counts));
+    return true;
+}
+
+void SupervisorMessage::replay(MetricProxyInterface& metrics) const noexcept {
+    switch (type) {
+    case Type::JOB_SUCCESS:
+        return metrics.reportJobSuccess(names[0], names[1], value);
+    case Type::HTTP_JOB_ERROR:
+        return metrics.reportHttpJobError(names[0], names[1], static_cast<uint16_t>(counts[0]));
+    case Type::JOB_TIMEOUT:
+        return metrics.reportJobTimeout(names[0], names[1]);
+    case Type::JOB_ERROR:
+        return metrics.reportJobError(names[0], names[1]);
+    case Type::JOB_RETRY:
+        return metrics.reportJobRetry(names[0], names[1]);
+    case Type::JOB_RETRY_DENIED:
+        return metrics.reportJobRetryDenied(names[0], names[1], names[2]);
+    case Type::THREAD_STARTED:
+        return metrics.reportThreadStarted(names[0]);
+    case Type::THREAD_ENDED:
+        return metrics.reportThreadEnded(names[0]);
+    case Type::THREAD_STARTING_WORK:
+        return metrics.reportThreadStartingWork(names[0], names[1]);
+    case Type::THREAD_WORK_COMPLETE:
+        return metrics.reportThreadWorkComplete(names[0], names[1]);
+    case Type::CIRCUIT_BREAKER_TRANSITION:
+        return metrics.reportCircuitBreakerTransition(names[0], names[1], names[2]);
+    case Type::BACKPRESSURE_PAUSE:
+        return metrics.reportBackpressurePause(names[0], names[1], value);
+    case Type::CONCURRENCY_LIMIT:
+        return metrics.reportConcurrencyLimit(names[0], static_cast<uint32_t>(counts[0]));
+    case Type::THROTTLED:
+        return metrics.reportThrottled(names[0], names[1], value);
+    case Type::RECONNECT:
+        return metrics.reportReconnect(names[0]);
+    case Type::QUEUE_STATUS:
+        return metrics.reportQueueStatus(names[0], counts[0], counts[1], counts[2]);
+    case Type::TIME_TO_CAPACITY:
+        return metrics.reportTimeToCapacity(value);
+    case Type::SCALE_DOWN:
+        return metrics.reportScaleDown(names[0], value);
+    case Type::READY:
+        return;
+    }
+}
+
+SupervisorChannel::SupervisorChannel(int fd, uint32_t process) noexcept
+    : m_fd(fd)
+    , m_process(process)
+    , m_mutex()
+    , m_backlog()
+    , m_dropped(0)
+    , m_gone(false) {
+    if (fcntl(m_fd, F_SETFD, FD_CLOEXEC) == -1) {
+        LOG4CXX_ERROR(MainLogger, "Unable to set up the supervisor channel. errno: " << errno);
+    }
+}
+
+SupervisorChannel::~SupervisorChannel() noexcept {
+    close(m_fd);
+}
+
+std::unique_ptr<SupervisorChannel> SupervisorChannel::inherited() noexcept {
+    const char *fd_value = getenv(SUPERVISOR_FD_VARIABLE);
+    const char *process_value = getenv(WORKER_PROCESS_VARIABLE);
+    if (!fd_value || !process_value) {
+        return std::unique_ptr<SupervisorChannel>();
+    }
+
+    int fd = atoi(fd_value);
+    uint32_t process = strtoul(process_value, nullptr, 10);
+    unsetenv(SUPERVISOR_FD_VARIABLE);
+    unsetenv(WORKER_PROCESS_VARIABLE);
+    if (fd < 3 || fcntl(fd, F_GETFD) == -1) {
+        LOG4CXX_ERROR(MainLogger, "Ignoring " << SUPERVISOR_FD_VARIABLE << ". Not an open descriptor");
+        return std::unique_ptr<SupervisorChannel>();
+    }
+
+    return std::unique_ptr<SupervisorChannel>(new SupervisorChannel(fd, process));
+}
+
+bool SupervisorChannel::sendNow(const std::string& data) noexcept {
+    if (m_gone) {
+        return true;
+    }
+    while (::send(m_fd, data.data(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT) == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+        if (errno != EINTR) {
+            // The supervisor is gone. closed() tells the main loop so
+            m_gone = true;
+            m_backlog.clear();
+            break;
+        }
+    }
+    return true;
+}
+
+void SupervisorChannel::drain() noexcept {
+    while (!m_backlog.empty() && sendNow(m_backlog.front())) {
+        if (!m_backlog.empty()) {
+            m_backlog.pop_front();
+        }
+    }
+    if (m_backlog.empty() && m_dropped > 0) {
+        LOG4CXX_ERROR(MainLogger, "The supervisor caught up after " << m_dropped << " metric messages were dropped");
+        m_dropped = 0;
+    }
+}
+
+void SupervisorChannel::send(const SupervisorMessage& message) noexcept {
+    char buffer[SUPERVISOR_MESSAGE_MAX];
+    std::string data(buffer, message.encode(buffer));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    drain();
+    if (m_backlog.empty() && sendNow(data)) {
+        return;
+    }
+    if (m_backlog.size() < SUPERVISOR_BACKLOG_MAX) {
+        m_backlog.push_back(std::move(data));
+        return;
+    }
+    if (m_dropped++ == 0) {
+        LOG4CXX_ERROR(MainLogger, "The supervisor is " << SUPERVISOR_BACKLOG_MAX
+                                  << " metric messages behind. Dropping new ones until it catches up");
+    }
+}
+
+void SupervisorChannel::sendReady() noexcept {
+    char buffer[SUPERVISOR_MESSAGE_MAX];
+    std::string data(buffer, SupervisorMessage(SupervisorMessage::Type::READY).encode(buffer));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_backlog.push_back(std::move(data));
+    while (true) {
+        drain();
+        if (m_backlog.empty()) {
+            return;
+        }
+        struct pollfd pfd = { m_fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+            LOG4CXX_ERROR(MainLogger, "Unable to wait for the supervisor. errno: " << errno);
+            return;
+        }
+    }
+}
+
+void SupervisorChannel::flush() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    drain();
+}
+
+bool SupervisorChannel::backlogged() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_backlog.empty();
+}
+
+bool SupervisorChannel::closed() noexcept {
+    char byte;
+    ssize_t len = recv(m_fd, &byte, sizeof(byte), MSG_DONTWAIT);
+    return len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR);
+}
+
+void SupervisorChannel::reportJobSuccess(const std::string &pool_name, const std::string &function_name, double duration) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::JOB_SUCCESS);
+    message.names[0] = pool_name;
+    message.names[1] = function_name;
+    message.value = duration;
+    send(message);
+}
+
+void SupervisorChannel::reportHttpJobError(const std::string &pool_name, const std::string &function_name, uint16_t http_status) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::HTTP_JOB_ERROR);
+    message.names[0] = pool_name;
+    message.names[1] = function_name;
+    message.counts[0] = http_status;
+    send(message);
+}
+
+void SupervisorChannel::reportJobTimeout(const std::string &pool_name, const std::string &function_name) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::JOB_TIMEOUT);
+    message.names[0] = pool_name;
+    message.names[1] = function_name;
+    send(message);
+}
+
+void SupervisorChannel::reportJobError(const std::string &pool_name, const std::string &function_name) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::JOB_ERROR);
+    message.names[0] = pool_name;
+    message.names[1] = function_name;
+    send(message);
+}
+
+void SupervisorChannel::reportJobRetry(const std::string &pool_name, const std::string &function_name) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::JOB_RETRY);
+    message.names[0] = pool_name;
+    message.names[1] = function_name;
+    send(message);
+}
+
+void SupervisorChannel::reportJobRetryDenied(const std::string &pool_name, const std::string &function_name, const std::string &reason) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::JOB_RETRY_DENIED);
+    message.names[0] = pool_name;
+    message.names[1] = function_name;
+    message.names[2] = reason;
+    send(message);
+}
+
+void SupervisorChannel::reportThreadStarted(const std::string &pool_name) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::THREAD_STARTED);
+    message.names[0] = pool_name;
+    send(message);
+}
+
+void SupervisorChannel::reportThreadEnded(const std::string &pool_name) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::THREAD_ENDED);
+    message.names[0] = pool_name;
+    send(message);
+}
+
+void SupervisorChannel::reportThreadStartingWork(const std::string &pool_name, const std::string &function_name) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::THREAD_STARTING_WORK);
+    message.names[0] = pool_name;
+    message.names[1] = function_name;
+    send(message);
+}
+
+void SupervisorChannel::reportThreadWorkComplete(const std::string &pool_name, const std::string &function_name) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::THREAD_WORK_COMPLETE);
+    message.names[0] = pool_name;
+    message.names[1] = function_name;
+    send(message);
+}
+
+void SupervisorChannel::reportCircuitBreakerTransition(const std::string &pool_name, const std::string &from_state, const std::string &to_state) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::CIRCUIT_BREAKER_TRANSITION);
+    message.names[0] = pool_name;
+    message.names[1] = from_state;
+    message.names[2] = to_state;
+    send(message);
+}
+
+void SupervisorChannel::reportBackpressurePause(const std::string &pool_name, const std::string &reason, double duration) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::BACKPRESSURE_PAUSE);
+    message.names[0] = pool_name;
+    message.names[1] = reason;
+    message.value = duration;
+    send(message);
+}
+
+void SupervisorChannel::reportConcurrencyLimit(const std::string &pool_name, uint32_t limit) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::CONCURRENCY_LIMIT);
+    message.names[0] = pool_name;
+    message.counts[0] = limit;
+    send(message);
+}
+
+void SupervisorChannel::reportThrottled(const std::string &pool_name, const std::string &limit_name, double duration) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::THROTTLED);
+    message.names[0] = pool_name;
+    message.names[1] = limit_name;
+    message.value = duration;
+    send(message);
+}
+
+void SupervisorChannel::reportReconnect(const std::string &pool_name) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::RECONNECT);
+    message.names[0] = pool_name;
+    send(message);
+}
+
+void SupervisorChannel::reportQueueStatus(const std::string &function_name, uint64_t queued, uint64_t running, uint64_t available_workers) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::QUEUE_STATUS);
+    message.names[0] = function_name;
+    message.counts[0] = queued;
+    message.counts[1] = running;
+    message.counts[2] = available_workers;
+    send(message);
+}
+
+void SupervisorChannel::reportTimeToCapacity(double duration) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::TIME_TO_CAPACITY);
+    message.value = duration;
+    send(message);
+}
+
+void SupervisorChannel::reportScaleDown(const std::string &pool_name, double duration) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::SCALE_DOWN);
+    message.names[0] = pool_name;
+    message.value = duration;
+    send(message);
+}
+
+} // namespace Driveshaft
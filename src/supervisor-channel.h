@@ -0,0 +1,164 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_SUPERVISOR_CHANNEL_H_
+#define incl_DRIVESHAFT_SUPERVISOR_CHANNEL_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <memory>
+#include <sys/types.h>
+#include "common-defs.h"
+#include "metric-proxy.h"
+
+namespace Driveshaft {
+
+// Tell a driveshaft it is a worker process, and which descriptor leads to the supervisor
+static const char SUPERVISOR_FD_VARIABLE[] = "DRIVESHAFT_SUPERVISOR_FD";
+static const char WORKER_PROCESS_VARIABLE[] = "DRIVESHAFT_WORKER_PROCESS";
+
+// No message is larger. Longer pool, function or label names are cut short
+static const size_t SUPERVISOR_MESSAGE_MAX = 1024;
+static const size_t SUPERVISOR_NAME_MAX = 256;
+// Messages held while the socket buffer is full, before new ones are dropped
+static const size_t SUPERVISOR_BACKLOG_MAX = 4096;
+
+/* One call of MetricProxyInterface, or READY. Every call fits the same shape:
+ * up to three names, one duration and up to three counts.
+ */
+struct SupervisorMessage {
+    enum class Type : uint8_t {
+        JOB_SUCCESS = 1,
+        HTTP_JOB_ERROR,
+        JOB_TIMEOUT,
+        JOB_ERROR,
+        JOB_RETRY,
+        JOB_RETRY_DENIED,
+        THREAD_STARTED,
+        THREAD_ENDED,
+        THREAD_STARTING_WORK,
+        THREAD_WORK_COMPLETE,
+        CIRCUIT_BREAKER_TRANSITION,
+        BACKPRESSURE_PAUSE,
+        CONCURRENCY_LIMIT,
+        THROTTLED,
+        RECONNECT,
+        QUEUE_STATUS,
+        TIME_TO_CAPACITY,
+        SCALE_DOWN,
+        READY, // every thread of the worker process is connected
+        LAST = READY
+    };
+
+    Type type;
+    std::string names[3];
+    double value;
+    uint64_t counts[3];
+
+    explicit SupervisorMessage(Type message_type) noexcept
+        : type(message_type), names(), value(0), counts() {}
+
+    // Returns the length written to buffer, which holds SUPERVISOR_MESSAGE_MAX
+    size_t encode(char *buffer) const noexcept;
+    // false if data is not a whole message
+    bool decode(const char *data, size_t length) noexcept;
+    // Makes the same call on metrics. READY is not a metric and is ignored
+    void replay(MetricProxyInterface& metrics) const noexcept;
+};
+
+/* A worker process's end of the socket to its supervisor. Metrics are sent
+ * there instead of to an exporter of its own, so the supervisor serves the
+ * metrics of every worker process on one address. Sends never block a job
+ * thread: while the supervisor is a whole socket buffer behind, messages wait
+ * in order in a bounded backlog, and are dropped once that is full or the
+ * supervisor is gone.
+ */
+class SupervisorChannel : public MetricProxyInterface {
+public:
+    SupervisorChannel(int fd, uint32_t process) noexcept;
+    ~SupervisorChannel() noexcept override;
+
+    // Unset unless this process was started by a supervisor
+    static std::unique_ptr<SupervisorChannel> inherited() noexcept;
+
+    int fd() const noexcept { return m_fd; }
+    uint32_t process() const noexcept { return m_process; }
+
+    // Blocks until READY, and everything before it, is delivered
+    void sendReady() noexcept;
+    // Sends what the backlog holds, as far as the socket buffer allows
+    void flush() noexcept;
+    // true while messages wait for the supervisor to catch up
+    bool backlogged() noexcept;
+    // true once the supervisor has exited. Never blocks
+    bool closed() noexcept;
+
+    void reportJobSuccess(const std::string &pool_name, const std::string &function_name, double duration) noexcept override;
+    void reportHttpJobError(const std::string &pool_name, const std::string &function_name, uint16_t http_status) noexcept override;
+    void reportJobTimeout(const std::string &pool_name, const std::string &function_name) noexcept override;
+    void reportJobError(const std::string &pool_name, const std::string &function_name) noexcept override;
+    void reportJobRetry(const std::string &pool_name, const std::string &function_name) noexcept override;
+    void reportJobRetryDenied(const std::string &pool_name, const std::string &function_name, const std::string &reason) noexcept override;
+
+    void reportThreadStarted(const std::string &pool_name) noexcept override;
+    void reportThreadEnded(const std::string &pool_name) noexcept override;
+    void reportThreadStartingWork(const std::string &pool_name, const std::string &function_name) noexcept override;
+    void reportThreadWorkComplete(const std::string &pool_name, const std::string &function_name) noexcept override;
+
+    void reportCircuitBreakerTransition(const std::string &pool_name, const std::string &from_state, const std::string &to_state) noexcept override;
+    void reportBackpressurePause(const std::string &pool_name, const std::string &reason, double duration) noexcept override;
+    void reportConcurrencyLimit(const std::string &pool_name, uint32_t limit) noexcept override;
+    void reportThrottled(const std::string &pool_name, const std::string &limit_name, double duration) noexcept override;
+    void reportReconnect(const std::string &pool_name) noexcept override;
+
+    void reportQueueStatus(const std::string &function_name, uint64_t queued, uint64_t running, uint64_t available_workers) noexcept override;
+    void reportTimeToCapacity(double duration) noexcept override;
+    void reportScaleDown(const std::string &pool_name, double duration) noexcept override;
+
+private:
+    SupervisorChannel() = delete;
+    SupervisorChannel(const SupervisorChannel&) = delete;
+    SupervisorChannel(SupervisorChannel&&) = delete;
+    SupervisorChannel& operator=(const SupervisorChannel&) = delete;
+    SupervisorChannel& operator=(const SupervisorChannel&&) = delete;
+
+    void send(const SupervisorMessage& message) noexcept;
+    // false if the socket buffer is full. Need m_mutex
+    bool sendNow(const std::string& data) noexcept;
+    void drain() noexcept;
+
+    int m_fd;
+    uint32_t m_process;
+
+    std::mutex m_mutex;
+    std::deque<std::string> m_backlog;
+    uint64_t m_dropped;
+    bool m_gone;
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_SUPERVISOR_CHANNEL_H_
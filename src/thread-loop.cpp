@@ -25,58 +25,93 @@
 
 #include "thread-loop.h"
 #include "gearman-client.h"
+#include "retry-policy.h"
 
 namespace Driveshaft {
 
 ThreadLoop::ThreadLoop(ThreadRegistryPtr registry,
                        const std::string& pool,
-                       GearmanClient *client) noexcept :
+                       std::function<GearmanClient*()> make_client) noexcept :
                        m_registry(registry),
                        m_pool(pool),
-                       m_client(client) {
+                       m_make_client(make_client),
+                       m_client() {
     LOG4CXX_DEBUG(ThreadLogger, "Starting ThreadLoop for " << m_pool);
-    std::thread::id tid(std::this_thread::get_id());
-    m_registry->registerThread(m_pool, tid);
-    m_registry->setThreadState(tid, std::string("Waiting for work"));
+    m_registry->registerThread(m_pool);
+    m_registry->setThreadState(ThreadState::CONNECTING);
 }
 
 ThreadLoop::~ThreadLoop() noexcept {
     LOG4CXX_DEBUG(ThreadLogger, "Stopping ThreadLoop for " << m_pool);
-    m_registry->unregisterThread(m_pool, std::this_thread::get_id());
+    m_registry->unregisterThread();
 }
 
-static const int64_t MAX_THREAD_LOOP_ATTEMPTS = 5;
-static const int64_t THREAD_LOOP_RETRY_SLEEP_DURATION = 10; // Seconds
+// Bounds of the jittered exponential backoff between reconnects
+static const uint32_t THREAD_LOOP_RECONNECT_INITIAL_BACKOFF_MS = 100;
+static const uint32_t THREAD_LOOP_RECONNECT_MAX_BACKOFF_MS = 30000;
+static const std::chrono::milliseconds THREAD_LOOP_SHUTDOWN_CHECK_INTERVAL(100);
 
-void ThreadLoop::run(uint32_t attempts) noexcept {
-    if (attempts > MAX_THREAD_LOOP_ATTEMPTS) {
-        LOG4CXX_ERROR(ThreadLogger, "Exceeded max loop attempts");
-        return;
-    }
+bool ThreadLoop::shouldShutdown() const noexcept {
+    return g_force_shutdown || m_registry->shouldShutdown();
+}
+
+/* Keeps the thread serving its pool until it is asked to shut down. Its
+ * client tells the registry it is ready once gearmand has answered; threads
+ * of a pool start up side by side and nobody waits on them. When the
+ * client loses gearmand it backs off with full jitter, so the threads of
+ * every pool do not all reconnect at the same moment after an outage, and
+ * then rebuilds its worker. That reconnects to every server of the thread,
+ * not only the one that failed. The backoff only starts over once gearmand
+ * has answered the new worker. Errors that are not retriable end the thread
+ * and the main loop starts a fresh one.
+ */
+void ThreadLoop::run() noexcept {
+    RetryOptions backoff;
+    backoff.initial_backoff_ms = THREAD_LOOP_RECONNECT_INITIAL_BACKOFF_MS;
+    backoff.max_backoff_ms = THREAD_LOOP_RECONNECT_MAX_BACKOFF_MS;
+    uint32_t failures = 0;
+    bool disconnected = false;
 
-    try {
-        while (true) {
-            // First check if we should shutdown
-            if (g_force_shutdown || m_registry->shouldShutdown(std::this_thread::get_id())) {
-                LOG4CXX_INFO(ThreadLogger, "Shutdown requested. Exiting loop");
-                break;
+    while (!shouldShutdown()) {
+        try {
+            if (!m_client) {
+                m_client.reset(m_make_client());
+                m_registry->setThreadState(ThreadState::WAITING_FOR_WORK);
+            } else if (disconnected) {
+                m_client->reconnect();
+                disconnected = false;
             }
 
             // Do real work
             m_client->run();
+            if (m_client->answered()) {
+                failures = 0;
+            }
+        } catch (GearmanClientException& e) {
+            LOG4CXX_ERROR(ThreadLogger, "Caught GearmanClientException: " << e.what() << ". Retriable: " << e.retriable());
+            if (!e.retriable()) {
+                return;
+            }
+
+            if (m_client) {
+                m_client->disconnect();
+                disconnected = true;
+            }
+            auto delay = retry_backoff(backoff, ++failures);
+            LOG4CXX_INFO(ThreadLogger, "Reconnect attempt " << failures << " in " << delay.count() << "ms");
+
+            auto deadline = std::chrono::steady_clock::now() + delay;
+            while (std::chrono::steady_clock::now() < deadline && !shouldShutdown()) {
+                std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                    deadline - std::chrono::steady_clock::now(), THREAD_LOOP_SHUTDOWN_CHECK_INTERVAL));
+            }
+        } catch (std::exception& e) {
+            LOG4CXX_ERROR(ThreadLogger, "Caught unhandled exception in ThreadLoop::run. Details: " << e.what());
+            return;
         }
-    } catch (GearmanClientException& e) {
-        LOG4CXX_ERROR(ThreadLogger, "Caught GearmanClientException: " << e.what() << ". Retriable: " << e.retriable());
-        if (e.retriable()) {
-            LOG4CXX_INFO(ThreadLogger, "Sleeping for " << THREAD_LOOP_RETRY_SLEEP_DURATION << " seconds before retrying");
-            std::this_thread::sleep_for(std::chrono::seconds(THREAD_LOOP_RETRY_SLEEP_DURATION));
-            return run(++attempts);
-        }
-    } catch (std::exception& e) {
-        LOG4CXX_ERROR(ThreadLogger, "Caught unhandled exception in ThreadLoop::run. Details: " << e.what());
     }
 
-    return;
+    LOG4CXX_INFO(ThreadLogger, "Shutdown requested. Exiting loop");
 }
 
 } // namespace Driveshaft
@@ -32,6 +32,7 @@
 #include <thread>
 #include <memory>
 #include <mutex>
+#include <functional>
 #include "common-defs.h"
 #include "thread-registry.h"
 
@@ -42,11 +43,12 @@ class GearmanClient;
 class ThreadLoop {
 
 public:
+    // make_client connects the thread. It runs on the thread, and again after a retriable failure
     ThreadLoop(ThreadRegistryPtr registry,
                const std::string& pool,
-               GearmanClient *client) noexcept;
+               std::function<GearmanClient*()> make_client) noexcept;
     ~ThreadLoop() noexcept;
-    void run(uint32_t attempts) noexcept;
+    void run() noexcept;
 
 private:
     ThreadLoop() = delete;
@@ -55,9 +57,12 @@ private:
     ThreadLoop& operator=(const ThreadLoop&) = delete;
     ThreadLoop& operator=(const ThreadLoop&&) = delete;
 
+    bool shouldShutdown() const noexcept;
+
     ThreadRegistryPtr m_registry;
     const std::string& m_pool;
-    std::unique_ptr<GearmanClient> m_client;
+    std::function<GearmanClient*()> m_make_client;
+    std::unique_ptr<GearmanClient> m_client; // unset until the thread has connected
 };
 
 } // namespace Driveshaft
@@ -23,6 +23,12 @@
  *
  */
 
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
 #include "thread-registry.h"
 
 namespace Driveshaft {
@@ -35,38 +41,203 @@ namespace Driveshaft {
         }\
     } while(0)
 
-ThreadRegistry::ThreadRegistry() noexcept : m_thread_map(), m_registry_store(), m_mutex() {
+// The slot of the calling thread, between registerThread and unregisterThread
+static thread_local ThreadSlotPtr t_slot;
+
+const char* thread_state_name(ThreadState state) noexcept {
+    switch (state) {
+    case ThreadState::STARTING:
+        return "Starting up";
+    case ThreadState::CONNECTING:
+        return "Connecting";
+    case ThreadState::WAITING_FOR_WORK:
+        return "Waiting for work";
+    case ThreadState::WORKING:
+        return "Working";
+    }
+    return "Unknown";
+}
+
+ThreadSlot::ThreadSlot(const std::string& pool, bool should_shutdown) noexcept
+    : m_pool(pool)
+    , m_state(ThreadState::STARTING)
+    , m_should_shutdown(should_shutdown)
+    , m_ready(false)
+    , m_job_started(0)
+    , m_job_sequence(0) {
+    store(m_job_handle, nullptr);
+    store(m_job_unique, nullptr);
+}
+
+void ThreadSlot::setJob(const char *job_handle, const char *job_unique) noexcept {
+    uint32_t sequence = m_job_sequence.load(std::memory_order_relaxed);
+    m_job_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    store(m_job_handle, job_handle);
+    store(m_job_unique, job_unique);
+
+    m_job_sequence.store(sequence + 2, std::memory_order_release);
+    m_job_started.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+void ThreadSlot::job(std::string& job_handle, std::string& job_unique) const noexcept {
+    while (true) {
+        uint32_t sequence = m_job_sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::string handle(load(m_job_handle));
+        std::string unique(load(m_job_unique));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_job_sequence.load(std::memory_order_relaxed) == sequence) {
+            job_handle.swap(handle);
+            job_unique.swap(unique);
+            return;
+        }
+    }
+}
+
+void ThreadSlot::store(JobId& to, const char *from) noexcept {
+    char buffer[THREAD_JOB_ID_SIZE];
+    memset(buffer, 0, sizeof(buffer));
+    if (from) {
+        memcpy(buffer, from, strnlen(from, sizeof(buffer)));
+    }
+
+    for (size_t i = 0; i < sizeof(buffer) / sizeof(uint64_t); ++i) {
+        uint64_t word;
+        memcpy(&word, buffer + i * sizeof(uint64_t), sizeof(uint64_t));
+        to[i].store(word, std::memory_order_relaxed);
+    }
+}
+
+std::string ThreadSlot::load(const JobId& from) noexcept {
+    char buffer[THREAD_JOB_ID_SIZE];
+    for (size_t i = 0; i < sizeof(buffer) / sizeof(uint64_t); ++i) {
+        uint64_t word = from[i].load(std::memory_order_relaxed);
+        memcpy(buffer + i * sizeof(uint64_t), &word, sizeof(uint64_t));
+    }
+
+    return std::string(buffer, strnlen(buffer, sizeof(buffer)));
+}
+
+ThreadRegistry::ThreadRegistry() noexcept
+    : m_registry_store()
+    , m_slots(new ThreadSlotList())
+    , m_pending_starts()
+    , m_exited_pools()
+    , m_scale_downs()
+    , m_scale_down_times()
+    , m_ready_count(0)
+    , m_event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    , m_mutex() {
     LOG4CXX_DEBUG(MainLogger, "Starting thread registry");
+
+    if (m_event_fd == -1) {
+        LOG4CXX_ERROR(MainLogger, "Unable to create thread eventfd. Polling for exited threads. errno: " << errno);
+    }
 }
 
 ThreadRegistry::~ThreadRegistry() noexcept {
-    DS_ASSERT(m_thread_map.size() == 0, MainLogger);
+    DS_ASSERT(m_registry_store.size() == 0, MainLogger);
+
+    if (m_event_fd != -1) {
+        close(m_event_fd);
+    }
+}
+
+void ThreadRegistry::reserveThreads(const std::string& pool, uint32_t count) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    LOG4CXX_DEBUG(MainLogger, "Reserving " << count << " threads for pool " << pool);
+
+    m_pending_starts[pool].count += count;
 }
 
-void ThreadRegistry::registerThread(const std::string& pool, std::thread::id tid) noexcept {
+void ThreadRegistry::registerThread(const std::string& pool) noexcept {
     std::lock_guard<std::mutex> lock(m_mutex);
 
-    LOG4CXX_DEBUG(ThreadLogger, "Registering thread for pool " << pool << " with ID " << tid);
+    LOG4CXX_DEBUG(ThreadLogger, "Registering thread for pool " << pool << " with ID " << std::this_thread::get_id());
+    DS_ASSERT(!t_slot, ThreadLogger);
 
-    auto& pool_threads = m_registry_store[pool];
-    DS_ASSERT(pool_threads.count(tid) == 0, ThreadLogger);
-    pool_threads.insert(tid);
+    // A thread the pool was scaled back down from before it even started
+    // registers already told to shut down
+    bool should_shutdown = false;
+    auto pending = m_pending_starts.find(pool);
+    if (pending != m_pending_starts.end()) {
+        if (pending->second.to_shutdown > 0) {
+            --pending->second.to_shutdown;
+            should_shutdown = true;
+        }
+        if (--pending->second.count == 0) {
+            m_pending_starts.erase(pending);
+        }
+    }
 
-    DS_ASSERT(m_thread_map.count(tid) == 0, ThreadLogger);
-    m_thread_map.insert(std::pair<std::thread::id, ThreadData>(tid, {pool, false, "Starting up"}));
+    t_slot.reset(new ThreadSlot(pool, should_shutdown));
+    m_registry_store[pool].push_back(t_slot);
+    publishSlots();
 }
 
-void ThreadRegistry::unregisterThread(const std::string& pool, std::thread::id tid) noexcept {
+void ThreadRegistry::unregisterThread() noexcept {
     std::lock_guard<std::mutex> lock(m_mutex);
 
-    LOG4CXX_DEBUG(ThreadLogger, "Unregistering thread for pool " << pool << " with ID " << tid);
+    DS_ASSERT(t_slot, ThreadLogger);
+    const std::string pool(t_slot->pool());
+    LOG4CXX_DEBUG(ThreadLogger, "Unregistering thread for pool " << pool << " with ID " << std::this_thread::get_id());
 
-    auto& pool_threads = m_registry_store[pool];
-    DS_ASSERT(pool_threads.count(tid) == 1, ThreadLogger);
-    pool_threads.erase(tid);
+    auto found = m_registry_store.find(pool);
+    DS_ASSERT(found != m_registry_store.end(), ThreadLogger);
+    auto& pool_slots = found->second;
+    auto slot = std::find(pool_slots.begin(), pool_slots.end(), t_slot);
+    DS_ASSERT(slot != pool_slots.end(), ThreadLogger);
+    pool_slots.erase(slot);
+    if (pool_slots.empty()) {
+        m_registry_store.erase(found);
+    }
+    m_exited_pools.insert(pool);
 
-    DS_ASSERT(m_thread_map.count(tid) == 1, ThreadLogger);
-    m_thread_map.erase(tid);
+    auto scale_down = m_scale_downs.find(pool);
+    if (t_slot->shouldShutdown() && scale_down != m_scale_downs.end() && --scale_down->second.remaining == 0) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - scale_down->second.started;
+        LOG4CXX_INFO(ThreadLogger, "Pool " << pool << " finished shrinking in " << elapsed.count() << " seconds");
+        m_scale_down_times[pool] = elapsed.count();
+        m_scale_downs.erase(scale_down);
+    }
+
+    if (t_slot->ready()) {
+        m_ready_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+    t_slot.reset();
+    publishSlots();
+
+    // Wakes the main loop to replenish the pool
+    notify();
+}
+
+// Rebuilds the list snapshot() reads, so it never has to take the lock
+void ThreadRegistry::publishSlots() noexcept {
+    std::shared_ptr<ThreadSlotList> slots(new ThreadSlotList());
+    for (const auto& i : m_registry_store) {
+        slots->insert(slots->end(), i.second.begin(), i.second.end());
+    }
+    std::atomic_store(&m_slots, std::shared_ptr<const ThreadSlotList>(slots));
+}
+
+// Exits and startups that pile up before the main loop gets to them only add to the counter
+void ThreadRegistry::notify() noexcept {
+    if (m_event_fd == -1) {
+        return;
+    }
+
+    uint64_t one = 1;
+    if (write(m_event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        LOG4CXX_ERROR(ThreadLogger, "Unable to signal the main loop. errno: " << errno);
+    }
 }
 
 uint32_t ThreadRegistry::poolCount(const std::string& pool) noexcept {
@@ -74,7 +245,44 @@ uint32_t ThreadRegistry::poolCount(const std::string& pool) noexcept {
 
     LOG4CXX_DEBUG(MainLogger, "Getting poolCount for pool " << pool);
 
-    return m_registry_store[pool].size();
+    uint32_t count = 0;
+    auto found = m_registry_store.find(pool);
+    if (found != m_registry_store.end()) {
+        count += found->second.size();
+    }
+
+    auto pending = m_pending_starts.find(pool);
+    if (pending != m_pending_starts.end()) {
+        count += pending->second.count;
+    }
+    return count;
+}
+
+uint32_t ThreadRegistry::threadCount() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint32_t count = 0;
+    for (const auto& i : m_registry_store) {
+        count += i.second.size();
+    }
+    for (const auto& i : m_pending_starts) {
+        count += i.second.count;
+    }
+    return count;
+}
+
+// Lower goes first: threads that are not connected yet, then idle ones, then busy ones
+static int shutdown_rank(ThreadState state) noexcept {
+    switch (state) {
+    case ThreadState::STARTING:
+    case ThreadState::CONNECTING:
+        return 0;
+    case ThreadState::WAITING_FOR_WORK:
+        return 1;
+    case ThreadState::WORKING:
+        return 2;
+    }
+    return 2;
 }
 
 bool ThreadRegistry::sendShutdown(const std::string& pool, uint32_t count) noexcept {
@@ -82,47 +290,119 @@ bool ThreadRegistry::sendShutdown(const std::string& pool, uint32_t count) noexc
 
     LOG4CXX_INFO(MainLogger, "Sending shutdown to pool " << pool << ". Count " << count);
 
-    const auto& pool_threads = m_registry_store[pool];
+    // Threads that have not registered yet never take a job
     uint32_t msg_sent = 0;
+    auto pending = m_pending_starts.find(pool);
+    if (pending != m_pending_starts.end()) {
+        msg_sent = std::min(count, pending->second.count - pending->second.to_shutdown);
+        pending->second.to_shutdown += msg_sent;
+    }
+
+    auto found = m_registry_store.find(pool);
+    if (msg_sent < count && found != m_registry_store.end()) {
+        // The state is only a hint: a thread may pick up a job right after
+        // it was looked at. Its job then runs to completion as before
+        struct Candidate {
+            int rank;
+            std::chrono::steady_clock::time_point job_started;
+            ThreadSlot *slot;
+        };
+        std::vector<Candidate> candidates;
+        for (const auto& slot : found->second) {
+            if (!slot->shouldShutdown()) {
+                candidates.push_back({shutdown_rank(slot->state()), slot->jobStarted(), slot.get()});
+            }
+        }
 
-    for (auto tid : pool_threads) {
-        DS_ASSERT(m_thread_map.count(tid) == 1, MainLogger);
-        auto& threaddata = m_thread_map[tid];
-        if (threaddata.should_shutdown == false) {
-            threaddata.should_shutdown = true;
-            ++msg_sent;
+        // Of the busy ones, stopping the youngest job wastes least of what was done so far
+        std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+            return a.rank != b.rank ? a.rank < b.rank : a.job_started > b.job_started;
+        });
+
+        for (const auto& candidate : candidates) {
             if (msg_sent == count) {
                 break;
             }
+
+            if (candidate.slot->requestShutdown()) {
+                ++msg_sent;
+            }
         }
     }
 
+    if (msg_sent > 0) {
+        auto inserted = m_scale_downs.insert(std::make_pair(pool, ScaleDown{std::chrono::steady_clock::now(), 0}));
+        inserted.first->second.remaining += msg_sent;
+    }
+
     LOG4CXX_INFO(MainLogger, "Shutdown sent to " << msg_sent << " members of pool " << pool);
 
     return msg_sent == count;
 }
 
-bool ThreadRegistry::shouldShutdown(std::thread::id tid) noexcept {
-    std::lock_guard<std::mutex> lock(m_mutex);
+bool ThreadRegistry::shouldShutdown() noexcept {
+    return t_slot && t_slot->shouldShutdown();
+}
 
-    LOG4CXX_DEBUG(ThreadLogger, "Checking shouldShutdown for ID " << tid);
+void ThreadRegistry::setThreadState(ThreadState state) noexcept {
+    if (t_slot) {
+        t_slot->setState(state);
+    }
+}
 
-    DS_ASSERT(m_thread_map.count(tid) == 1, ThreadLogger);
-    return m_thread_map[tid].should_shutdown;
+void ThreadRegistry::setThreadJob(const char *job_handle, const char *job_unique) noexcept {
+    if (t_slot) {
+        t_slot->setJob(job_handle, job_unique);
+        t_slot->setState(ThreadState::WORKING);
+    }
 }
 
-void ThreadRegistry::setThreadState(std::thread::id tid, const std::string& state) noexcept {
-    std::lock_guard<std::mutex> lock(m_mutex);
+void ThreadRegistry::setThreadReady() noexcept {
+    if (t_slot && t_slot->setReady()) {
+        LOG4CXX_DEBUG(ThreadLogger, "Thread with ID " << std::this_thread::get_id() << " is ready");
+        m_ready_count.fetch_add(1, std::memory_order_relaxed);
+        notify();
+    }
+}
+
+uint32_t ThreadRegistry::readyCount() noexcept {
+    return m_ready_count.load(std::memory_order_relaxed);
+}
 
-    LOG4CXX_DEBUG(ThreadLogger, "Checking shouldShutdown for ID " << tid);
+ThreadSnapshots ThreadRegistry::snapshot() noexcept {
+    auto slots = std::atomic_load(&m_slots);
 
-    DS_ASSERT(m_thread_map.count(tid) == 1, ThreadLogger);
-    m_thread_map[tid].state = state;
+    ThreadSnapshots snapshots;
+    snapshots.reserve(slots->size());
+    for (const auto& slot : *slots) {
+        ThreadSnapshot snapshot;
+        snapshot.pool = slot->pool();
+        snapshot.state = slot->state();
+        snapshot.should_shutdown = slot->shouldShutdown();
+        snapshot.ready = slot->ready();
+        slot->job(snapshot.job_handle, snapshot.job_unique);
+        snapshots.push_back(std::move(snapshot));
+    }
+    return snapshots;
 }
 
-ThreadMap ThreadRegistry::getThreadMap() noexcept {
+StringSet ThreadRegistry::takeExitedPools() noexcept {
     std::lock_guard<std::mutex> lock(m_mutex);
 
-    return m_thread_map;
+    StringSet exited_pools;
+    exited_pools.swap(m_exited_pools);
+    return exited_pools;
+}
+
+ScaleDownTimes ThreadRegistry::takeScaleDownTimes() noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    ScaleDownTimes scale_down_times;
+    scale_down_times.swap(m_scale_down_times);
+    return scale_down_times;
+}
+
+int ThreadRegistry::eventFd() noexcept {
+    return m_event_fd;
 }
 }
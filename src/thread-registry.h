@@ -28,39 +28,145 @@
 
 #include <string>
 #include <map>
-#include <set>
-#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include "common-defs.h"
 
 namespace Driveshaft {
 
-/* This is duplicative. It can be better addressed as a single data
- * structure using boost::multi_index. But that is hard to read. So
- * for the time being I am prioritizing readability over efficiency.
- * This may change in the future
+enum class ThreadState : uint8_t {
+    STARTING,
+    CONNECTING,
+    WAITING_FOR_WORK,
+    WORKING
+};
+
+const char* thread_state_name(ThreadState state) noexcept;
+
+// Gearman bounds both at 64 bytes. Longer ones are cut short
+static const size_t THREAD_JOB_ID_SIZE = 64;
+
+/* What the registry knows about one thread. The thread owns its slot: it is
+ * the only writer of the state and the job, and it reads its shutdown flag
+ * without taking any lock. The job identity is published through a seqlock
+ * so the supervisor can copy it out while the thread moves on to its next
+ * job, without ever making the thread wait.
  */
-struct ThreadData {
+class ThreadSlot {
+public:
+    explicit ThreadSlot(const std::string& pool, bool should_shutdown) noexcept;
+
+    const std::string& pool() const noexcept { return m_pool; }
+
+    ThreadState state() const noexcept { return m_state.load(std::memory_order_relaxed); }
+    void setState(ThreadState state) noexcept { m_state.store(state, std::memory_order_relaxed); }
+
+    bool shouldShutdown() const noexcept { return m_should_shutdown.load(std::memory_order_acquire); }
+    // true when this call was the one to set it
+    bool requestShutdown() noexcept { return !m_should_shutdown.exchange(true, std::memory_order_acq_rel); }
+
+    bool ready() const noexcept { return m_ready.load(std::memory_order_acquire); }
+    bool setReady() noexcept { return !m_ready.exchange(true, std::memory_order_acq_rel); }
+
+    // When the current job was handed to the thread, if it is WORKING
+    std::chrono::steady_clock::time_point jobStarted() const noexcept {
+        return std::chrono::steady_clock::time_point(
+            std::chrono::steady_clock::duration(m_job_started.load(std::memory_order_relaxed)));
+    }
+
+    // Owning thread only
+    void setJob(const char *job_handle, const char *job_unique) noexcept;
+    // Any thread. Retries while the owner is halfway through a setJob
+    void job(std::string& job_handle, std::string& job_unique) const noexcept;
+
+private:
+    ThreadSlot() = delete;
+    ThreadSlot(const ThreadSlot&) = delete;
+    ThreadSlot(ThreadSlot&&) = delete;
+    ThreadSlot& operator=(const ThreadSlot&) = delete;
+    ThreadSlot& operator=(const ThreadSlot&&) = delete;
+
+    // Words rather than chars, so the racy copy a reader retries stays well defined
+    typedef std::atomic<uint64_t> JobId[THREAD_JOB_ID_SIZE / sizeof(uint64_t)];
+
+    static void store(JobId& to, const char *from) noexcept;
+    static std::string load(const JobId& from) noexcept;
+
+    const std::string m_pool;
+    std::atomic<ThreadState> m_state;
+    std::atomic<bool> m_should_shutdown;
+    std::atomic<bool> m_ready; // connected and grabbing jobs
+    std::atomic<std::chrono::steady_clock::rep> m_job_started;
+    std::atomic<uint32_t> m_job_sequence; // odd while setJob is writing
+    JobId m_job_handle;
+    JobId m_job_unique;
+};
+
+typedef std::shared_ptr<ThreadSlot> ThreadSlotPtr;
+
+// A copy of one slot, as the supervisor sees it
+struct ThreadSnapshot {
     std::string pool;
+    ThreadState state;
     bool should_shutdown;
-    std::string state;
+    bool ready;
+    std::string job_handle;
+    std::string job_unique;
 };
 
-typedef std::map<std::thread::id, ThreadData> ThreadMap;
-typedef std::map<std::string, std::set<std::thread::id> > ThreadRegistryStore;
+typedef std::vector<ThreadSnapshot> ThreadSnapshots;
+typedef std::vector<ThreadSlotPtr> ThreadSlotList;
+typedef std::map<std::string, ThreadSlotList> ThreadRegistryStore;
 
+// Threads asked for that have not registered yet
+struct PendingStarts {
+    uint32_t count;
+    uint32_t to_shutdown; // of those, how many a sendShutdown already reached
+};
+
+// A pool shrinking, from its first sendShutdown until the last thread told to go has gone
+struct ScaleDown {
+    std::chrono::steady_clock::time_point started;
+    uint32_t remaining;
+};
+
+// Seconds each pool took to shrink
+typedef std::map<std::string, double> ScaleDownTimes;
+
+/* Calls without a pool act on the calling thread's own slot. They are on the
+ * path of every job, and take no lock.
+ */
 class ThreadRegistryInterface {
 public:
     virtual ~ThreadRegistryInterface() noexcept {}
 
-    virtual void registerThread(const std::string& pool, std::thread::id tid) noexcept = 0;
-    virtual void unregisterThread(const std::string& pool, std::thread::id tid) noexcept = 0;
+    // Counts threads about to start towards poolCount, before they register
+    virtual void reserveThreads(const std::string& pool, uint32_t count) noexcept = 0;
+    virtual void registerThread(const std::string& pool) noexcept = 0;
+    virtual void unregisterThread() noexcept = 0;
     virtual uint32_t poolCount(const std::string& pool) noexcept = 0;
+    // Of all pools, including threads reserved but not registered yet
+    virtual uint32_t threadCount() noexcept = 0;
+    /* Picks the threads that lose least by stopping: those that have not
+     * started yet, then idle ones, then the ones whose jobs started last.
+     */
     virtual bool sendShutdown(const std::string& pool, uint32_t count) noexcept = 0;
-    virtual bool shouldShutdown(std::thread::id tid) noexcept = 0;
-    virtual void setThreadState(std::thread::id tid, const std::string& state) noexcept = 0;
-    virtual ThreadMap getThreadMap() noexcept = 0;
+    virtual bool shouldShutdown() noexcept = 0;
+    virtual void setThreadState(ThreadState state) noexcept = 0;
+    // Also moves the thread to WORKING
+    virtual void setThreadJob(const char *job_handle, const char *job_unique) noexcept = 0;
+    virtual void setThreadReady() noexcept = 0;
+    virtual uint32_t readyCount() noexcept = 0;
+    virtual ThreadSnapshots snapshot() noexcept = 0;
+    // Pools that lost a thread since the last call
+    virtual StringSet takeExitedPools() noexcept = 0;
+    // Pools that finished shrinking since the last call
+    virtual ScaleDownTimes takeScaleDownTimes() noexcept = 0;
+    // Turns readable when a thread exits or becomes ready, -1 when those can only be polled for
+    virtual int eventFd() noexcept = 0;
 };
 
 class ThreadRegistry : public ThreadRegistryInterface {
@@ -68,13 +174,21 @@ public:
     ThreadRegistry() noexcept;
     ~ThreadRegistry() noexcept;
 
-    void registerThread(const std::string& pool, std::thread::id tid) noexcept;
-    void unregisterThread(const std::string& pool, std::thread::id tid) noexcept;
+    void reserveThreads(const std::string& pool, uint32_t count) noexcept;
+    void registerThread(const std::string& pool) noexcept;
+    void unregisterThread() noexcept;
     uint32_t poolCount(const std::string& pool) noexcept;
+    uint32_t threadCount() noexcept;
     bool sendShutdown(const std::string& pool, uint32_t count) noexcept;
-    bool shouldShutdown(std::thread::id tid) noexcept;
-    void setThreadState(std::thread::id tid, const std::string& state) noexcept;
-    ThreadMap getThreadMap() noexcept;
+    bool shouldShutdown() noexcept;
+    void setThreadState(ThreadState state) noexcept;
+    void setThreadJob(const char *job_handle, const char *job_unique) noexcept;
+    void setThreadReady() noexcept;
+    uint32_t readyCount() noexcept;
+    ThreadSnapshots snapshot() noexcept;
+    StringSet takeExitedPools() noexcept;
+    ScaleDownTimes takeScaleDownTimes() noexcept;
+    int eventFd() noexcept;
 
 private:
     ThreadRegistry(const ThreadRegistry&) = delete;
@@ -82,8 +196,19 @@ private:
     ThreadRegistry& operator=(const ThreadRegistry&) = delete;
     ThreadRegistry& operator=(const ThreadRegistry&&) = delete;
 
-    ThreadMap m_thread_map;
+    void publishSlots() noexcept;
+    void notify() noexcept;
+
+    // Everything below but the atomics and the eventfd is guarded by m_mutex.
+    // Only registering, unregistering and the supervisor's calls take it
     ThreadRegistryStore m_registry_store;
+    std::shared_ptr<const ThreadSlotList> m_slots; // copy on write, for snapshot
+    std::map<std::string, PendingStarts> m_pending_starts;
+    StringSet m_exited_pools;
+    std::map<std::string, ScaleDown> m_scale_downs;
+    ScaleDownTimes m_scale_down_times;
+    std::atomic<uint32_t> m_ready_count;
+    int m_event_fd; // eventfd counting exits and startups the main loop has not seen yet
     std::mutex m_mutex;
 };
 
@@ -0,0 +1,181 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "thread-scheduling.h"
+
+namespace Driveshaft {
+
+static const char* policy_name(SchedulingPolicy policy) noexcept {
+    switch (policy) {
+    case SchedulingPolicy::BATCH:
+        return "batch";
+    case SchedulingPolicy::IDLE:
+        return "idle";
+    case SchedulingPolicy::OTHER:
+        break;
+    }
+    return "other";
+}
+
+bool parse_cpu_list(const std::string& list, std::set<uint32_t>& cpus) noexcept {
+    // A node with memory but no CPUs has an empty list
+    if (std::all_of(list.begin(), list.end(), ::isspace)) {
+        return true;
+    }
+
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+        if (range.empty()) {
+            return false;
+        }
+
+        char *end = nullptr;
+        unsigned long first = strtoul(range.c_str(), &end, 10);
+        unsigned long last = first;
+        if (end == range.c_str()) {
+            return false;
+        }
+        if (*end == '-') {
+            const char *start = end + 1;
+            last = strtoul(start, &end, 10);
+            if (end == start) {
+                return false;
+            }
+        }
+        if (*end != '\0' || last < first || last >= CPU_SETSIZE) {
+            return false;
+        }
+
+        for (unsigned long cpu = first; cpu <= last; ++cpu) {
+            cpus.insert(cpu);
+        }
+    }
+
+    return true;
+}
+
+bool numa_node_cpus(uint32_t node, std::set<uint32_t>& cpus) noexcept {
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (!in) {
+        return false;
+    }
+
+    std::string list((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return parse_cpu_list(list, cpus);
+}
+
+// Memory the thread allocates from here on comes from node while it has any free
+static bool prefer_numa_node(uint32_t node) noexcept {
+    const size_t bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(node / bits + 1, 0);
+    mask[node / bits] |= 1UL << (node % bits);
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * bits) == 0;
+}
+
+void apply_thread_scheduling(const std::string& pool_name, const SchedulingOptions& options) noexcept {
+    if (!options.enabled()) {
+        return;
+    }
+
+    std::set<uint32_t> cpus(options.cpus);
+    if (options.numa_node >= 0) {
+        std::set<uint32_t> node_cpus;
+        if (!numa_node_cpus(options.numa_node, node_cpus)) {
+            LOG4CXX_ERROR(ThreadLogger, "Pool " << pool_name << " has no NUMA node " << options.numa_node);
+        } else {
+            if (cpus.empty()) {
+                cpus = node_cpus;
+            } else {
+                std::set<uint32_t> both;
+                std::set_intersection(cpus.begin(), cpus.end(), node_cpus.begin(), node_cpus.end(),
+                                      std::inserter(both, both.end()));
+                if (both.empty()) {
+                    LOG4CXX_ERROR(ThreadLogger, "Pool " << pool_name << " has none of its cpus on NUMA node " <<
+                                                options.numa_node << ". Using the cpus");
+                } else {
+                    cpus.swap(both);
+                }
+            }
+
+            if (!prefer_numa_node(options.numa_node)) {
+                LOG4CXX_ERROR(ThreadLogger, "Unable to prefer memory of NUMA node " << options.numa_node <<
+                                            " for pool " << pool_name << ". errno: " << errno);
+            }
+        }
+    }
+
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (uint32_t cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc != 0) {
+            LOG4CXX_ERROR(ThreadLogger, "Unable to pin a thread of pool " << pool_name << " to its " << cpus.size() <<
+                                        " cpus. error: " << rc);
+        }
+    }
+
+    if (options.policy != SchedulingPolicy::OTHER) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        int policy = options.policy == SchedulingPolicy::BATCH ? SCHED_BATCH : SCHED_IDLE;
+        int rc = pthread_setschedparam(pthread_self(), policy, &param);
+        if (rc != 0) {
+            LOG4CXX_ERROR(ThreadLogger, "Unable to set scheduling policy " << policy_name(options.policy) <<
+                                        " for a thread of pool " << pool_name << ". error: " << rc);
+        }
+    }
+
+    // On Linux a nice value belongs to the thread, not the process
+    if (options.nice != 0 && setpriority(PRIO_PROCESS, syscall(SYS_gettid), options.nice) == -1) {
+        LOG4CXX_ERROR(ThreadLogger, "Unable to set nice " << options.nice << " for a thread of pool " << pool_name <<
+                                    ". errno: " << errno);
+    }
+
+    LOG4CXX_DEBUG(ThreadLogger, "Thread of pool " << pool_name << " runs on " << cpus.size() << " cpus with policy " <<
+                                policy_name(options.policy) << " and nice " << options.nice);
+}
+
+} // namespace Driveshaft
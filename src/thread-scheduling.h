@@ -0,0 +1,50 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_THREAD_SCHEDULING_H_
+#define incl_DRIVESHAFT_THREAD_SCHEDULING_H_
+
+#include <set>
+#include <string>
+#include "common-defs.h"
+#include "pool-options.h"
+
+namespace Driveshaft {
+
+/* Applies a pool's scheduling options to the calling thread. What the kernel
+ * refuses, such as a negative nice without CAP_SYS_NICE, is logged and the
+ * thread runs without it.
+ */
+void apply_thread_scheduling(const std::string& pool_name, const SchedulingOptions& options) noexcept;
+
+// Parses a kernel CPU list such as "0-3,8,10-11". false if it is malformed
+bool parse_cpu_list(const std::string& list, std::set<uint32_t>& cpus) noexcept;
+
+// The CPUs of a NUMA node, from sysfs. false if there is no such node
+bool numa_node_cpus(uint32_t node, std::set<uint32_t>& cpus) noexcept;
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_THREAD_SCHEDULING_H_
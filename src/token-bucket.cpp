@@ -0,0 +1,88 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "token-bucket.h"
+
+namespace Driveshaft {
+
+using std::chrono::steady_clock;
+using std::chrono::nanoseconds;
+using std::chrono::duration_cast;
+
+static int64_t token_interval(const RateLimitOptions& options) noexcept {
+    return std::max<int64_t>(1, static_cast<int64_t>(1e9 / options.jobs_per_second));
+}
+
+static int64_t token_capacity(const RateLimitOptions& options) noexcept {
+    int64_t burst = options.burst ? options.burst
+                                  : std::max<int64_t>(1, static_cast<int64_t>(std::ceil(options.jobs_per_second)));
+    return burst * token_interval(options);
+}
+
+TokenBucket::TokenBucket(const RateLimitOptions& options) noexcept
+    : m_interval(token_interval(options))
+    , m_capacity(token_capacity(options))
+    , m_full_at(0) {
+}
+
+int64_t TokenBucket::now() noexcept {
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+bool TokenBucket::tryTake() noexcept {
+    int64_t now = TokenBucket::now();
+    int64_t full_at = m_full_at.load(std::memory_order_relaxed);
+    int64_t next;
+    do {
+        next = std::max(full_at, now) + m_interval;
+        if (next - now > m_capacity) {
+            return false;
+        }
+    } while (!m_full_at.compare_exchange_weak(full_at, next, std::memory_order_relaxed));
+
+    return true;
+}
+
+void TokenBucket::take() noexcept {
+    int64_t now = TokenBucket::now();
+    int64_t full_at = m_full_at.load(std::memory_order_relaxed);
+    while (!m_full_at.compare_exchange_weak(full_at, std::max(full_at, now) + m_interval,
+                                            std::memory_order_relaxed)) {
+    }
+}
+
+void TokenBucket::giveBack() noexcept {
+    m_full_at.fetch_sub(m_interval, std::memory_order_relaxed);
+}
+
+nanoseconds TokenBucket::waitTime(uint32_t tokens) const noexcept {
+    int64_t now = TokenBucket::now();
+    int64_t next = std::max(m_full_at.load(std::memory_order_relaxed), now) + m_interval * tokens;
+    return nanoseconds(std::max<int64_t>(0, next - now - m_capacity));
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,72 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_TOKEN_BUCKET_H_
+#define incl_DRIVESHAFT_TOKEN_BUCKET_H_
+
+#include <chrono>
+#include <atomic>
+#include "common-defs.h"
+#include "pool-options.h"
+
+namespace Driveshaft {
+
+/* Lock-free token bucket shared by the threads of a pool. It is kept as the
+ * time the bucket would next be full (GCRA), so refill is implicit in the
+ * clock and taking a token is a single compare-and-swap.
+ */
+class TokenBucket {
+public:
+    explicit TokenBucket(const RateLimitOptions& options) noexcept;
+
+    // false, taking nothing, when the bucket is empty
+    bool tryTake() noexcept;
+    // Takes a token even from an empty bucket. The debt delays later takers
+    void take() noexcept;
+    // Returns a token taken for a job that never came
+    void giveBack() noexcept;
+
+    // How long until the bucket holds tokens, so tryTake() can succeed. Zero if it does now
+    std::chrono::nanoseconds waitTime(uint32_t tokens = 1) const noexcept;
+    // How many tokens the bucket holds when full
+    uint32_t burst() const noexcept { return static_cast<uint32_t>(m_capacity / m_interval); }
+
+private:
+    TokenBucket() = delete;
+    TokenBucket(const TokenBucket&) = delete;
+    TokenBucket(TokenBucket&&) = delete;
+    TokenBucket& operator=(const TokenBucket&) = delete;
+    TokenBucket& operator=(const TokenBucket&&) = delete;
+
+    static int64_t now() noexcept;
+
+    const int64_t m_interval; // nanoseconds per token
+    const int64_t m_capacity; // nanoseconds of tokens the bucket holds
+    std::atomic<int64_t> m_full_at; // steady_clock nanoseconds
+};
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_TOKEN_BUCKET_H_
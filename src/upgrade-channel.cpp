@@ -0,0 +1,228 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "upgrade-channel.h"
+
+extern char **environ;
+
+namespace Driveshaft {
+
+static const char UPGRADE_READY_MESSAGE[] = "ready\n";
+
+// When the descriptor limit is unlimited, a new process only gets the ones below this closed
+static const rlim_t START_PROCESS_MAX_CLOSED_FD = 65536;
+
+UpgradeChannel::UpgradeChannel(int fd, pid_t peer) noexcept
+    : m_fd(fd)
+    , m_peer(peer) {
+    int flags = fcntl(m_fd, F_GETFL);
+    if (flags == -1 || fcntl(m_fd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        fcntl(m_fd, F_SETFD, FD_CLOEXEC) == -1) {
+        LOG4CXX_ERROR(MainLogger, "Unable to set up the upgrade channel. errno: " << errno);
+    }
+}
+
+UpgradeChannel::~UpgradeChannel() noexcept {
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+// The arguments this process was started with, as the kernel has them
+static std::vector<std::string> current_command_line() {
+    std::ifstream in("/proc/self/cmdline", std::ios::in | std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::vector<std::string> args;
+    for (size_t start = 0; start < contents.size(); ) {
+        size_t end = contents.find('\0', start);
+        if (end == std::string::npos) {
+            end = contents.size();
+        }
+        args.push_back(contents.substr(start, end - start));
+        start = end + 1;
+    }
+    return args;
+}
+
+// true if entry sets one of the variables, given as NAME=value
+static bool sets_any(const char *entry, const std::vector<std::string>& variables) noexcept {
+    for (const auto& variable : variables) {
+        size_t name_length = variable.find('=') + 1;
+        if (strncmp(entry, variable.c_str(), name_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+pid_t start_process(const std::string& executable, const std::string& fd_variable,
+                    std::vector<std::string> variables, int socket_type, int& fd) {
+    std::vector<std::string> args(current_command_line());
+    if (executable.empty() || args.empty()) {
+        throw std::runtime_error("Unable to tell how this process was started");
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, socket_type | SOCK_CLOEXEC, 0, fds) == -1) {
+        throw std::runtime_error(std::string("Unable to create a socketpair for the new process: ") + strerror(errno));
+    }
+
+    // Everything the child needs is prepared before fork. Other threads may
+    // hold the allocator's locks, so the child sticks to async-signal-safe calls
+    variables.push_back(fd_variable + "=" + std::to_string(fds[1]));
+    std::vector<std::string> env;
+    for (char **entry = environ; *entry; ++entry) {
+        if (!sets_any(*entry, variables)) {
+            env.push_back(*entry);
+        }
+    }
+    env.insert(env.end(), variables.begin(), variables.end());
+
+    std::vector<char*> argv_ptrs;
+    for (auto& arg : args) {
+        argv_ptrs.push_back(&arg[0]);
+    }
+    argv_ptrs.push_back(nullptr);
+
+    std::vector<char*> env_ptrs;
+    for (auto& entry : env) {
+        env_ptrs.push_back(&entry[0]);
+    }
+    env_ptrs.push_back(nullptr);
+
+    struct rlimit limit;
+    rlim_t max_fd = START_PROCESS_MAX_CLOSED_FD;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        max_fd = limit.rlim_cur;
+    }
+
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        int fork_errno = errno;
+        close(fds[0]);
+        close(fds[1]);
+        throw std::runtime_error(std::string("Unable to fork the new process: ") + strerror(fork_errno));
+    }
+
+    if (pid == 0) {
+        // Gearmand and HTTP connections must not outlive the old process in the new one
+        for (rlim_t fd = 3; fd < max_fd; ++fd) {
+            if ((int) fd != fds[1]) {
+                close(fd);
+            }
+        }
+
+        fcntl(fds[1], F_SETFD, 0);
+        sigprocmask(SIG_SETMASK, &no_signals, nullptr);
+        signal(SIGPIPE, SIG_DFL);
+        execve(executable.c_str(), argv_ptrs.data(), env_ptrs.data());
+        _exit(127);
+    }
+
+    close(fds[1]);
+    fd = fds[0];
+    return pid;
+}
+
+std::unique_ptr<UpgradeChannel> UpgradeChannel::startNewProcess(const std::string& executable) {
+    int fd = -1;
+    pid_t pid = start_process(executable, UPGRADE_FD_VARIABLE, std::vector<std::string>(), SOCK_STREAM, fd);
+    LOG4CXX_INFO(MainLogger, "Started " << executable << " as process " << pid << " to take over");
+    return std::unique_ptr<UpgradeChannel>(new UpgradeChannel(fd, pid));
+}
+
+std::unique_ptr<UpgradeChannel> UpgradeChannel::inherited() noexcept {
+    const char *value = getenv(UPGRADE_FD_VARIABLE);
+    if (!value) {
+        return std::unique_ptr<UpgradeChannel>();
+    }
+
+    int fd = atoi(value);
+    unsetenv(UPGRADE_FD_VARIABLE);
+    if (fd < 3 || fcntl(fd, F_GETFD) == -1) {
+        LOG4CXX_ERROR(MainLogger, "Ignoring " << UPGRADE_FD_VARIABLE << "=" << value << ". Not an open descriptor");
+        return std::unique_ptr<UpgradeChannel>();
+    }
+
+    return std::unique_ptr<UpgradeChannel>(new UpgradeChannel(fd, getppid()));
+}
+
+bool UpgradeChannel::sendReady() noexcept {
+    ssize_t len = sizeof(UPGRADE_READY_MESSAGE) - 1;
+    if (send(m_fd, UPGRADE_READY_MESSAGE, len, MSG_NOSIGNAL) != len) {
+        LOG4CXX_ERROR(MainLogger, "Unable to tell process " << m_peer << " this one is ready. errno: " << errno);
+        return false;
+    }
+    return true;
+}
+
+UpgradeChannel::Event UpgradeChannel::receive() noexcept {
+    char buffer[64];
+    Event event = Event::NONE;
+    while (true) {
+        ssize_t len = read(m_fd, buffer, sizeof(buffer));
+        if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+            return Event::CLOSED;
+        }
+        if (len == -1) {
+            return event;
+        }
+
+        // Nothing but the one message is ever sent
+        event = Event::READY;
+    }
+}
+
+void UpgradeChannel::release() noexcept {
+    m_fd = -1;
+}
+
+std::string current_executable() noexcept {
+    char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0) {
+        return std::string();
+    }
+
+    return std::string(path, len);
+}
+
+} // namespace Driveshaft
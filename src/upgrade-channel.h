@@ -0,0 +1,100 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_UPGRADE_CHANNEL_H_
+#define incl_DRIVESHAFT_UPGRADE_CHANNEL_H_
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+#include "common-defs.h"
+
+namespace Driveshaft {
+
+// Tells a driveshaft it was started by an upgrade, and which descriptor leads back
+static const char UPGRADE_FD_VARIABLE[] = "DRIVESHAFT_UPGRADE_FD";
+
+/* Connects the two processes of a binary upgrade, so the host never runs
+ * short of workers while the binary is replaced:
+ * 1. SIGUSR2 makes the running driveshaft start its binary again, with the
+ *    same command line and one end of a socketpair.
+ * 2. The new process starts its pools and reports ready once gearmand has
+ *    answered every thread.
+ * 3. The old process drains gracefully and exits, closing its end.
+ * 4. The new process sees it close, then starts the metrics exporter on the
+ *    address the old one let go of and writes the pidfile.
+ * Until step 3 both run their pools, so concurrency only ever overshoots.
+ */
+class UpgradeChannel {
+public:
+    enum class Event {
+        NONE,
+        READY, // the new process is at full strength
+        CLOSED // the other process exited
+    };
+
+    UpgradeChannel(int fd, pid_t peer) noexcept;
+    ~UpgradeChannel() noexcept;
+
+    // From the old process. Throws std::runtime_error if the new one cannot be started
+    static std::unique_ptr<UpgradeChannel> startNewProcess(const std::string& executable);
+    // In the new process. Unset unless this process was started by an upgrade
+    static std::unique_ptr<UpgradeChannel> inherited() noexcept;
+
+    int fd() const noexcept { return m_fd; }
+    pid_t peer() const noexcept { return m_peer; }
+
+    bool sendReady() noexcept;
+    // Reads what arrived without blocking
+    Event receive() noexcept;
+    // Leaves the descriptor open until the process exits
+    void release() noexcept;
+
+private:
+    UpgradeChannel() = delete;
+    UpgradeChannel(const UpgradeChannel&) = delete;
+    UpgradeChannel(UpgradeChannel&&) = delete;
+    UpgradeChannel& operator=(const UpgradeChannel&) = delete;
+    UpgradeChannel& operator=(const UpgradeChannel&&) = delete;
+
+    int m_fd;
+    pid_t m_peer;
+};
+
+// The path this process was started from, so an upgrade runs whatever binary is there now
+std::string current_executable() noexcept;
+
+/* Starts executable with this process's command line and environment, plus
+ * variables given as NAME=value. The child finds its end of a socketpair of
+ * socket_type in fd_variable, and fd is set to ours. Returns the child's pid.
+ * Throws std::runtime_error if it cannot be started.
+ */
+pid_t start_process(const std::string& executable, const std::string& fd_variable,
+                    std::vector<std::string> variables, int socket_type, int& fd);
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_UPGRADE_CHANNEL_H_
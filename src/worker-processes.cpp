@@ -0,0 +1,263 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "worker-processes.h"
+#include "supervisor-channel.h"
+#include "upgrade-channel.h"
+
+namespace Driveshaft {
+
+// A process that exits sooner than this after starting counts as crashing
+static const std::chrono::seconds PROCESS_STABLE_DURATION(60);
+static const std::chrono::seconds PROCESS_MAX_RESTART_DELAY(60);
+
+static std::chrono::seconds restart_delay(uint32_t crashes) noexcept {
+    if (crashes == 0) {
+        return std::chrono::seconds(0);
+    }
+    return std::min(PROCESS_MAX_RESTART_DELAY, std::chrono::seconds(1 << std::min<uint32_t>(crashes - 1, 6)));
+}
+
+WorkerProcesses::WorkerProcesses(uint32_t count, const std::string& executable, MetricProxyPtr metrics) noexcept
+    : m_executable(executable)
+    , m_metrics(metrics)
+    , m_processes(count)
+    , m_stopping(false) {
+}
+
+WorkerProcesses::~WorkerProcesses() noexcept {
+    for (const auto& process : m_processes) {
+        if (process.fd != -1) {
+            close(process.fd);
+        }
+    }
+}
+
+std::vector<int> WorkerProcesses::start() noexcept {
+    std::vector<int> fds;
+    auto now = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < m_processes.size(); ++i) {
+        auto& process = m_processes[i];
+        if (process.pid != 0 || now < process.restart_at) {
+            continue;
+        }
+
+        std::vector<std::string> variables{std::string(WORKER_PROCESS_VARIABLE) + "=" + std::to_string(i)};
+        try {
+            process.pid = start_process(m_executable, SUPERVISOR_FD_VARIABLE, variables, SOCK_SEQPACKET, process.fd);
+        } catch (std::exception& e) {
+            process.pid = 0;
+            process.restart_at = now + restart_delay(++process.crashes);
+            LOG4CXX_ERROR(MainLogger, "Unable to start worker process " << i << ": " << e.what());
+            continue;
+        }
+
+        int flags = fcntl(process.fd, F_GETFL);
+        if (flags == -1 || fcntl(process.fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            LOG4CXX_ERROR(MainLogger, "Unable to make the socket of worker process " << i << " non-blocking. errno: " << errno);
+        }
+
+        process.started = now;
+        process.ready = false;
+        fds.push_back(process.fd);
+        LOG4CXX_INFO(MainLogger, "Started worker process " << i << " as " << process.pid);
+    }
+
+    return fds;
+}
+
+bool WorkerProcesses::owns(int fd) const noexcept {
+    for (const auto& process : m_processes) {
+        if (process.fd == fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerProcesses::handle(int fd) noexcept {
+    uint32_t index = 0;
+    while (index < m_processes.size() && m_processes[index].fd != fd) {
+        ++index;
+    }
+    if (index == m_processes.size()) {
+        return;
+    }
+
+    char buffer[SUPERVISOR_MESSAGE_MAX];
+    while (true) {
+        ssize_t len = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (len > 0) {
+            track(m_processes[index], buffer, len);
+        } else if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+            exited(index);
+            return;
+        } else if (errno == EAGAIN) {
+            return;
+        }
+    }
+}
+
+// Keeps count of what goes into the thread gauges before passing it on
+void WorkerProcesses::track(Process& process, const char *data, size_t length) noexcept {
+    SupervisorMessage message(SupervisorMessage::Type::READY);
+    if (!message.decode(data, length)) {
+        LOG4CXX_ERROR(MainLogger, "Ignoring a malformed message from worker process " << process.pid);
+        return;
+    }
+
+    typedef SupervisorMessage::Type Type;
+    switch (message.type) {
+    case Type::READY:
+        LOG4CXX_INFO(MainLogger, "Worker process " << process.pid << " is ready");
+        process.ready = true;
+        return;
+
+    case Type::TIME_TO_CAPACITY:
+        // The supervisor reports its own, for all processes together
+        return;
+
+    case Type::THREAD_STARTED:
+        ++process.threads[message.names[0]];
+        break;
+
+    case Type::THREAD_ENDED:
+        --process.threads[message.names[0]];
+        break;
+
+    case Type::THREAD_STARTING_WORK:
+        ++process.working[std::make_pair(message.names[0], message.names[1])];
+        break;
+
+    case Type::THREAD_WORK_COMPLETE:
+        --process.working[std::make_pair(message.names[0], message.names[1])];
+        break;
+
+    default:
+        break;
+    }
+
+    message.replay(*m_metrics);
+}
+
+void WorkerProcesses::exited(uint32_t index) noexcept {
+    auto& process = m_processes[index];
+    close(process.fd);
+
+    int status = 0;
+    while (waitpid(process.pid, &status, 0) == -1 && errno == EINTR) {
+    }
+
+    // Its threads are gone without having said so
+    for (const auto& i : process.working) {
+        for (int64_t n = 0; n < i.second; ++n) {
+            m_metrics->reportThreadWorkComplete(i.first.first, i.first.second);
+        }
+    }
+    for (const auto& i : process.threads) {
+        for (int64_t n = 0; n < i.second; ++n) {
+            m_metrics->reportThreadEnded(i.first);
+        }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - process.started < PROCESS_STABLE_DURATION) {
+        ++process.crashes;
+    } else {
+        process.crashes = 0;
+    }
+    process.restart_at = now + restart_delay(process.crashes);
+
+    std::string how = WIFSIGNALED(status) ? "was killed by signal " + std::to_string(WTERMSIG(status))
+                                          : "exited with status " + std::to_string(WEXITSTATUS(status));
+    if (m_stopping) {
+        LOG4CXX_INFO(MainLogger, "Worker process " << index << " (" << process.pid << ") " << how);
+    } else {
+        LOG4CXX_ERROR(MainLogger, "Worker process " << index << " (" << process.pid << ") " << how
+                                  << ". Restarting it in " << restart_delay(process.crashes).count() << " seconds");
+    }
+
+    process.pid = 0;
+    process.fd = -1;
+    process.ready = false;
+    process.threads.clear();
+    process.working.clear();
+}
+
+void WorkerProcesses::stop(int signal_number) noexcept {
+    m_stopping = true;
+    for (const auto& process : m_processes) {
+        if (process.pid != 0 && kill(process.pid, signal_number) == -1) {
+            LOG4CXX_ERROR(MainLogger, "Unable to signal worker process " << process.pid << ". errno: " << errno);
+        }
+    }
+}
+
+void WorkerProcesses::abandon() noexcept {
+    stop(SIGKILL);
+    for (uint32_t i = 0; i < m_processes.size(); ++i) {
+        if (m_processes[i].pid != 0) {
+            exited(i);
+        }
+    }
+}
+
+uint32_t WorkerProcesses::running() const noexcept {
+    return std::count_if(m_processes.begin(), m_processes.end(),
+                         [](const Process& process) { return process.pid != 0; });
+}
+
+bool WorkerProcesses::restartPending() const noexcept {
+    return running() < m_processes.size();
+}
+
+bool WorkerProcesses::allReady() const noexcept {
+    return std::all_of(m_processes.begin(), m_processes.end(),
+                       [](const Process& process) { return process.pid != 0 && process.ready; });
+}
+
+// FNV-1a, so a pool stays in the same process across builds and upgrades
+uint32_t pool_process(const std::string& pool_name, int32_t process, uint32_t count) noexcept {
+    if (process >= 0) {
+        return process % count;
+    }
+
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : pool_name) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash % count;
+}
+
+} // namespace Driveshaft
@@ -0,0 +1,103 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef incl_DRIVESHAFT_WORKER_PROCESSES_H_
+#define incl_DRIVESHAFT_WORKER_PROCESSES_H_
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+#include "common-defs.h"
+#include "metric-proxy.h"
+
+namespace Driveshaft {
+
+/* The supervisor's side of multi-process mode. It starts count copies of
+ * this binary, each running the pools assigned to its index, and replays the
+ * metrics they send into its own exporter. A process that exits is started
+ * again, right away if it had been running a while and with a doubling delay
+ * if it keeps crashing.
+ */
+class WorkerProcesses {
+public:
+    WorkerProcesses(uint32_t count, const std::string& executable, MetricProxyPtr metrics) noexcept;
+    // Closing the sockets makes the processes still running shut down hard
+    ~WorkerProcesses() noexcept;
+
+    // Starts the processes that are due. Returns their sockets to watch for messages
+    std::vector<int> start() noexcept;
+    bool owns(int fd) const noexcept;
+    /* Replays what a process sent. If it exited, it is reaped and its socket
+     * closed, which also takes it out of any epoll set.
+     */
+    void handle(int fd) noexcept;
+
+    // Sends every process a shutdown signal. Those that exit are no longer restarted
+    void stop(int signal_number) noexcept;
+    // Kills and reaps whatever is still running
+    void abandon() noexcept;
+
+    uint32_t running() const noexcept;
+    bool restartPending() const noexcept;
+    // Every process is running and has connected all of its threads
+    bool allReady() const noexcept;
+
+private:
+    WorkerProcesses() = delete;
+    WorkerProcesses(const WorkerProcesses&) = delete;
+    WorkerProcesses(WorkerProcesses&&) = delete;
+    WorkerProcesses& operator=(const WorkerProcesses&) = delete;
+    WorkerProcesses& operator=(const WorkerProcesses&&) = delete;
+
+    struct Process {
+        pid_t pid = 0;
+        int fd = -1;
+        bool ready = false;
+        uint32_t crashes = 0; // in a row, each soon after starting
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point restart_at;
+        // What the process's threads added to the thread gauges, taken back when it exits
+        std::map<std::string, int64_t> threads;
+        std::map<std::pair<std::string, std::string>, int64_t> working;
+    };
+
+    void track(Process& process, const char *data, size_t length) noexcept;
+    void exited(uint32_t index) noexcept;
+
+    std::string m_executable;
+    MetricProxyPtr m_metrics;
+    std::vector<Process> m_processes;
+    bool m_stopping;
+};
+
+// Which of count worker processes runs a pool: process if set, or by a hash of the name
+uint32_t pool_process(const std::string& pool_name, int32_t process, uint32_t count) noexcept;
+
+} // namespace Driveshaft
+
+#endif // incl_DRIVESHAFT_WORKER_PROCESSES_H_
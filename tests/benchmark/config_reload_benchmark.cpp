@@ -0,0 +1,140 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Times config reloads against a generated config with many pools, by
+ * default 10000:
+ *
+ *     driveshaft_config_benchmark [pools] [rounds]
+ *
+ * A reload parses the new config, compares it with the running one and
+ * informs a watcher of every pool that changed. The watcher here only counts
+ * calls, so the numbers are the config side of a reload.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <log4cxx/logger.h>
+#include "driveshaft-config.h"
+
+namespace Driveshaft {
+    log4cxx::LoggerPtr MainLogger(log4cxx::Logger::getLogger("benchmark-main"));
+    log4cxx::LoggerPtr ThreadLogger(log4cxx::Logger::getLogger("benchmark-thread"));
+
+    std::atomic_bool g_force_shutdown(false);
+
+    uint32_t MAX_JOB_RUNNING_TIME = 5;
+    uint32_t GEARMAND_RESPONSE_TIMEOUT = 5;
+}
+
+using namespace Driveshaft;
+
+class CountingPoolWatcher : public PoolWatcher {
+public:
+    CountingPoolWatcher() : informed(0) {}
+
+    void inform(uint32_t config_worker_count, const std::string& pool_name,
+                const StringSet& server_list, const StringSet& jobs_list,
+                const std::string& processing_uri, const PoolOptions& options) override {
+        ++informed;
+    }
+
+    uint32_t informed;
+};
+
+// changed_pool gets a different worker_count from every other pool
+static std::string make_config(uint32_t pools, uint32_t changed_pool) {
+    std::ostringstream config;
+    config << "{\"gearman_servers_list\": [\"gearmand-1:4730\", \"gearmand-2:4730\"], \"pools_list\": {";
+    for (uint32_t i = 0; i < pools; ++i) {
+        config << (i ? "," : "") << "\"pool-" << i << "\": {"
+               << "\"worker_count\": " << (i == changed_pool ? 2 : 1) << ","
+               << "\"jobs_list\": [\"Job" << i << "\"],"
+               << "\"job_processing_uri\": \"http://localhost/pool/" << i << "\"}";
+    }
+    config << "}}";
+    return config.str();
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double millis_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+    MainLogger->setLevel(log4cxx::Level::getOff());
+    ThreadLogger->setLevel(log4cxx::Level::getOff());
+
+    uint32_t pools = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    uint32_t rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10;
+    if (pools < 2 || rounds == 0) {
+        std::cerr << "usage: " << argv[0] << " [pools >= 2] [rounds > 0]" << std::endl;
+        return 1;
+    }
+
+    Json::CharReaderBuilder jsonfactory;
+    jsonfactory.strictMode(&jsonfactory.settings_);
+    std::shared_ptr<Json::CharReader> json_parser(jsonfactory.newCharReader());
+
+    const std::string unchanged(make_config(pools, pools));
+    const std::string one_changed(make_config(pools, pools / 2));
+
+    double parse_ms = 0, unchanged_ms = 0, one_changed_ms = 0;
+    uint32_t unchanged_informed = 0, one_changed_informed = 0;
+    for (uint32_t round = 0; round < rounds; ++round) {
+        DriveshaftConfig running;
+        running.parseConfig(unchanged, json_parser);
+
+        auto start = Clock::now();
+        DriveshaftConfig same;
+        same.parseConfig(unchanged, json_parser);
+        parse_ms += millis_since(start);
+
+        CountingPoolWatcher watcher;
+        start = Clock::now();
+        same.supersede(running, watcher);
+        unchanged_ms += millis_since(start);
+        unchanged_informed += watcher.informed;
+
+        DriveshaftConfig changed;
+        changed.parseConfig(one_changed, json_parser);
+        watcher.informed = 0;
+        start = Clock::now();
+        changed.supersede(same, watcher);
+        one_changed_ms += millis_since(start);
+        one_changed_informed += watcher.informed;
+    }
+
+    std::cout << pools << " pools, averaged over " << rounds << " rounds" << std::endl
+              << "  parse:                  " << parse_ms / rounds << "ms" << std::endl
+              << "  supersede, unchanged:   " << unchanged_ms / rounds << "ms, "
+              << unchanged_informed / rounds << " pools informed" << std::endl
+              << "  supersede, one changed: " << one_changed_ms / rounds << "ms, "
+              << one_changed_informed / rounds << " pools informed" << std::endl;
+    return 0;
+}
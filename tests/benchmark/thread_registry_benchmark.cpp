@@ -0,0 +1,135 @@
+/*
+ * Driveshaft: Gearman worker manager
+ *
+ * Copyright (c) [2015] [Keyur Govande]
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Times the registry calls a worker makes for every job, with more and more
+ * threads making them at once:
+ *
+ *     driveshaft_registry_benchmark [max threads] [jobs per thread]
+ *
+ * Every simulated job publishes its identity, goes back to waiting and
+ * checks for shutdown, like GearmanClient and ThreadLoop do. A supervisor
+ * thread takes snapshots throughout. Flat per-job times mean the threads do
+ * not contend with each other.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <log4cxx/logger.h>
+#include "thread-registry.h"
+
+namespace Driveshaft {
+    log4cxx::LoggerPtr MainLogger(log4cxx::Logger::getLogger("benchmark-main"));
+    log4cxx::LoggerPtr ThreadLogger(log4cxx::Logger::getLogger("benchmark-thread"));
+
+    std::atomic_bool g_force_shutdown(false);
+
+    uint32_t MAX_JOB_RUNNING_TIME = 5;
+    uint32_t GEARMAND_RESPONSE_TIMEOUT = 5;
+}
+
+using namespace Driveshaft;
+
+typedef std::chrono::steady_clock Clock;
+
+static void run_jobs(ThreadRegistry& registry, uint32_t jobs, std::atomic<uint32_t>& ready,
+                     std::atomic<bool>& go, std::atomic<uint64_t>& shutdowns_seen) {
+    registry.registerThread("benchmark");
+    ++ready;
+    while (!go) {
+        std::this_thread::yield();
+    }
+
+    uint64_t seen = 0;
+    const std::string unique(std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())));
+    const std::string handle("H:gearmand:" + unique);
+    for (uint32_t i = 0; i < jobs; ++i) {
+        registry.setThreadJob(handle.c_str(), unique.c_str());
+        registry.setThreadState(ThreadState::WAITING_FOR_WORK);
+        seen += registry.shouldShutdown();
+    }
+
+    shutdowns_seen += seen;
+    registry.unregisterThread();
+}
+
+int main(int argc, char **argv) {
+    MainLogger->setLevel(log4cxx::Level::getOff());
+    ThreadLogger->setLevel(log4cxx::Level::getOff());
+
+    uint32_t max_threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+    uint32_t jobs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000;
+    if (max_threads == 0 || jobs == 0) {
+        std::cerr << "usage: " << argv[0] << " [max threads > 0] [jobs per thread > 0]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "threads  ns per job  jobs per second  snapshots" << std::endl;
+    for (uint32_t threads = 1; threads <= max_threads; threads *= 4) {
+        ThreadRegistry registry;
+        std::atomic<uint32_t> ready(0);
+        std::atomic<bool> go(false);
+        std::atomic<bool> done(false);
+        std::atomic<uint64_t> shutdowns_seen(0);
+
+        std::vector<std::thread> workers;
+        for (uint32_t i = 0; i < threads; ++i) {
+            workers.emplace_back(run_jobs, std::ref(registry), jobs, std::ref(ready),
+                                 std::ref(go), std::ref(shutdowns_seen));
+        }
+        while (ready < threads) {
+            std::this_thread::yield();
+        }
+
+        uint64_t snapshots = 0;
+        std::thread supervisor([&registry, &done, &snapshots] {
+            while (!done) {
+                snapshots += !registry.snapshot().empty();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+
+        auto start = Clock::now();
+        go = true;
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        done = true;
+        supervisor.join();
+
+        // Every thread ran its jobs side by side; on more threads than cores
+        // the time per job is bounded by the cores, not by the registry
+        double total_jobs = double(threads) * jobs;
+        std::cout << threads << "\t " << elapsed * 1e9 * std::min<uint32_t>(threads, std::thread::hardware_concurrency()) / total_jobs
+                  << "\t     " << uint64_t(total_jobs / elapsed)
+                  << "\t      " << snapshots << std::endl;
+    }
+    return 0;
+}
@@ -25,6 +25,18 @@ const std::string testConfigOneServerOnePoolNewUri(
      "}"
 );
 
+const std::string testConfigOneServerOnePoolNewJobs(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\", \"Product\"],"
+            "\"job_processing_uri\": \"send.work.here\""
+            "}"
+        "}"
+     "}"
+);
+
 const std::string testConfigOneServerTwoPools(
     "{\"gearman_servers_list\": [\"foo\"],"
      "\"pools_list\": {"
@@ -58,3 +70,284 @@ const std::string testConfigTwoServersTwoPools(
         "}"
      "}"
 );
+
+const std::string testConfigTwoServersTwoPoolsOneDedicated(
+    "{\"gearman_servers_list\": [\"foo\", \"bar\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\""
+            "},"
+          "\"test-pool-2\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Product\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"gearman_servers_list\": [\"foo\"]"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolBadServers(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"gearman_servers_list\": \"foo\""
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolCircuitBreaker(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"circuit_breaker\": {"
+              "\"failure_threshold\": 3,"
+              "\"open_duration_ms\": 500"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolRetry(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\", \"Product\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"retry\": {"
+              "\"max_attempts\": 3,"
+              "\"initial_backoff_ms\": 50,"
+              "\"budget_percent\": 10,"
+              "\"functions\": {"
+                "\"Product\": {\"max_attempts\": 1}"
+                "}"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolBackpressure(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"backpressure\": {"
+              "\"pause_ms\": 200,"
+              "\"latency_threshold_ms\": 1500"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolConcurrencyLimit(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"concurrency_limit\": {"
+              "\"min_limit\": 2,"
+              "\"max_limit\": 5"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolBadConcurrencyLimit(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"concurrency_limit\": {"
+              "\"min_limit\": 8,"
+              "\"max_limit\": 5"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolAutoscale(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"autoscale\": {"
+              "\"min_workers\": 2,"
+              "\"max_workers\": 20,"
+              "\"jobs_per_worker\": 4,"
+              "\"hosts\": 3"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolRateLimit(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\", \"Product\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"rate_limit\": {"
+              "\"jobs_per_second\": 50,"
+              "\"functions\": {"
+                "\"Product\": {\"jobs_per_second\": 0.5, \"burst\": 2}"
+                "}"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolFetchQueue(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 50,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"fetch_queue\": {"
+              "\"fetchers\": 2"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolFetchQueueNewJobs(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 50,"
+            "\"jobs_list\": [\"Sum\", \"Product\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"fetch_queue\": {"
+              "\"fetchers\": 2"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolBadFetchQueue(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 50,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"fetch_queue\": {"
+              "\"fetchers\": 2,"
+              "\"capacity\": 0"
+              "}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolNativeProtocol(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 50,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"worker_protocol\": \"native\","
+            "\"gearmand_probe\": {\"interval_ms\": 60000, \"timeout_ms\": 5000}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigTwoServersOnePoolSharded(
+    "{\"gearman_servers_list\": [\"foo\", \"bar\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 50,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"servers_per_thread\": 1"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolBadProtocol(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 50,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"worker_protocol\": \"carrier-pigeon\""
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolScheduling(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 50,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"scheduling\": {\"cpus\": [2, 3], \"numa_node\": 1, \"nice\": 5, \"policy\": \"batch\"}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerOnePoolBadSchedulingPolicy(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 50,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"scheduling\": {\"policy\": \"realtime\"}"
+            "}"
+        "}"
+     "}"
+);
+
+const std::string testConfigOneServerTwoPoolsOnePlaced(
+    "{\"gearman_servers_list\": [\"foo\"],"
+     "\"pools_list\": {"
+          "\"test-pool-1\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Sum\"],"
+            "\"job_processing_uri\": \"send.work.here\","
+            "\"process\": 3"
+            "},"
+          "\"test-pool-2\": {"
+            "\"worker_count\": 5,"
+            "\"jobs_list\": [\"Product\"],"
+            "\"job_processing_uri\": \"send.work.here\""
+            "}"
+        "}"
+     "}"
+);
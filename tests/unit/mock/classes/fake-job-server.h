@@ -0,0 +1,180 @@
+#ifndef incl_DRIVESHAFT_FAKE_JOB_SERVER_H_
+#define incl_DRIVESHAFT_FAKE_JOB_SERVER_H_
+
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "gearman-protocol.h"
+
+namespace mock {
+namespace classes {
+
+using Driveshaft::GearmanPacketType;
+
+/* Serves the worker protocol to one connection on localhost: hands out the
+ * jobs it is given on GRAB_JOB_UNIQ, NO_JOB otherwise, and wakes a sleeping
+ * worker with a NOOP when a job is added.
+ */
+class FakeJobServer {
+public:
+    FakeJobServer() : m_client_fd(-1), m_sleeping(false), m_answers_echo(true) {
+        m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        listen(m_listen_fd, 1);
+
+        socklen_t len = sizeof(addr);
+        getsockname(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+        m_port = ntohs(addr.sin_port);
+
+        m_thread = std::thread([this] { serve(); });
+    }
+
+    // Hangs up on the worker if it is still connected
+    ~FakeJobServer() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_client_fd >= 0) {
+                shutdown(m_client_fd, SHUT_RDWR);
+            }
+            shutdown(m_listen_fd, SHUT_RDWR);
+        }
+        m_thread.join();
+        close(m_listen_fd);
+    }
+
+    std::string address() const {
+        return "127.0.0.1:" + std::to_string(m_port);
+    }
+
+    void addJob(const std::string& handle, const std::string& workload) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back({handle, workload});
+        if (m_sleeping) {
+            m_sleeping = false;
+            respond(GearmanPacketType::NOOP, "");
+        }
+    }
+
+    // Stops answering ECHO_REQ, like a host that went away without a FIN
+    void stopAnsweringEcho() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_answers_echo = false;
+    }
+
+    // Resets the worker's connection, so its next write fails
+    void hangUp() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_client_fd >= 0) {
+            struct linger abort = {1, 0};
+            setsockopt(m_client_fd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+            shutdown(m_client_fd, SHUT_RDWR);
+        }
+    }
+
+    // Waits up to attempts * 10ms for a request of the given type and returns its data
+    bool waitFor(GearmanPacketType type, std::string& data, int attempts = 500) {
+        for (int i = 0; i <= attempts; i++) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (const auto& request : m_requests) {
+                    if (request.first == type) {
+                        data = request.second;
+                        return true;
+                    }
+                }
+            }
+            if (i < attempts) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        return false;
+    }
+
+private:
+    void serve() {
+        int fd = accept(m_listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_client_fd = fd;
+        }
+
+        char header[12];
+        while (readFully(fd, header, sizeof(header))) {
+            uint32_t type, size;
+            memcpy(&type, header + 4, 4);
+            memcpy(&size, header + 8, 4);
+            std::string data(ntohl(size), '\0');
+            if (!readFully(fd, &data[0], data.size())) {
+                break;
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto packet_type = static_cast<GearmanPacketType>(ntohl(type));
+            m_requests.push_back({packet_type, data});
+            if (packet_type == GearmanPacketType::GRAB_JOB_UNIQ) {
+                if (m_jobs.empty()) {
+                    respond(GearmanPacketType::NO_JOB, "");
+                } else {
+                    auto job = m_jobs.front();
+                    m_jobs.pop_front();
+                    respond(GearmanPacketType::JOB_ASSIGN_UNIQ,
+                            job.first + std::string("\0Sum\0", 5) + job.first + std::string(1, '\0') + job.second);
+                }
+            } else if (packet_type == GearmanPacketType::PRE_SLEEP) {
+                m_sleeping = true;
+            } else if (packet_type == GearmanPacketType::ECHO_REQ && m_answers_echo) {
+                respond(GearmanPacketType::ECHO_RES, data);
+            }
+        }
+        close(fd);
+    }
+
+    static bool readFully(int fd, char *buf, size_t len) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = recv(fd, buf + done, len - done, 0);
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    // Called with m_mutex held
+    void respond(GearmanPacketType type, const std::string& data) {
+        std::string packet("\0RES", 4);
+        uint32_t header[2] = {htonl(static_cast<uint32_t>(type)), htonl(static_cast<uint32_t>(data.size()))};
+        packet.append(reinterpret_cast<const char*>(header), sizeof(header));
+        packet += data;
+        send(m_client_fd, packet.data(), packet.size(), MSG_NOSIGNAL);
+    }
+
+    int m_listen_fd;
+    int m_client_fd;
+    uint16_t m_port;
+    bool m_sleeping;
+    bool m_answers_echo;
+    std::mutex m_mutex;
+    std::deque<std::pair<std::string, std::string>> m_jobs;
+    std::vector<std::pair<GearmanPacketType, std::string>> m_requests;
+    std::thread m_thread;
+};
+
+} // namespace classes
+} // namespace mock
+
+#endif // incl_DRIVESHAFT_FAKE_JOB_SERVER_H_
@@ -1,6 +1,8 @@
 #ifndef incl_DRIVESHAFT_MOCK_METRIC_PROXY_H_
 #define incl_DRIVESHAFT_MOCK_METRIC_PROXY_H_
 
+#include <chrono>
+#include <queue>
 #include "metric-proxy.h"
 
 namespace mock {
@@ -32,6 +34,14 @@ public:
         m_job_http_error_count.clear();
         m_job_timeout_count.clear();
         m_job_error_count.clear();
+        m_job_retry_count.clear();
+        m_job_retry_denied_count.clear();
+        m_circuit_breaker_states.clear();
+        m_backpressure_pause_count.clear();
+        m_concurrency_limits.clear();
+        m_queued_jobs.clear();
+        m_throttled_count.clear();
+        m_reconnect_count.clear();
     }
 
     /* Implementation of the MetricProxyInterface */
@@ -55,6 +65,14 @@ public:
         m_job_timeout_count[make_pf(pool_name, function_name)] += 1;
     }
     
+    void reportJobRetry(const std::string &pool_name, const std::string &function_name) noexcept override {
+        m_job_retry_count[make_pf(pool_name, function_name)] += 1;
+    }
+
+    void reportJobRetryDenied(const std::string &pool_name, const std::string &function_name, const std::string &reason) noexcept override {
+        m_job_retry_denied_count[std::make_tuple(pool_name, function_name, reason)] += 1;
+    }
+
     void reportThreadStarted(const std::string &pool_name) noexcept override{
         m_thread_starts[pool_name].push(high_resolution_clock::now());
     }
@@ -67,6 +85,34 @@ public:
     void reportThreadWorkComplete(const std::string &pool_name, const std::string &function_name) noexcept override {
         m_work_ends[make_pf(pool_name, function_name)].push(high_resolution_clock::now());
     }
+
+    void reportCircuitBreakerTransition(const std::string &pool_name, const std::string &from_state, const std::string &to_state) noexcept override {
+        m_circuit_breaker_states[pool_name] = to_state;
+    }
+
+    void reportBackpressurePause(const std::string &pool_name, const std::string &reason, double duration) noexcept override {
+        m_backpressure_pause_count[make_pf(pool_name, reason)] += 1;
+    }
+
+    void reportConcurrencyLimit(const std::string &pool_name, uint32_t limit) noexcept override {
+        m_concurrency_limits[pool_name] = limit;
+    }
+
+    void reportThrottled(const std::string &pool_name, const std::string &limit_name, double duration) noexcept override {
+        m_throttled_count[make_pf(pool_name, limit_name)] += 1;
+    }
+
+    void reportReconnect(const std::string &pool_name) noexcept override {
+        m_reconnect_count[pool_name] += 1;
+    }
+
+    void reportQueueStatus(const std::string &function_name, uint64_t queued, uint64_t running, uint64_t available_workers) noexcept override {
+        m_queued_jobs[function_name] = queued;
+    }
+
+    void reportTimeToCapacity(double duration) noexcept override {}
+
+    void reportScaleDown(const std::string &pool_name, double duration) noexcept override {}
     
     /* Here on below, an interface for validation from test cases */
     uint32_t getJobSuccessesCount(const std::string& pool_name, const std::string& function_name) {
@@ -90,6 +136,38 @@ public:
         return m_job_error_count[make_pf(pool_name, function_name)];
     }
 
+    uint32_t getJobRetryCount(const std::string& pool_name, const std::string& function_name) {
+        return m_job_retry_count[make_pf(pool_name, function_name)];
+    }
+
+    uint32_t getJobRetryDeniedCount(const std::string& pool_name, const std::string& function_name, const std::string& reason) {
+        return m_job_retry_denied_count[std::make_tuple(pool_name, function_name, reason)];
+    }
+
+    std::string getCircuitBreakerState(const std::string& pool_name) {
+        return m_circuit_breaker_states[pool_name];
+    }
+
+    uint32_t getBackpressurePauseCount(const std::string& pool_name, const std::string& reason) {
+        return m_backpressure_pause_count[make_pf(pool_name, reason)];
+    }
+
+    uint32_t getConcurrencyLimit(const std::string& pool_name) {
+        return m_concurrency_limits[pool_name];
+    }
+
+    uint32_t getThrottledCount(const std::string& pool_name, const std::string& limit_name) {
+        return m_throttled_count[make_pf(pool_name, limit_name)];
+    }
+
+    uint32_t getReconnectCount(const std::string& pool_name) {
+        return m_reconnect_count[pool_name];
+    }
+
+    uint64_t getQueuedJobs(const std::string& function_name) {
+        return m_queued_jobs[function_name];
+    }
+
     time_point popThreadStart(const std::string& pool_name) {
         if (m_thread_starts[pool_name].empty()) throw std::runtime_error("no thread starts recorded");
         auto retval = m_thread_starts[pool_name].top();
@@ -126,12 +204,21 @@ private:
     std::map<pool_function_and_status, uint32_t> m_job_http_error_count;
     std::map<pool_and_function, uint32_t> m_job_timeout_count;
     std::map<pool_and_function, uint32_t> m_job_error_count;
+    std::map<pool_and_function, uint32_t> m_job_retry_count;
+    std::map<std::tuple<std::string, std::string, std::string>, uint32_t> m_job_retry_denied_count;
 
     std::map<std::string, time_points> m_thread_starts;
     std::map<std::string, time_points> m_thread_ends;
     std::map<pool_and_function, time_points> m_work_starts;
     std::map<pool_and_function, time_points> m_work_ends;
 
+    std::map<std::string, std::string> m_circuit_breaker_states;
+    std::map<pool_and_function, uint32_t> m_backpressure_pause_count; // keyed by pool and reason
+    std::map<std::string, uint32_t> m_concurrency_limits;
+    std::map<std::string, uint64_t> m_queued_jobs;
+    std::map<pool_and_function, uint32_t> m_throttled_count; // keyed by pool and limit
+    std::map<std::string, uint32_t> m_reconnect_count;
+
     static pool_and_function make_pf(const std::string &pool_name, const std::string &function_name) { return std::make_pair(pool_name, function_name); }
 };
 
@@ -1,6 +1,7 @@
 #ifndef incl_DRIVESHAFT_MOCK_THREAD_REGISTRY_H_
 #define incl_DRIVESHAFT_MOCK_THREAD_REGISTRY_H_
 
+#include <atomic>
 #include "thread-registry.h"
 
 namespace mock {
@@ -8,13 +9,26 @@ namespace classes {
 
 class MockThreadRegistry : public Driveshaft::ThreadRegistryInterface {
 public:
-    void registerThread(const std::string& pool, std::thread::id tid) noexcept {}
-    void unregisterThread(const std::string& pool, std::thread::id tid) noexcept {}
+    MockThreadRegistry() : timesReadySet(0), shutdownRequested(false) {}
+
+    void reserveThreads(const std::string& pool, uint32_t count) noexcept {}
+    void registerThread(const std::string& pool) noexcept {}
+    void unregisterThread() noexcept {}
     uint32_t poolCount(const std::string& pool) noexcept { return 0; }
+    uint32_t threadCount() noexcept { return 0; }
     bool sendShutdown(const std::string& pool, uint32_t count) noexcept { return true; }
-    bool shouldShutdown(std::thread::id tid) noexcept { return false; }
-    void setThreadState(std::thread::id tid, const std::string& state) noexcept {}
-    Driveshaft::ThreadMap getThreadMap() noexcept { return Driveshaft::ThreadMap(); }
+    bool shouldShutdown() noexcept { return shutdownRequested; }
+    void setThreadState(Driveshaft::ThreadState state) noexcept {}
+    void setThreadJob(const char *job_handle, const char *job_unique) noexcept {}
+    void setThreadReady() noexcept { timesReadySet++; }
+    uint32_t readyCount() noexcept { return 0; }
+    Driveshaft::ThreadSnapshots snapshot() noexcept { return Driveshaft::ThreadSnapshots(); }
+    Driveshaft::StringSet takeExitedPools() noexcept { return Driveshaft::StringSet(); }
+    Driveshaft::ScaleDownTimes takeScaleDownTimes() noexcept { return Driveshaft::ScaleDownTimes(); }
+    int eventFd() noexcept { return -1; }
+
+    std::atomic<uint32_t> timesReadySet;
+    std::atomic<bool> shutdownRequested; // as if sendShutdown picked the thread
 };
 
 } // namespace classes
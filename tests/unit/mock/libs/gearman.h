@@ -21,6 +21,10 @@ public:
         return GEARMAN_SUCCESS;
     }
 
+    virtual gearman_return_t unregister(gearman_worker_st *worker, const char *functionName) {
+        return GEARMAN_SUCCESS;
+    }
+
     virtual gearman_return_t addServers(gearman_worker_st *worker, const char *servers) {
         return GEARMAN_SUCCESS;
     }
@@ -49,6 +53,15 @@ public:
     virtual const char* lastError(const gearman_worker_st *worker) {
         return "";
     }
+
+    virtual gearman_return_t registerFunction(gearman_worker_st *worker, const char *functionName, uint32_t timeout) {
+        return GEARMAN_SUCCESS;
+    }
+
+    virtual gearman_job_st* grabJob(gearman_worker_st *worker, gearman_job_st *job, gearman_return_t *ret_ptr) {
+        *ret_ptr = GEARMAN_NO_JOBS;
+        return nullptr;
+    }
 };
 
 class MockGearmanJobLib {
@@ -72,6 +85,17 @@ public:
     virtual const void* workload(const gearman_job_st *job) {
         return nullptr;
     }
+
+    virtual gearman_return_t sendComplete(gearman_job_st *job, const void *result, size_t result_size) {
+        return GEARMAN_SUCCESS;
+    }
+
+    virtual gearman_return_t sendFail(gearman_job_st *job) {
+        return GEARMAN_SUCCESS;
+    }
+
+    virtual void free(gearman_job_st *job) {
+    }
 };
 
 } // namespace gearman
@@ -101,6 +125,10 @@ gearman_return_t gearman_worker_unregister_all(gearman_worker_st *worker) {
     return sMockWorkerLib->unregisterAll(worker);
 }
 
+gearman_return_t gearman_worker_unregister(gearman_worker_st *worker, const char *functionName) {
+    return sMockWorkerLib->unregister(worker, functionName);
+}
+
 void gearman_worker_add_options(gearman_worker_st *worker, gearman_worker_options_t options) {
     sMockWorkerLib->addOptions(worker, options);
 }
@@ -127,6 +155,14 @@ const char* gearman_worker_error(const gearman_worker_st *worker) {
     return sMockWorkerLib->lastError(worker);
 }
 
+gearman_return_t gearman_worker_register(gearman_worker_st *worker, const char *functionName, uint32_t timeout) {
+    return sMockWorkerLib->registerFunction(worker, functionName, timeout);
+}
+
+gearman_job_st* gearman_worker_grab_job(gearman_worker_st *worker, gearman_job_st *job, gearman_return_t *ret_ptr) {
+    return sMockWorkerLib->grabJob(worker, job, ret_ptr);
+}
+
 const char* gearman_job_function_name(const gearman_job_st *job) {
     return sMockJobLib->functionName(job);
 }
@@ -147,4 +183,16 @@ const void* gearman_job_workload(const gearman_job_st *job) {
     return sMockJobLib->workload(job);
 }
 
+gearman_return_t gearman_job_send_complete(gearman_job_st *job, const void *result, size_t result_size) {
+    return sMockJobLib->sendComplete(job, result, result_size);
+}
+
+gearman_return_t gearman_job_send_fail(gearman_job_st *job) {
+    return sMockJobLib->sendFail(job);
+}
+
+void gearman_job_free(gearman_job_st *job) {
+    sMockJobLib->free(job);
+}
+
 #endif // incl_DRIVESHAFT_MOCK_GEARMAN_WORKER_LIB_H_
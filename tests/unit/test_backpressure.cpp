@@ -0,0 +1,95 @@
+#include <thread>
+#include "gtest/gtest.h"
+#include "mock/classes/mock-metric-proxy.h"
+#include "backpressure.h"
+
+using namespace Driveshaft;
+using std::chrono::milliseconds;
+
+class BackpressureTest : public ::testing::Test {
+public:
+    BackpressureTest() : mockMetricProxy(new mock::classes::MockMetricProxy) {
+        options.pause_ms = 100;
+        options.max_pause_ms = 300;
+    }
+
+    BackpressureOptions options;
+    MockMetricProxyPtr mockMetricProxy;
+};
+
+TEST_F(BackpressureTest, TestNotPausedInitially) {
+    Backpressure backpressure("pool", options, mockMetricProxy);
+    ASSERT_EQ(0, backpressure.pausedFor().count());
+}
+
+TEST_F(BackpressureTest, TestOverloadPausesAndDoublesUpToMax) {
+    Backpressure backpressure("pool", options, mockMetricProxy);
+
+    backpressure.reportOverload(-1);
+    ASSERT_GT(backpressure.pausedFor().count(), 0);
+    ASSERT_LE(backpressure.pausedFor().count(), 100);
+
+    backpressure.reportOverload(-1);
+    ASSERT_GT(backpressure.pausedFor().count(), 100);
+
+    backpressure.reportOverload(-1);
+    backpressure.reportOverload(-1);
+    ASSERT_LE(backpressure.pausedFor().count(), 300);
+    ASSERT_GE(mockMetricProxy->getBackpressurePauseCount("pool", "overload"), 3);
+}
+
+TEST_F(BackpressureTest, TestRetryAfterOverridesPauseButNotMax) {
+    Backpressure backpressure("pool", options, mockMetricProxy);
+
+    backpressure.reportOverload(250);
+    ASSERT_GT(backpressure.pausedFor().count(), 100);
+
+    Backpressure capped("pool", options, mockMetricProxy);
+    capped.reportOverload(60000);
+    ASSERT_LE(capped.pausedFor().count(), 300);
+}
+
+TEST_F(BackpressureTest, TestNewOptionsApplyToTheNextPause) {
+    Backpressure backpressure("pool", options, mockMetricProxy);
+
+    options.max_pause_ms = 50;
+    backpressure.setOptions(options);
+    backpressure.reportOverload(60000);
+    ASSERT_LE(backpressure.pausedFor().count(), 50);
+}
+
+TEST_F(BackpressureTest, TestResetEndsPause) {
+    Backpressure backpressure("pool", options, mockMetricProxy);
+
+    backpressure.reportOverload(-1);
+    ASSERT_GT(backpressure.pausedFor().count(), 0);
+    backpressure.reset();
+    ASSERT_EQ(0, backpressure.pausedFor().count());
+}
+
+TEST_F(BackpressureTest, TestSuccessfulResponseResetsPause) {
+    options.pause_ms = 5;
+    Backpressure backpressure("pool", options, mockMetricProxy);
+
+    backpressure.reportOverload(-1);
+    backpressure.reportOverload(-1);
+    backpressure.reportResponse(milliseconds(1));
+    std::this_thread::sleep_for(milliseconds(15));
+
+    backpressure.reportOverload(-1);
+    ASSERT_LE(backpressure.pausedFor().count(), 5);
+}
+
+TEST_F(BackpressureTest, TestSlowResponsesPause) {
+    options.latency_threshold_ms = 50;
+    Backpressure backpressure("pool", options, mockMetricProxy);
+
+    backpressure.reportResponse(milliseconds(10));
+    ASSERT_EQ(0, backpressure.pausedFor().count());
+
+    for (int i = 0; i < 20; i++) {
+        backpressure.reportResponse(milliseconds(200));
+    }
+    ASSERT_GT(backpressure.pausedFor().count(), 0);
+    ASSERT_EQ(1, mockMetricProxy->getBackpressurePauseCount("pool", "latency"));
+}
@@ -0,0 +1,88 @@
+#include <thread>
+#include <vector>
+#include <atomic>
+#include "gtest/gtest.h"
+#include "bounded-queue.h"
+
+using namespace Driveshaft;
+
+TEST(BoundedQueueTest, TestPopsInPushOrder) {
+    BoundedQueue<int> queue(4);
+
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(queue.tryPush(i));
+    }
+    for (int i = 0; i < 4; i++) {
+        int value = -1;
+        ASSERT_TRUE(queue.tryPop(value));
+        ASSERT_EQ(i, value);
+    }
+}
+
+TEST(BoundedQueueTest, TestRefusesPushWhenFullAndPopWhenEmpty) {
+    BoundedQueue<int> queue(2);
+    int value;
+
+    ASSERT_FALSE(queue.tryPop(value));
+    ASSERT_TRUE(queue.tryPush(1));
+    ASSERT_TRUE(queue.tryPush(2));
+    ASSERT_FALSE(queue.tryPush(3));
+
+    ASSERT_TRUE(queue.tryPop(value));
+    ASSERT_TRUE(queue.tryPush(3));
+    ASSERT_FALSE(queue.tryPush(4));
+}
+
+TEST(BoundedQueueTest, TestWrapsAroundManyTimes) {
+    BoundedQueue<int> queue(3);
+
+    for (int i = 0; i < 100; i++) {
+        int value = -1;
+        ASSERT_TRUE(queue.tryPush(i));
+        ASSERT_TRUE(queue.tryPop(value));
+        ASSERT_EQ(i, value);
+    }
+}
+
+TEST(BoundedQueueTest, TestConcurrentProducersAndConsumersSeeEachValueOnce) {
+    static const int producers = 4;
+    static const int consumers = 4;
+    static const int per_producer = 20000;
+    BoundedQueue<int> queue(16);
+    std::vector<std::atomic<int>> seen(producers * per_producer);
+    for (auto& i : seen) {
+        i.store(0);
+    }
+    std::atomic<int> popped(0);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, p]{
+            for (int i = 0; i < per_producer; i++) {
+                while (!queue.tryPush(p * per_producer + i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([&queue, &seen, &popped]{
+            int value;
+            while (popped.load() < producers * per_producer) {
+                if (queue.tryPop(value)) {
+                    seen[value]++;
+                    popped++;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (auto& i : seen) {
+        ASSERT_EQ(1, i.load());
+    }
+}
@@ -0,0 +1,129 @@
+#include <thread>
+#include "gtest/gtest.h"
+#include "mock/classes/mock-metric-proxy.h"
+#include "circuit-breaker.h"
+
+using namespace Driveshaft;
+
+class CircuitBreakerTest : public ::testing::Test {
+public:
+    CircuitBreakerTest() : mockMetricProxy(new mock::classes::MockMetricProxy) {
+        options.failure_threshold = 3;
+        options.open_duration_ms = 20;
+        options.half_open_probes = 2;
+    }
+
+    void trip(CircuitBreaker &breaker) {
+        bool probe;
+        for (uint32_t i = 0; i < options.failure_threshold; i++) {
+            ASSERT_TRUE(breaker.tryAcquire(probe));
+            breaker.recordFailure(probe);
+        }
+    }
+
+    CircuitBreakerOptions options;
+    MockMetricProxyPtr mockMetricProxy;
+};
+
+TEST_F(CircuitBreakerTest, TestClosedBreakerHandsOutPermits) {
+    CircuitBreaker breaker("pool", options, mockMetricProxy);
+
+    bool probe = true;
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(breaker.tryAcquire(probe));
+        ASSERT_FALSE(probe);
+    }
+    ASSERT_EQ(CircuitBreaker::State::CLOSED, breaker.state());
+}
+
+TEST_F(CircuitBreakerTest, TestSuccessResetsConsecutiveFailures) {
+    CircuitBreaker breaker("pool", options, mockMetricProxy);
+
+    bool probe;
+    for (int i = 0; i < 10; i++) {
+        breaker.tryAcquire(probe);
+        breaker.recordFailure(probe);
+        breaker.tryAcquire(probe);
+        breaker.recordSuccess(probe);
+    }
+    ASSERT_EQ(CircuitBreaker::State::CLOSED, breaker.state());
+}
+
+TEST_F(CircuitBreakerTest, TestOpensAfterThresholdAndRefusesPermits) {
+    CircuitBreaker breaker("pool", options, mockMetricProxy);
+    trip(breaker);
+
+    bool probe;
+    ASSERT_EQ(CircuitBreaker::State::OPEN, breaker.state());
+    ASSERT_FALSE(breaker.tryAcquire(probe));
+    ASSERT_GT(breaker.retryDelay().count(), 0);
+    ASSERT_EQ("open", mockMetricProxy->getCircuitBreakerState("pool"));
+}
+
+TEST_F(CircuitBreakerTest, TestResetClosesOpenBreaker) {
+    CircuitBreaker breaker("pool", options, mockMetricProxy);
+    trip(breaker);
+
+    breaker.reset();
+    bool probe;
+    ASSERT_EQ(CircuitBreaker::State::CLOSED, breaker.state());
+    ASSERT_TRUE(breaker.tryAcquire(probe));
+    ASSERT_FALSE(probe);
+    ASSERT_EQ("closed", mockMetricProxy->getCircuitBreakerState("pool"));
+}
+
+TEST_F(CircuitBreakerTest, TestHalfOpenLimitsProbesAndClosesOnSuccess) {
+    CircuitBreaker breaker("pool", options, mockMetricProxy);
+    trip(breaker);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.open_duration_ms + 5));
+
+    bool probe1, probe2, probe3;
+    ASSERT_TRUE(breaker.tryAcquire(probe1));
+    ASSERT_TRUE(breaker.tryAcquire(probe2));
+    ASSERT_TRUE(probe1 && probe2);
+    ASSERT_FALSE(breaker.tryAcquire(probe3));
+    ASSERT_EQ(CircuitBreaker::State::HALF_OPEN, breaker.state());
+
+    // A probe that found no job hands its slot back
+    breaker.release(probe2);
+    ASSERT_TRUE(breaker.tryAcquire(probe2));
+
+    breaker.recordSuccess(probe1);
+    ASSERT_EQ(CircuitBreaker::State::HALF_OPEN, breaker.state());
+    breaker.recordSuccess(probe2);
+    ASSERT_EQ(CircuitBreaker::State::CLOSED, breaker.state());
+    ASSERT_EQ("closed", mockMetricProxy->getCircuitBreakerState("pool"));
+}
+
+TEST_F(CircuitBreakerTest, TestFailedProbeReopens) {
+    CircuitBreaker breaker("pool", options, mockMetricProxy);
+    trip(breaker);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.open_duration_ms + 5));
+
+    bool probe;
+    ASSERT_TRUE(breaker.tryAcquire(probe));
+    breaker.recordFailure(probe);
+    ASSERT_EQ(CircuitBreaker::State::OPEN, breaker.state());
+    ASSERT_FALSE(breaker.tryAcquire(probe));
+}
+
+TEST_F(CircuitBreakerTest, TestStragglerFailureDoesNotReopenHalfOpenBreaker) {
+    CircuitBreaker breaker("pool", options, mockMetricProxy);
+
+    // A job started while the breaker was closed, and fails after it half-opens
+    bool straggler;
+    ASSERT_TRUE(breaker.tryAcquire(straggler));
+    trip(breaker);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.open_duration_ms + 5));
+
+    bool probe;
+    ASSERT_TRUE(breaker.tryAcquire(probe));
+    ASSERT_TRUE(probe);
+    breaker.recordFailure(straggler);
+    ASSERT_EQ(CircuitBreaker::State::HALF_OPEN, breaker.state());
+
+    breaker.recordSuccess(probe);
+    ASSERT_TRUE(breaker.tryAcquire(probe));
+    breaker.recordSuccess(probe);
+    ASSERT_EQ(CircuitBreaker::State::CLOSED, breaker.state());
+}
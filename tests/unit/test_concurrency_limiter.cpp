@@ -0,0 +1,115 @@
+#include "gtest/gtest.h"
+#include "mock/classes/mock-metric-proxy.h"
+#include "concurrency-limiter.h"
+
+using namespace Driveshaft;
+using std::chrono::milliseconds;
+
+class ConcurrencyLimiterTest : public ::testing::Test {
+public:
+    ConcurrencyLimiterTest() : mockMetricProxy(new mock::classes::MockMetricProxy) {
+        options.min_limit = 2;
+        options.max_limit = 10;
+    }
+
+    // Keeps the pool busy enough that latency samples count
+    void fill(ConcurrencyLimiter &limiter) {
+        while (limiter.tryAcquire()) {}
+    }
+
+    ConcurrencyLimitOptions options;
+    MockMetricProxyPtr mockMetricProxy;
+};
+
+TEST_F(ConcurrencyLimiterTest, TestStartsAtMaxAndHandsOutThatManySlots) {
+    ConcurrencyLimiter limiter("pool", options, mockMetricProxy);
+    ASSERT_EQ(10, limiter.limit());
+    ASSERT_EQ(10, mockMetricProxy->getConcurrencyLimit("pool"));
+
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(limiter.tryAcquire());
+    }
+    ASSERT_FALSE(limiter.tryAcquire());
+
+    limiter.release();
+    ASSERT_TRUE(limiter.tryAcquire());
+}
+
+TEST_F(ConcurrencyLimiterTest, TestDropsShrinkLimitDownToMin) {
+    ConcurrencyLimiter limiter("pool", options, mockMetricProxy);
+
+    limiter.recordDrop();
+    ASSERT_EQ(9, limiter.limit());
+    for (int i = 0; i < 100; i++) {
+        limiter.recordDrop();
+    }
+    ASSERT_EQ(2, limiter.limit());
+    ASSERT_EQ(2, mockMetricProxy->getConcurrencyLimit("pool"));
+}
+
+TEST_F(ConcurrencyLimiterTest, TestResetRestoresMaxLimit) {
+    ConcurrencyLimiter limiter("pool", options, mockMetricProxy);
+    for (int i = 0; i < 100; i++) {
+        limiter.recordDrop();
+    }
+    ASSERT_EQ(2, limiter.limit());
+
+    limiter.reset();
+    ASSERT_EQ(10, limiter.limit());
+    ASSERT_EQ(10, mockMetricProxy->getConcurrencyLimit("pool"));
+}
+
+TEST_F(ConcurrencyLimiterTest, TestWorkersOverLimitShedTheirSlots) {
+    ConcurrencyLimiter limiter("pool", options, mockMetricProxy);
+    fill(limiter);
+    ASSERT_FALSE(limiter.tryShed());
+
+    limiter.recordDrop();
+    limiter.recordDrop();
+    uint32_t over = 10 - limiter.limit();
+    for (uint32_t i = 0; i < over; i++) {
+        ASSERT_TRUE(limiter.tryShed());
+    }
+    ASSERT_FALSE(limiter.tryShed());
+}
+
+TEST_F(ConcurrencyLimiterTest, TestRisingLatencyShrinksLimit) {
+    ConcurrencyLimiter limiter("pool", options, mockMetricProxy);
+    fill(limiter);
+
+    for (int i = 0; i < 50; i++) {
+        limiter.recordSuccess(milliseconds(10));
+    }
+    ASSERT_EQ(10, limiter.limit());
+
+    for (int i = 0; i < 50; i++) {
+        limiter.recordSuccess(milliseconds(100));
+    }
+    ASSERT_LT(limiter.limit(), 10);
+}
+
+TEST_F(ConcurrencyLimiterTest, TestSteadyLatencyGrowsLimitBackToMax) {
+    ConcurrencyLimiter limiter("pool", options, mockMetricProxy);
+    for (int i = 0; i < 100; i++) {
+        limiter.recordDrop();
+    }
+    fill(limiter);
+
+    for (int i = 0; i < 100; i++) {
+        limiter.recordSuccess(milliseconds(10));
+        fill(limiter);
+    }
+    ASSERT_EQ(10, limiter.limit());
+}
+
+TEST_F(ConcurrencyLimiterTest, TestIdlePoolDoesNotGrowLimit) {
+    ConcurrencyLimiter limiter("pool", options, mockMetricProxy);
+    for (int i = 0; i < 100; i++) {
+        limiter.recordDrop();
+    }
+
+    for (int i = 0; i < 100; i++) {
+        limiter.recordSuccess(milliseconds(10));
+    }
+    ASSERT_EQ(2, limiter.limit());
+}
@@ -0,0 +1,86 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <poll.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "config-watcher.h"
+
+using namespace Driveshaft;
+
+class ConfigWatcherTest : public ::testing::Test {
+public:
+    ConfigWatcherTest() : directory(), filename() {}
+
+    void SetUp() {
+        char path[] = "/tmp/driveshaft-config-watcher-XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(path));
+        directory = path;
+        filename = directory + "/jobs.json";
+        write(filename, "{}");
+    }
+
+    void TearDown() {
+        unlink(filename.c_str());
+        unlink((filename + ".new").c_str());
+        rmdir(directory.c_str());
+    }
+
+    void write(const std::string& path, const std::string& contents) {
+        std::ofstream out(path, std::ios::out | std::ios::trunc);
+        out << contents;
+    }
+
+    std::string directory;
+    std::string filename;
+};
+
+TEST_F(ConfigWatcherTest, TestTimesOutWithoutChanges) {
+    ConfigWatcher watcher(filename);
+    ASSERT_FALSE(watcher.wait(std::chrono::milliseconds(10)));
+}
+
+TEST_F(ConfigWatcherTest, TestWakesUpWhenTheFileIsWritten) {
+    ConfigWatcher watcher(filename);
+    write(filename, "{\"changed\": true}");
+
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(watcher.wait(std::chrono::seconds(5)));
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+    // The events were all consumed
+    ASSERT_FALSE(watcher.wait(std::chrono::milliseconds(10)));
+}
+
+TEST_F(ConfigWatcherTest, TestWatchesAConfigDirectoryItself) {
+    ConfigWatcher watcher(directory);
+    write(filename, "{\"changed\": true}");
+
+    ASSERT_TRUE(watcher.wait(std::chrono::seconds(5)));
+}
+
+TEST_F(ConfigWatcherTest, TestWakesUpWhenANewFileIsRenamedOverIt) {
+    write(filename + ".new", "{\"changed\": true}");
+    ConfigWatcher watcher(filename);
+    ASSERT_EQ(0, std::rename((filename + ".new").c_str(), filename.c_str()));
+
+    ASSERT_TRUE(watcher.wait(std::chrono::seconds(5)));
+}
+
+TEST_F(ConfigWatcherTest, TestReportsChangesThroughItsDescriptor) {
+    ConfigWatcher watcher(filename);
+    ASSERT_TRUE(watcher.watching());
+    ASSERT_FALSE(watcher.changed());
+
+    write(filename, "{\"changed\": true}");
+
+    struct pollfd pfd;
+    pfd.fd = watcher.fd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ASSERT_EQ(1, poll(&pfd, 1, 5000));
+    ASSERT_TRUE(watcher.changed());
+    ASSERT_FALSE(watcher.changed());
+}
@@ -1,3 +1,5 @@
+#include <fstream>
+#include <unistd.h>
 #include "gtest/gtest.h"
 #include "driveshaft-config.h"
 #include "./data/configs.h"
@@ -12,13 +14,21 @@ public:
     // map of pool -> most recent worker count
     std::map<std::string, uint32_t> poolsCleared;
 
+    // map of pool -> most recent options
+    std::map<std::string, PoolOptions> poolOptions;
+
+    // map of pool -> most recent servers
+    std::map<std::string, StringSet> poolServers;
+
     TestPoolWatcher() : poolsCleared() {}
 
     virtual void inform(uint32_t configWorkerCount, const std::string &poolName,
                         const StringSet &serverList, const StringSet &jobsList,
-                        const std::string &processingUri) {
+                        const std::string &processingUri, const PoolOptions &options) {
         auto pair(std::make_pair(poolName, configWorkerCount));
         this->poolsCleared.emplace(pair);
+        this->poolOptions[poolName] = options;
+        this->poolServers[poolName] = serverList;
         callbacksSeen.push_back(pair);
     }
 };
@@ -80,6 +90,33 @@ TEST_F(DriveshaftConfigTest, TestCompareInvalidatesAllPoolsOnServerListChange) {
     }
 }
 
+TEST_F(DriveshaftConfigTest, TestCompareRestartsOnlyPoolsWhoseServersChanged) {
+    DriveshaftConfig oldconf, newconf;
+    oldconf.parseConfig(testConfigOneServerTwoPools, json_parser);
+    newconf.parseConfig(testConfigTwoServersTwoPoolsOneDedicated, json_parser);
+
+    StringSet toRemove, toAdd;
+    std::tie(toRemove, toAdd) = oldconf.compare(newconf);
+
+    // test-pool-2 keeps talking to foo alone, so only test-pool-1 restarts
+    ASSERT_EQ(StringSet({ "test-pool-1" }), toRemove);
+    ASSERT_EQ(StringSet({ "test-pool-1" }), toAdd);
+}
+
+TEST_F(DriveshaftConfigTest, TestPoolServerListOverridesGlobal) {
+    DriveshaftConfig oldconf, newconf;
+    newconf.parseConfig(testConfigTwoServersTwoPoolsOneDedicated, json_parser);
+    newconf.supersede(oldconf, watcher);
+
+    ASSERT_EQ(StringSet({ "foo", "bar" }), watcher.poolServers["test-pool-1"]);
+    ASSERT_EQ(StringSet({ "foo" }), watcher.poolServers["test-pool-2"]);
+}
+
+TEST_F(DriveshaftConfigTest, TestPoolServerListMustBeArray) {
+    DriveshaftConfig config;
+    ASSERT_THROW(config.parseConfig(testConfigOneServerOnePoolBadServers, json_parser), std::runtime_error);
+}
+
 TEST_F(DriveshaftConfigTest, TestCompareAddsPoolOnConfigChange) {
     DriveshaftConfig oldconf, newconf;
     oldconf.parseConfig(testConfigOneServerOnePool, json_parser);
@@ -108,7 +145,7 @@ TEST_F(DriveshaftConfigTest, TestCompareInvalidateRemovesPoolOnConfigChange) {
     ASSERT_NE(toRemove.end(), toRemove.find(poolRemoved));
 }
 
-TEST_F(DriveshaftConfigTest, TestCompareInvalidatesOnProcessingUriChange) {
+TEST_F(DriveshaftConfigTest, TestCompareKeepsPoolOnProcessingUriChange) {
     DriveshaftConfig oldconf, newconf;
     oldconf.parseConfig(testConfigOneServerOnePool, json_parser);
     newconf.parseConfig(testConfigOneServerOnePoolNewUri, json_parser);
@@ -116,18 +153,65 @@ TEST_F(DriveshaftConfigTest, TestCompareInvalidatesOnProcessingUriChange) {
     StringSet toRemove, toAdd;
     std::tie(toRemove, toAdd) = oldconf.compare(newconf);
 
-    ASSERT_EQ(1, toRemove.size());
-    ASSERT_EQ(1, toAdd.size());
-    std::string poolRemoved("test-pool-1");
-    std::string poolAdded("test-pool-1");
-    ASSERT_NE(toRemove.end(), toRemove.find(poolRemoved));
-    ASSERT_NE(toAdd.end(), toAdd.find(poolAdded));
+    // The running workers pick up the new URI themselves
+    ASSERT_EQ(0, toRemove.size());
+    ASSERT_EQ(0, toAdd.size());
+}
+
+TEST_F(DriveshaftConfigTest, TestCompareKeepsPoolOnJobsListChange) {
+    DriveshaftConfig oldconf, newconf;
+    oldconf.parseConfig(testConfigOneServerOnePool, json_parser);
+    newconf.parseConfig(testConfigOneServerOnePoolNewJobs, json_parser);
+
+    StringSet toRemove, toAdd;
+    std::tie(toRemove, toAdd) = oldconf.compare(newconf);
+
+    ASSERT_EQ(0, toRemove.size());
+    ASSERT_EQ(0, toAdd.size());
+}
+
+TEST_F(DriveshaftConfigTest, TestPoolOptionTunablesDoNotNeedRestart) {
+    PoolOptions current;
+    current.retry.max_attempts = 3;
+    current.backpressure.pause_ms = 100;
+
+    PoolOptions latest = current;
+    latest.autoscale.min_workers = 2;
+    latest.autoscale.max_workers = 20;
+    latest.retry.max_backoff_ms = 100;
+    latest.retry_budget_percent = 50;
+    latest.backpressure.max_pause_ms = 1000;
+    ASSERT_NE(current, latest);
+    ASSERT_FALSE(current.needsRestart(latest));
+
+    // Turning a feature on or off builds different pool state
+    latest.retry.max_attempts = 1;
+    ASSERT_TRUE(current.needsRestart(latest));
+    latest = current;
+    latest.backpressure.pause_ms = 0;
+    ASSERT_TRUE(current.needsRestart(latest));
+    latest = current;
+    latest.concurrency_limit.max_limit = 4;
+    ASSERT_TRUE(current.needsRestart(latest));
+}
+
+TEST_F(DriveshaftConfigTest, TestCompareInvalidatesFetchQueueOnJobsListChange) {
+    DriveshaftConfig oldconf, newconf;
+    oldconf.parseConfig(testConfigOneServerOnePoolFetchQueue, json_parser);
+    newconf.parseConfig(testConfigOneServerOnePoolFetchQueueNewJobs, json_parser);
+
+    StringSet toRemove, toAdd;
+    std::tie(toRemove, toAdd) = oldconf.compare(newconf);
+
+    // The fetchers registered the old functions on their own connections
+    ASSERT_EQ(StringSet({ "test-pool-1" }), toRemove);
+    ASSERT_EQ(StringSet({ "test-pool-1" }), toAdd);
 }
 
 TEST_F(DriveshaftConfigTest, TestSupersedeNotifiesPoolWatcher) {
     DriveshaftConfig oldconf, newconf;
     oldconf.parseConfig(testConfigOneServerOnePool, json_parser);
-    newconf.parseConfig(testConfigOneServerOnePoolNewUri, json_parser);
+    newconf.parseConfig(testConfigOneServerOnePoolCircuitBreaker, json_parser);
 
     TestPoolWatcher watcher;
     newconf.supersede(oldconf, watcher);
@@ -139,3 +223,316 @@ TEST_F(DriveshaftConfigTest, TestSupersedeNotifiesPoolWatcher) {
     ASSERT_EQ(std::make_pair(poolRemoved, uint32_t(0)), watcher.callbacksSeen[0]);
     ASSERT_EQ(std::make_pair(poolAdded, uint32_t(5)), watcher.callbacksSeen[1]);
 }
+
+TEST_F(DriveshaftConfigTest, TestSupersedeOnlyInformsChangedPools) {
+    DriveshaftConfig oldconf, newconf;
+    oldconf.parseConfig(testConfigOneServerOnePool, json_parser);
+    newconf.parseConfig(testConfigOneServerTwoPools, json_parser);
+
+    TestPoolWatcher watcher;
+    newconf.supersede(oldconf, watcher);
+
+    // test-pool-1 is as it was
+    ASSERT_EQ(1, watcher.callbacksSeen.size());
+    ASSERT_EQ(std::make_pair(std::string("test-pool-2"), uint32_t(5)), watcher.callbacksSeen[0]);
+}
+
+TEST_F(DriveshaftConfigTest, TestSupersedeOfSameConfigInformsNothing) {
+    DriveshaftConfig oldconf, newconf;
+    oldconf.parseConfig(testConfigTwoServersTwoPools, json_parser);
+    newconf.parseConfig(testConfigTwoServersTwoPools, json_parser);
+
+    TestPoolWatcher watcher;
+    newconf.supersede(oldconf, watcher);
+    ASSERT_EQ(0, watcher.callbacksSeen.size());
+}
+
+TEST_F(DriveshaftConfigTest, TestSupersedeReconfiguresPoolInPlace) {
+    DriveshaftConfig oldconf, newconf;
+    oldconf.parseConfig(testConfigOneServerOnePool, json_parser);
+    newconf.parseConfig(testConfigOneServerOnePoolNewUri, json_parser);
+
+    TestPoolWatcher watcher;
+    newconf.supersede(oldconf, watcher);
+
+    ASSERT_EQ(1, watcher.callbacksSeen.size());
+    ASSERT_EQ(std::make_pair(std::string("test-pool-1"), uint32_t(5)), watcher.callbacksSeen[0]);
+}
+
+TEST_F(DriveshaftConfigTest, TestLoadSkipsUnchangedContents) {
+    char path[] = "/tmp/driveshaft-config-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+    std::string filename(path);
+    std::ofstream(filename, std::ios::trunc) << testConfigOneServerOnePool;
+
+    DriveshaftConfig running, same, changed;
+    ASSERT_TRUE(running.load(filename, json_parser, DriveshaftConfig()));
+    ASSERT_FALSE(same.load(filename, json_parser, running));
+
+    // Caught however soon after the last load it happens
+    std::ofstream(filename, std::ios::trunc) << testConfigOneServerTwoPools;
+    ASSERT_TRUE(changed.load(filename, json_parser, running));
+    unlink(path);
+}
+
+class DriveshaftConfigDirectoryTest : public DriveshaftConfigTest {
+public:
+    void SetUp() {
+        char path[] = "/tmp/driveshaft-config-dir-XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(path));
+        directory = path;
+        write("servers.json", "{\"gearman_servers_list\": [\"foo\"]}");
+        write("test-pool-1.json", "{\"worker_count\": 5, \"jobs_list\": [\"Sum\"], "
+                                  "\"job_processing_uri\": \"send.work.here\"}");
+        write("test-pool-2.json", "{\"worker_count\": 5, \"jobs_list\": [\"Product\"], "
+                                  "\"job_processing_uri\": \"send.work.here\", "
+                                  "\"gearman_servers_list\": [\"bar\"]}");
+        write(".test-pool-2.json.swp", "not json");
+    }
+
+    void TearDown() {
+        for (const auto& name : { "servers.json", "test-pool-1.json", "test-pool-2.json", ".test-pool-2.json.swp" }) {
+            unlink((directory + "/" + name).c_str());
+        }
+        rmdir(directory.c_str());
+    }
+
+    void write(const std::string& name, const std::string& contents) {
+        std::ofstream(directory + "/" + name, std::ios::trunc) << contents;
+    }
+
+    std::string directory;
+};
+
+TEST_F(DriveshaftConfigDirectoryTest, TestLoadsOnePoolPerFile) {
+    DriveshaftConfig oldconf, newconf;
+    ASSERT_TRUE(newconf.load(directory, json_parser, oldconf));
+    newconf.supersede(oldconf, watcher);
+
+    ASSERT_EQ(2, watcher.callbacksSeen.size());
+    ASSERT_EQ(StringSet({ "foo" }), watcher.poolServers["test-pool-1"]);
+    ASSERT_EQ(StringSet({ "bar" }), watcher.poolServers["test-pool-2"]);
+}
+
+TEST_F(DriveshaftConfigDirectoryTest, TestReloadsOnlyChangedFiles) {
+    DriveshaftConfig running, same, changed, removed;
+    ASSERT_TRUE(running.load(directory, json_parser, DriveshaftConfig()));
+    ASSERT_FALSE(same.load(directory, json_parser, running));
+
+    write("test-pool-2.json", "{\"worker_count\": 7, \"jobs_list\": [\"Product\"], "
+                              "\"job_processing_uri\": \"send.work.here\", "
+                              "\"gearman_servers_list\": [\"bar\"]}");
+    ASSERT_TRUE(changed.load(directory, json_parser, running));
+    changed.supersede(running, watcher);
+    ASSERT_EQ(1, watcher.callbacksSeen.size());
+    ASSERT_EQ(std::make_pair(std::string("test-pool-2"), uint32_t(7)), watcher.callbacksSeen[0]);
+
+    unlink((directory + "/test-pool-1.json").c_str());
+    ASSERT_TRUE(removed.load(directory, json_parser, changed));
+
+    StringSet toRemove, toAdd;
+    std::tie(toRemove, toAdd) = changed.compare(removed);
+    ASSERT_EQ(StringSet({ "test-pool-1" }), toRemove);
+    ASSERT_EQ(0, toAdd.size());
+}
+
+TEST_F(DriveshaftConfigDirectoryTest, TestWorkerProcessSkipsUnchangedPoolsOfOthers) {
+    write("test-pool-1.json", "{\"worker_count\": 5, \"jobs_list\": [\"Sum\"], "
+                              "\"job_processing_uri\": \"send.work.here\", \"process\": 0}");
+    write("test-pool-2.json", "{\"worker_count\": 5, \"jobs_list\": [\"Product\"], "
+                              "\"job_processing_uri\": \"send.work.here\", \"process\": 1}");
+
+    DriveshaftConfig running, same, changed;
+    ASSERT_TRUE(running.load(directory, json_parser, DriveshaftConfig()));
+    running.keepProcessPools(0, 2);
+    ASSERT_FALSE(same.load(directory, json_parser, running));
+
+    // The other process's pool still counts as changed when its file does
+    write("test-pool-2.json", "{\"worker_count\": 7, \"jobs_list\": [\"Product\"], "
+                              "\"job_processing_uri\": \"send.work.here\", \"process\": 1}");
+    ASSERT_TRUE(changed.load(directory, json_parser, running));
+    changed.keepProcessPools(0, 2);
+    changed.supersede(running, watcher);
+    ASSERT_EQ(0, watcher.callbacksSeen.size());
+}
+
+TEST_F(DriveshaftConfigDirectoryTest, TestRejectsMalformedPoolFile) {
+    write("test-pool-1.json", "[]");
+    DriveshaftConfig config;
+    ASSERT_THROW(config.load(directory, json_parser, DriveshaftConfig()), std::runtime_error);
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesCircuitBreakerOptions) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerOnePoolCircuitBreaker, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    const auto &breaker = watcher.poolOptions["test-pool-1"].circuit_breaker;
+    ASSERT_EQ(3, breaker.failure_threshold);
+    ASSERT_EQ(500, breaker.open_duration_ms);
+    ASSERT_EQ(CircuitBreakerOptions().half_open_probes, breaker.half_open_probes);
+}
+
+TEST_F(DriveshaftConfigTest, TestCompareInvalidatesOnPoolOptionsChange) {
+    DriveshaftConfig oldconf, newconf;
+    oldconf.parseConfig(testConfigOneServerOnePool, json_parser);
+    newconf.parseConfig(testConfigOneServerOnePoolCircuitBreaker, json_parser);
+
+    StringSet toRemove, toAdd;
+    std::tie(toRemove, toAdd) = oldconf.compare(newconf);
+
+    ASSERT_EQ(1, toRemove.size());
+    ASSERT_EQ(1, toAdd.size());
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesRetryOptionsWithFunctionOverrides) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerOnePoolRetry, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    const auto &options = watcher.poolOptions["test-pool-1"];
+    ASSERT_EQ(10, options.retry_budget_percent);
+    ASSERT_EQ(3, options.retryOptions("Sum").max_attempts);
+    ASSERT_EQ(50, options.retryOptions("Sum").initial_backoff_ms);
+
+    // Overrides inherit what they do not name from the pool
+    ASSERT_EQ(1, options.retryOptions("Product").max_attempts);
+    ASSERT_EQ(50, options.retryOptions("Product").initial_backoff_ms);
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesBackpressureOptions) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerOnePoolBackpressure, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    const auto &backpressure = watcher.poolOptions["test-pool-1"].backpressure;
+    ASSERT_EQ(200, backpressure.pause_ms);
+    ASSERT_EQ(1500, backpressure.latency_threshold_ms);
+    ASSERT_EQ(BackpressureOptions().max_pause_ms, backpressure.max_pause_ms);
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesConcurrencyLimitOptions) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerOnePoolConcurrencyLimit, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    const auto &limit = watcher.poolOptions["test-pool-1"].concurrency_limit;
+    ASSERT_EQ(2, limit.min_limit);
+    ASSERT_EQ(5, limit.max_limit);
+    ASSERT_EQ(ConcurrencyLimitOptions().latency_tolerance_percent, limit.latency_tolerance_percent);
+}
+
+TEST_F(DriveshaftConfigTest, TestRejectsConcurrencyMinAboveMax) {
+    DriveshaftConfig config;
+    ASSERT_THROW(config.parseConfig(testConfigOneServerOnePoolBadConcurrencyLimit, json_parser), std::runtime_error);
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesAutoscaleOptions) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerOnePoolAutoscale, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    const auto &autoscale = watcher.poolOptions["test-pool-1"].autoscale;
+    ASSERT_EQ(2, autoscale.min_workers);
+    ASSERT_EQ(20, autoscale.max_workers);
+    ASSERT_EQ(4, autoscale.jobs_per_worker);
+    ASSERT_EQ(3, autoscale.hosts);
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesRateLimitOptions) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerOnePoolRateLimit, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    const auto &options = watcher.poolOptions["test-pool-1"];
+    ASSERT_EQ(50, options.rate_limit.jobs_per_second);
+    ASSERT_EQ(0, options.rate_limit.burst);
+    ASSERT_EQ(1, options.function_rate_limit.size());
+    ASSERT_EQ(0.5, options.function_rate_limit.at("Product").jobs_per_second);
+    ASSERT_EQ(2, options.function_rate_limit.at("Product").burst);
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesFetchQueueOptions) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerOnePoolFetchQueue, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    const auto &fetch_queue = watcher.poolOptions["test-pool-1"].fetch_queue;
+    ASSERT_EQ(2, fetch_queue.fetchers);
+    ASSERT_EQ(FetchQueueOptions().capacity, fetch_queue.capacity);
+}
+
+TEST_F(DriveshaftConfigTest, TestRejectsEmptyFetchQueue) {
+    DriveshaftConfig config;
+    ASSERT_THROW(config.parseConfig(testConfigOneServerOnePoolBadFetchQueue, json_parser), std::runtime_error);
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesWorkerProtocol) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerOnePoolNativeProtocol, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    ASSERT_TRUE(WorkerProtocol::NATIVE == watcher.poolOptions["test-pool-1"].worker_protocol);
+    ASSERT_EQ(60000, watcher.poolOptions["test-pool-1"].gearmand_probe.interval_ms);
+    ASSERT_EQ(5000, watcher.poolOptions["test-pool-1"].gearmand_probe.timeout_ms);
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesServersPerThread) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigTwoServersOnePoolSharded, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    ASSERT_EQ(1, watcher.poolOptions["test-pool-1"].servers_per_thread);
+}
+
+TEST_F(DriveshaftConfigTest, TestRejectsUnknownWorkerProtocol) {
+    DriveshaftConfig config;
+    ASSERT_THROW(config.parseConfig(testConfigOneServerOnePoolBadProtocol, json_parser), std::runtime_error);
+}
+
+TEST_F(DriveshaftConfigTest, TestParsesSchedulingOptions) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerOnePoolScheduling, json_parser);
+    config.clearAllWorkerCounts(watcher);
+
+    const auto& scheduling = watcher.poolOptions["test-pool-1"].scheduling;
+    ASSERT_EQ(std::set<uint32_t>({2, 3}), scheduling.cpus);
+    ASSERT_EQ(1, scheduling.numa_node);
+    ASSERT_EQ(5, scheduling.nice);
+    ASSERT_TRUE(SchedulingPolicy::BATCH == scheduling.policy);
+    ASSERT_TRUE(scheduling.enabled());
+}
+
+TEST_F(DriveshaftConfigTest, TestRejectsUnknownSchedulingPolicy) {
+    DriveshaftConfig config;
+    ASSERT_THROW(config.parseConfig(testConfigOneServerOnePoolBadSchedulingPolicy, json_parser), std::runtime_error);
+}
+
+TEST_F(DriveshaftConfigTest, TestKeepsPlacedPoolInItsProcess) {
+    DriveshaftConfig config;
+    config.parseConfig(testConfigOneServerTwoPoolsOnePlaced, json_parser);
+    config.keepProcessPools(3, 4);
+    config.clearAllWorkerCounts(watcher);
+
+    ASSERT_EQ(1, watcher.poolsCleared.count("test-pool-1"));
+}
+
+TEST_F(DriveshaftConfigTest, TestEveryPoolRunsInOneProcess) {
+    std::map<std::string, uint32_t> processes_per_pool;
+    for (uint32_t process = 0; process < 4; ++process) {
+        TestPoolWatcher process_watcher;
+        DriveshaftConfig config;
+        config.parseConfig(testConfigOneServerTwoPoolsOnePlaced, json_parser);
+        config.keepProcessPools(process, 4);
+        config.clearAllWorkerCounts(process_watcher);
+        for (const auto& i : process_watcher.poolsCleared) {
+            ++processes_per_pool[i.first];
+        }
+    }
+
+    ASSERT_EQ(2, processes_per_pool.size());
+    ASSERT_EQ(1, processes_per_pool["test-pool-1"]);
+    ASSERT_EQ(1, processes_per_pool["test-pool-2"]);
+}
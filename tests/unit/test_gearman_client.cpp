@@ -1,6 +1,10 @@
 #include <string>
 #include <stdexcept>
 #include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
 #include "gtest/gtest.h"
 #include "mock/libs/gearman.h"
 #include "mock/libs/curl.h"
@@ -21,22 +25,48 @@ public:
         waitReturn(GEARMAN_NO_JOBS),
         serversReturn(GEARMAN_SUCCESS),
         jobsReturn(GEARMAN_SUCCESS),
-        gearmanClient(nullptr) {}
+        gearmanClient(nullptr) {
+        waitDelayMs = 0;
+        timeoutMs = -1;
+        timesGrabCalled = 0;
+    }
 
     gearman_worker_st* create(gearman_worker_st *worker) {
         return reinterpret_cast<gearman_worker_st*>(1);
     }
 
     gearman_return_t addServers(gearman_worker_st *worker, const char *servers) {
+        std::lock_guard<std::mutex> lock(this->serversMutex);
+        this->addedServers.push_back(servers);
         return this->serversReturn;
     }
 
     gearman_return_t addFunction(gearman_worker_st *worker,
                                  const char *functionName, uint32_t timeout,
                                  gearman_worker_fn *function, void *context) {
+        std::lock_guard<std::mutex> lock(this->serversMutex);
+        this->addedFunctions.push_back(functionName);
         return this->jobsReturn;
     }
 
+    gearman_return_t unregister(gearman_worker_st *worker, const char *functionName) {
+        this->unregistered.insert(functionName);
+        return GEARMAN_SUCCESS;
+    }
+
+    // Hands out jobsToGrab jobs, then none. Called from fetcher threads
+    gearman_job_st* grabJob(gearman_worker_st *worker, gearman_job_st *job, gearman_return_t *ret_ptr) {
+        this->timesGrabCalled++;
+        if (this->jobsToGrab.load() > 0) {
+            this->jobsToGrab--;
+            *ret_ptr = GEARMAN_SUCCESS;
+            return reinterpret_cast<gearman_job_st*>(1);
+        }
+
+        *ret_ptr = GEARMAN_NO_JOBS;
+        return nullptr;
+    }
+
     gearman_return_t work(gearman_worker_st *worker) {
         // mechanism to terminate the run loop by throwing a test-specific err
         if (this->timesWorkCalled++ > 1) {
@@ -49,8 +79,18 @@ public:
         return this->workReturn;
     }
 
+    void setTimeout(gearman_worker_st *worker, int timeout) {
+        this->timeoutMs = timeout;
+    }
+
     gearman_return_t wait(gearman_worker_st *worker) {
         this->timesWaitCalled++;
+        int timeout = this->timeoutMs.load();
+        if (timeout >= 0 && this->waitDelayMs.load() > static_cast<uint32_t>(timeout)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+            return GEARMAN_TIMEOUT;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(this->waitDelayMs.load()));
         return this->waitReturn;
     }
 
@@ -85,10 +125,25 @@ public:
         this->timesWorkCalled = 0;
         this->timesWaitCalled = 0;
         this->gearmanClient = nullptr;
+        this->unregistered.clear();
+        this->jobsToGrab = 0;
+        this->waitDelayMs = 0;
+        this->timeoutMs = -1;
+        this->timesGrabCalled = 0;
+        this->addedServers.clear();
+        this->addedFunctions.clear();
     }
 
     bool waitCalled;
     uint32_t timesWorkCalled, timesWaitCalled;
+    StringSet unregistered;
+    std::atomic<uint32_t> jobsToGrab;
+    std::atomic<uint32_t> waitDelayMs; // how long gearmand takes to answer a wait
+    std::atomic<int> timeoutMs; // the last timeout set on the worker, -1 for none
+    std::atomic<uint32_t> timesGrabCalled;
+    std::mutex serversMutex;
+    std::vector<std::string> addedServers;
+    std::vector<std::string> addedFunctions;
 
 
 private:
@@ -102,16 +157,43 @@ private:
 };
 
 class ConfigurableMockGearmanJobLib : public mock::libs::gearman::MockGearmanJobLib {
+public:
+    ConfigurableMockGearmanJobLib() : timesCompleteSent(0), timesFailSent(0), timesFreed(0) {}
+
+    gearman_return_t sendComplete(gearman_job_st *job, const void *result, size_t result_size) {
+        this->timesCompleteSent++;
+        return GEARMAN_SUCCESS;
+    }
+
+    gearman_return_t sendFail(gearman_job_st *job) {
+        this->timesFailSent++;
+        return GEARMAN_SUCCESS;
+    }
+
+    void free(gearman_job_st *job) {
+        this->timesFreed++;
+    }
+
+    void reset() {
+        this->timesCompleteSent = 0;
+        this->timesFailSent = 0;
+        this->timesFreed = 0;
+    }
+
+    std::atomic<uint32_t> timesCompleteSent, timesFailSent, timesFreed;
 };
 
 namespace mockcurl = mock::libs::curl;
 class ConfigurableMockCurlLib : public mock::libs::curl::MockCurlLib {
 public:
     ConfigurableMockCurlLib() :
+        timesPerformCalled(0),
         cleanupCalled(false), formFreed(false), stringsFreed(false),
         initRet(reinterpret_cast<mockcurl::CURLHandle>(1)),
         setOptRet(CURLE_OK), performRet(CURLE_OK),
-        getInfoRet(CURLE_OK), formAddRet(CURL_FORMADD_OK) {}
+        getInfoRet(CURLE_OK), formAddRet(CURL_FORMADD_OK),
+        retryAfter(-1), performMs(0), headerData(nullptr),
+        progressFunction(nullptr), progressData(nullptr) {}
 
     void configure(CURLcode setOptRet, CURLcode performRet,
                    CURLcode getInfoRet, CURLFORMcode formAddRet) {
@@ -136,6 +218,7 @@ public:
     }
 
     void reset() {
+        this->timesPerformCalled = 0;
         this->cleanupCalled = false;
         this->formFreed = false;
         this->stringsFreed = false;
@@ -146,6 +229,11 @@ public:
         this->formAddRet = CURL_FORMADD_OK;
         this->infoAction = std::tuple<CURLINFO, void*>();
         this->setOptAction = std::tuple<CURLoption, std::function<void(void*)>>();
+        this->retryAfter = -1;
+        this->performMs = 0;
+        this->headerData = nullptr;
+        this->progressFunction = nullptr;
+        this->progressData = nullptr;
     }
 
     bool allCleanupRoutinesCalled() {
@@ -157,6 +245,13 @@ public:
     }
 
     CURLcode setOpt(mockcurl::CURLHandle handle, CURLoption opt, void *param) {
+        if (opt == CURLOPT_HEADERDATA) {
+            this->headerData = static_cast<long*>(param);
+        } else if (opt == CURLOPT_PROGRESSFUNCTION) {
+            this->progressFunction = reinterpret_cast<ProgressFunction>(param);
+        } else if (opt == CURLOPT_PROGRESSDATA) {
+            this->progressData = param;
+        }
         if (opt == std::get<0>(this->setOptAction)) {
             auto optFunc = std::get<1>(this->setOptAction);
             if (optFunc) {
@@ -174,6 +269,18 @@ public:
     }
 
     CURLcode perform(mockcurl::CURLHandle handle) {
+        this->timesPerformCalled++;
+        // A slow request, which asks the progress callback whether to go on the way curl does
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(this->performMs);
+        while (std::chrono::steady_clock::now() < until) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if (this->progressFunction && this->progressFunction(this->progressData, 0, 0, 0, 0)) {
+                return CURLE_ABORTED_BY_CALLBACK;
+            }
+        }
+        if (this->headerData && this->retryAfter >= 0) {
+            *this->headerData = this->retryAfter; // as if the response carried a Retry-After
+        }
         return this->performRet;
     }
 
@@ -204,6 +311,11 @@ public:
     virtual void reclaimStringList(mockcurl::CURLStringList list) {
         this->stringsFreed = true;
     }
+
+    uint32_t timesPerformCalled;
+    long retryAfter; // seconds, sent with every response when not negative
+    uint32_t performMs; // how long each request takes
+
 private:
     bool infoActionSet() {
         return this->infoAction != std::tuple<CURLINFO, void*>();
@@ -221,6 +333,11 @@ private:
 
     std::tuple<CURLINFO, void*> infoAction;
     std::tuple<CURLoption, std::function<void(void*)>> setOptAction;
+    long *headerData;
+
+    typedef int (*ProgressFunction)(void *, double, double, double, double);
+    ProgressFunction progressFunction;
+    void *progressData;
 };
 
 class FailedWriter : public Writer {
@@ -252,10 +369,35 @@ public:
     void SetUp() {
         mockCurlLib.reset();
         mockGearmanWorkerLib.reset();
+        mockGearmanJobLib.reset();
         initMockCurlLib(&mockCurlLib);
         initMockGearmanLibs(&mockGearmanJobLib, &mockGearmanWorkerLib);
         mockMetricProxy->reset();
+        savedResponseTimeout = GEARMAND_RESPONSE_TIMEOUT;
     }
+
+    void TearDown() {
+        GEARMAND_RESPONSE_TIMEOUT = savedResponseTimeout;
+    }
+
+    PoolContextPtr makePool(const PoolOptions& options, const StringSet& jobs = StringSet(),
+                            const std::string& uri = "") {
+        return PoolContextPtr(new PoolContext("testcase_pool_name", uri, jobs, options, mockMetricProxy));
+    }
+
+    GearmanClient* makeClient(PoolContextPtr poolContext, const StringSet& servers = StringSet(),
+                              const StringSet& jobs = StringSet()) {
+        return new GearmanClient(mockThreadRegistry, mockMetricProxyPoolWrapper, servers, jobs, "", poolContext);
+    }
+
+    // One pass of run() that gives up at once instead of waiting on gearmand
+    void runWithoutWaiting(GearmanClient& client) {
+        GEARMAND_RESPONSE_TIMEOUT = 0;
+        client.run();
+    }
+
+private:
+    uint32_t savedResponseTimeout; // put back by TearDown, whatever a test set it to
 };
 
 const gearman_return_t GEARMAN_FAKE_RET(static_cast<gearman_return_t>(999));
@@ -394,6 +536,65 @@ TEST_F(GearmanClientTest, TestRunThrowsOnUnknownWorkReturn) {
     ASSERT_TRUE(caught);
 }
 
+TEST_F(GearmanClientTest, TestReconnectRebuildsWorkerAfterLosingGearmand) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NOT_CONNECTED, GEARMAN_FAKE_RET,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    std::unique_ptr<GearmanClient> client(
+        new GearmanClient(mockThreadRegistry, mockMetricProxyPoolWrapper, StringSet(), StringSet(), "")
+    );
+
+    bool retriable = false;
+    try {
+        client->run();
+    } catch (const GearmanClientException &e) {
+        retriable = e.retriable();
+    }
+    ASSERT_TRUE(retriable);
+
+    client->disconnect();
+    mockGearmanWorkerLib.reset();
+    mockGearmanWorkerLib.configure(
+        GEARMAN_IO_WAIT, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+    client->reconnect();
+    ASSERT_EQ(1, mockMetricProxy->getReconnectCount("testcase_pool_name"));
+
+    client->run(); // back to waiting on gearmand
+    ASSERT_EQ(1, mockGearmanWorkerLib.timesWaitCalled);
+}
+
+TEST_F(GearmanClientTest, TestThreadIsReadyOnlyOnceGearmandAnswers) {
+    auto registry = static_cast<mock::classes::MockThreadRegistry*>(mockThreadRegistry.get());
+    mockGearmanWorkerLib.configure(
+        GEARMAN_IO_WAIT, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    std::unique_ptr<GearmanClient> client(
+        new GearmanClient(mockThreadRegistry, mockMetricProxyPoolWrapper, StringSet(), StringSet(), "")
+    );
+    ASSERT_EQ(0, registry->timesReadySet); // Servers are only added, nothing is connected yet
+
+    // Nothing came back from gearmand
+    client->run();
+    ASSERT_EQ(0, registry->timesReadySet);
+
+    // work() read what wait() saw arrive
+    mockGearmanWorkerLib.reset();
+    mockGearmanWorkerLib.configure(
+        GEARMAN_IO_WAIT, GEARMAN_SUCCESS,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+    try {
+        client->run();
+    } catch (...) {} // test-specific error
+    ASSERT_EQ(1, registry->timesReadySet);
+}
+
 TEST_F(GearmanClientTest, TestRunInPollStateGrabsNextJobOnSuccess) {
     mockGearmanWorkerLib.configure(
         GEARMAN_SUCCESS, GEARMAN_SUCCESS,
@@ -683,6 +884,59 @@ TEST_F(GearmanClientTest, TestProgressCallbackRespectsShutdownFlag) {
     g_force_shutdown = false;
 }
 
+TEST_F(GearmanClientTest, TestGracefulDrainLetsRunningJobFinish) {
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+    mockCurlLib.performMs = 300;
+    long ok(200);
+    mockCurlLib.configureGetInfo(CURLINFO_RESPONSE_CODE, &ok);
+    auto writeFunc = [] (void *userData) {
+        const char *response = "{\"gearman_ret\": 0, \"response_string\": \"OK\"}";
+        curl_write_func(const_cast<char*>(response), strlen(response), 1, userData);
+    };
+    mockCurlLib.configureSetOpt(CURLOPT_WRITEDATA, writeFunc);
+
+    std::unique_ptr<GearmanClient> client(
+        new GearmanClient(mockThreadRegistry, mockMetricProxyPoolWrapper, StringSet(), StringSet(), "")
+    );
+
+    // A drain asks the thread to stop while its request is in flight, and nothing more
+    auto registry = static_cast<mock::classes::MockThreadRegistry*>(mockThreadRegistry.get());
+    std::thread drain([registry]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        registry->shutdownRequested = true;
+    });
+    std::string gearmanRet;
+    gearman_return_t ret = client->processJob(nullptr, gearmanRet);
+    drain.join();
+    registry->shutdownRequested = false;
+
+    ASSERT_EQ(GEARMAN_SUCCESS, ret);
+    ASSERT_EQ("OK", gearmanRet);
+}
+
+TEST_F(GearmanClientTest, TestHardShutdownAbortsRunningJob) {
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+    mockCurlLib.performMs = 2000;
+
+    std::unique_ptr<GearmanClient> client(
+        new GearmanClient(mockThreadRegistry, mockMetricProxyPoolWrapper, StringSet(), StringSet(), "")
+    );
+
+    std::thread shutdown([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        g_force_shutdown = true;
+    });
+    auto start = std::chrono::steady_clock::now();
+    std::string gearmanRet;
+    gearman_return_t ret = client->processJob(nullptr, gearmanRet);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    shutdown.join();
+    g_force_shutdown = false;
+
+    ASSERT_EQ(GEARMAN_WORK_FAIL, ret);
+    ASSERT_LT(elapsed, std::chrono::seconds(1));
+}
+
 TEST_F(GearmanClientTest, TestProgressCallbackErrorsOnTimeout) {
     // epoch value of 0 guarantees we're in a timed-out state
     time_t startTime(0);
@@ -845,4 +1099,560 @@ TEST_F(GearmanClientTest, TestThreadMetrics) {
     EXPECT_GT(workStart, threadStart);
     EXPECT_GT(workEnd, workStart);
     EXPECT_GT(threadEnd, workEnd);
-}
\ No newline at end of file
+}
+TEST_F(GearmanClientTest, TestRunDoesNotGrabJobsWhileCircuitOpen) {
+    mockCurlLib.configure(CURLE_OK, CURLE_COULDNT_CONNECT, CURLE_OK, CURL_FORMADD_OK);
+    mockGearmanWorkerLib.configure(
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    PoolOptions options;
+    options.circuit_breaker.failure_threshold = 1;
+    options.circuit_breaker.open_duration_ms = 60000;
+    PoolContextPtr poolContext = makePool(options);
+
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext));
+
+    std::string gearmanRet;
+    client->processJob(nullptr, gearmanRet);
+    ASSERT_EQ(CircuitBreaker::State::OPEN, poolContext->circuitBreaker()->state());
+    ASSERT_EQ("open", mockMetricProxy->getCircuitBreakerState("testcase_pool_name"));
+
+    // The wait is capped at the loop timeout, so run() returns without working
+    runWithoutWaiting(*client);
+
+    ASSERT_EQ(0, mockGearmanWorkerLib.timesWorkCalled);
+}
+
+TEST_F(GearmanClientTest, TestShardsServersAcrossThreads) {
+    PoolOptions options;
+    options.servers_per_thread = 2;
+    PoolContextPtr poolContext = makePool(options);
+    StringSet servers = {"a", "b,c", "d"};
+
+    std::unique_ptr<GearmanClient> first(makeClient(poolContext, servers));
+    std::unique_ptr<GearmanClient> second(makeClient(poolContext, servers));
+    ASSERT_EQ(std::vector<std::string>({"a", "b", "c", "d"}), mockGearmanWorkerLib.addedServers);
+
+    // A thread started after another exits takes over its servers
+    first.reset();
+    mockGearmanWorkerLib.addedServers.clear();
+    first.reset(makeClient(poolContext, servers));
+    ASSERT_EQ(std::vector<std::string>({"a", "b"}), mockGearmanWorkerLib.addedServers);
+
+    // Losing gearmand moves a thread on to other servers
+    mockGearmanWorkerLib.addedServers.clear();
+    first->reconnect();
+    ASSERT_EQ(std::vector<std::string>({"b", "c"}), mockGearmanWorkerLib.addedServers);
+}
+
+class GearmanClientRetryTest : public GearmanClientTest {
+public:
+    PoolContextPtr makePoolContext(uint32_t maxAttempts, uint32_t budgetPercent = 20) {
+        PoolOptions options;
+        options.retry.max_attempts = maxAttempts;
+        options.retry.initial_backoff_ms = 1;
+        options.retry.max_backoff_ms = 2;
+        options.retry_budget_percent = budgetPercent;
+        return makePool(options);
+    }
+};
+
+TEST_F(GearmanClientRetryTest, TestRetriesTransientHttpErrors) {
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+
+    long unavailable(503);
+    mockCurlLib.configureGetInfo(CURLINFO_RESPONSE_CODE, &unavailable);
+
+    std::unique_ptr<GearmanClient> client(makeClient(makePoolContext(3)));
+
+    std::string gearmanRet;
+    ASSERT_EQ(GEARMAN_WORK_FAIL, client->processJob(nullptr, gearmanRet));
+    ASSERT_EQ(3, mockCurlLib.timesPerformCalled);
+    ASSERT_EQ(2, mockMetricProxy->getJobRetryCount("testcase_pool_name", "mocked_function_name"));
+    ASSERT_EQ(1, mockMetricProxy->getJobErrorCount("testcase_pool_name", "mocked_function_name"));
+    ASSERT_TRUE(mockCurlLib.allCleanupRoutinesCalled());
+}
+
+TEST_F(GearmanClientRetryTest, TestRetriesConnectErrors) {
+    mockCurlLib.configure(CURLE_OK, CURLE_COULDNT_CONNECT, CURLE_OK, CURL_FORMADD_OK);
+
+    std::unique_ptr<GearmanClient> client(makeClient(makePoolContext(2)));
+
+    std::string gearmanRet;
+    ASSERT_EQ(GEARMAN_WORK_FAIL, client->processJob(nullptr, gearmanRet));
+    ASSERT_EQ(2, mockCurlLib.timesPerformCalled);
+}
+
+TEST_F(GearmanClientRetryTest, TestRetryAfterIsCappedAtMaxBackoff) {
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+    mockCurlLib.retryAfter = 3600;
+
+    long unavailable(503);
+    mockCurlLib.configureGetInfo(CURLINFO_RESPONSE_CODE, &unavailable);
+
+    std::unique_ptr<GearmanClient> client(makeClient(makePoolContext(3)));
+
+    // An hour would be past the job's deadline. Capped, the retries go ahead right away
+    auto start = std::chrono::steady_clock::now();
+    std::string gearmanRet;
+    ASSERT_EQ(GEARMAN_WORK_FAIL, client->processJob(nullptr, gearmanRet));
+    ASSERT_EQ(3, mockCurlLib.timesPerformCalled);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+}
+
+TEST_F(GearmanClientRetryTest, TestShutdownCutsRetryBackoffShort) {
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+    mockCurlLib.retryAfter = 3;
+
+    long unavailable(503);
+    mockCurlLib.configureGetInfo(CURLINFO_RESPONSE_CODE, &unavailable);
+
+    PoolOptions options;
+    options.retry.max_attempts = 3;
+    options.retry.max_backoff_ms = 10000;
+    options.retry_budget_percent = 100;
+    PoolContextPtr poolContext = makePool(options);
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext));
+
+    std::thread shutdown([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        g_force_shutdown = true;
+    });
+    auto start = std::chrono::steady_clock::now();
+    std::string gearmanRet;
+    gearman_return_t ret = client->processJob(nullptr, gearmanRet);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    shutdown.join();
+    g_force_shutdown = false;
+
+    ASSERT_EQ(GEARMAN_WORK_FAIL, ret);
+    ASSERT_EQ(1, mockCurlLib.timesPerformCalled);
+    ASSERT_LT(elapsed, std::chrono::seconds(2));
+}
+
+TEST_F(GearmanClientRetryTest, TestRunningWorkersTakeRetunedRetryOptions) {
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+
+    long unavailable(503);
+    mockCurlLib.configureGetInfo(CURLINFO_RESPONSE_CODE, &unavailable);
+
+    PoolContextPtr poolContext = makePoolContext(3);
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext));
+
+    PoolOptions options = *poolContext->options();
+    options.retry.max_attempts = 2;
+    poolContext->retune(options);
+
+    std::string gearmanRet;
+    ASSERT_EQ(GEARMAN_WORK_FAIL, client->processJob(nullptr, gearmanRet));
+    ASSERT_EQ(2, mockCurlLib.timesPerformCalled);
+}
+
+TEST_F(GearmanClientRetryTest, TestDoesNotRetryPermanentErrors) {
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+
+    long serverError(500);
+    mockCurlLib.configureGetInfo(CURLINFO_RESPONSE_CODE, &serverError);
+
+    std::unique_ptr<GearmanClient> client(makeClient(makePoolContext(3)));
+
+    std::string gearmanRet;
+    ASSERT_EQ(GEARMAN_WORK_FAIL, client->processJob(nullptr, gearmanRet));
+    ASSERT_EQ(1, mockCurlLib.timesPerformCalled);
+}
+
+TEST_F(GearmanClientRetryTest, TestRetriesStopWhenBudgetIsExhausted) {
+    mockCurlLib.configure(CURLE_OK, CURLE_COULDNT_CONNECT, CURLE_OK, CURL_FORMADD_OK);
+
+    std::unique_ptr<GearmanClient> client(makeClient(makePoolContext(100, 0)));
+
+    // With no deposits only the reserve can be spent
+    std::string gearmanRet;
+    client->processJob(nullptr, gearmanRet);
+    uint32_t performs = mockCurlLib.timesPerformCalled;
+    ASSERT_GT(performs, 1);
+    ASSERT_LT(performs, 100);
+    ASSERT_EQ(1, mockMetricProxy->getJobRetryDeniedCount("testcase_pool_name", "mocked_function_name", "budget"));
+}
+
+TEST_F(GearmanClientTest, TestHeaderCallbackParsesRetryAfter) {
+    long retryAfter = -1;
+    char *header = "retry-after: 7\r\n";
+    ASSERT_EQ(strlen(header), curl_header_func(header, strlen(header), 1, &retryAfter));
+    ASSERT_EQ(7, retryAfter);
+
+    retryAfter = -1;
+    char *dateHeader = "Retry-After: Wed, 21 Oct 2015 07:28:00 GMT\r\n";
+    curl_header_func(dateHeader, strlen(dateHeader), 1, &retryAfter);
+    ASSERT_EQ(-1, retryAfter);
+
+    char *otherHeader = "Content-Type: text/plain\r\n";
+    curl_header_func(otherHeader, strlen(otherHeader), 1, &retryAfter);
+    ASSERT_EQ(-1, retryAfter);
+}
+
+TEST_F(GearmanClientTest, TestRunDoesNotGrabJobsUnderBackpressure) {
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+    mockGearmanWorkerLib.configure(
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    long tooManyRequests(429);
+    mockCurlLib.configureGetInfo(CURLINFO_RESPONSE_CODE, &tooManyRequests);
+
+    PoolOptions options;
+    options.backpressure.pause_ms = 60000;
+    PoolContextPtr poolContext = makePool(options);
+
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext));
+
+    std::string gearmanRet;
+    client->processJob(nullptr, gearmanRet);
+    ASSERT_GT(poolContext->backpressure()->pausedFor().count(), 0);
+    ASSERT_EQ(1, mockMetricProxy->getBackpressurePauseCount("testcase_pool_name", "overload"));
+
+    runWithoutWaiting(*client);
+
+    ASSERT_EQ(0, mockGearmanWorkerLib.timesWorkCalled);
+}
+
+TEST_F(GearmanClientTest, TestRunIdlesWhilePoolIsAtConcurrencyLimit) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    PoolOptions options;
+    options.concurrency_limit.max_limit = 1;
+    PoolContextPtr poolContext = makePool(options);
+    ASSERT_TRUE(poolContext->concurrencyLimiter()->tryAcquire());
+
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext));
+
+    runWithoutWaiting(*client);
+
+    ASSERT_EQ(0, mockGearmanWorkerLib.timesWorkCalled);
+}
+
+TEST_F(GearmanClientTest, TestRunDoesNotGrabJobsWithoutPoolRateLimitTokens) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NO_JOBS, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    PoolOptions options;
+    options.rate_limit.jobs_per_second = 0.001;
+    options.rate_limit.burst = 1;
+    PoolContextPtr poolContext = makePool(options);
+    ASSERT_TRUE(poolContext->rateLimiter()->tryTake());
+
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext));
+
+    runWithoutWaiting(*client);
+
+    ASSERT_EQ(0, mockGearmanWorkerLib.timesWorkCalled);
+    ASSERT_EQ(1, mockMetricProxy->getThrottledCount("testcase_pool_name", "pool"));
+}
+
+TEST_F(GearmanClientTest, TestRunGivesBackPoolTokenWhenNoJobIsGrabbed) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NO_JOBS, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    PoolOptions options;
+    options.rate_limit.jobs_per_second = 0.001;
+    options.rate_limit.burst = 1;
+    PoolContextPtr poolContext = makePool(options);
+
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext));
+
+    client->run();
+    ASSERT_EQ(1, mockGearmanWorkerLib.timesWorkCalled);
+    ASSERT_TRUE(poolContext->rateLimiter()->tryTake());
+}
+
+TEST_F(GearmanClientTest, TestRunUnregistersFunctionsOutOfRateLimitTokens) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NO_JOBS, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    PoolOptions options;
+    options.function_rate_limit["Limited"].jobs_per_second = 0.001;
+    options.function_rate_limit["Limited"].burst = 1;
+    PoolContextPtr poolContext = makePool(options, StringSet({"Limited", "Free"}));
+    poolContext->functionRateLimiter("Limited")->take();
+
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext, StringSet(), StringSet({"Limited", "Free"})));
+
+    // The other function keeps the worker grabbing jobs
+    client->run();
+    ASSERT_EQ(1, mockGearmanWorkerLib.timesWorkCalled);
+    ASSERT_EQ(StringSet({"Limited"}), mockGearmanWorkerLib.unregistered);
+}
+
+// Seen by the work function below, which cannot capture
+static TokenBucket *limitedBucket = nullptr;
+static bool limitedTokenHeld = false;
+
+TEST_F(GearmanClientTest, TestRunHoldsFunctionTokenWhileGrabbing) {
+    PoolOptions options;
+    options.function_rate_limit["Limited"].jobs_per_second = 0.001;
+    options.function_rate_limit["Limited"].burst = 1;
+    PoolContextPtr poolContext = makePool(options, StringSet({"Limited", "Free"}));
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext, StringSet(), StringSet({"Limited", "Free"})));
+
+    limitedBucket = poolContext->functionRateLimiter("Limited");
+    limitedTokenHeld = false;
+    mockGearmanWorkerLib.configure_with_work_function([](GearmanClient *) {
+        // Another thread grabbing now finds the bucket empty, so the burst cannot outrun it
+        limitedTokenHeld = !limitedBucket->tryTake();
+        return GEARMAN_NO_JOBS;
+    }, client.get(), GEARMAN_TIMEOUT, GEARMAN_SUCCESS, GEARMAN_SUCCESS);
+
+    client->run();
+    ASSERT_TRUE(limitedTokenHeld);
+    // No job came of the grab, so the token is back
+    ASSERT_EQ(0, limitedBucket->waitTime().count());
+    ASSERT_EQ(0, mockGearmanWorkerLib.unregistered.size());
+}
+
+TEST_F(GearmanClientTest, TestRunAppliesPoolReconfigurationInPlace) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NO_JOBS, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    PoolContextPtr poolContext = makePool(PoolOptions(), StringSet({"Sum", "Product"}));
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext, StringSet(), StringSet({"Sum", "Product"})));
+    mockGearmanWorkerLib.addedFunctions.clear();
+
+    poolContext->reconfigure("now.send.here", StringSet({"Product", "Quotient"}));
+    ASSERT_EQ(1, poolContext->configGeneration());
+
+    // Same worker, only the difference goes to gearmand
+    client->run();
+    ASSERT_EQ(1, mockGearmanWorkerLib.timesWorkCalled);
+    ASSERT_EQ(StringSet({"Sum"}), mockGearmanWorkerLib.unregistered);
+    ASSERT_EQ(std::vector<std::string>({"Quotient"}), mockGearmanWorkerLib.addedFunctions);
+    ASSERT_EQ("now.send.here", poolContext->config()->uri);
+}
+
+TEST_F(GearmanClientTest, TestFetcherReportsJobsWithoutWaitingOnGearmand) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NO_JOBS, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+    mockGearmanWorkerLib.jobsToGrab = 1;
+    mockGearmanWorkerLib.waitDelayMs = 2000;
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+
+    PoolOptions options;
+    options.fetch_queue.fetchers = 1;
+    PoolContextPtr poolContext = makePool(options);
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext, StringSet({"localhost"}), StringSet({"Sum"})));
+    poolContext->startFetchers(StringSet({"localhost"}), StringSet({"Sum"}));
+    client->run();
+    ASSERT_EQ(1, mockCurlLib.timesPerformCalled);
+
+    // The executor wakes the fetcher, which is not stuck waiting on gearmand
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 500 && mockGearmanJobLib.timesFreed.load() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(1, mockGearmanJobLib.timesFreed);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(1000));
+}
+
+TEST_F(GearmanClientTest, TestFetcherDoesNotPollGearmandWhileJobsAreOut) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NO_JOBS, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+    mockGearmanWorkerLib.jobsToGrab = 1;
+    mockGearmanWorkerLib.waitDelayMs = 2000;
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+    mockCurlLib.performMs = 300;
+
+    PoolOptions options;
+    options.fetch_queue.fetchers = 1;
+    PoolContextPtr poolContext = makePool(options);
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext, StringSet({"localhost"}), StringSet({"Sum"})));
+    poolContext->startFetchers(StringSet({"localhost"}), StringSet({"Sum"}));
+    client->run();
+    ASSERT_EQ(1, mockCurlLib.timesPerformCalled);
+
+    // The grab that found the job and the one that found nothing, none while it ran
+    ASSERT_LE(mockGearmanWorkerLib.timesGrabCalled.load(), 2u);
+    for (int i = 0; i < 500 && mockGearmanJobLib.timesFreed.load() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(1, mockGearmanJobLib.timesFreed);
+}
+
+TEST_F(GearmanClientTest, TestNewUriForgetsOldEndpointsHealth) {
+    PoolOptions options;
+    options.circuit_breaker.failure_threshold = 1;
+    options.backpressure.pause_ms = 10000;
+    PoolContextPtr poolContext = makePool(options, StringSet({"Sum"}), "first.uri");
+    bool probe;
+    poolContext->circuitBreaker()->recordFailure(false);
+    poolContext->backpressure()->reportOverload(-1);
+
+    // Same endpoint, so its health still stands
+    poolContext->reconfigure("first.uri", StringSet({"Product"}));
+    ASSERT_FALSE(poolContext->circuitBreaker()->tryAcquire(probe));
+    ASSERT_GT(poolContext->backpressure()->pausedFor().count(), 0);
+
+    poolContext->reconfigure("second.uri", StringSet({"Product"}));
+    ASSERT_TRUE(poolContext->circuitBreaker()->tryAcquire(probe));
+    ASSERT_EQ(0, poolContext->backpressure()->pausedFor().count());
+}
+
+TEST_F(GearmanClientTest, TestStartsFromThePoolsCurrentConfig) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NO_JOBS, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+
+    PoolContextPtr poolContext = makePool(PoolOptions(), StringSet({"Sum"}), "first.uri");
+    poolContext->reconfigure("second.uri", StringSet({"Product"}));
+
+    // The thread was started with the settings of the pool's first config
+    std::unique_ptr<GearmanClient> client(
+        new GearmanClient(mockThreadRegistry, mockMetricProxyPoolWrapper, StringSet(),
+                          StringSet({"Sum"}), "first.uri", poolContext)
+    );
+    ASSERT_EQ(std::vector<std::string>({"Product"}), mockGearmanWorkerLib.addedFunctions);
+
+    // and has nothing left to apply
+    client->run();
+    ASSERT_TRUE(mockGearmanWorkerLib.unregistered.empty());
+    ASSERT_EQ(std::vector<std::string>({"Product"}), mockGearmanWorkerLib.addedFunctions);
+}
+
+TEST_F(GearmanClientTest, TestRunExecutesJobsGrabbedByPoolFetchers) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NO_JOBS, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+    mockGearmanWorkerLib.jobsToGrab = 1;
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+
+    PoolOptions options;
+    options.fetch_queue.fetchers = 1;
+    PoolContextPtr poolContext = makePool(options);
+    ASSERT_NE(nullptr, poolContext->jobQueue());
+
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext, StringSet({"localhost"}), StringSet({"Sum"})));
+    poolContext->startFetchers(StringSet({"localhost"}), StringSet({"Sum"}));
+
+    // The executor never talks to gearmand itself, and is ready once the fetcher has
+    client->run();
+    ASSERT_EQ(0, mockGearmanWorkerLib.timesWorkCalled);
+    ASSERT_EQ(1, mockCurlLib.timesPerformCalled);
+    ASSERT_EQ(1, static_cast<mock::classes::MockThreadRegistry*>(mockThreadRegistry.get())->timesReadySet);
+
+    // The fetcher reports the outcome on its own thread
+    for (int i = 0; i < 500 && mockGearmanJobLib.timesFreed.load() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(1, mockGearmanJobLib.timesCompleteSent + mockGearmanJobLib.timesFailSent);
+    ASSERT_EQ(1, mockGearmanJobLib.timesFreed);
+}
+
+// A queued job whose connection to gearmand dropped after it was grabbed
+class StaleJob : public FetchedJob, public JobSource {
+public:
+    StaleJob() : FetchedJob(this), abandoned(false) {}
+
+    const char* functionName() const noexcept override { return "Sum"; }
+    const char* handle() const noexcept override { return "H:stale"; }
+    const char* unique() const noexcept override { return ""; }
+    const char* workload() const noexcept override { return ""; }
+    size_t workloadSize() const noexcept override { return 0; }
+    bool stale() const noexcept override { return true; }
+
+    void complete(FetchedJob *job) noexcept override {}
+    void abandon(FetchedJob *job) noexcept override { abandoned = true; }
+
+    bool abandoned;
+};
+
+TEST_F(GearmanClientTest, TestExecutorSkipsJobRequeuedByGearmand) {
+    PoolOptions options;
+    options.fetch_queue.fetchers = 1;
+    PoolContextPtr poolContext = makePool(options);
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext, StringSet({"localhost"}), StringSet({"Sum"})));
+
+    StaleJob job;
+    poolContext->jobQueue()->setConnected();
+    ASSERT_TRUE(poolContext->jobQueue()->tryPush(&job));
+    client->run();
+
+    ASSERT_TRUE(job.abandoned);
+    ASSERT_EQ(0, mockCurlLib.timesPerformCalled);
+}
+
+TEST_F(GearmanClientTest, TestExecutorHoldsQueueWhileOutOfRateLimitTokens) {
+    PoolOptions options;
+    options.fetch_queue.fetchers = 1;
+    options.rate_limit.jobs_per_second = 0.001;
+    options.rate_limit.burst = 1;
+    PoolContextPtr poolContext = makePool(options);
+    ASSERT_TRUE(poolContext->rateLimiter()->tryTake());
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext, StringSet({"localhost"}), StringSet({"Sum"})));
+
+    // Fetchers leave jobs in gearmand while no executor can run them
+    runWithoutWaiting(*client);
+    ASSERT_TRUE(poolContext->jobQueue()->held());
+
+    poolContext->rateLimiter()->giveBack();
+    client->run();
+    ASSERT_FALSE(poolContext->jobQueue()->held());
+}
+
+TEST_F(GearmanClientTest, TestUpgradeDrainLetsQueuedJobFinish) {
+    mockGearmanWorkerLib.configure(
+        GEARMAN_NO_JOBS, GEARMAN_TIMEOUT,
+        GEARMAN_SUCCESS, GEARMAN_SUCCESS
+    );
+    mockGearmanWorkerLib.jobsToGrab = 1;
+    mockCurlLib.configure(CURLE_OK, CURLE_OK, CURLE_OK, CURL_FORMADD_OK);
+    mockCurlLib.performMs = 300;
+    long ok(200);
+    mockCurlLib.configureGetInfo(CURLINFO_RESPONSE_CODE, &ok);
+    auto writeFunc = [] (void *userData) {
+        const char *response = "{\"gearman_ret\": 0, \"response_string\": \"OK\"}";
+        curl_write_func(const_cast<char*>(response), strlen(response), 1, userData);
+    };
+    mockCurlLib.configureSetOpt(CURLOPT_WRITEDATA, writeFunc);
+
+    PoolOptions options;
+    options.fetch_queue.fetchers = 1;
+    PoolContextPtr poolContext = makePool(options);
+    std::unique_ptr<GearmanClient> client(makeClient(poolContext, StringSet({"localhost"}), StringSet({"Sum"})));
+    poolContext->startFetchers(StringSet({"localhost"}), StringSet({"Sum"}));
+
+    // The old process of an upgrade drains as on SIGUSR1 once the new one is ready
+    auto registry = static_cast<mock::classes::MockThreadRegistry*>(mockThreadRegistry.get());
+    std::thread drain([registry]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        registry->shutdownRequested = true;
+    });
+    client->run();
+    drain.join();
+    registry->shutdownRequested = false;
+    ASSERT_EQ(1, mockCurlLib.timesPerformCalled);
+
+    // The job's result still reaches gearmand, instead of a failure
+    for (int i = 0; i < 500 && mockGearmanJobLib.timesFreed.load() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(1, mockGearmanJobLib.timesCompleteSent);
+    ASSERT_EQ(0, mockGearmanJobLib.timesFailSent);
+}
@@ -0,0 +1,159 @@
+#include <string>
+#include <arpa/inet.h>
+#include "gtest/gtest.h"
+#include "gearman-protocol.h"
+
+using namespace Driveshaft;
+
+static std::string response(GearmanPacketType type, const std::string& data) {
+    std::string packet("\0RES", 4);
+    uint32_t header[2] = {htonl(static_cast<uint32_t>(type)), htonl(static_cast<uint32_t>(data.size()))};
+    packet.append(reinterpret_cast<const char*>(header), sizeof(header));
+    return packet + data;
+}
+
+TEST(GearmanProtocolTest, TestEncodesRequestsWithNulSeparatedArgs) {
+    std::string out;
+    append_gearman_request(out, GearmanPacketType::WORK_COMPLETE, {"H:1", "done"});
+
+    ASSERT_EQ(std::string("\0REQ\0\0\0\x0d\0\0\0\x08H:1\0done", 20), out);
+
+    append_gearman_request(out, GearmanPacketType::PRE_SLEEP);
+    ASSERT_EQ(std::string("\0REQ\0\0\0\x04\0\0\0\0", 12), out.substr(20));
+}
+
+TEST(GearmanProtocolTest, TestParsesJobAssignUniq) {
+    std::string buf = response(GearmanPacketType::JOB_ASSIGN_UNIQ, std::string("H:1\0Sum\0u1\0a\0b", 14));
+    GearmanPacket packet;
+
+    ASSERT_EQ(static_cast<ssize_t>(buf.size()), parse_gearman_response(buf.data(), buf.size(), packet));
+    ASSERT_EQ(GearmanPacketType::JOB_ASSIGN_UNIQ, packet.type);
+    ASSERT_EQ(4, packet.arg_count);
+    ASSERT_EQ("H:1", packet.args[0].str());
+    ASSERT_STREQ("Sum", packet.args[1].data); // parsed in place
+    ASSERT_EQ(buf.data() + 20, packet.args[2].data);
+    ASSERT_EQ(std::string("a\0b", 3), packet.args[3].str()); // workloads may hold NULs
+}
+
+TEST(GearmanProtocolTest, TestWaitsForWholePackets) {
+    std::string buf = response(GearmanPacketType::NOOP, "") + response(GearmanPacketType::NO_JOB, "");
+    GearmanPacket packet;
+
+    ASSERT_EQ(0, parse_gearman_response(buf.data(), 5, packet));
+    ASSERT_EQ(12, parse_gearman_response(buf.data(), buf.size(), packet));
+    ASSERT_EQ(GearmanPacketType::NOOP, packet.type);
+    ASSERT_EQ(12, parse_gearman_response(buf.data() + 12, buf.size() - 12, packet));
+    ASSERT_EQ(GearmanPacketType::NO_JOB, packet.type);
+}
+
+TEST(GearmanProtocolTest, TestRejectsCorruptStreams) {
+    GearmanPacket packet;
+    std::string bad_magic("\0REQ\0\0\0\x06\0\0\0\0", 12);
+    ASSERT_EQ(-1, parse_gearman_response(bad_magic.data(), bad_magic.size(), packet));
+
+    std::string missing_args = response(GearmanPacketType::JOB_ASSIGN, "H:1");
+    ASSERT_EQ(-1, parse_gearman_response(missing_args.data(), missing_args.size(), packet));
+}
+
+TEST(GearmanProtocolTest, TestSplitsServers) {
+    std::string host, port;
+    split_gearman_server("gearman1:4731", host, port);
+    ASSERT_EQ("gearman1", host);
+    ASSERT_EQ("4731", port);
+
+    split_gearman_server("[::1]:4732", host, port);
+    ASSERT_EQ("::1", host);
+    ASSERT_EQ("4732", port);
+
+    split_gearman_server("gearman2", host, port);
+    ASSERT_EQ("gearman2", host);
+    ASSERT_EQ("4730", port);
+
+    auto servers = expand_gearman_servers({"a:1,b:2", "c"});
+    ASSERT_EQ(3, servers.size());
+}
+
+static GearmanProbeOptions probe_options() {
+    GearmanProbeOptions options;
+    options.interval_ms = 1000;
+    options.timeout_ms = 500;
+    return options;
+}
+
+TEST(GearmanProtocolTest, TestLivenessProbesQuietConnections) {
+    GearmanLiveness liveness(probe_options());
+    auto start = std::chrono::steady_clock::now();
+    liveness.heard(start);
+
+    ASSERT_TRUE(GearmanLiveness::Action::NONE == liveness.check(start + std::chrono::milliseconds(500)));
+    ASSERT_TRUE(GearmanLiveness::Action::PROBE == liveness.check(start + std::chrono::seconds(1)));
+    ASSERT_TRUE(GearmanLiveness::Action::NONE == liveness.check(start + std::chrono::milliseconds(1200)));
+    ASSERT_TRUE(GearmanLiveness::Action::DEAD == liveness.check(start + std::chrono::milliseconds(1500)));
+
+    // Any answer ends the probe
+    liveness.heard(start + std::chrono::milliseconds(1500));
+    ASSERT_TRUE(GearmanLiveness::Action::NONE == liveness.check(start + std::chrono::milliseconds(2000)));
+    ASSERT_TRUE(start + std::chrono::milliseconds(2500) == liveness.nextCheck());
+}
+
+TEST(GearmanProtocolTest, TestLivenessProbingCanBeTurnedOff) {
+    GearmanProbeOptions options;
+    options.interval_ms = 0;
+    GearmanLiveness liveness(options);
+    auto start = std::chrono::steady_clock::now();
+    liveness.heard(start);
+
+    ASSERT_TRUE(GearmanLiveness::Action::NONE == liveness.check(start + std::chrono::hours(1)));
+    ASSERT_TRUE(GearmanLiveness::time_point::max() == liveness.nextCheck());
+}
+
+TEST(GearmanProtocolTest, TestConnectionWithJobsInFlightOutlivesProbeTimeout) {
+    std::vector<std::string> reasons;
+    GearmanConnection conn("gearmand:4730", probe_options(), -1, [&](GearmanConnection&, const std::string& reason) {
+        reasons.push_back(reason);
+    });
+    auto start = std::chrono::steady_clock::now();
+    conn.state = GearmanConnection::State::IDLE;
+    conn.liveness.heard(start);
+    conn.in_flight = 1;
+
+    conn.check(start + std::chrono::seconds(1)); // probes
+    conn.out.clear();
+    ASSERT_TRUE(conn.check(start + std::chrono::seconds(2)));
+    ASSERT_TRUE(reasons.empty());
+
+    conn.in_flight = 0;
+    conn.check(start + std::chrono::seconds(3));
+    conn.out.clear(); // No socket to send the probe on
+    ASSERT_FALSE(conn.check(start + std::chrono::seconds(4)));
+    ASSERT_EQ(std::vector<std::string>({"no answer to echo"}), reasons);
+}
+
+TEST(GearmanProtocolTest, TestShardsServersEvenly) {
+    std::vector<std::string> servers = {"a", "b", "c"};
+
+    ASSERT_EQ(servers, shard_gearman_servers(servers, 0, 5, 0));
+    ASSERT_EQ(servers, shard_gearman_servers(servers, 3, 5, 0));
+    ASSERT_EQ(std::vector<std::string>({"a", "b"}), shard_gearman_servers(servers, 2, 0, 0));
+    ASSERT_EQ(std::vector<std::string>({"c", "a"}), shard_gearman_servers(servers, 2, 1, 0));
+    ASSERT_EQ(std::vector<std::string>({"b", "c"}), shard_gearman_servers(servers, 2, 2, 0));
+    ASSERT_EQ(std::vector<std::string>({"a", "b"}), shard_gearman_servers(servers, 2, 1, 1));
+}
+
+TEST(GearmanProtocolTest, TestConnectionBacksOffWhenUnresolvable) {
+    std::vector<std::string> reasons;
+    GearmanConnection conn("gearmand.invalid:4730", probe_options(), -1, [&](GearmanConnection&, const std::string& reason) {
+        reasons.push_back(reason);
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(conn.reconnectDue(start));
+    ASSERT_FALSE(conn.connect());
+    ASSERT_EQ(std::vector<std::string>({"unable to resolve"}), reasons);
+    ASSERT_TRUE(GearmanConnection::State::DISCONNECTED == conn.state);
+    ASSERT_EQ(1, conn.failures);
+    ASSERT_EQ(1, conn.generation);
+    ASSERT_FALSE(conn.fill());
+    ASSERT_EQ(1, reasons.size());
+    ASSERT_TRUE(conn.nextCheck() == conn.deadline);
+}
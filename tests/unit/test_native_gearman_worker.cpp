@@ -0,0 +1,190 @@
+#include <string>
+#include "gtest/gtest.h"
+#include "native-gearman-worker.h"
+#include "job-fetcher.h"
+#include "mock/classes/fake-job-server.h"
+
+using namespace Driveshaft;
+using mock::classes::FakeJobServer;
+
+class NativeGearmanWorkerTest : public ::testing::Test {
+protected:
+    NativeGearmanWorkerTest()
+        : jobsRun(0)
+        , jobRet(GEARMAN_SUCCESS)
+        , worker([this](const FetchedJob& job, std::string& result) {
+                     jobsRun++;
+                     functionName = job.functionName();
+                     handle = job.handle();
+                     unique = job.unique();
+                     workload.assign(job.workload(), job.workloadSize());
+                     result = "done";
+                     return jobRet;
+                 }, 10, "driveshaft-test", probeOptions()) {}
+
+    static GearmanProbeOptions probeOptions() {
+        GearmanProbeOptions options;
+        options.interval_ms = 1000;
+        options.timeout_ms = 500;
+        return options;
+    }
+
+    // Drives the worker like GearmanClient::run until a job has run
+    gearman_return_t workUntilJob() {
+        int before = jobsRun;
+        for (int i = 0; i < 500; i++) {
+            auto ret = worker.work();
+            if (jobsRun > before) {
+                return ret;
+            }
+            EXPECT_EQ(GEARMAN_IO_WAIT, ret);
+            worker.wait();
+        }
+        return GEARMAN_TIMEOUT;
+    }
+
+    int jobsRun;
+    gearman_return_t jobRet;
+    std::string functionName;
+    std::string handle;
+    std::string unique;
+    std::string workload;
+    NativeGearmanWorker worker;
+};
+
+TEST_F(NativeGearmanWorkerTest, TestRunsJobsAndReportsResults) {
+    FakeJobServer server;
+    server.addJob("H:1", std::string("pay\0load", 8));
+    worker.addServers(server.address());
+    worker.addFunction("Sum");
+
+    ASSERT_EQ(GEARMAN_SUCCESS, workUntilJob());
+    ASSERT_EQ("Sum", functionName);
+    ASSERT_EQ("H:1", handle);
+    ASSERT_EQ("H:1", unique);
+    ASSERT_EQ(std::string("pay\0load", 8), workload);
+
+    std::string data;
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::SET_CLIENT_ID, data));
+    ASSERT_EQ("driveshaft-test", data);
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::CAN_DO, data));
+    ASSERT_EQ("Sum", data);
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::WORK_COMPLETE, data));
+    ASSERT_EQ(std::string("H:1\0done", 8), data);
+}
+
+TEST_F(NativeGearmanWorkerTest, TestSleepsUntilWokenAndReportsFailures) {
+    FakeJobServer server;
+    worker.addServers(server.address());
+    worker.addFunction("Sum");
+
+    std::string data;
+    for (int i = 0; i < 500 && !server.waitFor(GearmanPacketType::PRE_SLEEP, data, 0); i++) {
+        worker.work();
+        worker.wait();
+    }
+
+    jobRet = GEARMAN_ERRNO;
+    server.addJob("H:2", "later");
+    ASSERT_EQ(GEARMAN_WORK_FAIL, workUntilJob());
+    ASSERT_EQ("H:2", handle);
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::WORK_FAIL, data));
+    ASSERT_EQ("H:2", data);
+}
+
+TEST_F(NativeGearmanWorkerTest, TestRemovedFunctionsAreUnregistered) {
+    FakeJobServer server;
+    worker.addServers(server.address());
+    worker.addFunction("Sum");
+
+    std::string data;
+    for (int i = 0; i < 500 && !server.waitFor(GearmanPacketType::CAN_DO, data, 0); i++) {
+        worker.work();
+        worker.wait();
+    }
+
+    worker.removeFunction("Sum");
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::CANT_DO, data));
+    ASSERT_EQ("Sum", data);
+}
+
+TEST_F(NativeGearmanWorkerTest, TestKeepsWaitingWhileServersAreDown) {
+    worker.addServers("127.0.0.1:1");
+    worker.addFunction("Sum");
+
+    ASSERT_EQ(GEARMAN_IO_WAIT, worker.work());
+    ASSERT_EQ(GEARMAN_TIMEOUT, worker.wait());
+    ASSERT_EQ(GEARMAN_IO_WAIT, worker.work());
+    ASSERT_STRNE("", worker.error());
+    ASSERT_FALSE(worker.answered());
+}
+
+TEST_F(NativeGearmanWorkerTest, TestIsAnsweredOnceServerReplies) {
+    FakeJobServer server;
+    worker.addServers(server.address());
+    worker.addFunction("Sum");
+    ASSERT_FALSE(worker.answered()); // Nothing is connected until work()
+
+    for (int i = 0; i < 500 && !worker.answered(); i++) {
+        worker.work();
+        worker.wait();
+    }
+    ASSERT_TRUE(worker.answered());
+}
+
+TEST_F(NativeGearmanWorkerTest, TestDropsServersThatStopAnswering) {
+    FakeJobServer server;
+    worker.addServers(server.address());
+    worker.addFunction("Sum");
+
+    // Quiet connections are probed after a second
+    std::string data;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline && !server.waitFor(GearmanPacketType::ECHO_REQ, data, 0)) {
+        ASSERT_EQ(GEARMAN_IO_WAIT, worker.work());
+        worker.wait();
+    }
+    ASSERT_STREQ("", worker.error()); // answered
+
+    server.stopAnsweringEcho();
+    while (std::chrono::steady_clock::now() < deadline && std::string(worker.error()).empty()) {
+        worker.work();
+        worker.wait();
+    }
+    ASSERT_NE(std::string::npos, std::string(worker.error()).find("no answer to echo"));
+}
+
+TEST_F(NativeGearmanWorkerTest, TestFailedConnectIsNotReadFrom) {
+    worker.addServers("gearmand.invalid:4730");
+    worker.addFunction("Sum");
+
+    ASSERT_EQ(GEARMAN_IO_WAIT, worker.work());
+    ASSERT_NE(std::string::npos, std::string(worker.error()).find("unable to resolve"));
+}
+
+TEST(NativeGearmanWorkerResultTest, TestReportsJobWhoseResultWasLost) {
+    FakeJobServer server;
+    server.addJob("H:3", "payload");
+    server.addJob("H:4", "payload");
+
+    int jobsRun = 0;
+    NativeGearmanWorker worker([&](const FetchedJob& job, std::string& result) {
+                                   jobsRun++;
+                                   server.hangUp();
+                                   std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                                   result = "done";
+                                   return GEARMAN_SUCCESS;
+                               }, 10, "driveshaft-test");
+    worker.addServers(server.address());
+    worker.addFunction("Sum");
+
+    gearman_return_t ret = GEARMAN_IO_WAIT;
+    for (int i = 0; i < 500 && jobsRun == 0; i++) {
+        ret = worker.work();
+        worker.wait();
+    }
+
+    ASSERT_EQ(1, jobsRun);
+    ASSERT_EQ(GEARMAN_SUCCESS, ret);
+    ASSERT_NE(std::string::npos, std::string(worker.error()).find("write failed"));
+}
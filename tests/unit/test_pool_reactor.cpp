@@ -0,0 +1,135 @@
+#include "gtest/gtest.h"
+#include "pool-reactor.h"
+#include "mock/classes/fake-job-server.h"
+#include "mock/classes/mock-metric-proxy.h"
+
+using namespace Driveshaft;
+using mock::classes::FakeJobServer;
+using mock::classes::MockMetricProxy;
+using std::chrono::milliseconds;
+
+static FetchQueueOptions reactor_options() {
+    FetchQueueOptions options;
+    options.reactor = true;
+    options.capacity = 4;
+    return options;
+}
+
+TEST(PoolReactorTest, TestGrabsJobsAndReportsResults) {
+    FakeJobServer server;
+    server.addJob("H:1", "payload");
+
+    PoolReactor reactor("test-pool", reactor_options(), GearmanProbeOptions(), std::make_shared<MockMetricProxy>());
+    reactor.start({server.address()}, {"Sum"});
+
+    FetchedJob *job = nullptr;
+    ASSERT_TRUE(reactor.queue().pop(job, milliseconds(5000)));
+    ASSERT_STREQ("Sum", job->functionName());
+    ASSERT_STREQ("H:1", job->handle());
+    ASSERT_EQ("payload", std::string(job->workload(), job->workloadSize()));
+
+    std::string data;
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::CAN_DO, data));
+    ASSERT_EQ("Sum", data);
+
+    job->result = "done";
+    job->source->complete(job);
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::WORK_COMPLETE, data));
+    ASSERT_EQ(std::string("H:1\0done", 8), data);
+}
+
+TEST(PoolReactorTest, TestSleepsUntilWokenForNewJobs) {
+    FakeJobServer server;
+
+    PoolReactor reactor("test-pool", reactor_options(), GearmanProbeOptions(), std::make_shared<MockMetricProxy>());
+    reactor.start({server.address()}, {"Sum"});
+
+    std::string data;
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::PRE_SLEEP, data));
+
+    FetchedJob *job = nullptr;
+    ASSERT_FALSE(reactor.queue().pop(job, milliseconds(50)));
+
+    server.addJob("H:2", "later");
+    ASSERT_TRUE(reactor.queue().pop(job, milliseconds(5000)));
+    ASSERT_STREQ("H:2", job->handle());
+
+    job->ret = GEARMAN_WORK_FAIL;
+    job->source->complete(job);
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::WORK_FAIL, data));
+    ASSERT_EQ("H:2", data);
+}
+
+TEST(PoolReactorTest, TestReportsReconnectsToLostServers) {
+    auto metrics = std::make_shared<MockMetricProxy>();
+    PoolReactor reactor("test-pool", reactor_options(), GearmanProbeOptions(), metrics);
+    reactor.start({"127.0.0.1:1"}, {"Sum"});
+
+    for (int i = 0; i < 500 && metrics->getReconnectCount("test-pool") == 0; i++) {
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+    ASSERT_LT(0, metrics->getReconnectCount("test-pool"));
+}
+
+TEST(PoolReactorTest, TestKeepsQuietServerWhileJobsAreRunning) {
+    FakeJobServer server;
+    server.addJob("H:5", "payload");
+    server.stopAnsweringEcho();
+
+    GearmanProbeOptions probe;
+    probe.interval_ms = 100;
+    probe.timeout_ms = 50;
+    PoolReactor reactor("test-pool", reactor_options(), probe, std::make_shared<MockMetricProxy>());
+    reactor.start({server.address()}, {"Sum"});
+
+    FetchedJob *job = nullptr;
+    ASSERT_TRUE(reactor.queue().pop(job, milliseconds(5000)));
+
+    std::string data;
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::ECHO_REQ, data));
+    std::this_thread::sleep_for(milliseconds(300));
+
+    job->result = "done";
+    job->source->complete(job);
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::WORK_COMPLETE, data));
+    ASSERT_EQ(std::string("H:5\0done", 8), data);
+}
+
+TEST(PoolReactorTest, TestQueuedJobGoesStaleWhenConnectionDrops) {
+    FakeJobServer server;
+    server.addJob("H:6", "payload");
+
+    PoolReactor reactor("test-pool", reactor_options(), GearmanProbeOptions(), std::make_shared<MockMetricProxy>());
+    reactor.start({server.address()}, {"Sum"});
+
+    FetchedJob *job = nullptr;
+    ASSERT_TRUE(reactor.queue().pop(job, milliseconds(5000)));
+    ASSERT_FALSE(job->stale());
+
+    // gearmand hands the job of a lost connection to another worker, so executors must skip it
+    server.hangUp();
+    for (int i = 0; i < 500 && !job->stale(); i++) {
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+    ASSERT_TRUE(job->stale());
+    job->source->abandon(job);
+}
+
+TEST(PoolReactorTest, TestLeavesJobsInGearmandWhileQueueIsHeld) {
+    FakeJobServer server;
+    server.addJob("H:7", "payload");
+
+    PoolReactor reactor("test-pool", reactor_options(), GearmanProbeOptions(), std::make_shared<MockMetricProxy>());
+    reactor.queue().setHeld(true);
+    reactor.start({server.address()}, {"Sum"});
+
+    std::string data;
+    ASSERT_TRUE(server.waitFor(GearmanPacketType::CAN_DO, data));
+    ASSERT_FALSE(server.waitFor(GearmanPacketType::GRAB_JOB_UNIQ, data, 30));
+
+    reactor.queue().setHeld(false);
+    FetchedJob *job = nullptr;
+    ASSERT_TRUE(reactor.queue().pop(job, milliseconds(5000)));
+    ASSERT_STREQ("H:7", job->handle());
+    job->source->complete(job);
+}
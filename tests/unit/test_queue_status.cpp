@@ -0,0 +1,243 @@
+#include <thread>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "mock/classes/mock-metric-proxy.h"
+#include "queue-status.h"
+
+using namespace Driveshaft;
+using std::chrono::milliseconds;
+
+// Answers one admin connection on localhost with a canned status response
+class FakeGearmand {
+public:
+    explicit FakeGearmand(const std::string& response) : m_response(response), m_command() {
+        m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        listen(m_listen_fd, 1);
+
+        socklen_t len = sizeof(addr);
+        getsockname(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+        m_port = ntohs(addr.sin_port);
+
+        m_thread = std::thread([this] {
+            int fd = accept(m_listen_fd, nullptr, nullptr);
+            char buffer[64];
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                m_command.assign(buffer, n);
+            }
+            send(fd, m_response.data(), m_response.size(), 0);
+            close(fd);
+        });
+    }
+
+    ~FakeGearmand() {
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+        close(m_listen_fd);
+    }
+
+    std::string address() const {
+        return "127.0.0.1:" + std::to_string(m_port);
+    }
+
+    // What the client sent, once the exchange is over
+    const std::string& command() {
+        m_thread.join();
+        return m_command;
+    }
+
+private:
+    std::string m_response;
+    std::string m_command;
+    int m_listen_fd;
+    uint16_t m_port;
+    std::thread m_thread;
+};
+
+// Accepts admin connections on localhost and never answers them
+class SilentGearmand {
+public:
+    SilentGearmand() {
+        m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        listen(m_listen_fd, 4);
+
+        socklen_t len = sizeof(addr);
+        getsockname(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+        m_port = ntohs(addr.sin_port);
+    }
+
+    ~SilentGearmand() {
+        close(m_listen_fd);
+    }
+
+    std::string address() const {
+        return "127.0.0.1:" + std::to_string(m_port);
+    }
+
+private:
+    int m_listen_fd;
+    uint16_t m_port;
+};
+
+TEST(QueueStatusTest, TestParsesAndSumsStatusResponses) {
+    FunctionStatusMap status;
+    ASSERT_TRUE(parse_gearman_status("Sum\t10\t2\t4\nProduct\t0\t0\t4\n.\n", status));
+    ASSERT_TRUE(parse_gearman_status("Sum\t5\t1\t3\r\n.\r\n", status));
+
+    ASSERT_EQ(15, status["Sum"].total);
+    ASSERT_EQ(3, status["Sum"].running);
+    ASSERT_EQ(12, status["Sum"].queued());
+    ASSERT_EQ(7, status["Sum"].available_workers);
+    ASSERT_EQ(0, status["Product"].queued());
+}
+
+TEST(QueueStatusTest, TestRejectsMalformedOrTruncatedResponses) {
+    FunctionStatusMap status;
+    ASSERT_FALSE(parse_gearman_status("Sum\t10\t2\n.\n", status));
+    ASSERT_FALSE(parse_gearman_status("Sum\tten\t2\t4\n.\n", status));
+    ASSERT_FALSE(parse_gearman_status("Sum\t10\t2\t4\n", status));
+    ASSERT_TRUE(parse_gearman_status(".\n", status));
+}
+
+TEST(QueueStatusTest, TestMalformedResponseLeavesCountsAlone) {
+    FunctionStatusMap status;
+    ASSERT_TRUE(parse_gearman_status("Sum\t10\t2\t4\n.\n", status));
+    ASSERT_FALSE(parse_gearman_status("Sum\t5\t1\t3\nProduct\t1\t0\n.\n", status));
+
+    ASSERT_EQ(1, status.size());
+    ASSERT_EQ(10, status["Sum"].total);
+}
+
+TEST(QueueStatusTest, TestAutoscaleTargetFollowsDemandWithinBounds) {
+    AutoscaleOptions options;
+    options.min_workers = 2;
+    options.max_workers = 10;
+    options.jobs_per_worker = 3;
+
+    FunctionStatusMap status;
+    status["Sum"].total = 7;
+    status["Product"].total = 5;
+    status["Other"].total = 1000;
+
+    ASSERT_EQ(4, autoscale_target(options, {"Sum", "Product"}, status));
+    ASSERT_EQ(2, autoscale_target(options, {"Missing"}, status));
+    ASSERT_EQ(10, autoscale_target(options, {"Other"}, status));
+}
+
+TEST(QueueStatusTest, TestAutoscaleTargetIsThisHostsShare) {
+    AutoscaleOptions options;
+    options.max_workers = 100;
+    options.jobs_per_worker = 2;
+    options.hosts = 4;
+
+    FunctionStatusMap status;
+    status["Sum"].total = 80;
+    status["Product"].total = 2;
+
+    // 40 workers across the cluster, 10 on each host
+    ASSERT_EQ(10, autoscale_target(options, {"Sum"}, status));
+    ASSERT_EQ(1, autoscale_target(options, {"Product"}, status));
+}
+
+TEST(QueueStatusTest, TestFetchesStatusFromGearmand) {
+    FakeGearmand gearmand("Sum\t3\t1\t2\n.\n");
+
+    std::string response;
+    ASSERT_TRUE(fetch_gearman_status(gearmand.address(), milliseconds(1000), response));
+    ASSERT_EQ("Sum\t3\t1\t2\n.\n", response);
+    ASSERT_EQ("status\n", gearmand.command());
+}
+
+TEST(QueueStatusTest, TestFetchFailsWhenServerClosesEarly) {
+    FakeGearmand gearmand("Sum\t3\t1\t2\n");
+
+    std::string response;
+    ASSERT_FALSE(fetch_gearman_status(gearmand.address(), milliseconds(1000), response));
+}
+
+TEST(QueueStatusTest, TestCollectorReportsServedFunctions) {
+    FakeGearmand gearmand("Sum\t3\t1\t2\nOther\t9\t0\t0\n.\n");
+    MockMetricProxyPtr mockMetricProxy(new mock::classes::MockMetricProxy);
+    QueueStatusCollector collector(mockMetricProxy, milliseconds(1000));
+
+    FunctionStatusMap status;
+    ASSERT_FALSE(collector.snapshot(status));
+
+    collector.setTargets({gearmand.address()}, {"Sum", "Product"});
+    collector.collect();
+
+    ASSERT_TRUE(collector.snapshot(status));
+    ASSERT_EQ(2, status.size());
+    ASSERT_EQ(2, status["Sum"].queued());
+    ASSERT_EQ(0, status["Product"].total);
+    ASSERT_EQ(2, mockMetricProxy->getQueuedJobs("Sum"));
+}
+
+TEST(QueueStatusTest, TestCollectorSnapshotInvalidWhenNoServerAnswers) {
+    MockMetricProxyPtr mockMetricProxy(new mock::classes::MockMetricProxy);
+    QueueStatusCollector collector(mockMetricProxy, milliseconds(200));
+
+    // Nothing listens on the discard port
+    collector.setTargets({"127.0.0.1:9"}, {"Sum"});
+    collector.collect();
+
+    FunctionStatusMap status;
+    ASSERT_FALSE(collector.snapshot(status));
+}
+
+TEST(QueueStatusTest, TestCollectorSnapshotInvalidWhenAnyServerFails) {
+    FakeGearmand gearmand("Sum\t3\t1\t2\n.\n");
+    MockMetricProxyPtr mockMetricProxy(new mock::classes::MockMetricProxy);
+    QueueStatusCollector collector(mockMetricProxy, milliseconds(200));
+
+    // Half the queues are missing, too few to scale on or report
+    collector.setTargets({gearmand.address(), "127.0.0.1:9"}, {"Sum"});
+    collector.collect();
+
+    FunctionStatusMap status;
+    ASSERT_FALSE(collector.snapshot(status));
+    ASSERT_EQ(0, mockMetricProxy->getQueuedJobs("Sum"));
+}
+
+TEST(QueueStatusTest, TestCollectorPollsServersInParallel) {
+    SilentGearmand first, second, third;
+    MockMetricProxyPtr mockMetricProxy(new mock::classes::MockMetricProxy);
+    QueueStatusCollector collector(mockMetricProxy, milliseconds(300));
+
+    collector.setTargets({first.address(), second.address(), third.address()}, {"Sum"});
+    auto start = std::chrono::steady_clock::now();
+    collector.collect();
+
+    // One interval for the whole round, not one per server
+    ASSERT_LT(std::chrono::steady_clock::now() - start, milliseconds(600));
+    FunctionStatusMap status;
+    ASSERT_FALSE(collector.snapshot(status));
+}
+
+TEST(QueueStatusTest, TestStopCutsRoundShort) {
+    SilentGearmand gearmand;
+    MockMetricProxyPtr mockMetricProxy(new mock::classes::MockMetricProxy);
+    QueueStatusCollector collector(mockMetricProxy, milliseconds(10000));
+
+    collector.setTargets({gearmand.address()}, {"Sum"});
+    collector.start();
+    std::this_thread::sleep_for(milliseconds(100));
+
+    auto start = std::chrono::steady_clock::now();
+    collector.stop();
+    ASSERT_LT(std::chrono::steady_clock::now() - start, milliseconds(1000));
+}
@@ -0,0 +1,33 @@
+#include "gtest/gtest.h"
+#include "retry-policy.h"
+
+using namespace Driveshaft;
+
+TEST(RetryPolicyTest, TestBackoffStaysWithinExponentialCeiling) {
+    RetryOptions options;
+    options.initial_backoff_ms = 10;
+    options.max_backoff_ms = 100;
+
+    for (int i = 0; i < 100; i++) {
+        ASSERT_LE(retry_backoff(options, 1).count(), 10);
+        ASSERT_LE(retry_backoff(options, 3).count(), 40);
+        ASSERT_LE(retry_backoff(options, 30).count(), 100);
+    }
+}
+
+TEST(RetryPolicyTest, TestBudgetAllowsReserveThenRequiresDeposits) {
+    RetryBudget budget(50);
+
+    uint32_t reserve = 0;
+    while (budget.tryRetry()) {
+        reserve++;
+    }
+    ASSERT_GT(reserve, 0);
+
+    // Two jobs at 50% buy one retry
+    budget.recordJob();
+    ASSERT_FALSE(budget.tryRetry());
+    budget.recordJob();
+    ASSERT_TRUE(budget.tryRetry());
+    ASSERT_FALSE(budget.tryRetry());
+}
@@ -0,0 +1,33 @@
+#include <chrono>
+#include <future>
+#include <thread>
+#include "gtest/gtest.h"
+#include "spare-threads.h"
+
+using namespace Driveshaft;
+
+TEST(SpareThreadsTest, TestRunsWorkOnASpare) {
+    SpareThreads spares(2);
+    ASSERT_FALSE(spares.assign([]{}));
+
+    spares.fill();
+    ASSERT_EQ(2u, spares.idle());
+
+    std::promise<std::thread::id> ran_on;
+    ASSERT_TRUE(spares.assign([&ran_on]{ ran_on.set_value(std::this_thread::get_id()); }));
+    ASSERT_EQ(1u, spares.idle());
+
+    auto result = ran_on.get_future();
+    ASSERT_EQ(std::future_status::ready, result.wait_for(std::chrono::seconds(5)));
+    ASSERT_NE(std::this_thread::get_id(), result.get());
+
+    spares.fill();
+    ASSERT_EQ(2u, spares.idle());
+}
+
+TEST(SpareThreadsTest, TestWithoutSparesTheCallerStartsItsOwn) {
+    SpareThreads spares(0);
+    spares.fill();
+    ASSERT_EQ(0u, spares.idle());
+    ASSERT_FALSE(spares.assign([]{}));
+}
@@ -0,0 +1,202 @@
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "supervisor-channel.h"
+#include "mock/classes/mock-metric-proxy.h"
+
+using namespace Driveshaft;
+
+class SupervisorChannelTest : public ::testing::Test {
+public:
+    SupervisorChannelTest() : supervisor_fd(-1), channel(), metrics(new mock::classes::MockMetricProxy()) {}
+
+    void SetUp() {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+        supervisor_fd = fds[0];
+        channel.reset(new SupervisorChannel(fds[1], 2));
+    }
+
+    void TearDown() {
+        if (supervisor_fd != -1) {
+            close(supervisor_fd);
+        }
+    }
+
+    // Reads one message the way the supervisor does and replays it
+    SupervisorMessage::Type replayNext() {
+        char buffer[SUPERVISOR_MESSAGE_MAX];
+        ssize_t len = recv(supervisor_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        EXPECT_LT(0, len);
+
+        SupervisorMessage message(SupervisorMessage::Type::READY);
+        EXPECT_TRUE(message.decode(buffer, len));
+        message.replay(*metrics);
+        return message.type;
+    }
+
+    int supervisor_fd;
+    std::unique_ptr<SupervisorChannel> channel;
+    MockMetricProxyPtr metrics;
+};
+
+TEST_F(SupervisorChannelTest, TestReplaysJobMetrics) {
+    channel->reportJobSuccess("pool", "Sum", 0.5);
+    channel->reportHttpJobError("pool", "Sum", 503);
+    channel->reportJobRetryDenied("pool", "Sum", "budget");
+    for (int i = 0; i < 3; ++i) {
+        replayNext();
+    }
+
+    ASSERT_EQ(1, metrics->getJobSuccessesCount("pool", "Sum"));
+    ASSERT_EQ(0.5, metrics->getJobSuccessesDelaySum("pool", "Sum"));
+    ASSERT_EQ(1, metrics->getJobHttpErrorCount("pool", "Sum", 503));
+    ASSERT_EQ(1, metrics->getJobRetryDeniedCount("pool", "Sum", "budget"));
+}
+
+TEST_F(SupervisorChannelTest, TestReplaysPoolMetrics) {
+    channel->reportCircuitBreakerTransition("pool", "closed", "open");
+    channel->reportConcurrencyLimit("pool", 7);
+    channel->reportQueueStatus("Sum", 12, 3, 4);
+    for (int i = 0; i < 3; ++i) {
+        replayNext();
+    }
+
+    ASSERT_EQ("open", metrics->getCircuitBreakerState("pool"));
+    ASSERT_EQ(7, metrics->getConcurrencyLimit("pool"));
+    ASSERT_EQ(12, metrics->getQueuedJobs("Sum"));
+}
+
+TEST_F(SupervisorChannelTest, TestSendsReady) {
+    channel->sendReady();
+    ASSERT_TRUE(SupervisorMessage::Type::READY == replayNext());
+}
+
+TEST_F(SupervisorChannelTest, TestCutsLongNames) {
+    channel->reportReconnect(std::string(SUPERVISOR_NAME_MAX * 2, 'p'));
+    replayNext();
+
+    ASSERT_EQ(1, metrics->getReconnectCount(std::string(SUPERVISOR_NAME_MAX, 'p')));
+}
+
+TEST_F(SupervisorChannelTest, TestRejectsMalformedMessages) {
+    SupervisorMessage message(SupervisorMessage::Type::JOB_ERROR);
+    message.names[0] = "pool";
+    char buffer[SUPERVISOR_MESSAGE_MAX];
+    size_t len = message.encode(buffer);
+
+    SupervisorMessage decoded(SupervisorMessage::Type::READY);
+    ASSERT_TRUE(decoded.decode(buffer, len));
+    ASSERT_FALSE(decoded.decode(buffer, len - 1));
+    ASSERT_FALSE(decoded.decode(buffer, 0));
+
+    buffer[0] = 0;
+    ASSERT_FALSE(decoded.decode(buffer, len));
+}
+
+TEST_F(SupervisorChannelTest, TestNoticesSupervisorExit) {
+    ASSERT_FALSE(channel->closed());
+    close(supervisor_fd);
+    supervisor_fd = -1;
+    ASSERT_TRUE(channel->closed());
+}
+
+TEST_F(SupervisorChannelTest, TestHoldsMetricsWhileSupervisorIsBehind) {
+    // Nobody reads until the socket buffer is full; none of these may block
+    int sent = 0;
+    while (!channel->backlogged()) {
+        channel->reportJobError("pool", "Sum");
+        ++sent;
+    }
+    for (int i = 0; i < 10; ++i) {
+        channel->reportJobError("pool", "Sum");
+        ++sent;
+    }
+
+    struct pollfd pfd = { supervisor_fd, POLLIN, 0 };
+    while (channel->backlogged()) {
+        replayNext();
+        channel->flush();
+    }
+    while (poll(&pfd, 1, 0) == 1) {
+        replayNext();
+    }
+    ASSERT_EQ(sent, metrics->getJobErrorCount("pool", "Sum"));
+}
+
+TEST_F(SupervisorChannelTest, TestDropsMetricsOnceBacklogIsFull) {
+    while (!channel->backlogged()) {
+        channel->reportJobError("pool", "Sum");
+    }
+    for (size_t i = 0; i < SUPERVISOR_BACKLOG_MAX + 10; ++i) {
+        channel->reportJobError("pool", "Sum");
+    }
+
+    struct pollfd pfd = { supervisor_fd, POLLIN, 0 };
+    uint32_t received = 0;
+    while (channel->backlogged() || poll(&pfd, 1, 0) == 1) {
+        if (poll(&pfd, 1, 0) == 1) {
+            replayNext();
+            ++received;
+        }
+        channel->flush();
+    }
+    ASSERT_EQ(received, metrics->getJobErrorCount("pool", "Sum"));
+    ASSERT_GT(received, SUPERVISOR_BACKLOG_MAX);
+
+    // The supervisor caught up, so new metrics go out again
+    channel->reportJobError("pool", "Sum");
+    replayNext();
+    ASSERT_EQ(received + 1, metrics->getJobErrorCount("pool", "Sum"));
+}
+
+TEST_F(SupervisorChannelTest, TestReadyWaitsForBacklog) {
+    while (!channel->backlogged()) {
+        channel->reportJobError("pool", "Sum");
+    }
+
+    std::thread reader([this]() {
+        SupervisorMessage::Type type;
+        do {
+            struct pollfd pfd = { supervisor_fd, POLLIN, 0 };
+            poll(&pfd, 1, -1);
+            type = replayNext();
+        } while (type != SupervisorMessage::Type::READY);
+    });
+    channel->sendReady();
+    reader.join();
+    ASSERT_FALSE(channel->backlogged());
+}
+
+TEST_F(SupervisorChannelTest, TestDropsMetricsOnceSupervisorIsGone) {
+    close(supervisor_fd);
+    supervisor_fd = -1;
+    channel->reportJobError("pool", "Sum");
+    ASSERT_FALSE(channel->backlogged());
+}
+
+TEST(SupervisorChannelInheritTest, TestInheritsDescriptorAndIndex) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+    setenv(SUPERVISOR_FD_VARIABLE, std::to_string(fds[1]).c_str(), 1);
+    setenv(WORKER_PROCESS_VARIABLE, "3", 1);
+
+    auto channel = SupervisorChannel::inherited();
+    ASSERT_TRUE(channel.get() != nullptr);
+    EXPECT_EQ(fds[1], channel->fd());
+    EXPECT_EQ(3, channel->process());
+    EXPECT_EQ(nullptr, getenv(SUPERVISOR_FD_VARIABLE));
+    EXPECT_EQ(nullptr, getenv(WORKER_PROCESS_VARIABLE));
+    close(fds[0]);
+}
+
+TEST(SupervisorChannelInheritTest, TestNotStartedBySupervisor) {
+    unsetenv(SUPERVISOR_FD_VARIABLE);
+    unsetenv(WORKER_PROCESS_VARIABLE);
+    EXPECT_FALSE(SupervisorChannel::inherited());
+}
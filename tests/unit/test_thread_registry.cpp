@@ -0,0 +1,201 @@
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include "gtest/gtest.h"
+#include "thread-registry.h"
+
+using namespace Driveshaft;
+
+static bool readable(int fd) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 1;
+}
+
+TEST(ThreadRegistryTest, TestSignalsThreadExits) {
+    ThreadRegistry registry;
+    ASSERT_NE(-1, registry.eventFd());
+
+    registry.registerThread("pool");
+    ASSERT_FALSE(readable(registry.eventFd()));
+
+    registry.unregisterThread();
+    ASSERT_TRUE(readable(registry.eventFd()));
+    ASSERT_EQ(StringSet({"pool"}), registry.takeExitedPools());
+    ASSERT_EQ(0u, registry.poolCount("pool"));
+
+    uint64_t count = 0;
+    ASSERT_EQ((ssize_t) sizeof(count), read(registry.eventFd(), &count, sizeof(count)));
+    ASSERT_EQ(1u, count);
+    ASSERT_FALSE(readable(registry.eventFd()));
+    ASSERT_TRUE(registry.takeExitedPools().empty());
+}
+
+TEST(ThreadRegistryTest, TestCountsReservedThreadsUntilTheyRegister) {
+    ThreadRegistry registry;
+    registry.reserveThreads("pool", 2);
+    registry.reserveThreads("other", 1);
+    ASSERT_EQ(2u, registry.poolCount("pool"));
+    ASSERT_EQ(3u, registry.threadCount());
+
+    registry.registerThread("pool");
+    ASSERT_EQ(2u, registry.poolCount("pool"));
+    ASSERT_EQ(3u, registry.threadCount());
+    ASSERT_FALSE(registry.shouldShutdown());
+
+    registry.unregisterThread();
+    ASSERT_EQ(1u, registry.poolCount("pool"));
+    ASSERT_EQ(2u, registry.threadCount());
+}
+
+TEST(ThreadRegistryTest, TestShutsDownReservedThreadsAsTheyRegister) {
+    ThreadRegistry registry;
+    registry.reserveThreads("pool", 1);
+    ASSERT_TRUE(registry.sendShutdown("pool", 1));
+    ASSERT_FALSE(registry.sendShutdown("pool", 1));
+
+    registry.registerThread("pool");
+    ASSERT_TRUE(registry.shouldShutdown());
+    registry.unregisterThread();
+}
+
+TEST(ThreadRegistryTest, TestSignalsReadyThreads) {
+    ThreadRegistry registry;
+    registry.registerThread("pool");
+    ASSERT_EQ(0u, registry.readyCount());
+
+    registry.setThreadReady();
+    ASSERT_EQ(1u, registry.readyCount());
+    ASSERT_TRUE(readable(registry.eventFd()));
+
+    registry.unregisterThread();
+    ASSERT_EQ(0u, registry.readyCount());
+}
+
+TEST(ThreadRegistryTest, TestSnapshotsThreadSlots) {
+    ThreadRegistry registry;
+    ASSERT_TRUE(registry.snapshot().empty());
+
+    registry.registerThread("pool");
+    registry.setThreadJob("H:gearmand:1", "unique-1");
+
+    auto snapshots = registry.snapshot();
+    ASSERT_EQ(1u, snapshots.size());
+    ASSERT_EQ("pool", snapshots[0].pool);
+    ASSERT_EQ(ThreadState::WORKING, snapshots[0].state);
+    ASSERT_FALSE(snapshots[0].should_shutdown);
+    ASSERT_EQ("H:gearmand:1", snapshots[0].job_handle);
+    ASSERT_EQ("unique-1", snapshots[0].job_unique);
+
+    ASSERT_TRUE(registry.sendShutdown("pool", 1));
+    registry.setThreadState(ThreadState::WAITING_FOR_WORK);
+    snapshots = registry.snapshot();
+    ASSERT_TRUE(snapshots[0].should_shutdown);
+    ASSERT_EQ(ThreadState::WAITING_FOR_WORK, snapshots[0].state);
+
+    registry.unregisterThread();
+    ASSERT_TRUE(registry.snapshot().empty());
+}
+
+TEST(ThreadRegistryTest, TestJobIdentityIsNeverTorn) {
+    ThreadSlot slot("pool", false);
+    std::atomic<bool> done(false);
+
+    std::thread writer([&slot, &done] {
+        for (int i = 0; i < 20000; ++i) {
+            std::string id(std::to_string(i % 2 ? 1111111 : 2222222));
+            slot.setJob(("H:" + id).c_str(), id.c_str());
+        }
+        done = true;
+    });
+
+    std::string job_handle;
+    std::string job_unique;
+    uint32_t torn = 0;
+    while (!done) {
+        slot.job(job_handle, job_unique);
+        if (!job_handle.empty() && job_handle != "H:" + job_unique) {
+            ++torn;
+        }
+    }
+    writer.join();
+    ASSERT_EQ(0u, torn);
+
+    // Longer than gearman allows is cut short
+    slot.setJob(std::string(100, 'h').c_str(), "");
+    slot.job(job_handle, job_unique);
+    ASSERT_EQ(THREAD_JOB_ID_SIZE, job_handle.size());
+    ASSERT_TRUE(job_unique.empty());
+}
+
+// A thread of the pool, held in whatever state setup left it in until released
+class HeldThread {
+public:
+    HeldThread(ThreadRegistry& registry, std::function<void(ThreadRegistry&)> setup)
+        : registered(false), release(false), told_to_stop(false)
+        , thread([this, &registry, setup] {
+            registry.registerThread("pool");
+            setup(registry);
+            registered = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+            told_to_stop = registry.shouldShutdown();
+            registry.unregisterThread();
+        }) {
+        while (!registered) {
+            std::this_thread::yield();
+        }
+    }
+
+    bool stop() {
+        release = true;
+        thread.join();
+        return told_to_stop;
+    }
+
+    std::atomic<bool> registered;
+    std::atomic<bool> release;
+    std::atomic<bool> told_to_stop;
+    std::thread thread;
+};
+
+TEST(ThreadRegistryTest, TestShutsDownIdleThreadsThenTheYoungestJobs) {
+    ThreadRegistry registry;
+    HeldThread old_job(registry, [](ThreadRegistry& r) { r.setThreadJob("H:1", "1"); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    HeldThread young_job(registry, [](ThreadRegistry& r) { r.setThreadJob("H:2", "2"); });
+    HeldThread idle(registry, [](ThreadRegistry& r) { r.setThreadState(ThreadState::WAITING_FOR_WORK); });
+
+    ASSERT_TRUE(registry.sendShutdown("pool", 2));
+    ASSERT_TRUE(registry.takeScaleDownTimes().empty());
+
+    ASSERT_TRUE(idle.stop());
+    ASSERT_TRUE(young_job.stop());
+    ASSERT_FALSE(old_job.stop());
+
+    // Converged once both threads told to stop were gone
+    auto scale_down_times = registry.takeScaleDownTimes();
+    ASSERT_EQ(1u, scale_down_times.count("pool"));
+    ASSERT_GE(scale_down_times["pool"], 0.0);
+}
+
+TEST(ThreadRegistryTest, TestShutsDownThreadsThatHaveNotStartedFirst) {
+    ThreadRegistry registry;
+    HeldThread idle(registry, [](ThreadRegistry& r) { r.setThreadState(ThreadState::WAITING_FOR_WORK); });
+    registry.reserveThreads("pool", 1);
+
+    ASSERT_TRUE(registry.sendShutdown("pool", 1));
+    ASSERT_FALSE(idle.stop());
+
+    registry.registerThread("pool");
+    ASSERT_TRUE(registry.shouldShutdown());
+    registry.unregisterThread();
+    ASSERT_EQ(1u, registry.takeScaleDownTimes().count("pool"));
+}
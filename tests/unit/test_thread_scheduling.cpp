@@ -0,0 +1,67 @@
+#include <thread>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "thread-scheduling.h"
+
+using namespace Driveshaft;
+
+TEST(ThreadSchedulingTest, TestParsesCpuList) {
+    std::set<uint32_t> cpus;
+    ASSERT_TRUE(parse_cpu_list("0-3,8,10-11\n", cpus));
+    EXPECT_EQ(std::set<uint32_t>({0, 1, 2, 3, 8, 10, 11}), cpus);
+}
+
+TEST(ThreadSchedulingTest, TestRejectsMalformedCpuList) {
+    std::set<uint32_t> cpus;
+    EXPECT_FALSE(parse_cpu_list("3-1", cpus));
+    EXPECT_FALSE(parse_cpu_list("0,,2", cpus));
+    EXPECT_FALSE(parse_cpu_list("a-b", cpus));
+}
+
+TEST(ThreadSchedulingTest, TestAcceptsEmptyCpuList) {
+    std::set<uint32_t> cpus;
+    ASSERT_TRUE(parse_cpu_list("\n", cpus));
+    EXPECT_TRUE(cpus.empty());
+}
+
+TEST(ThreadSchedulingTest, TestDefaultsAreDisabled) {
+    EXPECT_FALSE(SchedulingOptions().enabled());
+}
+
+TEST(ThreadSchedulingTest, TestAppliesToCallingThreadOnly) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+    uint32_t first_cpu = 0;
+    while (!CPU_ISSET(first_cpu, &allowed)) {
+        ++first_cpu;
+    }
+
+    SchedulingOptions options;
+    options.cpus.insert(first_cpu);
+    options.nice = 5;
+    options.policy = SchedulingPolicy::BATCH;
+
+    int cpu_count = 0;
+    int policy = -1;
+    int nice = 0;
+    std::thread thread([&]() {
+        apply_thread_scheduling("test-pool", options);
+
+        cpu_set_t applied;
+        CPU_ZERO(&applied);
+        sched_getaffinity(0, sizeof(applied), &applied);
+        cpu_count = CPU_COUNT(&applied);
+        policy = sched_getscheduler(0);
+        nice = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+    });
+    thread.join();
+
+    EXPECT_EQ(1, cpu_count);
+    EXPECT_EQ(SCHED_BATCH, policy);
+    EXPECT_EQ(5, nice);
+    EXPECT_EQ(SCHED_OTHER, sched_getscheduler(0));
+}
@@ -0,0 +1,97 @@
+#include <thread>
+#include <vector>
+#include <atomic>
+#include "gtest/gtest.h"
+#include "token-bucket.h"
+
+using namespace Driveshaft;
+
+static RateLimitOptions rate(double jobs_per_second, uint32_t burst) {
+    RateLimitOptions options;
+    options.jobs_per_second = jobs_per_second;
+    options.burst = burst;
+    return options;
+}
+
+TEST(TokenBucketTest, TestHandsOutBurstThenRefuses) {
+    TokenBucket bucket(rate(1, 3));
+
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(bucket.tryTake());
+    }
+    ASSERT_FALSE(bucket.tryTake());
+    ASSERT_GT(bucket.waitTime().count(), 0);
+}
+
+TEST(TokenBucketTest, TestDefaultBurstIsOneSecondOfTokens) {
+    TokenBucket bucket(rate(5, 0));
+
+    for (int i = 0; i < 5; i++) {
+        ASSERT_TRUE(bucket.tryTake());
+    }
+    ASSERT_FALSE(bucket.tryTake());
+}
+
+TEST(TokenBucketTest, TestRefillsOverTime) {
+    TokenBucket bucket(rate(100, 1));
+
+    ASSERT_TRUE(bucket.tryTake());
+    ASSERT_FALSE(bucket.tryTake());
+    std::this_thread::sleep_for(bucket.waitTime() + std::chrono::milliseconds(1));
+    ASSERT_EQ(0, bucket.waitTime().count());
+    ASSERT_TRUE(bucket.tryTake());
+}
+
+TEST(TokenBucketTest, TestWaitsLongerForMoreTokens) {
+    TokenBucket bucket(rate(0.001, 4));
+    ASSERT_EQ(4, bucket.burst());
+
+    ASSERT_TRUE(bucket.tryTake());
+    ASSERT_TRUE(bucket.tryTake());
+    ASSERT_EQ(0, bucket.waitTime(2).count());
+    ASSERT_GT(bucket.waitTime(3).count(), 0);
+
+    bucket.tryTake();
+    bucket.tryTake();
+    ASSERT_GT(bucket.waitTime(2).count(), bucket.waitTime().count());
+}
+
+TEST(TokenBucketTest, TestGiveBackRestoresToken) {
+    TokenBucket bucket(rate(0.001, 1));
+
+    ASSERT_TRUE(bucket.tryTake());
+    ASSERT_FALSE(bucket.tryTake());
+    bucket.giveBack();
+    ASSERT_TRUE(bucket.tryTake());
+}
+
+TEST(TokenBucketTest, TestTakeRunsIntoDebt) {
+    TokenBucket bucket(rate(0.001, 2));
+
+    bucket.take();
+    bucket.take();
+    bucket.take();
+    bucket.giveBack();
+    ASSERT_FALSE(bucket.tryTake());
+}
+
+TEST(TokenBucketTest, TestConcurrentTakersShareOneBurst) {
+    TokenBucket bucket(rate(0.001, 50));
+    std::atomic<uint32_t> taken(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 100; i++) {
+                if (bucket.tryTake()) {
+                    taken++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(50, taken.load());
+}
@@ -0,0 +1,118 @@
+#include <cstdlib>
+#include <string>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "upgrade-channel.h"
+
+using namespace Driveshaft;
+
+class UpgradeChannelTest : public ::testing::Test {
+public:
+    void SetUp() {
+        int fds[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        old_side.reset(new UpgradeChannel(fds[0], getpid()));
+        new_side.reset(new UpgradeChannel(fds[1], getpid()));
+    }
+
+    bool readable(const UpgradeChannel& channel) {
+        struct pollfd pfd = {channel.fd(), POLLIN, 0};
+        return poll(&pfd, 1, 1000) == 1;
+    }
+
+    std::unique_ptr<UpgradeChannel> old_side;
+    std::unique_ptr<UpgradeChannel> new_side;
+};
+
+TEST_F(UpgradeChannelTest, TestNothingArrived) {
+    EXPECT_EQ(UpgradeChannel::Event::NONE, old_side->receive());
+    EXPECT_EQ(UpgradeChannel::Event::NONE, new_side->receive());
+}
+
+TEST_F(UpgradeChannelTest, TestReady) {
+    ASSERT_TRUE(new_side->sendReady());
+    ASSERT_TRUE(readable(*old_side));
+    EXPECT_EQ(UpgradeChannel::Event::READY, old_side->receive());
+    EXPECT_EQ(UpgradeChannel::Event::NONE, old_side->receive());
+}
+
+TEST_F(UpgradeChannelTest, TestOldProcessExits) {
+    old_side.reset();
+    ASSERT_TRUE(readable(*new_side));
+    EXPECT_EQ(UpgradeChannel::Event::CLOSED, new_side->receive());
+}
+
+TEST_F(UpgradeChannelTest, TestNewProcessExitsAfterReady) {
+    ASSERT_TRUE(new_side->sendReady());
+    new_side.reset();
+    ASSERT_TRUE(readable(*old_side));
+    EXPECT_EQ(UpgradeChannel::Event::CLOSED, old_side->receive());
+}
+
+TEST_F(UpgradeChannelTest, TestReleaseKeepsDescriptorOpen) {
+    old_side->release();
+    old_side.reset();
+    EXPECT_EQ(UpgradeChannel::Event::NONE, new_side->receive());
+}
+
+TEST(UpgradeChannelInheritTest, TestNotStartedByUpgrade) {
+    unsetenv(UPGRADE_FD_VARIABLE);
+    EXPECT_FALSE(UpgradeChannel::inherited());
+}
+
+TEST(UpgradeChannelInheritTest, TestInheritsDescriptor) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    setenv(UPGRADE_FD_VARIABLE, std::to_string(fds[1]).c_str(), 1);
+
+    auto channel = UpgradeChannel::inherited();
+    ASSERT_TRUE(channel.get() != nullptr);
+    EXPECT_EQ(fds[1], channel->fd());
+    EXPECT_EQ(getppid(), channel->peer());
+    EXPECT_EQ(nullptr, getenv(UPGRADE_FD_VARIABLE));
+
+    close(fds[0]);
+    EXPECT_EQ(UpgradeChannel::Event::CLOSED, channel->receive());
+}
+
+TEST(UpgradeChannelInheritTest, TestIgnoresClosedDescriptor) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    close(fds[0]);
+    close(fds[1]);
+    setenv(UPGRADE_FD_VARIABLE, std::to_string(fds[1]).c_str(), 1);
+
+    EXPECT_FALSE(UpgradeChannel::inherited());
+    EXPECT_EQ(nullptr, getenv(UPGRADE_FD_VARIABLE));
+}
+
+TEST(UpgradeChannelStartTest, TestNewProcessExitsBeforeReady) {
+    auto channel = UpgradeChannel::startNewProcess("/bin/true");
+    ASSERT_TRUE(channel.get() != nullptr);
+
+    struct pollfd pfd = {channel->fd(), POLLIN, 0};
+    ASSERT_EQ(1, poll(&pfd, 1, 5000));
+    EXPECT_EQ(UpgradeChannel::Event::CLOSED, channel->receive());
+
+    int status = -1;
+    ASSERT_EQ(channel->peer(), waitpid(channel->peer(), &status, 0));
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST(UpgradeChannelStartTest, TestMissingExecutable) {
+    auto channel = UpgradeChannel::startNewProcess("/nonexistent/driveshaft");
+    ASSERT_TRUE(channel.get() != nullptr);
+
+    struct pollfd pfd = {channel->fd(), POLLIN, 0};
+    ASSERT_EQ(1, poll(&pfd, 1, 5000));
+    EXPECT_EQ(UpgradeChannel::Event::CLOSED, channel->receive());
+
+    int status = -1;
+    ASSERT_EQ(channel->peer(), waitpid(channel->peer(), &status, 0));
+    EXPECT_EQ(127, WEXITSTATUS(status));
+}
@@ -0,0 +1,52 @@
+#include <memory>
+#include <poll.h>
+#include "gtest/gtest.h"
+#include "worker-processes.h"
+#include "mock/classes/mock-metric-proxy.h"
+
+using namespace Driveshaft;
+
+TEST(WorkerProcessesTest, TestRestartsExitedProcess) {
+    MockMetricProxyPtr metrics(new mock::classes::MockMetricProxy());
+    WorkerProcesses processes(1, "/bin/true", metrics);
+    ASSERT_TRUE(processes.restartPending());
+
+    auto fds = processes.start();
+    ASSERT_EQ(1, fds.size());
+    ASSERT_TRUE(processes.owns(fds[0]));
+    ASSERT_EQ(1, processes.running());
+    ASSERT_FALSE(processes.restartPending());
+    ASSERT_FALSE(processes.allReady());
+
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    ASSERT_EQ(1, poll(&pfd, 1, 5000));
+    processes.handle(fds[0]);
+    ASSERT_EQ(0, processes.running());
+    ASSERT_FALSE(processes.owns(fds[0]));
+    ASSERT_TRUE(processes.restartPending());
+
+    // It crashed right after starting, so the next start waits a second
+    ASSERT_EQ(0, processes.start().size());
+}
+
+TEST(WorkerProcessesTest, TestAbandonKillsProcesses) {
+    MockMetricProxyPtr metrics(new mock::classes::MockMetricProxy());
+    WorkerProcesses processes(2, "/bin/sleep", metrics);
+
+    ASSERT_EQ(2, processes.start().size());
+    ASSERT_EQ(2, processes.running());
+    processes.abandon();
+    ASSERT_EQ(0, processes.running());
+}
+
+TEST(WorkerProcessesTest, TestPlacesExplicitProcess) {
+    ASSERT_EQ(2, pool_process("pool", 2, 4));
+    ASSERT_EQ(1, pool_process("pool", 5, 4));
+}
+
+TEST(WorkerProcessesTest, TestHashesPoolName) {
+    uint32_t process = pool_process("pool", -1, 4);
+    ASSERT_GT(4, process);
+    ASSERT_EQ(process, pool_process("pool", -1, 4));
+    ASSERT_EQ(0, pool_process("pool", -1, 1));
+}